@@ -0,0 +1,83 @@
+// AllocationCounter.cpp - Heap allocation counting implementation
+#include "stdafx.h"
+#include "AllocationCounter.h"
+#include <new>
+#include <stdlib.h>
+
+#ifdef SDE_COUNT_ALLOCATIONS
+
+#ifdef _WIN32
+#define SDE_THREAD_LOCAL __declspec(thread)
+#else
+#define SDE_THREAD_LOCAL __thread
+#endif
+
+// Dynamic exception specifications are gone in C++17, noexcept came in C++11
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define SDE_NOEXCEPT noexcept
+#else
+#define SDE_NOEXCEPT throw()
+#endif
+
+static SDE_THREAD_LOCAL SIZE_T g_nAllocations = 0;
+
+void *operator new(size_t nSize)
+{
+    g_nAllocations++;
+    void *p = malloc(nSize ? nSize : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return(p);
+}
+
+void *operator new[](size_t nSize)
+{
+    return(operator new(nSize));
+}
+
+void operator delete(void *p) SDE_NOEXCEPT
+{
+    free(p);
+}
+
+void operator delete[](void *p) SDE_NOEXCEPT
+{
+    free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, size_t) SDE_NOEXCEPT
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) SDE_NOEXCEPT
+{
+    free(p);
+}
+#endif
+
+#endif
+
+namespace SDE
+{
+
+bool CAllocationCounter::IsEnabled(void)
+{
+#ifdef SDE_COUNT_ALLOCATIONS
+    return(true);
+#else
+    return(false);
+#endif
+}
+
+SIZE_T CAllocationCounter::GetCount(void)
+{
+#ifdef SDE_COUNT_ALLOCATIONS
+    return(g_nAllocations);
+#else
+    return(0);
+#endif
+}
+
+}
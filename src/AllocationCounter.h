@@ -0,0 +1,19 @@
+// AllocationCounter.h - Heap allocation counting header
+#pragma once
+
+namespace SDE
+{
+
+// Built with SDE_COUNT_ALLOCATIONS defined, the library replaces the global
+// operator new and counts the allocations made by each thread, so the
+// debugger can tell the allocations made while it handles debug events
+// (CDebugger::GetEventAllocations). Without it the count stays 0.
+class CAllocationCounter
+{
+public:
+    static bool IsEnabled(void);
+    // Allocations made by the calling thread
+    static SIZE_T GetCount(void);
+};
+
+}
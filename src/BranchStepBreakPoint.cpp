@@ -0,0 +1,264 @@
+// BranchStepBreakPoint.cpp - Branch stepping breakpoint implementation
+#include "stdafx.h"
+#include "BranchStepBreakPoint.h"
+#include "InterruptFlagSet.h"
+#include "InstructionDecoder.h"
+
+namespace SDE
+{
+
+CBranchStepBreakPoint::CBranchSite::CBranchSite(CBranchStepBreakPoint *pOwner)
+: m_pOwner(pOwner)
+{
+}
+
+bool CBranchStepBreakPoint::CBranchSite::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    // Puts EIP back on the branch
+    if (CBreakPointOnExecution::IsTriggered(hThread, pException) == false)
+        return(false);
+
+    if (hThread == m_pOwner->m_hThread)
+        m_pOwner->OnBranch(reinterpret_cast<ULONG_PTR>(GetAddress()));
+
+    // Never reaches the clients, the debugger steps the thread past the INT3
+    pException->dwFirstChance = 0xBADC0DE;
+    return(false);
+}
+
+CBranchStepBreakPoint::CBranchStepBreakPoint(HANDLE hThread)
+: m_hProcess(NULL)
+, m_hThread(hThread)
+, m_bIsInitialized(false)
+, m_bIsEnabled(false)
+, m_lpVA(NULL)
+, m_lpBranch(NULL)
+, m_pDebugger(NULL)
+, m_Site(this)
+, m_bSiteAdded(false)
+, m_bSiteArmed(false)
+, m_nState(cStepping)
+, m_ulpBranch(0)
+, m_nBlocks(0)
+, m_nTraps(0)
+{
+}
+
+CBranchStepBreakPoint::~CBranchStepBreakPoint()
+{
+    if (m_bIsInitialized == true)
+        Deinitialize();
+}
+
+LPVOID CBranchStepBreakPoint::GetBranchAddress(void) const
+{
+    return(m_lpBranch);
+}
+
+SIZE_T CBranchStepBreakPoint::GetBlocks(void) const
+{
+    return(m_nBlocks);
+}
+
+SIZE_T CBranchStepBreakPoint::GetTraps(void) const
+{
+    return(m_nTraps);
+}
+
+bool CBranchStepBreakPoint::Initialize(IDebugger *pDebugger, HANDLE hProcess)
+{
+    m_hProcess = hProcess;
+    m_pDebugger = pDebugger;
+    m_bIsInitialized = true;
+    return(true);
+}
+
+bool CBranchStepBreakPoint::Enable(void)
+{
+    // Must be initialized
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already enabled?
+    if (m_bIsEnabled == true)
+        return(false);
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (m_pDebugger->GetThreadContext(m_hThread, &ctx) == FALSE)
+        return(false);
+
+    m_Blocks.clear();
+    m_nBlocks = 0;
+    m_nTraps = 0;
+    m_bIsEnabled = true;
+
+    Arm(ctx.Eip);
+
+    return(true);
+}
+
+bool CBranchStepBreakPoint::Disable(void)
+{
+    // Must be initialized
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already disabled?
+    if (m_bIsEnabled == false)
+        return(false);
+
+    if (m_nState != cAtBranch)
+        CInterruptFlagSet::ClearInterruptFlag(*m_pDebugger, m_hThread);
+
+    if (m_bSiteAdded == true) {
+        m_pDebugger->RemoveBreakPoint(&m_Site);
+        m_bSiteAdded = false;
+        m_bSiteArmed = false;
+    }
+
+    m_bIsEnabled = false;
+
+    return(true);
+}
+
+void CBranchStepBreakPoint::Deinitialize(void)
+{
+    if (m_bIsEnabled == true)
+        Disable();
+
+    m_bIsInitialized = false;
+}
+
+bool CBranchStepBreakPoint::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    // Must be initialized and enabled
+    if (m_bIsInitialized == false || m_bIsEnabled == false)
+        return(false);
+
+    // Must be the same thread
+    if (hThread != m_hThread)
+        return(false);
+
+    // Must be a first-chance exception
+    if (pException->dwFirstChance == 0)
+        return(false);
+
+    // Exception must be of EXCEPTION_SINGLE_STEP type
+    if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return(false);
+
+    // Not one of ours while the thread runs to the branch
+    if (m_nState == cAtBranch)
+        return(false);
+
+    m_nTraps++;
+
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(pException->ExceptionRecord.ExceptionAddress);
+    bool bTaken = (m_nState == cOnBranch);
+    ULONG_PTR ulpBranch = m_ulpBranch;
+
+    Arm(ulpAddress);
+
+    // Stepping code without a branch, go on
+    if (bTaken == false) {
+        pException->dwFirstChance = 0xBADC0DE;
+        return(false);
+    }
+
+    m_lpBranch = reinterpret_cast<LPVOID>(ulpBranch);
+    m_lpVA = reinterpret_cast<LPVOID>(ulpAddress);
+    m_nBlocks++;
+
+    return(true);
+}
+
+void CBranchStepBreakPoint::Arm(ULONG_PTR ulpAddress)
+{
+    ULONG_PTR ulpBranch = FindBranch(ulpAddress);
+    bool bSiteThere = (m_bSiteArmed == true && reinterpret_cast<ULONG_PTR>(m_Site.GetAddress()) == ulpBranch);
+
+    // Move the INT3 to the branch, a loop finds it there already. The thread
+    // already on a branch just steps it.
+    if (ulpBranch != 0 && ulpBranch != ulpAddress && bSiteThere == false) {
+        if (m_bSiteAdded == false) {
+            m_Site.SetAddress(reinterpret_cast<LPVOID>(ulpBranch));
+            m_pDebugger->AddBreakPoint(&m_Site);
+            m_bSiteAdded = true;
+        } else {
+            m_Site.Disable();
+            m_Site.SetAddress(reinterpret_cast<LPVOID>(ulpBranch));
+        }
+        m_bSiteArmed = bSiteThere = m_Site.Enable();
+    }
+
+    if (bSiteThere == true) {
+        m_nState = cAtBranch;
+        return;
+    }
+
+    // No branch found, on one or the INT3 couldn't be placed: step
+    m_ulpBranch = ulpBranch;
+    m_nState = (ulpBranch == ulpAddress) ? cOnBranch : cStepping;
+    CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread);
+}
+
+void CBranchStepBreakPoint::OnBranch(ULONG_PTR ulpBranch)
+{
+    // Run the branch alone, past the INT3
+    m_ulpBranch = ulpBranch;
+    m_nState = cOnBranch;
+    m_nTraps++;
+    CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread);
+}
+
+ULONG_PTR CBranchStepBreakPoint::FindBranch(ULONG_PTR ulpAddress)
+{
+    BlockMap::const_iterator i = m_Blocks.find(ulpAddress);
+    if (i != m_Blocks.end())
+        return(i->second);
+
+    // The debugger's reads see the original bytes under INT3s
+    ULONG_PTR ulpNext = ulpAddress;
+    for (int n = 0; n < cMaxBlockLength; n++) {
+        BYTE Code[CInstructionDecoder::cMaxLength];
+        InstructionInfo info;
+        if (CInstructionDecoder::Decode(*m_pDebugger, reinterpret_cast<LPCVOID>(ulpNext), Code, &info) == 0)
+            break;
+
+        if (info.dwFlags & CInstructionDecoder::cBranch) {
+            m_Blocks[ulpAddress] = ulpNext;
+            return(ulpNext);
+        }
+        ulpNext += info.nLength;
+    }
+
+    return(0);
+}
+
+LPVOID CBranchStepBreakPoint::GetAddress(void) const
+{
+    return(m_lpVA);
+}
+
+HANDLE CBranchStepBreakPoint::GetThread(void) const
+{
+    return(m_hThread);
+}
+
+HANDLE CBranchStepBreakPoint::GetProcess(void) const
+{
+    return(m_hProcess);
+}
+
+bool CBranchStepBreakPoint::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // Only a single step in our thread can trigger us, the INT3 is the site's
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = NULL;
+    pKey->hThread = m_hThread;
+    return(true);
+}
+
+}
@@ -0,0 +1,82 @@
+// BranchStepBreakPoint.h - Branch stepping breakpoint header
+#pragma once
+
+#include "Defs.h"
+#include "BreakPointOnExecution.h"
+#include <map>
+
+namespace SDE
+{
+
+// Steps a thread from one basic block to the next. The instructions from the
+// PC up to the next transfer of control are decoded and an INT3 is placed on
+// it; only when the thread gets there is the branch itself single stepped.
+// The breakpoint triggers on every block entered, GetAddress returns its
+// first instruction and GetBranchAddress the branch that led to it. Code
+// without a branch within cMaxBlockLength instructions, or that can't be
+// decoded, is single stepped without triggering.
+class CBranchStepBreakPoint : public IBreakPoint
+{
+    // The INT3 on the branch, it lets other threads pass
+    class CBranchSite : public CBreakPointOnExecution
+    {
+    public:
+        CBranchSite(CBranchStepBreakPoint *pOwner);
+        virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+
+    private:
+        CBranchStepBreakPoint *m_pOwner;
+    };
+
+    typedef std::map<ULONG_PTR, ULONG_PTR> BlockMap;
+public:
+    static const int cMaxBlockLength = 256;
+
+    CBranchStepBreakPoint(HANDLE hThread);
+    virtual ~CBranchStepBreakPoint();
+
+    LPVOID GetBranchAddress(void) const;
+
+    // Blocks entered and traps taken since the breakpoint was enabled
+    SIZE_T GetBlocks(void) const;
+    SIZE_T GetTraps(void) const;
+
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
+    virtual bool Enable(void);
+    virtual bool Disable(void);
+    virtual void Deinitialize(void);
+    virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    virtual LPVOID GetAddress(void) const;
+    virtual HANDLE GetThread(void) const;
+    virtual HANDLE GetProcess(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
+
+private:
+    // Waiting for the INT3, stepping the branch, stepping code without one
+    static const int cAtBranch = 0;
+    static const int cOnBranch = 1;
+    static const int cStepping = 2;
+
+    void Arm(ULONG_PTR ulpAddress);
+    void OnBranch(ULONG_PTR ulpBranch);
+    ULONG_PTR FindBranch(ULONG_PTR ulpAddress);
+
+private:
+    HANDLE m_hProcess;
+    HANDLE m_hThread;
+    bool m_bIsInitialized;
+    bool m_bIsEnabled;
+    LPVOID m_lpVA;
+    LPVOID m_lpBranch;
+    IDebugger *m_pDebugger;
+    CBranchSite m_Site;
+    bool m_bSiteAdded;
+    bool m_bSiteArmed;
+    int m_nState;
+    ULONG_PTR m_ulpBranch;
+    BlockMap m_Blocks;
+    SIZE_T m_nBlocks;
+    SIZE_T m_nTraps;
+};
+
+}
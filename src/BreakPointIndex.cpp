@@ -0,0 +1,233 @@
+// BreakPointIndex.cpp - Breakpoint lookup by exception code, address and thread
+#include "stdafx.h"
+#include "BreakPointIndex.h"
+
+using namespace std;
+
+namespace SDE
+{
+
+static const size_t cInitialSlots = 64;
+
+CBreakPointIndex::CTable::CTable()
+: m_nUsed(0)
+{
+}
+
+size_t CBreakPointIndex::CTable::Probe(ULONG_PTR ulpCode, ULONG_PTR ulpKey) const
+{
+    // Fibonacci hashing of key and code, then linear probing
+    ULONG_PTR ulpHash = (ulpKey ^ (ulpKey >> 12) ^ (ulpCode << 7)) * static_cast<ULONG_PTR>(0x9E3779B1);
+    size_t nMask = m_Slots.size() - 1;
+    size_t n = static_cast<size_t>(ulpHash ^ (ulpHash >> 16)) & nMask;
+
+    while (m_Slots[n].bUsed) {
+        if (m_Slots[n].ulpCode == ulpCode && m_Slots[n].ulpKey == ulpKey)
+            break;
+        n = (n + 1) & nMask;
+    }
+    return(n);
+}
+
+void CBreakPointIndex::CTable::Grow(void)
+{
+    // Rebuild without emptied slots, doubling if still too full
+    size_t nLive = 0;
+    for (size_t i = 0; i < m_Slots.size(); i++) {
+        if (m_Slots[i].bUsed && m_Slots[i].BreakPoints.empty() == false)
+            nLive++;
+    }
+
+    size_t nSize = m_Slots.empty() ? cInitialSlots : m_Slots.size();
+    while (nLive * 2 >= nSize)
+        nSize *= 2;
+
+    SlotVector Old;
+    Old.swap(m_Slots);
+    m_Slots.resize(nSize);
+    for (size_t i = 0; i < nSize; i++)
+        m_Slots[i].bUsed = false;
+    m_nUsed = 0;
+
+    for (size_t i = 0; i < Old.size(); i++) {
+        if (Old[i].bUsed == false || Old[i].BreakPoints.empty() == true)
+            continue;
+        Slot & slot = m_Slots[Probe(Old[i].ulpCode, Old[i].ulpKey)];
+        slot.bUsed = true;
+        slot.ulpCode = Old[i].ulpCode;
+        slot.ulpKey = Old[i].ulpKey;
+        slot.BreakPoints.swap(Old[i].BreakPoints);
+        m_nUsed++;
+    }
+}
+
+void CBreakPointIndex::CTable::Insert(ULONG_PTR ulpCode, ULONG_PTR ulpKey, IBreakPoint *pBreakPoint)
+{
+    if ((m_nUsed + 1) * 4 >= m_Slots.size() * 3)
+        Grow();
+
+    Slot & slot = m_Slots[Probe(ulpCode, ulpKey)];
+    if (slot.bUsed == false) {
+        slot.bUsed = true;
+        slot.ulpCode = ulpCode;
+        slot.ulpKey = ulpKey;
+        m_nUsed++;
+    }
+    slot.BreakPoints.push_back(pBreakPoint);
+}
+
+void CBreakPointIndex::CTable::Remove(ULONG_PTR ulpCode, ULONG_PTR ulpKey, IBreakPoint *pBreakPoint)
+{
+    if (m_Slots.empty())
+        return;
+
+    // Emptied slots stay in place so probe chains remain intact
+    Slot & slot = m_Slots[Probe(ulpCode, ulpKey)];
+    if (slot.bUsed == false)
+        return;
+
+    BreakPointVector::iterator i = find(slot.BreakPoints.begin(), slot.BreakPoints.end(), pBreakPoint);
+    if (i != slot.BreakPoints.end())
+        slot.BreakPoints.erase(i);
+}
+
+const CBreakPointIndex::BreakPointVector *CBreakPointIndex::CTable::Find(ULONG_PTR ulpCode, ULONG_PTR ulpKey) const
+{
+    if (m_Slots.empty())
+        return(0);
+
+    const Slot & slot = m_Slots[Probe(ulpCode, ulpKey)];
+    if (slot.bUsed == false)
+        return(0);
+
+    return(&slot.BreakPoints);
+}
+
+void CBreakPointIndex::CTable::Clear(void)
+{
+    m_Slots.clear();
+    m_nUsed = 0;
+}
+
+CBreakPointIndex::CBreakPointIndex()
+{
+}
+
+CBreakPointIndex::~CBreakPointIndex()
+{
+}
+
+BreakPointKey CBreakPointIndex::GetKey(IBreakPoint *pBreakPoint)
+{
+    BreakPointKey key;
+    ZeroMemory(&key, sizeof(BreakPointKey));
+    if (pBreakPoint->GetTriggerKey(&key) == false)
+        ZeroMemory(&key, sizeof(BreakPointKey));
+    return(key);
+}
+
+void CBreakPointIndex::Link(IBreakPoint *pBreakPoint, const BreakPointKey & key)
+{
+    if (key.dwExceptionCode == 0) {
+        m_Wildcards.push_back(pBreakPoint);
+    } else if (key.lpAddress) {
+        m_ByAddress.Insert(key.dwExceptionCode, reinterpret_cast<ULONG_PTR>(key.lpAddress), pBreakPoint);
+    } else if (key.hThread) {
+        m_ByThread.Insert(key.dwExceptionCode, reinterpret_cast<ULONG_PTR>(key.hThread), pBreakPoint);
+    } else {
+        m_ByCode[key.dwExceptionCode].push_back(pBreakPoint);
+    }
+}
+
+void CBreakPointIndex::Unlink(IBreakPoint *pBreakPoint, const BreakPointKey & key)
+{
+    if (key.dwExceptionCode == 0) {
+        BreakPointVector::iterator i = find(m_Wildcards.begin(), m_Wildcards.end(), pBreakPoint);
+        if (i != m_Wildcards.end())
+            m_Wildcards.erase(i);
+    } else if (key.lpAddress) {
+        m_ByAddress.Remove(key.dwExceptionCode, reinterpret_cast<ULONG_PTR>(key.lpAddress), pBreakPoint);
+    } else if (key.hThread) {
+        m_ByThread.Remove(key.dwExceptionCode, reinterpret_cast<ULONG_PTR>(key.hThread), pBreakPoint);
+    } else {
+        BreakPointVector & v = m_ByCode[key.dwExceptionCode];
+        BreakPointVector::iterator i = find(v.begin(), v.end(), pBreakPoint);
+        if (i != v.end())
+            v.erase(i);
+    }
+}
+
+void CBreakPointIndex::Insert(IBreakPoint *pBreakPoint)
+{
+    if (m_Keys.find(pBreakPoint) != m_Keys.end()) {
+        Update(pBreakPoint);
+        return;
+    }
+
+    BreakPointKey key = GetKey(pBreakPoint);
+    m_Keys[pBreakPoint] = key;
+    Link(pBreakPoint, key);
+}
+
+bool CBreakPointIndex::Remove(IBreakPoint *pBreakPoint)
+{
+    KeyMap::iterator i = m_Keys.find(pBreakPoint);
+    if (i == m_Keys.end())
+        return(false);
+
+    Unlink(pBreakPoint, i->second);
+    m_Keys.erase(i);
+    return(true);
+}
+
+void CBreakPointIndex::Update(IBreakPoint *pBreakPoint)
+{
+    KeyMap::iterator i = m_Keys.find(pBreakPoint);
+    if (i == m_Keys.end())
+        return;
+
+    BreakPointKey key = GetKey(pBreakPoint);
+    if (key.dwExceptionCode == i->second.dwExceptionCode &&
+        key.lpAddress == i->second.lpAddress &&
+        key.hThread == i->second.hThread)
+        return;
+
+    Unlink(pBreakPoint, i->second);
+    i->second = key;
+    Link(pBreakPoint, key);
+}
+
+void CBreakPointIndex::Clear(void)
+{
+    m_Keys.clear();
+    m_ByAddress.Clear();
+    m_ByThread.Clear();
+    m_ByCode.clear();
+    m_Wildcards.clear();
+}
+
+bool CBreakPointIndex::Contains(IBreakPoint *pBreakPoint) const
+{
+    return(m_Keys.find(pBreakPoint) != m_Keys.end());
+}
+
+void CBreakPointIndex::GetCandidates(DWORD dwExceptionCode, LPVOID lpAddress, HANDLE hThread, BreakPointVector & Candidates) const
+{
+    const BreakPointVector *pv = m_ByAddress.Find(dwExceptionCode, reinterpret_cast<ULONG_PTR>(lpAddress));
+    if (pv)
+        Candidates.insert(Candidates.end(), pv->begin(), pv->end());
+
+    if (hThread) {
+        pv = m_ByThread.Find(dwExceptionCode, reinterpret_cast<ULONG_PTR>(hThread));
+        if (pv)
+            Candidates.insert(Candidates.end(), pv->begin(), pv->end());
+    }
+
+    CodeMap::const_iterator i = m_ByCode.find(dwExceptionCode);
+    if (i != m_ByCode.end())
+        Candidates.insert(Candidates.end(), i->second.begin(), i->second.end());
+
+    Candidates.insert(Candidates.end(), m_Wildcards.begin(), m_Wildcards.end());
+}
+
+}
@@ -0,0 +1,77 @@
+// BreakPointIndex.h - Breakpoint lookup by exception code, address and thread
+#pragma once
+
+#include "Defs.h"
+#include <vector>
+#include <map>
+
+namespace SDE
+{
+
+// Keeps breakpoints indexed by their BreakPointKey so the debugger only asks
+// the breakpoints that can match an exception:
+// - keys with an address live in an open-addressing table on (code, address)
+// - keys with a thread but no address live in a table on (code, thread)
+// - keys with only an exception code live in a per-code list
+// - breakpoints without a key (code 0) are asked about every exception
+class CBreakPointIndex
+{
+public:
+    typedef std::vector<IBreakPoint *> BreakPointVector;
+
+    CBreakPointIndex();
+    ~CBreakPointIndex();
+
+    void Insert(IBreakPoint *pBreakPoint);
+    bool Remove(IBreakPoint *pBreakPoint);
+    void Update(IBreakPoint *pBreakPoint);
+    void Clear(void);
+    bool Contains(IBreakPoint *pBreakPoint) const;
+
+    // Appends the breakpoints that may be triggered by the exception
+    void GetCandidates(DWORD dwExceptionCode, LPVOID lpAddress, HANDLE hThread, BreakPointVector & Candidates) const;
+
+private:
+    class CTable
+    {
+        struct Slot
+        {
+            ULONG_PTR ulpCode;
+            ULONG_PTR ulpKey;
+            bool bUsed;
+            BreakPointVector BreakPoints;
+        };
+        typedef std::vector<Slot> SlotVector;
+    public:
+        CTable();
+
+        void Insert(ULONG_PTR ulpCode, ULONG_PTR ulpKey, IBreakPoint *pBreakPoint);
+        void Remove(ULONG_PTR ulpCode, ULONG_PTR ulpKey, IBreakPoint *pBreakPoint);
+        const BreakPointVector *Find(ULONG_PTR ulpCode, ULONG_PTR ulpKey) const;
+        void Clear(void);
+
+    private:
+        size_t Probe(ULONG_PTR ulpCode, ULONG_PTR ulpKey) const;
+        void Grow(void);
+
+    private:
+        SlotVector m_Slots;
+        size_t m_nUsed;
+    };
+
+    typedef std::map<IBreakPoint *, BreakPointKey> KeyMap;
+    typedef std::map<DWORD, BreakPointVector> CodeMap;
+
+    static BreakPointKey GetKey(IBreakPoint *pBreakPoint);
+    void Link(IBreakPoint *pBreakPoint, const BreakPointKey & key);
+    void Unlink(IBreakPoint *pBreakPoint, const BreakPointKey & key);
+
+private:
+    KeyMap m_Keys;
+    CTable m_ByAddress;
+    CTable m_ByThread;
+    CodeMap m_ByCode;
+    BreakPointVector m_Wildcards;
+};
+
+}
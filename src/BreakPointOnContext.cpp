@@ -0,0 +1,197 @@
+// BreakPointOnContext.cpp - Breakpoint on a register condition implementation
+#include "stdafx.h"
+#include "BreakPointOnContext.h"
+#include "InterruptFlagSet.h"
+
+namespace SDE
+{
+
+bool CBreakPointOnContext::GetRegister(const _CONTEXT & ctx, int nRegister, ULONG_PTR *pulpValue)
+{
+    switch (nRegister) {
+        case cEax: *pulpValue = ctx.Eax; break;
+        case cEcx: *pulpValue = ctx.Ecx; break;
+        case cEdx: *pulpValue = ctx.Edx; break;
+        case cEbx: *pulpValue = ctx.Ebx; break;
+        case cEsp: *pulpValue = ctx.Esp; break;
+        case cEbp: *pulpValue = ctx.Ebp; break;
+        case cEsi: *pulpValue = ctx.Esi; break;
+        case cEdi: *pulpValue = ctx.Edi; break;
+#ifdef __x86_64__
+        case cR8: *pulpValue = ctx.R8; break;
+        case cR9: *pulpValue = ctx.R9; break;
+        case cR10: *pulpValue = ctx.R10; break;
+        case cR11: *pulpValue = ctx.R11; break;
+        case cR12: *pulpValue = ctx.R12; break;
+        case cR13: *pulpValue = ctx.R13; break;
+        case cR14: *pulpValue = ctx.R14; break;
+        case cR15: *pulpValue = ctx.R15; break;
+#endif
+        case cEip: *pulpValue = ctx.Eip; break;
+        // The trap flag is ours while stepping
+        case cEFlags: *pulpValue = ctx.EFlags & ~0x100; break;
+        default: return(false);
+    }
+    return(true);
+}
+
+CBreakPointOnContext::CBreakPointOnContext(HANDLE hThread)
+: m_hProcess(NULL)
+, m_hThread(hThread)
+, m_bIsInitialized(false)
+, m_bIsEnabled(false)
+, m_lpVA(NULL)
+, m_pDebugger(NULL)
+, m_ulpPrevious(0)
+, m_nSteps(0)
+{
+}
+
+CBreakPointOnContext::~CBreakPointOnContext()
+{
+    if (m_bIsInitialized == true)
+        Deinitialize();
+}
+
+SIZE_T CBreakPointOnContext::GetSteps(void) const
+{
+    return(m_nSteps);
+}
+
+bool CBreakPointOnContext::Initialize(IDebugger *pDebugger, HANDLE hProcess)
+{
+    m_hProcess = hProcess;
+    m_pDebugger = pDebugger;
+    m_bIsInitialized = true;
+    return(true);
+}
+
+bool CBreakPointOnContext::Enable(void)
+{
+    // Must be initialized
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already enabled?
+    if (m_bIsEnabled == true)
+        return(false);
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (m_pDebugger->GetThreadContext(m_hThread, &ctx) == FALSE)
+        return(false);
+
+    if (Reset(ctx) == false)
+        return(false);
+
+    // Set TF
+    if (CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread) == false)
+        return(false);
+
+    m_ulpPrevious = ctx.Eip;
+    m_nSteps = 0;
+    m_bIsEnabled = true;
+
+    return(true);
+}
+
+bool CBreakPointOnContext::Disable(void)
+{
+    // Must be initialized
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already disabled?
+    if (m_bIsEnabled == false)
+        return(false);
+
+    // Clear TF
+    if (CInterruptFlagSet::ClearInterruptFlag(*m_pDebugger, m_hThread) == false)
+        return(false);
+
+    m_bIsEnabled = false;
+
+    return(true);
+}
+
+void CBreakPointOnContext::Deinitialize(void)
+{
+    if (m_bIsEnabled == true)
+        Disable();
+
+    m_bIsInitialized = false;
+}
+
+bool CBreakPointOnContext::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    // Must be initialized and enabled
+    if (m_bIsInitialized == false || m_bIsEnabled == false)
+        return(false);
+
+    // Must be the same thread
+    if (hThread != m_hThread)
+        return(false);
+
+    // Must be a first-chance exception
+    if (pException->dwFirstChance == 0)
+        return(false);
+
+    // Exception must be of EXCEPTION_SINGLE_STEP type
+    if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return(false);
+
+    // The instruction that just ran
+    ULONG_PTR ulpAddress = m_ulpPrevious;
+    m_ulpPrevious = reinterpret_cast<ULONG_PTR>(pException->ExceptionRecord.ExceptionAddress);
+    m_nSteps++;
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    m_pDebugger->GetThreadContext(m_hThread, &ctx);
+
+    // Keep stepping, whether we trigger or not
+    ctx.EFlags |= 0x100;
+    m_pDebugger->SetThreadContext(m_hThread, &ctx);
+
+    if (Evaluate(ctx) == false) {
+        pException->dwFirstChance = 0xBADC0DE;
+        return(false);
+    }
+
+    m_lpVA = reinterpret_cast<LPVOID>(ulpAddress);
+
+    return(true);
+}
+
+bool CBreakPointOnContext::Reset(const _CONTEXT & ctx)
+{
+    return(true);
+}
+
+LPVOID CBreakPointOnContext::GetAddress(void) const
+{
+    return(m_lpVA);
+}
+
+HANDLE CBreakPointOnContext::GetThread(void) const
+{
+    return(m_hThread);
+}
+
+HANDLE CBreakPointOnContext::GetProcess(void) const
+{
+    return(m_hProcess);
+}
+
+bool CBreakPointOnContext::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // The condition is tested on each single step of our thread
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = NULL;
+    pKey->hThread = m_hThread;
+    return(true);
+}
+
+}
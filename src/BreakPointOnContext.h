@@ -0,0 +1,75 @@
+// BreakPointOnContext.h - Breakpoint on a register condition header
+#pragma once
+
+#include "Defs.h"
+
+namespace SDE
+{
+
+// Single steps a thread and tests a condition on its registers after every
+// instruction, from within the debugger loop: the registers come from the
+// debugger's context cache and the steps where the condition is false reach
+// no client. The thread keeps being stepped after the breakpoint triggers.
+// GetAddress returns the instruction that made the condition true, the
+// thread stands on the one after it.
+class CBreakPointOnContext : public IBreakPoint
+{
+public:
+    // Registers, in x86 encoding order
+    static const int cEax = 0;
+    static const int cEcx = 1;
+    static const int cEdx = 2;
+    static const int cEbx = 3;
+    static const int cEsp = 4;
+    static const int cEbp = 5;
+    static const int cEsi = 6;
+    static const int cEdi = 7;
+#ifdef __x86_64__
+    static const int cR8 = 8;
+    static const int cR9 = 9;
+    static const int cR10 = 10;
+    static const int cR11 = 11;
+    static const int cR12 = 12;
+    static const int cR13 = 13;
+    static const int cR14 = 14;
+    static const int cR15 = 15;
+#endif
+    static const int cEip = 16;
+    static const int cEFlags = 17;
+
+    static bool GetRegister(const _CONTEXT & ctx, int nRegister, ULONG_PTR *pulpValue);
+
+    CBreakPointOnContext(HANDLE hThread);
+    virtual ~CBreakPointOnContext();
+
+    // Instructions stepped since the breakpoint was enabled
+    SIZE_T GetSteps(void) const;
+
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
+    virtual bool Enable(void);
+    virtual bool Disable(void);
+    virtual void Deinitialize(void);
+    virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    virtual LPVOID GetAddress(void) const;
+    virtual HANDLE GetThread(void) const;
+    virtual HANDLE GetProcess(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
+
+protected:
+    // Called with the registers when the breakpoint is enabled
+    virtual bool Reset(const _CONTEXT & ctx);
+    // Called with the registers after each instruction, true triggers
+    virtual bool Evaluate(const _CONTEXT & ctx) = 0;
+
+private:
+    HANDLE m_hProcess;
+    HANDLE m_hThread;
+    bool m_bIsInitialized;
+    bool m_bIsEnabled;
+    LPVOID m_lpVA;
+    IDebugger *m_pDebugger;
+    ULONG_PTR m_ulpPrevious;
+    SIZE_T m_nSteps;
+};
+
+}
@@ -1,5 +1,5 @@
 // BreakPointOnExecution.cpp - Breakpoint on execution (using INT3) implementation
-#include "StdAfx.h"
+#include "stdafx.h"
 #include "BreakPointOnExecution.h"
 
 #pragma warning(disable:4312) // 'reinterpret_cast' : conversion from 'DWORD' to 'LPCVOID' of greater size
@@ -12,6 +12,7 @@ CBreakPointOnExecution::CBreakPointOnExecution(LPVOID lpVA)
 , m_bIsEnabled(false)
 , m_bIsInitialized(false)
 , m_hProcess(NULL)
+, m_pDebugger(NULL)
 {
 }
 
@@ -30,8 +31,9 @@ bool CBreakPointOnExecution::SetAddress(LPVOID lpVA)
 
     m_lpVA = lpVA;
 
-    if (m_hProcess)
-        ReadByte();
+    // Re-key the breakpoint in the debugger's index
+    if (m_pDebugger)
+        m_pDebugger->UpdateBreakPoint(this);
 
     if (bIsEnabled == true)
         Enable();
@@ -44,7 +46,7 @@ LPVOID CBreakPointOnExecution::GetAddress(void) const
     return(m_lpVA);
 }
 
-bool CBreakPointOnExecution::Initialize(HANDLE hProcess)
+bool CBreakPointOnExecution::Initialize(IDebugger *pDebugger, HANDLE hProcess)
 {
     // Breakpoint address must be initialized
     if (m_lpVA == 0) 
@@ -53,8 +55,14 @@ bool CBreakPointOnExecution::Initialize(HANDLE hProcess)
     // Initialize member variables
     m_bIsInitialized = true;
     m_hProcess = hProcess;
+    m_pDebugger = pDebugger;
 
-    return(ReadByte());
+    // The address must be readable
+    BYTE byByte = 0;
+    SIZE_T nNumRead = 0;
+    m_pDebugger->ReadProcessMemory(m_lpVA, &byByte, 1, &nNumRead);
+
+    return(nNumRead != 0);
 }
 
 bool CBreakPointOnExecution::Enable(void)
@@ -66,14 +74,12 @@ bool CBreakPointOnExecution::Enable(void)
     if (m_lpVA == 0)
         return(false);
 
-    // Place an INT3 in the address
-    BYTE byInt3 = 0xCC;
-
-    DWORD dwNumWritten = 0;
-    WriteProcessMemory(m_hProcess, m_lpVA, &byInt3, 1, &dwNumWritten);
-    FlushInstructionCache(m_hProcess, m_lpVA, dwNumWritten);
+    // Is already enabled?
+    if (m_bIsEnabled == true)
+        return(false);
 
-    if (dwNumWritten == 0)
+    // Place an INT3 in the address, shared with other breakpoints there
+    if (m_pDebugger->InsertBreakPointSite(m_lpVA) == false)
         return(false);
 
     // Set enabled flag
@@ -91,14 +97,13 @@ bool CBreakPointOnExecution::Disable(void)
     if (m_lpVA == 0)
         return(false);
 
-    // Place the original byte in the address
-    DWORD dwNumWritten = 0;
-    WriteProcessMemory(m_hProcess, m_lpVA, &m_bySavedByte, 1, &dwNumWritten);
-    FlushInstructionCache(m_hProcess, m_lpVA, dwNumWritten);
-
-    if (dwNumWritten == 0)
+    // Is already disabled?
+    if (m_bIsEnabled == false)
         return(false);
 
+    // The original byte is back when no other breakpoint uses the address
+    m_pDebugger->RemoveBreakPointSite(m_lpVA);
+
     // Set enabled flag
     m_bIsEnabled = false;
 
@@ -107,6 +112,9 @@ bool CBreakPointOnExecution::Disable(void)
 
 void CBreakPointOnExecution::Deinitialize(void)
 {
+    if (m_bIsEnabled == true)
+        Disable();
+
     m_bIsInitialized = false;
 }
 
@@ -128,31 +136,19 @@ bool CBreakPointOnExecution::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *p
     if (pException->ExceptionRecord.ExceptionAddress != m_lpVA)
         return(false);
 
-    // It's our breakpoint, set EIP back to INT3
+    // It's our breakpoint, set EIP back to INT3 (other breakpoints sharing it may have already)
     _CONTEXT ctx;
     ZeroMemory(&ctx, sizeof(_CONTEXT));
     ctx.ContextFlags = CONTEXT_CONTROL;
-    GetThreadContext(hThread, &ctx);
-    ctx.Eip--;
-    SetThreadContext(hThread, &ctx);
+    m_pDebugger->GetThreadContext(hThread, &ctx);
+    ctx.Eip = reinterpret_cast<ULONG_PTR>(m_lpVA);
+    m_pDebugger->SetThreadContext(hThread, &ctx);
 
     m_hThread = hThread;
 
     return(true);
 }
 
-bool CBreakPointOnExecution::ReadByte(void)
-{
-    // Save the byte from the address
-    DWORD dwNumRead = 0;
-    ReadProcessMemory(m_hProcess, m_lpVA, &m_bySavedByte, 1, &dwNumRead);
-
-    if (dwNumRead == 0)
-        return(false);
-
-    return(true);
-}
-
 HANDLE CBreakPointOnExecution::GetThread(void) const
 {
     return(m_hThread);
@@ -163,4 +159,13 @@ HANDLE CBreakPointOnExecution::GetProcess(void) const
     return(m_hProcess);
 }
 
+bool CBreakPointOnExecution::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // Only an INT3 at our address can trigger us
+    pKey->dwExceptionCode = EXCEPTION_BREAKPOINT;
+    pKey->lpAddress = m_lpVA;
+    pKey->hThread = NULL;
+    return(true);
+}
+
 }
\ No newline at end of file
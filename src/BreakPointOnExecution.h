@@ -6,6 +6,9 @@
 namespace SDE
 {
 
+// An INT3 placed through the debugger's breakpoint sites. It stays in memory
+// while the breakpoint is enabled, threads that hit it run the instruction
+// out of line.
 class CBreakPointOnExecution : public IBreakPoint
 {
 public:
@@ -15,25 +18,23 @@ public:
     bool SetAddress(LPVOID lpVA);
 
     // IBreakPoint implementation
-    virtual bool Initialize(HANDLE hProcess);
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
     virtual bool Enable(void);
     virtual bool Disable(void);
     virtual void Deinitialize(void);
     virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
     virtual HANDLE GetThread(void) const;
     virtual HANDLE GetProcess(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
     virtual LPVOID GetAddress(void) const;
 
-protected:
-    bool ReadByte(void);
-
 private:
     bool m_bIsInitialized;
     LPVOID m_lpVA;
     bool m_bIsEnabled;
-    BYTE m_bySavedByte;
     HANDLE m_hProcess;
     HANDLE m_hThread;
+    IDebugger *m_pDebugger;
 };
 
 }
\ No newline at end of file
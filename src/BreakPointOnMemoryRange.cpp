@@ -1,12 +1,14 @@
-#include "StdAfx.h"
-#include "breakpointonmemoryrange.h"
+#include "stdafx.h"
+#include "BreakPointOnMemoryRange.h"
+#include "InterruptFlagSet.h"
 #include <algorithm>
 
 using namespace std;
 
 namespace SDE {
 
-CBreakPointOnMemoryRange::Debugger2RangeVector CBreakPointOnMemoryRange::m_Ranges;
+// Largest watchpoint the debug registers can cover (8 bytes on x64 only)
+static const ULONG_PTR cMaxWatchLength = sizeof(ULONG_PTR);
 
 CBreakPointOnMemoryRange::CBreakPointOnMemoryRange(IDebugger & debugger, RangePair range)
 : m_bIsEnabled(false)
@@ -14,10 +16,9 @@ CBreakPointOnMemoryRange::CBreakPointOnMemoryRange(IDebugger & debugger, RangePa
 , m_hProcess(NULL)
 , m_lpVA(0)
 , m_debugger(debugger)
-, m_pss(0)
-, m_bWaitForBreakPoint(false)
+, m_bWriteOnly(false)
 {
-    m_Ranges[&debugger].push_back(range);
+    m_Ranges.push_back(range);
 }
 
 CBreakPointOnMemoryRange::~CBreakPointOnMemoryRange()
@@ -25,19 +26,38 @@ CBreakPointOnMemoryRange::~CBreakPointOnMemoryRange()
     if (m_bIsInitialized == true)
         Deinitialize();
 
-    if (m_pss) {
-        delete m_pss;
-    }
+    RemoveSteps();
+}
+
+CMemoryRangeIndex & CBreakPointOnMemoryRange::GetIndex(void) const
+{
+    return(m_debugger.GetMemoryRangeIndex());
 }
 
 bool CBreakPointOnMemoryRange::AddRange(RangePair range)
 {
+    // The debugger's index only holds the ranges while we're initialized
+    if (m_bIsInitialized == false) {
+        m_Ranges.push_back(range);
+        return(true);
+    }
+
+    CMemoryRangeIndex & index = GetIndex();
+
+    // Guarded ranges stay guarded, only the new range's pages need it
+    if (m_bIsEnabled == true && IsHardware() == false) {
+        m_Ranges.push_back(range);
+        index.Insert(this, range);
+        return(index.Guard(m_hProcess, RangeVector(1, range)));
+    }
+
     bool bIsEnabled = m_bIsEnabled;
 
     if (bIsEnabled == true)
         Disable();
 
-    m_Ranges[&m_debugger].push_back(range);
+    m_Ranges.push_back(range);
+    index.Insert(this, range);
 
     if (bIsEnabled == true)
         Enable();
@@ -47,16 +67,31 @@ bool CBreakPointOnMemoryRange::AddRange(RangePair range)
 
 bool CBreakPointOnMemoryRange::RemoveRange(RangePair range)
 {
+    RangeVector::iterator i = find(m_Ranges.begin(), m_Ranges.end(), range);
+    if (i == m_Ranges.end())
+        return(false);
+
+    if (m_bIsInitialized == false) {
+        m_Ranges.erase(i);
+        return(true);
+    }
+
+    CMemoryRangeIndex & index = GetIndex();
+
+    if (m_bIsEnabled == true && IsHardware() == false) {
+        index.Unguard(m_hProcess, RangeVector(1, range));
+        m_Ranges.erase(i);
+        index.Remove(this, range);
+        return(true);
+    }
+
     bool bIsEnabled = m_bIsEnabled;
 
     if (bIsEnabled == true)
         Disable();
 
-    RangeVector & ranges = m_Ranges[&m_debugger];
-    RangeVector::iterator i = find(ranges.begin(), ranges.end(), range);
-    if (i != ranges.end()) {
-        ranges.erase(i);
-    }
+    m_Ranges.erase(i);
+    index.Remove(this, range);
 
     if (bIsEnabled == true)
         Enable();
@@ -64,17 +99,44 @@ bool CBreakPointOnMemoryRange::RemoveRange(RangePair range)
     return(true);
 }
 
+bool CBreakPointOnMemoryRange::SetWriteOnly(bool bWriteOnly)
+{
+    bool bIsEnabled = m_bIsEnabled;
+
+    if (bIsEnabled == true)
+        Disable();
+
+    m_bWriteOnly = bWriteOnly;
+
+    if (bIsEnabled == true)
+        Enable();
+
+    return(true);
+}
+
+bool CBreakPointOnMemoryRange::IsHardware(void) const
+{
+    return(m_Watchpoints.empty() == false);
+}
+
 LPVOID CBreakPointOnMemoryRange::GetAddress(void) const
 {
     return(m_lpVA);
 }
 
-bool CBreakPointOnMemoryRange::Initialize(HANDLE hProcess)
+bool CBreakPointOnMemoryRange::Initialize(IDebugger *pDebugger, HANDLE hProcess)
 {
     // Breakpoint address must be initialized
     if (InvalidRange())
         return(false);
 
+    // Our ranges go into the debugger's index, on its thread
+    if (m_bIsInitialized == false) {
+        CMemoryRangeIndex & index = GetIndex();
+        for (size_t i = 0; i < m_Ranges.size(); i++)
+            index.Insert(this, m_Ranges[i]);
+    }
+
     // Initialize member variables
     m_bIsInitialized = true;
     m_hProcess = hProcess;
@@ -91,13 +153,20 @@ bool CBreakPointOnMemoryRange::Enable(void)
     if (InvalidRange())
         return(false);
 
-    // Set guard pages
-    if (SetGuardPages() == false)
+    // Is already enabled?
+    if (m_bIsEnabled == true)
+        return(false);
+
+    // Small ranges are watched by debug registers, the rest by guard pages
+    if (SetWatchpoints() == false && SetGuardPages() == false)
         return(false);
 
     // Set enabled flag
     m_bIsEnabled = true;
 
+    // Watchpoints and guard pages raise different exceptions
+    m_debugger.UpdateBreakPoint(this);
+
     return(true);
 }
 
@@ -110,70 +179,118 @@ bool CBreakPointOnMemoryRange::Disable(void)
     if (InvalidRange())
         return(false);
 
-    // Remove guard pages
-    if (RemoveGuardPages() == false)
+    // Is already disabled?
+    if (m_bIsEnabled == false)
+        return(false);
+
+    // Remove watchpoints or guard pages
+    if (IsHardware()) {
+        RemoveWatchpoints();
+    } else if (RemoveGuardPages() == false) {
         return(false);
+    }
 
     // Set enabled flag
     m_bIsEnabled = false;
 
+    m_debugger.UpdateBreakPoint(this);
+
     return(true);
 }
 
 void CBreakPointOnMemoryRange::Deinitialize(void)
 {
+    // The debug registers and page guards would stay taken otherwise
+    if (m_bIsEnabled == true)
+        Disable();
+
+    RemoveSteps();
+
+    if (m_bIsInitialized == true) {
+        CMemoryRangeIndex & index = GetIndex();
+        for (size_t i = 0; i < m_Ranges.size(); i++)
+            index.Remove(this, m_Ranges[i]);
+    }
+
     m_bIsInitialized = false;
 }
 
 bool CBreakPointOnMemoryRange::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
 {
-    // Must be initialized and enabled, and not waiting for breakpoint
-    if (m_bIsInitialized == false || m_bIsEnabled == false || m_bWaitForBreakPoint == true)
+    // Must be initialized and enabled
+    if (m_bIsInitialized == false || m_bIsEnabled == false)
         return(false);
 
     // Must be a first-chance exception
     if (pException->dwFirstChance == 0)
         return(false);
 
-    // Exception must be of EXCEPTION_BREAKPOINT type
+    if (IsHardware()) {
+        // Watchpoint hits are reported as EXCEPTION_SINGLE_STEP after the access
+        if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_SINGLE_STEP)
+            return(false);
+
+        // DR6 tells which debug registers were hit
+        _CONTEXT ctx;
+        ZeroMemory(&ctx, sizeof(_CONTEXT));
+        ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+        m_debugger.GetThreadContext(hThread, &ctx);
+
+        bool bIsTriggered = false;
+        for (size_t i = 0; i < m_Watchpoints.size(); i++) {
+            DWORD_PTR dwpMask = static_cast<DWORD_PTR>(1) << m_Watchpoints[i].nIndex;
+            if (ctx.Dr6 & dwpMask) {
+                ctx.Dr6 &= ~dwpMask;
+                if (bIsTriggered == false)
+                    m_lpVA = m_Watchpoints[i].lpAddress;
+                bIsTriggered = true;
+            }
+        }
+        if (bIsTriggered == false)
+            return(false);
+
+        // Clear the hits, the next single step would report them again
+        m_debugger.SetThreadContext(hThread, &ctx);
+
+        m_hThread = hThread;
+
+        return(true);
+    }
+
+    // Exception must be of EXCEPTION_GUARD_PAGE type
     if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_GUARD_PAGE)
         return(false);
 
-    // Did this exception occur because of our breakpoint?
+    // Is the faulting page guarded by a memory range breakpoint?
     ULONG_PTR ulpAddress = pException->ExceptionRecord.ExceptionInformation[1];
-    RangeVector & ranges = m_Ranges[&m_debugger];
-    for (size_t i = 0; i < ranges.size(); i++) {
-        RangePair & range = ranges[i];
-        if (!(ulpAddress >= reinterpret_cast<ULONG_PTR>(range.first) && ulpAddress <= reinterpret_cast<ULONG_PTR>(range.second))) {
-            // Did we cause the exception?
-            ulpAddress &= 0xFFFFF000;
-            ULONG_PTR ulpLow = reinterpret_cast<ULONG_PTR>(range.first) & 0xFFFFF000;
-            ULONG_PTR ulpHigh = reinterpret_cast<ULONG_PTR>(range.second) & 0xFFFFF000;
-            if (ulpAddress >= ulpLow && ulpAddress <= ulpHigh) {
-                // Continue to next instruction and set guard pages again
-                if (m_pss) {
-                    delete m_pss;
-                    m_pss = 0;
-                }
-
-                m_pss = new CSingleStepIntoBreakPoint(hThread);
-                m_debugger.AddBreakPoint(m_pss);
-                m_pss->Enable();
-                m_debugger.AddClient(this);
-
-                m_bWaitForBreakPoint = true;
-
-                pException->dwFirstChance = 0xBADC0DE;
-            }
-            return(false);
+    CMemoryRangeIndex & index = GetIndex();
+    if (index.IsGuarded(ulpAddress) == false)
+        return(false);
+
+    // The fault removed the page's guard. Whoever gets here first continues to
+    // the next instruction and sets it again.
+    if (index.BeginRearm(ulpAddress) == true) {
+        CRearmStep *pStep = NULL;
+        for (size_t i = 0; i < m_Steps.size() && pStep == NULL; i++) {
+            if (m_Steps[i]->IsActive() == false)
+                pStep = m_Steps[i];
+        }
+        if (pStep == NULL) {
+            pStep = new CRearmStep(this);
+            m_Steps.push_back(pStep);
+            m_debugger.AddBreakPoint(pStep);
         }
+        pStep->Start(hThread, ulpAddress);
     }
 
-    // Set guard pages
-    SetGuardPages();
+    // Did this exception occur because of our breakpoint?
+    if (index.Contains(this, ulpAddress) == false) {
+        pException->dwFirstChance = 0xBADC0DE;
+        return(false);
+    }
 
     // Set virtual address
-    m_lpVA = reinterpret_cast<LPVOID>(pException->ExceptionRecord.ExceptionInformation[1]);
+    m_lpVA = reinterpret_cast<LPVOID>(ulpAddress);
 
     m_hThread = hThread;
 
@@ -182,32 +299,74 @@ bool CBreakPointOnMemoryRange::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO
 
 bool CBreakPointOnMemoryRange::SetGuardPages(void)
 {
-    DWORD dwOldProtect = 0;
-    RangeVector & ranges = m_Ranges[&m_debugger];
-    for (size_t i = 0; i < ranges.size(); i++) {
-        RangePair & range = ranges[i];
-
-        ULONG_PTR ulpDelta = reinterpret_cast<ULONG_PTR>(range.second) - reinterpret_cast<ULONG_PTR>(range.first) + 1;
-        VirtualProtectEx(m_hProcess, range.first, ulpDelta, PAGE_EXECUTE_READWRITE, &dwOldProtect);
-        VirtualProtectEx(m_hProcess, range.first, ulpDelta, dwOldProtect | PAGE_GUARD, &dwOldProtect);
-    }
-    return(true);
+    return(GetIndex().Guard(m_hProcess, m_Ranges));
 }
 
 bool CBreakPointOnMemoryRange::RemoveGuardPages(void)
 {
-    DWORD dwOldProtect = 0;
-    RangeVector & ranges = m_Ranges[&m_debugger];
+    return(GetIndex().Unguard(m_hProcess, m_Ranges));
+}
+
+bool CBreakPointOnMemoryRange::SetWatchpoints(void)
+{
+    RemoveWatchpoints();
+
+    // Split the ranges into aligned 1/2/4/8 byte chunks, one per debug register
+    RangeVector & ranges = m_Ranges;
+    WatchpointVector watchpoints;
     for (size_t i = 0; i < ranges.size(); i++) {
-        RangePair & range = ranges[i];
+        ULONG_PTR ulpLow = reinterpret_cast<ULONG_PTR>(ranges[i].first);
+        ULONG_PTR ulpHigh = reinterpret_cast<ULONG_PTR>(ranges[i].second);
+        if (ulpHigh < ulpLow)
+            return(false);
+
+        while (ulpLow <= ulpHigh) {
+            if (watchpoints.size() == IDebugger::cNumDebugRegisters)
+                return(false);
+
+            ULONG_PTR ulpLength = cMaxWatchLength;
+            while ((ulpLow & (ulpLength - 1)) || ulpHigh - ulpLow < ulpLength - 1)
+                ulpLength >>= 1;
 
-        ULONG_PTR ulpDelta = reinterpret_cast<ULONG_PTR>(range.second) - reinterpret_cast<ULONG_PTR>(range.first) + 1;
-        VirtualProtectEx(m_hProcess, range.first, ulpDelta, PAGE_EXECUTE_READWRITE, &dwOldProtect);
-        VirtualProtectEx(m_hProcess, range.first, ulpDelta, dwOldProtect & ~PAGE_GUARD, &dwOldProtect);
+            Watchpoint wp;
+            wp.nIndex = -1;
+            wp.dwLength = static_cast<DWORD>(ulpLength);
+            wp.lpAddress = reinterpret_cast<LPVOID>(ulpLow);
+            watchpoints.push_back(wp);
+
+            // Stop at the top of the address space
+            if (ulpLow + ulpLength - 1 == ulpHigh)
+                break;
+            ulpLow += ulpLength;
+        }
+    }
+
+    if (watchpoints.empty() == true)
+        return(false);
+
+    // Take the debug registers
+    DWORD dwCondition = m_bWriteOnly ? IDebugger::cDrWrite : IDebugger::cDrReadWrite;
+    for (size_t i = 0; i < watchpoints.size(); i++) {
+        Watchpoint wp = watchpoints[i];
+        wp.nIndex = m_debugger.AllocateDebugRegister(wp.lpAddress, dwCondition, wp.dwLength);
+        if (wp.nIndex < 0) {
+            // Taken by other breakpoints, fall back to guard pages
+            RemoveWatchpoints();
+            return(false);
+        }
+        m_Watchpoints.push_back(wp);
     }
+
     return(true);
 }
 
+void CBreakPointOnMemoryRange::RemoveWatchpoints(void)
+{
+    for (size_t i = 0; i < m_Watchpoints.size(); i++)
+        m_debugger.FreeDebugRegister(m_Watchpoints[i].nIndex);
+    m_Watchpoints.clear();
+}
+
 HANDLE CBreakPointOnMemoryRange::GetThread(void) const
 {
     return(m_hThread);
@@ -218,37 +377,45 @@ HANDLE CBreakPointOnMemoryRange::GetProcess(void) const
     return(m_hProcess);
 }
 
-bool CBreakPointOnMemoryRange::OnBreakPoint(IBreakPoint *pBreakPoint)
+bool CBreakPointOnMemoryRange::GetTriggerKey(BreakPointKey *pKey) const
 {
-    CSingleStepIntoBreakPoint *pBp = dynamic_cast<CSingleStepIntoBreakPoint *>(pBreakPoint);
-
-    if (pBp == m_pss) {
-        m_pss->Disable();
-        m_debugger.RemoveBreakPoint(pBreakPoint);
-        delete m_pss;
-        m_pss = 0;
-
-        m_debugger.RemoveClient(this);
-
-        SetGuardPages();
+    // Any watchpoint hit or guard page violation may be ours, the ranges are checked in IsTriggered
+    pKey->dwExceptionCode = IsHardware() ? EXCEPTION_SINGLE_STEP : EXCEPTION_GUARD_PAGE;
+    pKey->lpAddress = NULL;
+    pKey->hThread = NULL;
+    return(true);
+}
 
-        m_bWaitForBreakPoint = false;
+void CBreakPointOnMemoryRange::OnStepped(CRearmStep *pStep)
+{
+    // Stepped past the access, guard the page again
+    ULONG_PTR ulpAddress = pStep->GetPage();
+    pStep->Stop();
+    GetIndex().EndRearm(m_hProcess, ulpAddress);
+}
 
-        return(true); // We removed a breakpoint
+void CBreakPointOnMemoryRange::RemoveSteps(void)
+{
+    for (size_t i = 0; i < m_Steps.size(); i++) {
+        CRearmStep *pStep = m_Steps[i];
+        if (pStep->IsActive() == true) {
+            ULONG_PTR ulpAddress = pStep->GetPage();
+            pStep->Stop();
+            GetIndex().EndRearm(m_hProcess, ulpAddress);
+        }
+        m_debugger.RemoveBreakPoint(pStep);
+        delete pStep;
     }
-
-    return(false); // We didn't remove any breakpoints
+    m_Steps.clear();
 }
 
 bool CBreakPointOnMemoryRange::InvalidRange(void) const
 {
-    RangeVector & ranges = m_Ranges[&m_debugger];
-
-    if (ranges.empty() == true)
+    if (m_Ranges.empty() == true)
         return(false);
 
-    for (size_t i = 0; i < ranges.size(); i++) {
-        RangePair & range = ranges[i];
+    for (size_t i = 0; i < m_Ranges.size(); i++) {
+        const RangePair & range = m_Ranges[i];
 
         if (range.first == 0 || range.second == 0)
             return(true);
@@ -256,17 +423,109 @@ bool CBreakPointOnMemoryRange::InvalidRange(void) const
     return(false);
 }
 
-void CBreakPointOnMemoryRange::OnFinishedDebugging(void)
+CBreakPointOnMemoryRange::CRearmStep::CRearmStep(CBreakPointOnMemoryRange *pOwner)
+: m_pOwner(pOwner)
+, m_hThread(NULL)
+, m_ulpAddress(0)
+, m_bIsActive(false)
+{
+}
+
+CBreakPointOnMemoryRange::CRearmStep::~CRearmStep()
+{
+}
+
+bool CBreakPointOnMemoryRange::CRearmStep::Start(HANDLE hThread, ULONG_PTR ulpAddress)
 {
-    if (m_pss) {
-        m_pss->Disable();
-        m_debugger.RemoveBreakPoint(m_pss);
-        delete m_pss;
-        m_pss = 0;
+    // Re-key for the thread
+    if (hThread != m_hThread) {
+        m_hThread = hThread;
+        m_pOwner->m_debugger.UpdateBreakPoint(this);
     }
 
-    m_debugger.RemoveClient(this);
+    m_ulpAddress = ulpAddress;
+    m_bIsActive = true;
+    return(CInterruptFlagSet::SetInterruptFlag(m_pOwner->m_debugger, m_hThread));
+}
+
+void CBreakPointOnMemoryRange::CRearmStep::Stop(void)
+{
+    // The trap flag is already clear, or set again by another stepping breakpoint
+    m_bIsActive = false;
+}
+
+bool CBreakPointOnMemoryRange::CRearmStep::IsActive(void) const
+{
+    return(m_bIsActive);
+}
+
+ULONG_PTR CBreakPointOnMemoryRange::CRearmStep::GetPage(void) const
+{
+    return(m_ulpAddress);
+}
+
+bool CBreakPointOnMemoryRange::CRearmStep::Initialize(IDebugger *pDebugger, HANDLE hProcess)
+{
+    return(true);
+}
+
+bool CBreakPointOnMemoryRange::CRearmStep::Enable(void)
+{
+    return(m_bIsActive);
+}
+
+bool CBreakPointOnMemoryRange::CRearmStep::Disable(void)
+{
+    Stop();
+    return(true);
+}
+
+void CBreakPointOnMemoryRange::CRearmStep::Deinitialize(void)
+{
 }
 
+bool CBreakPointOnMemoryRange::CRearmStep::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    if (m_bIsActive == false || hThread != m_hThread)
+        return(false);
+
+    // Must be a first-chance exception
+    if (pException->dwFirstChance == 0)
+        return(false);
+
+    // Exception must be of EXCEPTION_SINGLE_STEP type
+    if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return(false);
+
+    m_pOwner->OnStepped(this);
+
+    // Never reaches the clients
+    pException->dwFirstChance = 0xBADC0DE;
+    return(false);
+}
+
+LPVOID CBreakPointOnMemoryRange::CRearmStep::GetAddress(void) const
+{
+    return(reinterpret_cast<LPVOID>(m_ulpAddress));
+}
+
+HANDLE CBreakPointOnMemoryRange::CRearmStep::GetThread(void) const
+{
+    return(m_hThread);
+}
+
+HANDLE CBreakPointOnMemoryRange::CRearmStep::GetProcess(void) const
+{
+    return(m_pOwner->m_hProcess);
+}
+
+bool CBreakPointOnMemoryRange::CRearmStep::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // Only a single step in the stepping thread
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = NULL;
+    pKey->hThread = m_hThread;
+    return(true);
 }
 
+}
\ No newline at end of file
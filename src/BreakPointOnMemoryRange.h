@@ -1,27 +1,65 @@
 #pragma once
 
 #include "Defs.h"
-#include "SingleStepIntoBreakpoint.h"
+#include "MemoryRangeIndex.h"
 #include <utility>
-#include <map>
 #include <vector>
 
 namespace SDE {
 
-class CBreakPointOnMemoryRange : public IBreakPoint, public IDebuggerClient
+class CBreakPointOnMemoryRange : public IBreakPoint
 {
+    // Single steps a thread over the access that faulted on a guard page, then
+    // has the page guarded again. Steps are kept in a pool and reused.
+    class CRearmStep : public IBreakPoint
+    {
+    public:
+        CRearmStep(CBreakPointOnMemoryRange *pOwner);
+        virtual ~CRearmStep();
+
+        bool Start(HANDLE hThread, ULONG_PTR ulpAddress);
+        void Stop(void);
+        bool IsActive(void) const;
+        ULONG_PTR GetPage(void) const;
+
+        virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
+        virtual bool Enable(void);
+        virtual bool Disable(void);
+        virtual void Deinitialize(void);
+        virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+        virtual LPVOID GetAddress(void) const;
+        virtual HANDLE GetThread(void) const;
+        virtual HANDLE GetProcess(void) const;
+        virtual bool GetTriggerKey(BreakPointKey *pKey) const;
+
+    private:
+        CBreakPointOnMemoryRange *m_pOwner;
+        HANDLE m_hThread;
+        ULONG_PTR m_ulpAddress;
+        bool m_bIsActive;
+    };
+
     typedef std::pair<LPVOID, LPVOID> RangePair;
     typedef std::vector<RangePair> RangeVector;
-    typedef std::map<IDebugger *, RangeVector> Debugger2RangeVector;
+    typedef std::vector<CRearmStep *> StepVector;
+
+    struct Watchpoint
+    {
+        int nIndex;
+        LPVOID lpAddress;
+        DWORD dwLength;
+    };
+    typedef std::vector<Watchpoint> WatchpointVector;
 public:
     CBreakPointOnMemoryRange(IDebugger & debugger, RangePair range);
     virtual ~CBreakPointOnMemoryRange(void);
 
     bool AddRange(RangePair range);
     bool RemoveRange(RangePair range);
+    bool SetWriteOnly(bool bWriteOnly);
+    bool IsHardware(void) const;
 
-    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint);
-    virtual bool Initialize(HANDLE hProcess);
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
     virtual bool Enable(void);
     virtual bool Disable(void);
     virtual void Deinitialize(void);
@@ -29,12 +67,17 @@ public:
     virtual LPVOID GetAddress(void) const;
     virtual HANDLE GetThread(void) const;
     virtual HANDLE GetProcess(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
     bool InvalidRange(void) const;
-    virtual void OnFinishedDebugging(void);
 
 protected:
     bool SetGuardPages(void);
     bool RemoveGuardPages(void);
+    bool SetWatchpoints(void);
+    void RemoveWatchpoints(void);
+    CMemoryRangeIndex & GetIndex(void) const;
+    void RemoveSteps(void);
+    void OnStepped(CRearmStep *pStep);
 
 private:
     bool m_bIsInitialized;
@@ -43,10 +86,10 @@ private:
     HANDLE m_hProcess;
     HANDLE m_hThread;
     IDebugger & m_debugger;
-    CSingleStepIntoBreakPoint *m_pss;
-    bool m_bWaitForBreakPoint;
-
-    static Debugger2RangeVector m_Ranges;
+    RangeVector m_Ranges;
+    StepVector m_Steps;
+    bool m_bWriteOnly;
+    WatchpointVector m_Watchpoints;
 };
 
 }
\ No newline at end of file
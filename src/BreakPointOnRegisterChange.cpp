@@ -0,0 +1,55 @@
+// BreakPointOnRegisterChange.cpp - Breakpoint on a register change implementation
+#include "stdafx.h"
+#include "BreakPointOnRegisterChange.h"
+
+namespace SDE
+{
+
+CBreakPointOnRegisterChange::CBreakPointOnRegisterChange(HANDLE hThread, int nRegister, ULONG_PTR ulpMask)
+: CBreakPointOnContext(hThread)
+, m_nRegister(nRegister)
+, m_ulpMask(ulpMask)
+, m_ulpOldValue(0)
+, m_ulpValue(0)
+{
+}
+
+void CBreakPointOnRegisterChange::SetRegister(int nRegister, ULONG_PTR ulpMask)
+{
+    m_nRegister = nRegister;
+    m_ulpMask = ulpMask;
+}
+
+ULONG_PTR CBreakPointOnRegisterChange::GetOldValue(void) const
+{
+    return(m_ulpOldValue);
+}
+
+ULONG_PTR CBreakPointOnRegisterChange::GetNewValue(void) const
+{
+    return(m_ulpValue);
+}
+
+bool CBreakPointOnRegisterChange::Reset(const _CONTEXT & ctx)
+{
+    // Must be a known register
+    if (GetRegister(ctx, m_nRegister, &m_ulpValue) == false)
+        return(false);
+
+    m_ulpOldValue = m_ulpValue;
+    return(true);
+}
+
+bool CBreakPointOnRegisterChange::Evaluate(const _CONTEXT & ctx)
+{
+    ULONG_PTR ulpValue = 0;
+    GetRegister(ctx, m_nRegister, &ulpValue);
+    if (((ulpValue ^ m_ulpValue) & m_ulpMask) == 0)
+        return(false);
+
+    m_ulpOldValue = m_ulpValue;
+    m_ulpValue = ulpValue;
+    return(true);
+}
+
+}
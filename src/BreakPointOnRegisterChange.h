@@ -0,0 +1,33 @@
+// BreakPointOnRegisterChange.h - Breakpoint on a register change header
+#pragma once
+
+#include "Defs.h"
+#include "BreakPointOnContext.h"
+
+namespace SDE
+{
+
+// Triggers when an instruction changes the bits of a register selected by the
+// mask. GetOldValue/GetNewValue return the last change.
+class CBreakPointOnRegisterChange : public CBreakPointOnContext
+{
+public:
+    CBreakPointOnRegisterChange(HANDLE hThread, int nRegister, ULONG_PTR ulpMask = ~static_cast<ULONG_PTR>(0));
+
+    void SetRegister(int nRegister, ULONG_PTR ulpMask = ~static_cast<ULONG_PTR>(0));
+
+    ULONG_PTR GetOldValue(void) const;
+    ULONG_PTR GetNewValue(void) const;
+
+protected:
+    virtual bool Reset(const _CONTEXT & ctx);
+    virtual bool Evaluate(const _CONTEXT & ctx);
+
+private:
+    int m_nRegister;
+    ULONG_PTR m_ulpMask;
+    ULONG_PTR m_ulpOldValue;
+    ULONG_PTR m_ulpValue;
+};
+
+}
@@ -0,0 +1,49 @@
+// BreakPointOnRegisterValue.cpp - Breakpoint on a register value implementation
+#include "stdafx.h"
+#include "BreakPointOnRegisterValue.h"
+
+namespace SDE
+{
+
+CBreakPointOnRegisterValue::CBreakPointOnRegisterValue(HANDLE hThread, int nRegister, ULONG_PTR ulpValue, ULONG_PTR ulpMask)
+: CBreakPointOnContext(hThread)
+, m_nRegister(nRegister)
+, m_ulpValue(ulpValue)
+, m_ulpMask(ulpMask)
+, m_bMatched(false)
+{
+}
+
+void CBreakPointOnRegisterValue::SetValue(int nRegister, ULONG_PTR ulpValue, ULONG_PTR ulpMask)
+{
+    m_nRegister = nRegister;
+    m_ulpValue = ulpValue;
+    m_ulpMask = ulpMask;
+}
+
+bool CBreakPointOnRegisterValue::Reset(const _CONTEXT & ctx)
+{
+    // Must be a known register
+    ULONG_PTR ulpValue = 0;
+    if (GetRegister(ctx, m_nRegister, &ulpValue) == false)
+        return(false);
+
+    m_bMatched = Matches(ctx);
+    return(true);
+}
+
+bool CBreakPointOnRegisterValue::Evaluate(const _CONTEXT & ctx)
+{
+    bool bWasMatched = m_bMatched;
+    m_bMatched = Matches(ctx);
+    return(m_bMatched == true && bWasMatched == false);
+}
+
+bool CBreakPointOnRegisterValue::Matches(const _CONTEXT & ctx) const
+{
+    ULONG_PTR ulpValue = 0;
+    GetRegister(ctx, m_nRegister, &ulpValue);
+    return((ulpValue & m_ulpMask) == (m_ulpValue & m_ulpMask));
+}
+
+}
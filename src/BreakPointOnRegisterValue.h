@@ -0,0 +1,33 @@
+// BreakPointOnRegisterValue.h - Breakpoint on a register value header
+#pragma once
+
+#include "Defs.h"
+#include "BreakPointOnContext.h"
+
+namespace SDE
+{
+
+// Triggers when an instruction sets the bits of a register selected by the
+// mask to the value; a register that keeps the value doesn't trigger again.
+class CBreakPointOnRegisterValue : public CBreakPointOnContext
+{
+public:
+    CBreakPointOnRegisterValue(HANDLE hThread, int nRegister, ULONG_PTR ulpValue, ULONG_PTR ulpMask = ~static_cast<ULONG_PTR>(0));
+
+    void SetValue(int nRegister, ULONG_PTR ulpValue, ULONG_PTR ulpMask = ~static_cast<ULONG_PTR>(0));
+
+protected:
+    virtual bool Reset(const _CONTEXT & ctx);
+    virtual bool Evaluate(const _CONTEXT & ctx);
+
+private:
+    bool Matches(const _CONTEXT & ctx) const;
+
+private:
+    int m_nRegister;
+    ULONG_PTR m_ulpValue;
+    ULONG_PTR m_ulpMask;
+    bool m_bMatched;
+};
+
+}
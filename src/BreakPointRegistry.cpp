@@ -0,0 +1,225 @@
+// BreakPointRegistry.cpp - Breakpoints by ID implementation
+#include "stdafx.h"
+#include "BreakPointRegistry.h"
+
+namespace SDE
+{
+
+static const size_t cInitialTable = 64;
+static const DWORD cSlotMask = CBreakPointRegistry::cMaxSlots;
+static const DWORD cMaxGeneration = 0xFFFF;
+
+CBreakPointRegistry::CBreakPointRegistry()
+: m_nTableUsed(0)
+, m_nCount(0)
+, m_lDefer(0)
+{
+}
+
+CBreakPointRegistry::~CBreakPointRegistry()
+{
+}
+
+BreakPointId CBreakPointRegistry::MakeId(DWORD dwSlot, DWORD dwGeneration)
+{
+    // Slot number + 1, an ID is never 0
+    return((dwGeneration << cSlotBits) | (dwSlot + 1));
+}
+
+size_t CBreakPointRegistry::Probe(IBreakPoint *pBreakPoint) const
+{
+    // Fibonacci hashing of the pointer, then linear probing
+    ULONG_PTR ulpHash = (reinterpret_cast<ULONG_PTR>(pBreakPoint) >> 3) * static_cast<ULONG_PTR>(0x9E3779B1);
+    size_t nMask = m_Table.size() - 1;
+    size_t n = static_cast<size_t>(ulpHash ^ (ulpHash >> 16)) & nMask;
+
+    while (m_Table[n] != cEmpty) {
+        if (m_Table[n] != cDeleted && m_Slots[m_Table[n] - 1].pBreakPoint == pBreakPoint)
+            break;
+        n = (n + 1) & nMask;
+    }
+    return(n);
+}
+
+void CBreakPointRegistry::Grow(void)
+{
+    // Rebuild without deleted entries, doubling if still too full
+    size_t nSize = m_Table.empty() ? cInitialTable : m_Table.size();
+    while (m_nCount * 2 >= nSize)
+        nSize *= 2;
+
+    m_Table.assign(nSize, static_cast<DWORD>(cEmpty));
+    m_nTableUsed = 0;
+
+    for (size_t i = 0; i < m_Slots.size(); i++) {
+        if (m_Slots[i].pBreakPoint == NULL)
+            continue;
+        m_Table[Probe(m_Slots[i].pBreakPoint)] = static_cast<DWORD>(i + 1);
+        m_nTableUsed++;
+    }
+}
+
+BreakPointId CBreakPointRegistry::Insert(IBreakPoint *pBreakPoint, IDebuggerClient *pOwner)
+{
+    if (pBreakPoint == NULL)
+        return(0);
+
+    BreakPointId id = Find(pBreakPoint);
+    if (id != 0)
+        return(id);
+
+    DWORD dwSlot;
+    if (m_Free.empty() == false) {
+        dwSlot = m_Free.back();
+        m_Free.pop_back();
+    } else {
+        if (m_Slots.size() >= cMaxSlots)
+            return(0);
+        dwSlot = static_cast<DWORD>(m_Slots.size());
+        Slot slot;
+        slot.pBreakPoint = NULL;
+        slot.pOwner = NULL;
+        slot.dwGeneration = 0;
+        m_Slots.push_back(slot);
+    }
+
+    m_Slots[dwSlot].pBreakPoint = pBreakPoint;
+    m_Slots[dwSlot].pOwner = pOwner;
+    m_nCount++;
+
+    if ((m_nTableUsed + 1) * 4 >= m_Table.size() * 3) {
+        Grow();
+    } else {
+        m_Table[Probe(pBreakPoint)] = dwSlot + 1;
+        m_nTableUsed++;
+    }
+
+    return(MakeId(dwSlot, m_Slots[dwSlot].dwGeneration));
+}
+
+bool CBreakPointRegistry::Remove(BreakPointId id)
+{
+    IBreakPoint *pBreakPoint = Get(id);
+    if (pBreakPoint == NULL)
+        return(false);
+
+    DWORD dwSlot = (id & cSlotMask) - 1;
+    m_Table[Probe(pBreakPoint)] = cDeleted;
+
+    // The ID is dead from now on
+    m_Slots[dwSlot].pBreakPoint = NULL;
+    m_Slots[dwSlot].pOwner = NULL;
+    m_Slots[dwSlot].dwGeneration++;
+    m_nCount--;
+
+    if (m_lDefer > 0)
+        m_Tombstones.push_back(dwSlot);
+    else
+        Release(dwSlot);
+
+    return(true);
+}
+
+void CBreakPointRegistry::Release(DWORD dwSlot)
+{
+    // A slot that went through every generation is retired, its IDs would repeat
+    if (m_Slots[dwSlot].dwGeneration <= cMaxGeneration)
+        m_Free.push_back(dwSlot);
+}
+
+IBreakPoint *CBreakPointRegistry::Get(BreakPointId id) const
+{
+    DWORD dwSlot = (id & cSlotMask) - 1;
+    if (dwSlot >= m_Slots.size())
+        return(NULL);
+
+    const Slot & slot = m_Slots[dwSlot];
+    if (slot.dwGeneration != (id >> cSlotBits))
+        return(NULL);
+
+    return(slot.pBreakPoint);
+}
+
+BreakPointId CBreakPointRegistry::Find(IBreakPoint *pBreakPoint) const
+{
+    if (m_nCount == 0 || pBreakPoint == NULL)
+        return(0);
+
+    DWORD dwEntry = m_Table[Probe(pBreakPoint)];
+    if (dwEntry == cEmpty)
+        return(0);
+
+    return(MakeId(dwEntry - 1, m_Slots[dwEntry - 1].dwGeneration));
+}
+
+SIZE_T CBreakPointRegistry::GetCount(void) const
+{
+    return(m_nCount);
+}
+
+IDebuggerClient *CBreakPointRegistry::GetOwner(BreakPointId id) const
+{
+    if (Get(id) == NULL)
+        return(NULL);
+    return(m_Slots[(id & cSlotMask) - 1].pOwner);
+}
+
+void CBreakPointRegistry::ClearOwner(IDebuggerClient *pOwner)
+{
+    for (size_t i = 0; i < m_Slots.size(); i++) {
+        if (m_Slots[i].pOwner == pOwner)
+            m_Slots[i].pOwner = NULL;
+    }
+}
+
+void CBreakPointRegistry::Clear(void)
+{
+    // Keep the generations, IDs handed out stay dead
+    m_Free.clear();
+    m_Tombstones.clear();
+    for (size_t i = 0; i < m_Slots.size(); i++) {
+        if (m_Slots[i].pBreakPoint) {
+            m_Slots[i].pBreakPoint = NULL;
+            m_Slots[i].pOwner = NULL;
+            m_Slots[i].dwGeneration++;
+        }
+        if (m_lDefer > 0)
+            m_Tombstones.push_back(static_cast<DWORD>(i));
+        else
+            Release(static_cast<DWORD>(i));
+    }
+
+    m_Table.assign(m_Table.size(), static_cast<DWORD>(cEmpty));
+    m_nTableUsed = 0;
+    m_nCount = 0;
+}
+
+void CBreakPointRegistry::BeginDefer(void)
+{
+    m_lDefer++;
+}
+
+void CBreakPointRegistry::EndDefer(void)
+{
+    if (--m_lDefer > 0)
+        return;
+
+    for (size_t i = 0; i < m_Tombstones.size(); i++)
+        Release(m_Tombstones[i]);
+    m_Tombstones.clear();
+}
+
+SIZE_T CBreakPointRegistry::GetSlots(void) const
+{
+    return(m_Slots.size());
+}
+
+IBreakPoint *CBreakPointRegistry::GetAt(SIZE_T nSlot, BreakPointId *pId) const
+{
+    const Slot & slot = m_Slots[nSlot];
+    if (slot.pBreakPoint && pId)
+        *pId = MakeId(static_cast<DWORD>(nSlot), slot.dwGeneration);
+    return(slot.pBreakPoint);
+}
+
+}
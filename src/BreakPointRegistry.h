@@ -0,0 +1,77 @@
+// BreakPointRegistry.h - Breakpoints by ID header
+#pragma once
+
+#include "Defs.h"
+#include <vector>
+
+namespace SDE
+{
+
+// Holds the debugger's breakpoints in slots. An ID is the slot number plus
+// the slot's generation, which changes when the breakpoint is removed, so a
+// stale ID never finds the breakpoint that took the slot later. Lookup by
+// ID, by pointer (through an open-addressing table) and removal are O(1).
+//
+// Removals between BeginDefer and EndDefer (while the debugger dispatches an
+// event) leave tombstones: the ID is dead at once, but the slot isn't reused
+// before EndDefer.
+class CBreakPointRegistry
+{
+    struct Slot
+    {
+        IBreakPoint *pBreakPoint;
+        IDebuggerClient *pOwner;
+        DWORD dwGeneration;
+    };
+
+    typedef std::vector<Slot> SlotVector;
+    typedef std::vector<DWORD> DwordVector;
+public:
+    static const DWORD cSlotBits = 16;
+    static const DWORD cMaxSlots = (1 << cSlotBits) - 1;
+
+    CBreakPointRegistry();
+    ~CBreakPointRegistry();
+
+    // Returns 0 if the registry is full, the ID it has if it's already in
+    BreakPointId Insert(IBreakPoint *pBreakPoint, IDebuggerClient *pOwner = NULL);
+    bool Remove(BreakPointId id);
+    IBreakPoint *Get(BreakPointId id) const;
+    // Returns 0 if the breakpoint isn't in
+    BreakPointId Find(IBreakPoint *pBreakPoint) const;
+    SIZE_T GetCount(void) const;
+    // The client the breakpoint was inserted for, NULL if none or the ID is dead
+    IDebuggerClient *GetOwner(BreakPointId id) const;
+    // Leaves the client's breakpoints without an owner
+    void ClearOwner(IDebuggerClient *pOwner);
+    void Clear(void);
+
+    void BeginDefer(void);
+    void EndDefer(void);
+
+    // Enumeration by slot, nSlot from 0 to GetSlots() - 1; returns NULL for
+    // empty slots
+    SIZE_T GetSlots(void) const;
+    IBreakPoint *GetAt(SIZE_T nSlot, BreakPointId *pId) const;
+
+private:
+    static const DWORD cEmpty = 0;
+    static const DWORD cDeleted = 0xFFFFFFFF;
+
+    static BreakPointId MakeId(DWORD dwSlot, DWORD dwGeneration);
+    size_t Probe(IBreakPoint *pBreakPoint) const;
+    void Grow(void);
+    void Release(DWORD dwSlot);
+
+private:
+    SlotVector m_Slots;
+    DwordVector m_Free;
+    DwordVector m_Tombstones;
+    // Slot number + 1 of each breakpoint, by pointer
+    DwordVector m_Table;
+    size_t m_nTableUsed;
+    SIZE_T m_nCount;
+    LONG m_lDefer;
+};
+
+}
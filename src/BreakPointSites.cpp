@@ -0,0 +1,141 @@
+// BreakPointSites.cpp - INT3 sites written into the debuggee implementation
+#include "stdafx.h"
+#include "BreakPointSites.h"
+
+namespace SDE
+{
+
+CBreakPointSites::CBreakPointSites()
+: m_nLive(0)
+, m_nReleased(0)
+{
+}
+
+CBreakPointSites::~CBreakPointSites()
+{
+}
+
+LONG CBreakPointSites::AddRef(ULONG_PTR ulpAddress, BYTE byOriginal)
+{
+    SiteMap::iterator i = m_Sites.find(ulpAddress);
+    if (i != m_Sites.end() && i->second.lRefs > 0)
+        return(++i->second.lRefs);
+
+    // A released site is taken back
+    if (i != m_Sites.end()) {
+        i->second.byOriginal = byOriginal;
+        i->second.lRefs = 1;
+        m_nReleased--;
+        m_nLive++;
+        return(1);
+    }
+
+    Site site;
+    site.byOriginal = byOriginal;
+    site.lRefs = 1;
+    m_Sites[ulpAddress] = site;
+    m_nLive++;
+    return(1);
+}
+
+LONG CBreakPointSites::Release(ULONG_PTR ulpAddress, BYTE *pbyOriginal)
+{
+    SiteMap::iterator i = m_Sites.find(ulpAddress);
+    if (i == m_Sites.end() || i->second.lRefs == 0)
+        return(-1);
+
+    if (pbyOriginal)
+        *pbyOriginal = i->second.byOriginal;
+
+    LONG lRefs = --i->second.lRefs;
+    if (lRefs == 0) {
+        m_nLive--;
+        m_nReleased++;
+        if (m_nReleased > cMaxReleased)
+            Prune();
+    }
+    return(lRefs);
+}
+
+bool CBreakPointSites::Find(ULONG_PTR ulpAddress, BYTE *pbyOriginal) const
+{
+    SiteMap::const_iterator i = m_Sites.find(ulpAddress);
+    if (i == m_Sites.end() || i->second.lRefs == 0)
+        return(false);
+
+    if (pbyOriginal)
+        *pbyOriginal = i->second.byOriginal;
+    return(true);
+}
+
+bool CBreakPointSites::Intersects(ULONG_PTR ulpAddress, SIZE_T nSize) const
+{
+    if (nSize == 0 || m_nLive == 0)
+        return(false);
+
+    for (SiteMap::const_iterator i = m_Sites.lower_bound(ulpAddress); i != m_Sites.end() && i->first - ulpAddress < nSize; ++i) {
+        if (i->second.lRefs > 0)
+            return(true);
+    }
+    return(false);
+}
+
+bool CBreakPointSites::IsEmpty(void) const
+{
+    return(m_nLive == 0);
+}
+
+void CBreakPointSites::Shadow(ULONG_PTR ulpAddress, LPBYTE lpBuffer, SIZE_T nSize) const
+{
+    if (nSize == 0)
+        return;
+
+    for (SiteMap::const_iterator i = m_Sites.lower_bound(ulpAddress); i != m_Sites.end() && i->first - ulpAddress < nSize; ++i) {
+        if (i->second.lRefs > 0)
+            lpBuffer[i->first - ulpAddress] = i->second.byOriginal;
+    }
+}
+
+void CBreakPointSites::Unshadow(ULONG_PTR ulpAddress, LPBYTE lpBuffer, SIZE_T nSize)
+{
+    if (nSize == 0)
+        return;
+
+    for (SiteMap::iterator i = m_Sites.lower_bound(ulpAddress); i != m_Sites.end() && i->first - ulpAddress < nSize; ++i) {
+        if (i->second.lRefs == 0)
+            continue;
+        i->second.byOriginal = lpBuffer[i->first - ulpAddress];
+        lpBuffer[i->first - ulpAddress] = cInt3;
+    }
+}
+
+void CBreakPointSites::GetLive(std::vector<ULONG_PTR> & Addresses, std::vector<BYTE> & Originals) const
+{
+    Addresses.clear();
+    Originals.clear();
+    for (SiteMap::const_iterator i = m_Sites.begin(); i != m_Sites.end(); ++i) {
+        if (i->second.lRefs == 0)
+            continue;
+        Addresses.push_back(i->first);
+        Originals.push_back(i->second.byOriginal);
+    }
+}
+
+void CBreakPointSites::Clear(void)
+{
+    m_Sites.clear();
+    m_nLive = m_nReleased = 0;
+}
+
+void CBreakPointSites::Prune(void)
+{
+    for (SiteMap::iterator i = m_Sites.begin(); i != m_Sites.end(); ) {
+        if (i->second.lRefs == 0)
+            m_Sites.erase(i++);
+        else
+            ++i;
+    }
+    m_nReleased = 0;
+}
+
+}
@@ -0,0 +1,62 @@
+// BreakPointSites.h - INT3 sites written into the debuggee header
+#pragma once
+
+#include <map>
+#include <vector>
+
+namespace SDE
+{
+
+// Keeps the original byte under every INT3 the debugger placed, counted by
+// the breakpoints sharing the address. Reads through the debugger see the
+// original bytes and writes over a site change the saved byte instead, so
+// the INT3 stays in memory for as long as a breakpoint wants it. Released
+// sites keep their entry (with no references) for a breakpoint that comes
+// back to the address, up to cMaxReleased of them, so a breakpoint moved
+// between the same addresses allocates nothing.
+class CBreakPointSites
+{
+    struct Site
+    {
+        BYTE byOriginal;
+        LONG lRefs;
+    };
+
+    typedef std::map<ULONG_PTR, Site> SiteMap;
+public:
+    static const BYTE cInt3 = 0xCC;
+    static const SIZE_T cMaxReleased = 1024;
+
+    CBreakPointSites();
+    ~CBreakPointSites();
+
+    // Returns the references to the site after adding one, the INT3 is to
+    // be written when it is 1
+    LONG AddRef(ULONG_PTR ulpAddress, BYTE byOriginal);
+    // Returns the references left, -1 if there is no site, the original byte
+    // is to be written back when it is 0
+    LONG Release(ULONG_PTR ulpAddress, BYTE *pbyOriginal);
+
+    bool Find(ULONG_PTR ulpAddress, BYTE *pbyOriginal) const;
+    bool Intersects(ULONG_PTR ulpAddress, SIZE_T nSize) const;
+    bool IsEmpty(void) const;
+
+    // Puts the original bytes in a buffer read from the debuggee
+    void Shadow(ULONG_PTR ulpAddress, LPBYTE lpBuffer, SIZE_T nSize) const;
+    // Takes the original bytes from a buffer to be written and puts the INT3s back
+    void Unshadow(ULONG_PTR ulpAddress, LPBYTE lpBuffer, SIZE_T nSize);
+    // The addresses and original bytes of the sites in use, in address order
+    void GetLive(std::vector<ULONG_PTR> & Addresses, std::vector<BYTE> & Originals) const;
+
+    void Clear(void);
+
+private:
+    void Prune(void);
+
+private:
+    SiteMap m_Sites;
+    SIZE_T m_nLive;
+    SIZE_T m_nReleased;
+};
+
+}
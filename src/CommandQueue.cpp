@@ -0,0 +1,49 @@
+// CommandQueue.cpp - Lock-free multiple producer, single consumer queue implementation
+#include "stdafx.h"
+#include "CommandQueue.h"
+
+namespace SDE
+{
+
+CCommandQueue::CCommandQueue()
+: m_pHead(NULL)
+{
+}
+
+CCommandQueue::~CCommandQueue()
+{
+}
+
+void CCommandQueue::Push(QueueEntry *pEntry)
+{
+    PVOID pHead;
+    do {
+        pHead = m_pHead;
+        pEntry->pNext = static_cast<QueueEntry *>(pHead);
+    } while (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile *>(&m_pHead), pEntry, pHead) != pHead);
+}
+
+QueueEntry *CCommandQueue::TakeAll(void)
+{
+    if (m_pHead == NULL)
+        return(NULL);
+
+    QueueEntry *pEntry = static_cast<QueueEntry *>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile *>(&m_pHead), NULL));
+
+    // Newest first as pushed, reverse
+    QueueEntry *pOldest = NULL;
+    while (pEntry) {
+        QueueEntry *pNext = pEntry->pNext;
+        pEntry->pNext = pOldest;
+        pOldest = pEntry;
+        pEntry = pNext;
+    }
+    return(pOldest);
+}
+
+bool CCommandQueue::IsEmpty(void) const
+{
+    return(m_pHead == NULL);
+}
+
+}
@@ -0,0 +1,32 @@
+// CommandQueue.h - Lock-free multiple producer, single consumer queue header
+#pragma once
+
+namespace SDE
+{
+
+// An entry is embedded in the queued object, pushing never allocates
+struct QueueEntry
+{
+    QueueEntry *pNext;
+};
+
+// Any thread may push, one thread takes the entries. Push links the entry
+// to the head with a compare-and-swap, TakeAll swaps the whole list out and
+// reverses it, so the consumer sees the entries in the order they were
+// pushed. Taking everything at once leaves no ABA problem to solve.
+class CCommandQueue
+{
+public:
+    CCommandQueue();
+    ~CCommandQueue();
+
+    void Push(QueueEntry *pEntry);
+    // Returns the oldest entry, linked to the newer ones, or NULL
+    QueueEntry *TakeAll(void);
+    bool IsEmpty(void) const;
+
+private:
+    QueueEntry * volatile m_pHead;
+};
+
+}
@@ -1,20 +1,71 @@
 // Debugger.cpp - SDE Debugger implementation
-#include "StdAfx.h"
+#include "stdafx.h"
 #include "Debugger.h"
+#include "DebuggerReactor.h"
+#include "AllocationCounter.h"
+
+// The string scan uses SSE2 where the compiler targets it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SDE_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 namespace SDE
 {
 
+static const SIZE_T cPageSize = 0x1000;
+
 CDebugger::CDebugger()
 : m_bProcessLoaded(false)
+, m_pMain(NULL)
+, m_pProcess(&m_NoProcess)
+, m_bFollowChildren(false)
+, m_bInheritBreakPoints(false)
+, m_dwThreadId(0)
+, m_pHeld(NULL)
+, m_pReactor(NULL)
+, m_hWake(NULL)
+, m_lSignaled(0)
+, m_bClientsAway(false)
+, m_dwClientThreadId(0)
+, m_GoCommand(cCommandGo)
+, m_bGoPending(false)
+, m_bQuit(false)
+, m_bRunning(false)
 , m_bMultithread(false)
 , m_lSuspendCount(0)
+, m_bInStop(false)
+, m_dwContinueStatus(DBG_CONTINUE)
+, m_hEventThread(NULL)
+, m_bFirstThread(true)
+, m_bPageCache(false)
+, m_dwDebugRegisterStamp(0)
+, m_nTrampolineAllocations(0)
+, m_nTrampolineReuses(0)
+, m_nTrampolineSyscallsSaved(0)
+, m_nDisplacedSteps(0)
+, m_dwDebuggedPid(0)
+, m_dwDebuggedTid(0)
+, m_nExceptionEvents(0)
+, m_nEventAllocations(0)
+, m_nAllocationsBefore(0)
 {
     // Create events
     for (int i = 0; i < cNumEvents; i++)
         m_hEvents[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_hWake = m_hEvents[cDebugWakeEvent];
+
+    ZeroMemory(m_DebugRegisters, sizeof(m_DebugRegisters));
+    ZeroMemory(&m_Event, sizeof(m_Event));
+
+    m_NoProcess.dwPid = 0;
+    m_NoProcess.hProcess = NULL;
+    m_NoProcess.bCreated = false;
+    m_NoProcess.bForked = false;
+    m_NoProcess.bUnfollowed = false;
+    m_NoProcess.nLifted = 0;
 }
 
 CDebugger::~CDebugger()
@@ -22,6 +73,8 @@ CDebugger::~CDebugger()
     if (m_bProcessLoaded)
         Stop();
 
+    EndThread();
+
     // Remove events
     for (int n = 0; n < cNumEvents; n++) {
         if (m_hEvents[n])
@@ -30,8 +83,17 @@ CDebugger::~CDebugger()
 
     CloseProcessHandles();
 
-    // Remove all breakpoints
-    for_each(m_BreakPoints.begin(), m_BreakPoints.end(), mem_fun(IBreakPoint::Deinitialize));
+    // Remove all breakpoints one at a time. One may remove and delete its
+    // helpers when deinitialized, so each is taken from the live registry.
+    for (SIZE_T n = 0; n < m_BreakPoints.GetSlots(); n++) {
+        BreakPointId id = 0;
+        if (m_BreakPoints.GetAt(n, &id) != NULL)
+            RemoveBreakPoint(id);
+    }
+    m_BreakPoints.Clear();
+    m_Index.Clear();
+
+    ClearProcesses();
 }
 
 DWORD CDebugger::LoadProcess(LPCSTR pszProcessName, LPCSTR pszArguments, LPCSTR pszCurrentDirectory, LPVOID lpEnvironment, LPSTARTUPINFO psi)
@@ -39,12 +101,33 @@ DWORD CDebugger::LoadProcess(LPCSTR pszProcessName, LPCSTR pszArguments, LPCSTR
     if (m_bProcessLoaded == true)
         Stop();
 
+    // The thread that creates the process is the one that can debug it
+    if (StartThread() == false)
+        return(0);
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandLoadProcess);
+        cmd.pszProcessName = pszProcessName;
+        cmd.pszArguments = pszArguments;
+        cmd.pszCurrentDirectory = pszCurrentDirectory;
+        cmd.lpEnvironment = lpEnvironment;
+        cmd.psi = psi;
+        Execute(&cmd);
+        return(cmd.dwResult);
+    }
+
     // Create the process
-    BOOL bRet = CreateProcess(pszProcessName, const_cast<LPSTR>(pszArguments), NULL, NULL, FALSE, DEBUG_PROCESS | DEBUG_ONLY_THIS_PROCESS, lpEnvironment, pszCurrentDirectory, psi, &m_pi);
+    DWORD dwCreationFlags = DEBUG_PROCESS;
+    if (m_bFollowChildren == false)
+        dwCreationFlags |= DEBUG_ONLY_THIS_PROCESS;
+    BOOL bRet = CreateProcess(pszProcessName, const_cast<LPSTR>(pszArguments), NULL, NULL, FALSE, dwCreationFlags, lpEnvironment, pszCurrentDirectory, psi, &m_pi);
     if (bRet == FALSE) {
         return(0);
     }
 
+    // Calls made before its first event go to it
+    ClearProcesses();
+    m_pMain = m_pProcess = AddProcess(m_pi.dwProcessId, m_pi.hProcess);
+
     // Set process-loaded flag
     m_bProcessLoaded = true;
     m_bActiveDebug = false;
@@ -57,9 +140,22 @@ bool CDebugger::AttachToProcess(DWORD dwPid)
     if (m_bProcessLoaded == true)
         Stop();
 
+    if (StartThread() == false)
+        return(false);
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandAttachToProcess);
+        cmd.dwPid = dwPid;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
     if (DebugActiveProcess(dwPid) == FALSE) 
         return(false);
 
+    // The handle comes with its first event
+    ClearProcesses();
+    m_pMain = m_pProcess = AddProcess(dwPid, NULL);
+
     m_bProcessLoaded = true;
     m_bActiveDebug = true;
 
@@ -68,96 +164,393 @@ bool CDebugger::AttachToProcess(DWORD dwPid)
 
 void CDebugger::AddClient(IDebuggerClient *pClient)
 {
-    Suspend();
-    m_vClients.push_front(pClient);
-    Resume();
+    if (pClient == NULL)
+        return;
+
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandAddClient);
+        cmd.pClient = pClient;
+        Execute(&cmd);
+        return;
+    }
+
+    ClientEntry entry;
+    entry.pClient = pClient;
+    entry.dwEventMask = pClient->GetEventMask();
+    m_vClients.push_front(entry);
+    BuildSubscribers();
+
+    // It hasn't been told the debugged thread yet
+    m_dwDebuggedPid = m_dwDebuggedTid = 0;
 }
 
 void CDebugger::RemoveClient(IDebuggerClient *pClient)
 {
-    Suspend();
-    ClientVector::iterator i = find(m_vClients.begin(), m_vClients.end(), pClient);
-    if (i != m_vClients.end()) {
-        m_vClients.erase(i);
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandRemoveClient);
+        cmd.pClient = pClient;
+        Execute(&cmd);
+        return;
+    }
+
+    for (ClientVector::iterator i = m_vClients.begin(); i != m_vClients.end(); ++i) {
+        if (i->pClient == pClient) {
+            m_vClients.erase(i);
+            break;
+        }
+    }
+    BuildSubscribers();
+
+    // Its breakpoints stay, nobody owns them now
+    m_BreakPoints.ClearOwner(pClient);
+}
+
+void CDebugger::UpdateClient(IDebuggerClient *pClient)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandUpdateClient);
+        cmd.pClient = pClient;
+        Execute(&cmd);
+        return;
+    }
+
+    for (ClientVector::iterator i = m_vClients.begin(); i != m_vClients.end(); ++i) {
+        if (i->pClient == pClient)
+            i->dwEventMask = pClient->GetEventMask();
+    }
+    BuildSubscribers();
+
+    // It may have subscribed to the debugged thread
+    m_dwDebuggedPid = m_dwDebuggedTid = 0;
+}
+
+void CDebugger::BuildSubscribers(void)
+{
+    for (int n = 0; n < cNumClientEvents; n++)
+        m_Subscribers[n].clear();
+
+    for (ClientVector::iterator i = m_vClients.begin(); i != m_vClients.end(); ++i) {
+        DWORD dwEventMask = i->dwEventMask;
+
+        // Clients taking every breakpoint already get their own
+        if (dwEventMask & IDebuggerClient::cEventBreakPoint)
+            dwEventMask &= ~IDebuggerClient::cEventOwnBreakPoints;
+
+        for (int n = 0; n < cNumClientEvents; n++) {
+            if (dwEventMask & (1 << n))
+                m_Subscribers[n].push_back(i->pClient);
+        }
     }
-    Resume();
 }
 
-bool CDebugger::AddBreakPoint(IBreakPoint *pBreakPoint)
+const CDebugger::ClientList & CDebugger::GetSubscribers(DWORD dwEvent) const
+{
+    int n = 0;
+    while ((dwEvent >> n) > 1)
+        n++;
+    return(m_Subscribers[n]);
+}
+
+BreakPointId CDebugger::AddBreakPoint(IBreakPoint *pBreakPoint)
+{
+    return(AddBreakPoint(pBreakPoint, NULL));
+}
+
+BreakPointId CDebugger::AddBreakPoint(IBreakPoint *pBreakPoint, IDebuggerClient *pOwner)
 {
     // A process must be loaded
     if (m_bProcessLoaded == false)
-        return(false);
+        return(0);
+
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandAddBreakPoint);
+        cmd.pBreakPoint = pBreakPoint;
+        cmd.pClient = pOwner;
+        Execute(&cmd);
+        return(cmd.idResult);
+    }
+
+    // Already added?
+    BreakPointId id = m_BreakPoints.Find(pBreakPoint);
+    if (id != 0)
+        return(id);
 
-    Suspend();
+    id = m_BreakPoints.Insert(pBreakPoint, pOwner);
+    if (id == 0)
+        return(0);
 
+    // It belongs to the process of the event being handled, the first one otherwise
     if (m_lProcessesCreated) {
-        pBreakPoint->Initialize(m_pi.hProcess);
+        pBreakPoint->Initialize(this, m_pProcess->hProcess);
+        SetBreakPoint(m_pProcess, id, true);
     }
 
-    // Add breakpoint to vector
-    m_BreakPoints.push_front(pBreakPoint);
-
-    Resume();
+    // Add breakpoint to the dispatch index
+    m_Index.Insert(pBreakPoint);
 
-    return(true);
+    return(id);
 }
 
 bool CDebugger::RemoveBreakPoint(IBreakPoint *pBreakPoint)
 {
-    Suspend();
+    // Looked up and removed in one command
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandRemoveBreakPoint);
+        cmd.pBreakPoint = pBreakPoint;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
 
-    BreakPointVector::iterator i = find(m_BreakPoints.begin(), m_BreakPoints.end(), pBreakPoint);
-    if (i == m_BreakPoints.end()) {
-        Resume();
-        return(false);
+    return(RemoveBreakPoint(GetBreakPointId(pBreakPoint)));
+}
+
+bool CDebugger::RemoveBreakPoint(BreakPointId id)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandRemoveBreakPoint);
+        cmd.id = id;
+        Execute(&cmd);
+        return(cmd.bResult);
     }
 
+    IBreakPoint *pBreakPoint = m_BreakPoints.Get(id);
+    if (pBreakPoint == NULL)
+        return(false);
+
+    // Unlinked first, a breakpoint may remove its helpers when deinitialized
+    m_BreakPoints.Remove(id);
+    m_Index.Remove(pBreakPoint);
+    for (size_t n = 0; n < m_Processes.size(); n++)
+        SetBreakPoint(m_Processes[n], id, false);
+
+    Process *pPrevious = SelectProcess(pBreakPoint);
     pBreakPoint->Deinitialize();
-    m_BreakPoints.erase(i);
-    
-    Resume();
+    SelectProcess(pPrevious);
 
     return(true);
 }
 
+bool CDebugger::EnableBreakPoint(IBreakPoint *pBreakPoint)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandEnableBreakPoint);
+        cmd.pBreakPoint = pBreakPoint;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    Process *pPrevious = SelectProcess(pBreakPoint);
+    bool bRet = pBreakPoint->Enable();
+    SelectProcess(pPrevious);
+
+    return(bRet);
+}
+
+bool CDebugger::DisableBreakPoint(IBreakPoint *pBreakPoint)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandDisableBreakPoint);
+        cmd.pBreakPoint = pBreakPoint;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    Process *pPrevious = SelectProcess(pBreakPoint);
+    bool bRet = pBreakPoint->Disable();
+    SelectProcess(pPrevious);
+
+    return(bRet);
+}
+
+IBreakPoint *CDebugger::GetBreakPoint(BreakPointId id)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandGetBreakPoint);
+        cmd.id = id;
+        Execute(&cmd);
+        return(cmd.pResult);
+    }
+
+    return(m_BreakPoints.Get(id));
+}
+
+BreakPointId CDebugger::GetBreakPointId(IBreakPoint *pBreakPoint)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandGetBreakPointId);
+        cmd.pBreakPoint = pBreakPoint;
+        Execute(&cmd);
+        return(cmd.idResult);
+    }
+
+    return(m_BreakPoints.Find(pBreakPoint));
+}
+
+void CDebugger::UpdateBreakPoint(IBreakPoint *pBreakPoint)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandUpdateBreakPoint);
+        cmd.pBreakPoint = pBreakPoint;
+        Execute(&cmd);
+        return;
+    }
+
+    m_Index.Update(pBreakPoint);
+}
+
 int CDebugger::GetNumBreakPoints(void)
 {
-    Suspend();
-    int nNumBreakPoints = static_cast<int>(m_BreakPoints.size());
-    Resume();
-    return(nNumBreakPoints);
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandGetNumBreakPoints);
+        Execute(&cmd);
+        return(cmd.nResult);
+    }
+
+    return(static_cast<int>(m_BreakPoints.GetCount()));
 }
 
 bool CDebugger::EnumBreakPoints(EnumBreakPointProc EnumProc, void *pUserData)
 {
-    Suspend();
-    BreakPointVector::const_iterator i;
-    for (i = m_BreakPoints.begin(); i != m_BreakPoints.end(); ++i) {
-        if (EnumProc(*i, pUserData) == false) {
-            Resume();
-            return(false);
+    // The callback runs on the debugger thread
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandEnumBreakPoints);
+        cmd.EnumProc = EnumProc;
+        cmd.pUserData = pUserData;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    // The callback may remove breakpoints, their slots aren't reused meanwhile
+    m_BreakPoints.BeginDefer();
+    bool bRet = true;
+    for (SIZE_T n = 0; n < m_BreakPoints.GetSlots() && bRet == true; n++) {
+        IBreakPoint *pBreakPoint = m_BreakPoints.GetAt(n, NULL);
+        if (pBreakPoint)
+            bRet = EnumProc(pBreakPoint, pUserData);
+    }
+    m_BreakPoints.EndDefer();
+    return(bRet);
+}
+
+BOOL CDebugger::GetThreadContext(HANDLE hThread, LPCONTEXT lpContext)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandGetThreadContext);
+        cmd.hThread = hThread;
+        cmd.lpContext = lpContext;
+        Execute(&cmd);
+        return(cmd.fResult);
+    }
+
+    // While stopped the registers are read once and kept until we continue
+    if (m_bInStop == false)
+        return(::GetThreadContext(hThread, lpContext));
+
+    return(m_Contexts.Get(hThread, lpContext) ? TRUE : FALSE);
+}
+
+BOOL CDebugger::SetThreadContext(HANDLE hThread, const CONTEXT *lpContext)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandSetThreadContext);
+        cmd.hThread = hThread;
+        cmd.lpcContext = lpContext;
+        Execute(&cmd);
+        return(cmd.fResult);
+    }
+
+    // While stopped the changes are written back before we continue
+    if (m_bInStop == false)
+        return(::SetThreadContext(hThread, lpContext));
+
+    return(m_Contexts.Set(hThread, lpContext) ? TRUE : FALSE);
+}
+
+int CDebugger::AllocateDebugRegister(LPVOID lpAddress, DWORD dwCondition, DWORD dwLength)
+{
+    // Length must be 1, 2, 4 or 8 (x64 only), and the address aligned to it
+    if (dwLength != 1 && dwLength != 2 && dwLength != 4 && dwLength != 8)
+        return(-1);
+    if (reinterpret_cast<ULONG_PTR>(lpAddress) & (dwLength - 1))
+        return(-1);
+
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandAllocateDebugRegister);
+        cmd.lpAddress = lpAddress;
+        cmd.dwCondition = dwCondition;
+        cmd.dwLength = dwLength;
+        Execute(&cmd);
+        return(cmd.nResult);
+    }
+
+    int nIndex = -1;
+    for (int i = 0; i < cNumDebugRegisters; i++) {
+        if (m_DebugRegisters[i].bUsed == false) {
+            nIndex = i;
+            break;
         }
     }
-    Resume();
-    return(true);
+
+    if (nIndex >= 0) {
+        m_DebugRegisters[nIndex].bUsed = true;
+        m_DebugRegisters[nIndex].lpAddress = lpAddress;
+        m_DebugRegisters[nIndex].dwCondition = dwCondition;
+        m_DebugRegisters[nIndex].dwLength = dwLength;
+        SetDebugRegisters();
+    }
+
+    return(nIndex);
+}
+
+void CDebugger::FreeDebugRegister(int nIndex)
+{
+    if (nIndex < 0 || nIndex >= cNumDebugRegisters)
+        return;
+
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandFreeDebugRegister);
+        cmd.nIndex = nIndex;
+        Execute(&cmd);
+        return;
+    }
+
+    m_DebugRegisters[nIndex].bUsed = false;
+    SetDebugRegisters();
 }
 
 bool CDebugger::Go(void)
 {
-    // A process must be loaded
-    if (m_bProcessLoaded == false)
+    HANDLE hStopped = GoAsync();
+    if (hStopped == NULL)
         return(false);
 
-    CloseProcessHandles();
+    // Called back from the debugger thread the loop runs after the callback
+    if (IsOtherThread() == true && m_dwClientThreadId != GetCurrentThreadId())
+        WaitForSingleObject(hStopped, INFINITE);
+
+    return(true);
+}
 
-    // Clear stop event, set running event and begin debugger thread
+HANDLE CDebugger::GoAsync(void)
+{
+    // A process must be loaded
+    if (m_bProcessLoaded == false || m_dwThreadId == 0)
+        return(NULL);
+
+    // Already going
+    if (m_bRunning == true)
+        return(m_hEvents[cDebugStoppedEvent]);
+
+    // Clear stop and stopped events, set running event and have the debugger thread go
     ResetEvent(m_hEvents[cDebugStopEvent]);
+    ResetEvent(m_hEvents[cDebugStoppedEvent]);
     SetEvent(m_hEvents[cDebugRunningEvent]);
+    m_bRunning = true;
 
-    DebuggerThread(this);
+    m_Commands.Push(&m_GoCommand);
+    Signal();
 
-    return(true);
+    return(m_hEvents[cDebugStoppedEvent]);
 }
 
 void CDebugger::Stop(void)
@@ -166,11 +559,11 @@ void CDebugger::Stop(void)
     if (m_bProcessLoaded == false)
         return;
 
-    // Signal stop event and wait until it becomes non-signaled again
-    ResetEvent(m_hEvents[cDebugStoppedEvent]);
     SetEvent(m_hEvents[cDebugStopEvent]);
-    
-    if (m_bMultithread == true) 
+    Wake();
+
+    // Wait for the loop to end, unless called from it or from its clients
+    if (m_bRunning == true && IsOtherThread() == true && m_dwClientThreadId != GetCurrentThreadId())
         WaitForSingleObject(m_hEvents[cDebugStoppedEvent], INFINITE);
 
     m_lSuspendCount = 0;
@@ -185,6 +578,9 @@ void CDebugger::Suspend(void)
     InterlockedIncrement(&m_lSuspendCount);
 
     CheckSuspend();
+
+    // Park the loop now rather than after its next debug event
+    Wake();
 }
 
 void CDebugger::Resume(void)
@@ -196,329 +592,1075 @@ void CDebugger::Resume(void)
     InterlockedDecrement(&m_lSuspendCount);
 
     CheckSuspend();
+
+    Wake();
 }
 
 void CDebugger::DebuggerThread(void *pParam)
 {
     CDebugger *pThis = reinterpret_cast<CDebugger *>(pParam);
-    bool bFirstProcess = true;
-    bool bFirstThread = true;
-    
-    pThis->m_lProcessesCreated = 0;
+
+    pThis->BeginSession();
 
     // Main debugger loop
     while (1) {
+        // Anything asked from now on wakes the wait below
+        ResetEvent(pThis->m_hEvents[cDebugWakeEvent]);
+
+        // Calls from other threads, between events
+        pThis->RunCommands();
+
         // Check stop event
         if (WaitForSingleObject(pThis->m_hEvents[cDebugStopEvent], 0) == WAIT_OBJECT_0)
             break;
 
-        // Check running flag (for suspend/resume)
-        WaitForSingleObject(pThis->m_hEvents[cDebugRunningEvent], INFINITE);
+        // Check running flag (for suspend/resume), still taking commands while suspended
+        if (WaitForSingleObject(pThis->m_hEvents[cDebugRunningEvent], 0) != WAIT_OBJECT_0) {
+            WaitForSingleObject(pThis->m_hEvents[cDebugWakeEvent], INFINITE);
+            continue;
+        }
 
         // Wait for a debug event
-        DEBUG_EVENT de;
-        BOOL bRet = WaitForDebugEvent(&de, 1000);
-        if (bRet == FALSE) {
+        pThis->m_nAllocationsBefore = CAllocationCounter::GetCount();
+        if (pThis->WaitForEvent(&pThis->m_Event) == false) {
             continue;
         }
 
-        DWORD dwContinueStatus = DBG_CONTINUE;
+        if (pThis->BeginEvent() == true)
+            pThis->CallClients();
 
-        // Set debugged thread
-        for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-            IDebuggerClient *pClient = *i;
-            if (pClient) {
-                pClient->SetDebuggedThread(de.dwProcessId, de.dwThreadId);
-            }
-        }
-        
-        // Check event type
-        switch (de.dwDebugEventCode) {
-            case EXCEPTION_DEBUG_EVENT:
-                // Exception
-                {
-                EXCEPTION_DEBUG_INFO *pException = &de.u.Exception;
-                bool bNotifyBreakPoint = false;
-                CDebugger::BreakPointVector TriggeredBreakPoints;
-
-                // Scan through exceptions to see if we triggered one
-                for (CDebugger::BreakPointVector::iterator i = pThis->m_BreakPoints.begin(); i != pThis->m_BreakPoints.end(); ++i) {
-                    IBreakPoint *pBreakPoint = *i;
-                    if (pBreakPoint) {
-                        DWORD dwFirstChance = pException->dwFirstChance;
-                        if (pBreakPoint->IsTriggered(pThis->m_Tid2Handle[de.dwThreadId], pException) == true) {
-                            TriggeredBreakPoints.push_front(pBreakPoint);
-                        }
-                    }
-                }
+        // Continue debugging
+        if (pThis->EndEvent() == false)
+            break;
+    }
 
-                // Notify client of breakpoint/exception
-                if (TriggeredBreakPoints.empty() == false) {
-                    // Notify each client of the triggered breakpoints
-                    for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                        IDebuggerClient *pClient = *i;
-                        if (pClient) {
-                            for (CDebugger::BreakPointVector::iterator j = TriggeredBreakPoints.begin(); j != TriggeredBreakPoints.end(); ++j) {
-                                IBreakPoint *pBreakPoint = *j;
-                                if (pClient->OnBreakPoint(pBreakPoint) == true) {
-                                    // Scan all triggered breakpoints, filter the ones already removed (by a breakpoint's IsTriggered)
-                                    CDebugger::BPVIteratorVector v;
-                                    for (CDebugger::BreakPointVector::iterator i = TriggeredBreakPoints.begin(); i != TriggeredBreakPoints.end(); ++i) {
-                                        IBreakPoint *pBreakPoint = *i;
-                                        if (find(pThis->m_BreakPoints.begin(), pThis->m_BreakPoints.end(), pBreakPoint) == pThis->m_BreakPoints.end()) {
-                                            v.push_back(i);
-                                        }
-                                    }
-                                    for (int i = 0; i < static_cast<int>(v.size()); i++) {
-                                        TriggeredBreakPoints.erase(v[i]);
-                                    }
-                                    if (TriggeredBreakPoints.empty() == true)
-                                        break;
-                                }
-                            }
-                        }
-                    }
-                } else {
-                    if (pException->dwFirstChance == 0xBADC0DE) break;
-
-                    bool bRet = false;
-                    for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                        IDebuggerClient *pClient = *i;
-                        if (pClient) {
-                            bRet |= pClient->OnException(pException);
-                        }
-                    }
+    pThis->EndSession();
+}
 
-                    if (bRet == false)
-                        dwContinueStatus = DBG_EXCEPTION_NOT_HANDLED;
-                }
-                }
+void CDebugger::BeginSession(void)
+{
+    m_lProcessesCreated = 0;
+    m_bFirstThread = true;
+}
+
+bool CDebugger::BeginEvent(void)
+{
+    DEBUG_EVENT & de = m_Event;
+    // The clients to call
+    DWORD dwEvent = 0;
+
+    m_dwContinueStatus = DBG_CONTINUE;
+    m_hEventThread = NULL;
+    m_Triggered.clear();
+    m_bInStop = true;
+
+    // The breakpoints and clients work on the event's process
+    Process *pProcess = FindProcess(de.dwProcessId);
+    if (pProcess)
+        m_pProcess = pProcess;
+
+    // Breakpoints removed while the event is handled leave tombstones
+    m_BreakPoints.BeginDefer();
+
+    // Check event type
+    switch (de.dwDebugEventCode) {
+        case EXCEPTION_DEBUG_EVENT:
+            // Exception
+            {
+            EXCEPTION_DEBUG_INFO *pException = &de.u.Exception;
+            HANDLE hThread = GetThreadHandle(de.dwThreadId);
+            m_hEventThread = hThread;
+            pProcess = m_pProcess;
+
+            // A thread running an instruction out of line, or over a lifted INT3
+            if (pProcess->Stepper.IsStepping(hThread) == true && pProcess->Stepper.OnException(*this, hThread, pException) == true)
                 break;
-            case CREATE_PROCESS_DEBUG_EVENT: 
-                // A process was created
-                {
-                CREATE_PROCESS_DEBUG_INFO *pCreateProcess = &de.u.CreateProcessInfo;
-                
-                if (bFirstProcess == true) {
-                    // Set process/thread handles
-                    pThis->m_pi.hProcess = pCreateProcess->hProcess;
-                    pThis->m_pi.hThread = pCreateProcess->hThread;
-                    pThis->m_pi.dwProcessId = de.dwProcessId;
-                    pThis->m_pi.dwThreadId = de.dwThreadId;
-
-                    // Add TID/Handle to maps
-                    if (pThis->m_pi.hThread && pThis->m_pi.dwThreadId) {
-                        pThis->m_Tid2Handle[pThis->m_pi.dwThreadId] = pThis->m_pi.hThread;
-                        pThis->m_Handle2Tid[pThis->m_pi.hThread] = pThis->m_pi.dwThreadId;
-                    }
+            if (pProcess->nLifted != 0)
+                EndStepInPlace(hThread, pException);
+
+            // Only ask the breakpoints indexed under this exception. The candidates are
+            // collected first since IsTriggered may add or remove breakpoints; removed
+            // ones leave tombstones until the event is handled, so their IDs stay dead.
+            m_Candidates.clear();
+            m_Index.GetCandidates(pException->ExceptionRecord.ExceptionCode, pException->ExceptionRecord.ExceptionAddress, hThread, m_Candidates);
+
+            for (size_t n = 0; n < m_Candidates.size(); n++) {
+                IBreakPoint *pBreakPoint = m_Candidates[n];
+                BreakPointId id = m_BreakPoints.Find(pBreakPoint);
+                if (id == 0 || HasBreakPoint(pProcess, id) == false)
+                    continue;
+                if (pBreakPoint->IsTriggered(hThread, pException) == true) {
+                    m_Triggered.push_back(id);
+                }
+            }
 
-                    // Initialize all breakpoints
-                    for (CDebugger::BreakPointVector::iterator i = pThis->m_BreakPoints.begin(); i != pThis->m_BreakPoints.end(); ++i) {
-                        IBreakPoint *pBreakPoint = *i;
-                        if (pBreakPoint) {
-                            pBreakPoint->Initialize(pThis->m_pi.hProcess);
-                        }
-                    }
-                    bFirstProcess = false;
+            // Notify client of breakpoint/exception
+            if (m_Triggered.empty() == false) {
+                dwEvent = IDebuggerClient::cEventBreakPoint;
+            } else {
+                if (pException->dwFirstChance == 0xBADC0DE) {
+                    // A breakpoint let a thread it doesn't watch pass its INT3
+                    if (pException->ExceptionRecord.ExceptionCode == EXCEPTION_BREAKPOINT)
+                        StepOverSite(hThread);
+                    break;
                 }
 
-                InterlockedIncrement(&pThis->m_lProcessesCreated);
+                if (RewindRemovedSite(hThread, pException) == true)
+                    break;
+                if (StepOverForeignSite(hThread, pException) == true)
+                    break;
 
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnProcessCreated(pCreateProcess);
-                    }
-                }
-                if (pCreateProcess->hFile)
-                    CloseHandle(pCreateProcess->hFile);
-                }
-                break;
-            case CREATE_THREAD_DEBUG_EVENT: 
-                // A thread was created
-                {
-                CREATE_THREAD_DEBUG_INFO *pCreateThread = &de.u.CreateThread;
-
-                if (bFirstThread) {
-                    if (pThis->m_bActiveDebug == true) {
-                        // Set as main thread
-                        pThis->m_pi.hThread = pCreateThread->hThread;
-                        pThis->m_pi.dwThreadId = de.dwThreadId;
-                    }
-                    bFirstThread = false;
+                // Exceptions the user only wants counted don't reach the clients
+                LONG lDisposition = m_Dispositions.Hit(pException->ExceptionRecord.ExceptionCode);
+                if (lDisposition == CExceptionDispositions::cPass) {
+                    m_dwContinueStatus = DBG_EXCEPTION_NOT_HANDLED;
+                    break;
                 }
+                if (lDisposition == CExceptionDispositions::cSwallow)
+                    break;
 
-                // Add to TID/Handle maps
-                if (pCreateThread->hThread) {
-                    pThis->m_Tid2Handle[de.dwThreadId] = pCreateThread->hThread;
-                    pThis->m_Handle2Tid[pCreateThread->hThread] = de.dwThreadId;
+                dwEvent = IDebuggerClient::cEventException;
+            }
+            }
+            break;
+        case CREATE_PROCESS_DEBUG_EVENT: 
+            // A process was created
+            {
+            CREATE_PROCESS_DEBUG_INFO *pCreateProcess = &de.u.CreateProcessInfo;
+            bool bNew = false;
+
+            if (pProcess == NULL) {
+                // A child
+                pProcess = AddProcess(de.dwProcessId, pCreateProcess->hProcess);
+                bNew = true;
+#ifndef _WIN32
+            } else if (pProcess->bUnfollowed == true) {
+                // The vfork child that isn't followed has its own memory now
+                DebugActiveProcessStop(de.dwProcessId);
+                RemoveProcess(pProcess);
+                return(false);
+#endif
+            } else if (pProcess->bCreated == true) {
+                // An exec, the process has a new image
+                ResetProcess(pProcess);
+            } else {
+                bNew = true;
+            }
+            pProcess->hProcess = pCreateProcess->hProcess;
+            pProcess->bCreated = true;
+            SelectProcess(pProcess);
+
+            // Add to the thread table
+            if (pCreateProcess->hThread && de.dwThreadId) {
+                CThreadTable::Thread *pThread = m_Threads.Insert(de.dwThreadId, pCreateProcess->hThread);
+                if (pThread) {
+                    pThread->dwPid = de.dwProcessId;
+                    if (DebugRegistersInUse())
+                        SetDebugRegisters(pThread);
                 }
+            }
 
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnThreadCreated(pCreateThread);
+            if (bNew == true && pProcess == m_pMain) {
+                // Set process/thread handles
+                m_pi.hProcess = pCreateProcess->hProcess;
+                m_pi.hThread = pCreateProcess->hThread;
+                m_pi.dwProcessId = de.dwProcessId;
+                m_pi.dwThreadId = de.dwThreadId;
+
+                // Initialize all breakpoints, their keys may depend on the process
+                for (SIZE_T n = 0; n < m_BreakPoints.GetSlots(); n++) {
+                    BreakPointId id = 0;
+                    IBreakPoint *pBreakPoint = m_BreakPoints.GetAt(n, &id);
+                    if (pBreakPoint) {
+                        pBreakPoint->Initialize(this, pProcess->hProcess);
+                        m_Index.Update(pBreakPoint);
+                        SetBreakPoint(pProcess, id, true);
                     }
                 }
-                }
-                break;
-            case EXIT_THREAD_DEBUG_EVENT: 
-                // A thread exit
-                {
-                EXIT_THREAD_DEBUG_INFO *pExitThread = &de.u.ExitThread;
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnThreadExit(pExitThread);
+            }
+#ifndef _WIN32
+            else if (bNew == true) {
+                // A forked child has a copy of its parent's memory, INT3s included
+                BOOL bVFork = FALSE;
+                Process *pParent = FindProcess(GetForkParentProcessId(de.dwProcessId, &bVFork));
+                if (pParent)
+                    InheritProcess(pProcess, pParent, bVFork == TRUE);
+
+                // One that isn't followed goes on undebugged, without them. A
+                // vfork child runs on its parent's memory and steps over the
+                // INT3s until it execs.
+                if (m_bFollowChildren == false) {
+                    if (bVFork == FALSE || pParent == NULL) {
+                        DebugActiveProcessStop(de.dwProcessId);
+                        RemoveProcess(pProcess);
+                        return(false);
                     }
+                    pProcess->bUnfollowed = true;
+                    return(false);
                 }
+            }
+#endif
 
-                // Remove thread from maps
-                pThis->m_Handle2Tid.erase(pThis->m_Tid2Handle[de.dwThreadId]);
-                pThis->m_Tid2Handle.erase(de.dwThreadId);
-                }
-                break;
-            case EXIT_PROCESS_DEBUG_EVENT: 
-                // A process exit
-                {
-                EXIT_PROCESS_DEBUG_INFO *pExitProcess = &de.u.ExitProcess;
-                InterlockedDecrement(&pThis->m_lProcessesCreated);
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnProcessExit(pExitProcess);
-                    }
-                }
+            if (bNew == true)
+                InterlockedIncrement(&m_lProcessesCreated);
 
-                // Remove thread from maps
-                pThis->m_Handle2Tid.erase(pThis->m_Tid2Handle[de.dwThreadId]);
-                pThis->m_Tid2Handle.erase(de.dwThreadId);
-                }
-                break;
-            case LOAD_DLL_DEBUG_EVENT: 
-                // A module was loaded
-                {
-                LOAD_DLL_DEBUG_INFO *pLoadDll = &de.u.LoadDll;
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnModuleLoaded(pLoadDll);
-                    }
-                }
-                }
-                break;
-            case UNLOAD_DLL_DEBUG_EVENT: 
-                // A module was unloaded
-                {
-                UNLOAD_DLL_DEBUG_INFO *pUnloadDll = &de.u.UnloadDll;
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnModuleUnloaded(pUnloadDll);
-                    }
-                }
-                }
-                break;
-            case OUTPUT_DEBUG_STRING_EVENT: 
-                // A debug string was received
-                {
-                OUTPUT_DEBUG_STRING_INFO *pDebugString = &de.u.DebugString;
-                for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-                    IDebuggerClient *pClient = *i;
-                    if (pClient) {
-                        pClient->OnDebugString(pDebugString);
-                    }
+            dwEvent = IDebuggerClient::cEventProcessCreated;
+            }
+            break;
+        case CREATE_THREAD_DEBUG_EVENT: 
+            // A thread was created
+            {
+            CREATE_THREAD_DEBUG_INFO *pCreateThread = &de.u.CreateThread;
+
+            if (m_bFirstThread && pProcess == m_pMain) {
+                if (m_bActiveDebug == true) {
+                    // Set as main thread
+                    m_pi.hThread = pCreateThread->hThread;
+                    m_pi.dwThreadId = de.dwThreadId;
                 }
+                m_bFirstThread = false;
+            }
+
+            // Add to the thread table
+            if (pCreateThread->hThread) {
+                CThreadTable::Thread *pThread = m_Threads.Insert(de.dwThreadId, pCreateThread->hThread);
+
+                // New threads get the debug registers too
+                if (pThread) {
+                    pThread->dwPid = de.dwProcessId;
+                    if (DebugRegistersInUse())
+                        SetDebugRegisters(pThread);
                 }
-                break;
-            default:
-                break;
-        }
+            }
 
-        // Continue debugging
-        if (ContinueDebugEvent(de.dwProcessId, de.dwThreadId, dwContinueStatus) == 0)
+            dwEvent = IDebuggerClient::cEventThreadCreated;
+            }
+            break;
+        case EXIT_THREAD_DEBUG_EVENT: 
+            // A thread exit, it leaves the table once the clients are told
+            m_hEventThread = GetThreadHandle(de.dwThreadId);
+            dwEvent = IDebuggerClient::cEventThreadExit;
+            break;
+        case EXIT_PROCESS_DEBUG_EVENT: 
+            // A process exit
+            if (m_pProcess->bUnfollowed == true)
+                break;
+            InterlockedDecrement(&m_lProcessesCreated);
+            dwEvent = IDebuggerClient::cEventProcessExit;
+            break;
+        case LOAD_DLL_DEBUG_EVENT: 
+            // A module was loaded
+            dwEvent = IDebuggerClient::cEventModuleLoaded;
+            break;
+        case UNLOAD_DLL_DEBUG_EVENT: 
+            // A module was unloaded
+            dwEvent = IDebuggerClient::cEventModuleUnloaded;
+            break;
+        case OUTPUT_DEBUG_STRING_EVENT: 
+            // A debug string was received
+            dwEvent = IDebuggerClient::cEventDebugString;
+            break;
+        default:
             break;
     }
 
-    // Clear process loaded flag
-    pThis->m_bProcessLoaded = false;
-
-    // Null thread/process handle
-    pThis->m_pi.hProcess = NULL;
-    pThis->m_pi.hThread = NULL;
+    // Nothing of a child that isn't followed reaches the clients
+    if (m_pProcess->bUnfollowed == true) {
+        if (dwEvent == IDebuggerClient::cEventException)
+            m_dwContinueStatus = DBG_EXCEPTION_NOT_HANDLED;
+        return(false);
+    }
 
-    // Clear maps
-    pThis->m_Tid2Handle.clear();
-    pThis->m_Handle2Tid.clear();
+    if (dwEvent != 0 && HasClientWork(dwEvent) == true)
+        return(true);
 
-    // Set stopped event
-    SetEvent(pThis->m_hEvents[cDebugStoppedEvent]);
+    // Nobody to call. The debugged thread is still recorded, exceptions do it
+    // once they would reach the clients.
+    if (de.dwDebugEventCode != EXCEPTION_DEBUG_EVENT || dwEvent != 0)
+        SetDebuggedThread(de.dwProcessId, de.dwThreadId);
 
-    // Call client's finish notifciation method
-    for (CDebugger::ClientVector::iterator i = pThis->m_vClients.begin(); i != pThis->m_vClients.end(); ++i) {
-        IDebuggerClient *pClient = *i;
-        if (pClient) {
-            pClient->OnFinishedDebugging();
-        }
-    }
-}
+    // With no subscriber the exception goes back to the debuggee unhandled
+    if (dwEvent == IDebuggerClient::cEventException)
+        m_dwContinueStatus = DBG_EXCEPTION_NOT_HANDLED;
 
-void CDebugger::CloseProcessHandles(void)
-{
-    // Close thread/process handles
-    if (m_pi.hThread)
-        CloseHandle(m_pi.hThread);
-    if (m_pi.hProcess)
-        CloseHandle(m_pi.hProcess);
-    
-    m_pi.hThread = m_pi.hProcess = NULL;
+    return(false);
 }
 
-BOOL CDebugger::ReadProcessMemory(LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead)
+bool CDebugger::HasClientWork(DWORD dwEvent) const
 {
-    return(::ReadProcessMemory(m_pi.hProcess, lpBaseAddress, lpBuffer, nSize, lpNumberOfBytesRead));
-}
+    if (GetSubscribers(dwEvent).empty() == false)
+        return(true);
+    if (dwEvent == IDebuggerClient::cEventBreakPoint && GetSubscribers(IDebuggerClient::cEventOwnBreakPoints).empty() == false)
+        return(true);
 
-BOOL CDebugger::WriteProcessMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten)
-{
-    return(::WriteProcessMemory(m_pi.hProcess, lpBaseAddress, lpBuffer, nSize, lpNumberOfBytesWritten));
+    // The clients told of the debugged thread, if it changes
+    if (m_Event.dwProcessId == m_dwDebuggedPid && m_Event.dwThreadId == m_dwDebuggedTid)
+        return(false);
+    return(GetSubscribers(IDebuggerClient::cEventDebuggedThread).empty() == false);
 }
 
-int CDebugger::GetCStringFromProcess(LPCVOID lpBaseAddress, LPSTR lpString, SIZE_T nMaxString, BOOL bUnicode)
+void CDebugger::CallClients(void)
 {
-    SIZE_T nCur = 0;
-    int nCharSize = (bUnicode == TRUE) ? sizeof(wchar_t) : sizeof(char);
-
-    if (nMaxString) {
-        lpString[nMaxString - 1] = '\0';
-        if (bUnicode)
-            lpString[nMaxString - 2] = '\0';
-    }
-
-    while (nCur < (nMaxString - 1)) {
-        DWORD dw = 0;
-        ReadProcessMemory(lpBaseAddress, &lpString[nCur * nCharSize], nCharSize, &dw);
-        if (dw == 0) break;
-        if (memcmp(&lpString[nCur * nCharSize], "\0\0", nCharSize) == 0) break;
-        nCur++;
-        lpBaseAddress = reinterpret_cast<LPCSTR>(lpBaseAddress) + nCharSize;
-    }
-
-    return(static_cast<int>(nCur));
-}
-
-DWORD CDebugger::GetThreadId(HANDLE hThread) const
+    DEBUG_EVENT & de = m_Event;
+
+    SetDebuggedThread(de.dwProcessId, de.dwThreadId);
+
+    switch (de.dwDebugEventCode) {
+        case EXCEPTION_DEBUG_EVENT:
+            if (m_Triggered.empty() == false) {
+                NotifyBreakPoints();
+            } else {
+                bool bRet = false;
+                const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventException);
+                for (size_t i = 0; i < Clients.size(); i++)
+                    bRet |= Clients[i]->OnException(&de.u.Exception);
+
+                if (bRet == false)
+                    m_dwContinueStatus = DBG_EXCEPTION_NOT_HANDLED;
+            }
+            break;
+        case CREATE_PROCESS_DEBUG_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventProcessCreated);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnProcessCreated(&de.u.CreateProcessInfo);
+            }
+            break;
+        case CREATE_THREAD_DEBUG_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventThreadCreated);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnThreadCreated(&de.u.CreateThread);
+            }
+            break;
+        case EXIT_THREAD_DEBUG_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventThreadExit);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnThreadExit(&de.u.ExitThread);
+            }
+            break;
+        case EXIT_PROCESS_DEBUG_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventProcessExit);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnProcessExit(&de.u.ExitProcess);
+            }
+            break;
+        case LOAD_DLL_DEBUG_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventModuleLoaded);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnModuleLoaded(&de.u.LoadDll);
+            }
+            break;
+        case UNLOAD_DLL_DEBUG_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventModuleUnloaded);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnModuleUnloaded(&de.u.UnloadDll);
+            }
+            break;
+        case OUTPUT_DEBUG_STRING_EVENT:
+            {
+            const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventDebugString);
+            for (size_t i = 0; i < Clients.size(); i++)
+                Clients[i]->OnDebugString(&de.u.DebugString);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool CDebugger::EndEvent(void)
+{
+    DEBUG_EVENT & de = m_Event;
+    Process *pProcess = m_pProcess;
+
+    switch (de.dwDebugEventCode) {
+        case EXCEPTION_DEBUG_EVENT:
+            // A breakpoint left enabled keeps its INT3, the thread steps past it out of line
+            if (m_Triggered.empty() == false && de.u.Exception.ExceptionRecord.ExceptionCode == EXCEPTION_BREAKPOINT)
+                StepOverSite(m_hEventThread);
+            break;
+        case CREATE_PROCESS_DEBUG_EVENT:
+            if (de.u.CreateProcessInfo.hFile)
+                CloseHandle(de.u.CreateProcessInfo.hFile);
+            break;
+        case EXIT_THREAD_DEBUG_EVENT:
+            {
+            // Drop its step, a lifted INT3 goes back
+            pProcess->Stepper.Cancel(*this, m_hEventThread);
+            CThreadTable::Thread *pThread = m_Threads.Find(de.dwThreadId);
+            if (pThread && pThread->bLifted == true) {
+                if (pProcess->Sites.Find(pThread->ulpLifted, 0) == true)
+                    WriteSiteByte(pThread->ulpLifted, CBreakPointSites::cInt3);
+                pProcess->nLifted--;
+            }
+
+            // Remove from the thread table
+            m_Threads.Remove(de.dwThreadId);
+            }
+            break;
+        case EXIT_PROCESS_DEBUG_EVENT:
+            {
+            // Remove from the thread table
+            m_Threads.Remove(de.dwThreadId);
+
+            // A child goes with its tables, the first process stays until debugging ends
+            pProcess = FindProcess(de.dwProcessId);
+            if (pProcess && pProcess != m_pMain)
+                RemoveProcess(pProcess);
+            }
+            break;
+        default:
+            break;
+    }
+
+    m_BreakPoints.EndDefer();
+
+    // Write back the thread contexts changed during this stop
+    m_Contexts.Flush();
+    m_Contexts.Clear();
+    m_PageCache.Invalidate();
+    m_pProcess = m_pMain;
+    m_bInStop = false;
+
+    // Continue debugging
+    BOOL bContinued = ContinueDebugEvent(de.dwProcessId, de.dwThreadId, m_dwContinueStatus);
+
+    if (de.dwDebugEventCode == EXCEPTION_DEBUG_EVENT) {
+        m_nExceptionEvents++;
+        m_nEventAllocations += CAllocationCounter::GetCount() - m_nAllocationsBefore;
+    }
+
+    return(bContinued != FALSE);
+}
+
+void CDebugger::EndSession(void)
+{
+    // Clear process loaded flag
+    m_bProcessLoaded = false;
+
+    // The trampolines and INT3 sites went away with the processes
+    ClearProcesses();
+
+    // Null thread/process handle
+    m_pi.hProcess = NULL;
+    m_pi.hThread = NULL;
+
+    m_dwDebuggedPid = m_dwDebuggedTid = 0;
+
+    // Clear the thread table
+    m_Threads.Clear();
+
+    // Call client's finish notifciation method
+    const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventFinished);
+    for (size_t i = 0; i < Clients.size(); i++)
+        Clients[i]->OnFinishedDebugging();
+
+    // Set stopped event, the clients are done with the debugger
+    m_bRunning = false;
+    SetEvent(m_hEvents[cDebugStoppedEvent]);
+}
+
+void CDebugger::SetDebuggedThread(DWORD dwPid, DWORD dwTid)
+{
+    // Only when it changed since the clients were last told
+    if (dwPid == m_dwDebuggedPid && dwTid == m_dwDebuggedTid)
+        return;
+
+    m_dwDebuggedPid = dwPid;
+    m_dwDebuggedTid = dwTid;
+    const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventDebuggedThread);
+    for (size_t i = 0; i < Clients.size(); i++)
+        Clients[i]->SetDebuggedThread(dwPid, dwTid);
+}
+
+void CDebugger::NotifyBreakPoints(void)
+{
+    // Notify each client of the triggered breakpoints still in, a client may
+    // have removed some
+    const ClientList & Clients = GetSubscribers(IDebuggerClient::cEventBreakPoint);
+    for (size_t i = 0; i < Clients.size(); i++) {
+        for (size_t n = 0; n < m_Triggered.size(); n++) {
+            IBreakPoint *pBreakPoint = m_BreakPoints.Get(m_Triggered[n]);
+            if (pBreakPoint)
+                Clients[i]->OnBreakPoint(pBreakPoint);
+        }
+    }
+
+    // Then the owners that only take their own breakpoints
+    const ClientList & Owners = GetSubscribers(IDebuggerClient::cEventOwnBreakPoints);
+    if (Owners.empty() == true)
+        return;
+    for (size_t n = 0; n < m_Triggered.size(); n++) {
+        IBreakPoint *pBreakPoint = m_BreakPoints.Get(m_Triggered[n]);
+        IDebuggerClient *pOwner = m_BreakPoints.GetOwner(m_Triggered[n]);
+        if (pBreakPoint && pOwner && find(Owners.begin(), Owners.end(), pOwner) != Owners.end())
+            pOwner->OnBreakPoint(pBreakPoint);
+    }
+}
+
+void CDebugger::CloseProcessHandles(void)
+{
+    // Close thread/process handles
+    if (m_pi.hThread)
+        CloseHandle(m_pi.hThread);
+    if (m_pi.hProcess)
+        CloseHandle(m_pi.hProcess);
+    
+    m_pi.hThread = m_pi.hProcess = NULL;
+}
+
+CDebugger::Process *CDebugger::AddProcess(DWORD dwPid, HANDLE hProcess)
+{
+    Process *pProcess = new Process;
+    pProcess->dwPid = dwPid;
+    pProcess->hProcess = hProcess;
+    pProcess->bCreated = false;
+    pProcess->bForked = false;
+    pProcess->bUnfollowed = false;
+    pProcess->nLifted = 0;
+    m_Processes.push_back(pProcess);
+    return(pProcess);
+}
+
+CDebugger::Process *CDebugger::FindProcess(DWORD dwPid)
+{
+    // Most events come from the process of the last one
+    if (m_pProcess->dwPid == dwPid && m_pProcess != &m_NoProcess)
+        return(m_pProcess);
+
+    for (size_t n = 0; n < m_Processes.size(); n++) {
+        if (m_Processes[n]->dwPid == dwPid)
+            return(m_Processes[n]);
+    }
+    return(NULL);
+}
+
+CDebugger::Process *CDebugger::FindProcess(HANDLE hProcess)
+{
+    for (size_t n = 0; n < m_Processes.size(); n++) {
+        if (m_Processes[n]->hProcess == hProcess)
+            return(m_Processes[n]);
+    }
+    return(NULL);
+}
+
+void CDebugger::RemoveProcess(Process *pProcess)
+{
+    // Threads may have gone with it without an event
+    RemoveThreads(pProcess->dwPid);
+
+    m_nTrampolineAllocations += pProcess->Trampolines.GetAllocations();
+    m_nTrampolineReuses += pProcess->Trampolines.GetReuses();
+    m_nTrampolineSyscallsSaved += pProcess->Trampolines.GetSyscallsSaved();
+    m_nDisplacedSteps += pProcess->Stepper.GetSteps();
+
+    m_Processes.erase(find(m_Processes.begin(), m_Processes.end(), pProcess));
+    if (m_pMain == pProcess)
+        m_pMain = NULL;
+    if (m_pProcess == pProcess)
+        SelectProcess(m_pMain ? m_pMain : &m_NoProcess);
+    delete pProcess;
+}
+
+void CDebugger::ClearProcesses(void)
+{
+    while (m_Processes.empty() == false)
+        RemoveProcess(m_Processes.back());
+}
+
+void CDebugger::ResetProcess(Process *pProcess)
+{
+    // Its other threads are gone, and the INT3s, trampolines and the
+    // breakpoints they were for with the old image
+    RemoveThreads(pProcess->dwPid);
+    pProcess->Sites.Clear();
+    pProcess->Trampolines.Reset();
+    pProcess->Stepper.Clear();
+    pProcess->nLifted = 0;
+    pProcess->BreakPoints.clear();
+    pProcess->bForked = false;
+}
+
+void CDebugger::RemoveThreads(DWORD dwPid)
+{
+    // Removing doesn't move the other threads
+    for (SIZE_T n = 0; n < m_Threads.GetSlots(); n++) {
+        CThreadTable::Thread *pThread = m_Threads.GetAt(n);
+        if (pThread && pThread->dwPid == dwPid)
+            m_Threads.Remove(pThread->dwTid);
+    }
+}
+
+void CDebugger::InheritProcess(Process *pChild, Process *pParent, bool bSharedMemory)
+{
+    // The child's memory holds the parent's INT3s, the sites come with their
+    // original bytes so nothing is read back
+    pChild->Sites = pParent->Sites;
+
+    if (m_bFollowChildren == true && m_bInheritBreakPoints == true) {
+        pChild->BreakPoints = pParent->BreakPoints;
+        pChild->bForked = pParent->bForked = true;
+
+        // INT3s the parent's threads had lifted for a step
+        if (bSharedMemory == false) {
+            for (SIZE_T n = 0; n < m_Threads.GetSlots(); n++) {
+                CThreadTable::Thread *pThread = m_Threads.GetAt(n);
+                if (pThread && pThread->dwPid == pParent->dwPid && pThread->bLifted == true && pChild->Sites.Find(pThread->ulpLifted, 0) == true)
+                    WriteSiteByte(pThread->ulpLifted, CBreakPointSites::cInt3);
+            }
+        }
+        return;
+    }
+
+    // After vfork the memory is the parent's, the child steps over the INT3s it hits
+    if (bSharedMemory == true) {
+        pChild->bForked = true;
+        return;
+    }
+
+    // Otherwise the original bytes go back in one batch
+    vector<ULONG_PTR> Addresses;
+    vector<BYTE> Originals;
+    pChild->Sites.GetLive(Addresses, Originals);
+    pChild->Sites.Clear();
+    if (Addresses.empty() == true)
+        return;
+
+    vector<MemoryRequest> Requests(Addresses.size());
+    for (size_t n = 0; n < Addresses.size(); n++) {
+        Requests[n].lpAddress = reinterpret_cast<LPVOID>(Addresses[n]);
+        Requests[n].lpBuffer = &Originals[n];
+        Requests[n].nSize = 1;
+        Requests[n].nTransferred = 0;
+    }
+    TransferBatch(&Requests[0], Requests.size(), true);
+}
+
+CDebugger::Process *CDebugger::SelectProcess(Process *pProcess)
+{
+    // The cached pages are the current process'
+    Process *pPrevious = m_pProcess;
+    if (pProcess != m_pProcess) {
+        m_PageCache.Invalidate();
+        m_pProcess = pProcess;
+    }
+    return(pPrevious);
+}
+
+CDebugger::Process *CDebugger::SelectProcess(IBreakPoint *pBreakPoint)
+{
+    // The process the breakpoint was initialized for, if it is still there
+    Process *pProcess = FindProcess(pBreakPoint->GetProcess());
+    if (pProcess == NULL)
+        return(m_pProcess);
+    return(SelectProcess(pProcess));
+}
+
+bool CDebugger::HasBreakPoint(const Process *pProcess, BreakPointId id)
+{
+    SIZE_T nSlot = (id & CBreakPointRegistry::cMaxSlots) - 1;
+    return(nSlot < pProcess->BreakPoints.size() && pProcess->BreakPoints[nSlot] == id);
+}
+
+void CDebugger::SetBreakPoint(Process *pProcess, BreakPointId id, bool bIn)
+{
+    SIZE_T nSlot = (id & CBreakPointRegistry::cMaxSlots) - 1;
+    if (bIn == true) {
+        if (nSlot >= pProcess->BreakPoints.size())
+            pProcess->BreakPoints.resize(nSlot + 1, 0);
+        pProcess->BreakPoints[nSlot] = id;
+    } else if (HasBreakPoint(pProcess, id) == true) {
+        pProcess->BreakPoints[nSlot] = 0;
+    }
+}
+
+BOOL CDebugger::ReadProcessMemory(LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead)
+{
+    // The site table and the page cache are the debugger thread's
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandReadMemory);
+        cmd.lpAddress = const_cast<LPVOID>(lpBaseAddress);
+        cmd.lpBuffer = lpBuffer;
+        cmd.nSize = nSize;
+        cmd.pnDone = lpNumberOfBytesRead;
+        Execute(&cmd);
+        return(cmd.fResult);
+    }
+
+    SIZE_T nRead = 0;
+    BOOL bRet = FALSE;
+
+    // The debuggee's memory can't change while it is stopped
+    if (m_bPageCache == true && m_bInStop == true)
+        bRet = m_PageCache.Read(m_pProcess->hProcess, lpBaseAddress, lpBuffer, nSize, &nRead);
+    else
+        bRet = ::ReadProcessMemory(m_pProcess->hProcess, lpBaseAddress, lpBuffer, nSize, &nRead);
+
+    // Show the bytes under the INT3s
+    m_pProcess->Sites.Shadow(reinterpret_cast<ULONG_PTR>(lpBaseAddress), reinterpret_cast<LPBYTE>(lpBuffer), nRead);
+
+    if (lpNumberOfBytesRead)
+        *lpNumberOfBytesRead = nRead;
+
+    return(bRet);
+}
+
+BOOL CDebugger::WriteProcessMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandWriteMemory);
+        cmd.lpAddress = lpBaseAddress;
+        cmd.lpcBuffer = lpBuffer;
+        cmd.nSize = nSize;
+        cmd.pnDone = lpNumberOfBytesWritten;
+        Execute(&cmd);
+        return(cmd.fResult);
+    }
+
+    // Writes over a site change the byte under its INT3
+    if (m_pProcess->Sites.Intersects(reinterpret_cast<ULONG_PTR>(lpBaseAddress), nSize) == true) {
+        m_WriteBuffer.assign(reinterpret_cast<const BYTE *>(lpBuffer), reinterpret_cast<const BYTE *>(lpBuffer) + nSize);
+        m_pProcess->Sites.Unshadow(reinterpret_cast<ULONG_PTR>(lpBaseAddress), &m_WriteBuffer[0], nSize);
+        return(WriteMemory(lpBaseAddress, &m_WriteBuffer[0], nSize, lpNumberOfBytesWritten));
+    }
+
+    return(WriteMemory(lpBaseAddress, lpBuffer, nSize, lpNumberOfBytesWritten));
+}
+
+BOOL CDebugger::WriteMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten)
+{
+    SIZE_T nWritten = 0;
+    BOOL bRet = ::WriteProcessMemory(m_pProcess->hProcess, lpBaseAddress, lpBuffer, nSize, &nWritten);
+
+    // Keep the cached pages coherent
+    if (m_bPageCache == true && nWritten)
+        m_PageCache.Write(lpBaseAddress, lpBuffer, nWritten);
+
+    if (lpNumberOfBytesWritten)
+        *lpNumberOfBytesWritten = nWritten;
+
+    return(bRet);
+}
+
+bool CDebugger::ReadProcessMemory(MemoryRequest *pRequests, SIZE_T nRequests)
+{
+    // Like a single read, the sites and the cached pages are the debugger thread's
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandReadMemoryBatch);
+        cmd.pRequests = pRequests;
+        cmd.nSize = nRequests;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    if (m_bPageCache == true && m_bInStop == true) {
+        bool bRet = true;
+        for (SIZE_T i = 0; i < nRequests; i++) {
+            pRequests[i].nTransferred = 0;
+            if (pRequests[i].nSize == 0)
+                continue;
+            if (ReadProcessMemory(pRequests[i].lpAddress, pRequests[i].lpBuffer, pRequests[i].nSize, &pRequests[i].nTransferred) == FALSE)
+                bRet = false;
+        }
+        return(bRet);
+    }
+
+    bool bRet = TransferBatch(pRequests, nRequests, false);
+
+    // Show the bytes under the INT3s
+    if (m_pProcess->Sites.IsEmpty() == false) {
+        for (SIZE_T i = 0; i < nRequests; i++)
+            m_pProcess->Sites.Shadow(reinterpret_cast<ULONG_PTR>(pRequests[i].lpAddress), reinterpret_cast<LPBYTE>(pRequests[i].lpBuffer), pRequests[i].nTransferred);
+    }
+
+    return(bRet);
+}
+
+bool CDebugger::WriteProcessMemory(MemoryRequest *pRequests, SIZE_T nRequests)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandWriteMemoryBatch);
+        cmd.pRequests = pRequests;
+        cmd.nSize = nRequests;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    // Requests over a site write copies with the INT3s kept
+    vector<vector<BYTE> > Copies;
+    vector<LPVOID> Buffers;
+    if (m_pProcess->Sites.IsEmpty() == false) {
+        for (SIZE_T i = 0; i < nRequests; i++) {
+            if (m_pProcess->Sites.Intersects(reinterpret_cast<ULONG_PTR>(pRequests[i].lpAddress), pRequests[i].nSize) == false)
+                continue;
+            if (Buffers.empty() == true) {
+                Buffers.resize(nRequests);
+                Copies.resize(nRequests);
+            }
+            LPBYTE lpBuffer = reinterpret_cast<LPBYTE>(pRequests[i].lpBuffer);
+            Copies[i].assign(lpBuffer, lpBuffer + pRequests[i].nSize);
+            m_pProcess->Sites.Unshadow(reinterpret_cast<ULONG_PTR>(pRequests[i].lpAddress), &Copies[i][0], pRequests[i].nSize);
+            Buffers[i] = pRequests[i].lpBuffer;
+            pRequests[i].lpBuffer = &Copies[i][0];
+        }
+    }
+
+    bool bRet = TransferBatch(pRequests, nRequests, true);
+
+    // Keep the cached pages coherent
+    if (m_bPageCache == true) {
+        for (SIZE_T i = 0; i < nRequests; i++)
+            m_PageCache.Write(pRequests[i].lpAddress, pRequests[i].lpBuffer, pRequests[i].nTransferred);
+    }
+
+    for (SIZE_T i = 0; i < Buffers.size(); i++) {
+        if (Buffers[i])
+            pRequests[i].lpBuffer = Buffers[i];
+    }
+
+    return(bRet);
+}
+
+#ifdef _WIN32
+
+bool CDebugger::TransferBatch(MemoryRequest *pRequests, SIZE_T nRequests, bool bWrite)
+{
+    bool bRet = true;
+
+    SIZE_T i = 0;
+    while (i < nRequests) {
+        // Requests that are contiguous both here and in the debuggee go in one call
+        SIZE_T nSize = pRequests[i].nSize;
+        SIZE_T j = i + 1;
+        for (; j < nRequests; j++) {
+            if (reinterpret_cast<LPBYTE>(pRequests[j].lpAddress) != reinterpret_cast<LPBYTE>(pRequests[i].lpAddress) + nSize ||
+                reinterpret_cast<LPBYTE>(pRequests[j].lpBuffer) != reinterpret_cast<LPBYTE>(pRequests[i].lpBuffer) + nSize)
+                break;
+            nSize += pRequests[j].nSize;
+        }
+
+        SIZE_T nDone = 0;
+        if (nSize) {
+            if (bWrite)
+                ::WriteProcessMemory(m_pProcess->hProcess, pRequests[i].lpAddress, pRequests[i].lpBuffer, nSize, &nDone);
+            else
+                ::ReadProcessMemory(m_pProcess->hProcess, pRequests[i].lpAddress, pRequests[i].lpBuffer, nSize, &nDone);
+        }
+
+        if (nDone == nSize) {
+            for (SIZE_T n = i; n < j; n++)
+                pRequests[n].nTransferred = pRequests[n].nSize;
+        } else {
+            // Part of the run failed, find out which requests did
+            for (SIZE_T n = i; n < j; n++) {
+                pRequests[n].nTransferred = 0;
+                if (pRequests[n].nSize == 0)
+                    continue;
+                if (bWrite)
+                    ::WriteProcessMemory(m_pProcess->hProcess, pRequests[n].lpAddress, pRequests[n].lpBuffer, pRequests[n].nSize, &pRequests[n].nTransferred);
+                else
+                    ::ReadProcessMemory(m_pProcess->hProcess, pRequests[n].lpAddress, pRequests[n].lpBuffer, pRequests[n].nSize, &pRequests[n].nTransferred);
+                if (pRequests[n].nTransferred != pRequests[n].nSize)
+                    bRet = false;
+            }
+        }
+
+        i = j;
+    }
+
+    return(bRet);
+}
+
+#else
+
+bool CDebugger::TransferBatch(MemoryRequest *pRequests, SIZE_T nRequests, bool bWrite)
+{
+    static const SIZE_T cMaxTransfers = 64;
+    MEMORY_TRANSFER Transfers[cMaxTransfers];
+    bool bRet = true;
+
+    // The shim moves each group with scatter/gather calls
+    for (SIZE_T i = 0; i < nRequests; i += cMaxTransfers) {
+        SIZE_T nCount = nRequests - i;
+        if (nCount > cMaxTransfers)
+            nCount = cMaxTransfers;
+
+        for (SIZE_T n = 0; n < nCount; n++) {
+            Transfers[n].lpRemote = pRequests[i + n].lpAddress;
+            Transfers[n].lpLocal = pRequests[i + n].lpBuffer;
+            Transfers[n].nSize = pRequests[i + n].nSize;
+        }
+
+        BOOL bDone = bWrite ? WriteProcessMemoryBatch(m_pProcess->hProcess, Transfers, nCount) : ReadProcessMemoryBatch(m_pProcess->hProcess, Transfers, nCount);
+        if (bDone == FALSE)
+            bRet = false;
+
+        for (SIZE_T n = 0; n < nCount; n++)
+            pRequests[i + n].nTransferred = Transfers[n].nTransferred;
+    }
+
+    return(bRet);
+}
+
+#endif
+
+// Returns the index of the first NUL character in pBuffer, or nChars if there is none
+static SIZE_T FindTerminator(const BYTE *pBuffer, SIZE_T nChars, int nCharSize)
+{
+    SIZE_T n = 0;
+
+#ifdef SDE_USE_SSE2
+    // 16 bytes at a time, the movemask has a bit set for each zero byte
+    const __m128i Zero = _mm_setzero_si128();
+    SIZE_T nCharsPerBlock = 16 / nCharSize;
+    for (; n + nCharsPerBlock <= nChars; n += nCharsPerBlock) {
+        __m128i Block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pBuffer + n * nCharSize));
+        int nMask = (nCharSize == 1) ? _mm_movemask_epi8(_mm_cmpeq_epi8(Block, Zero)) : _mm_movemask_epi8(_mm_cmpeq_epi16(Block, Zero));
+        if (nMask) {
+            int nBit = 0;
+            while ((nMask & (1 << nBit)) == 0)
+                nBit++;
+            return(n + nBit / nCharSize);
+        }
+    }
+#endif
+
+    if (nCharSize == 1) {
+        const void *p = memchr(pBuffer + n, 0, nChars - n);
+        return(p ? static_cast<const BYTE *>(p) - pBuffer : nChars);
+    }
+
+    for (; n < nChars; n++) {
+        if (pBuffer[n * 2] == 0 && pBuffer[n * 2 + 1] == 0)
+            break;
+    }
+    return(n);
+}
+
+SIZE_T CDebugger::ReadStringChunks(LPCVOID lpBaseAddress, LPBYTE lpBuffer, SIZE_T nMaxChars, int nCharSize, bool *pbTruncated, bool *pbFailed)
+{
+    ULONG_PTR ulpBase = reinterpret_cast<ULONG_PTR>(lpBaseAddress);
+    SIZE_T nMaxBytes = nMaxChars * nCharSize;
+    SIZE_T nBytes = 0;
+    SIZE_T nScanned = 0;
+
+    *pbTruncated = false;
+    *pbFailed = false;
+
+    // Read up to the end of each page, so an unreadable page only ends the string
+    while (nBytes < nMaxBytes) {
+        ULONG_PTR ulpAddress = ulpBase + nBytes;
+        SIZE_T nChunk = cPageSize - (ulpAddress & (cPageSize - 1));
+        if (nChunk > nMaxBytes - nBytes)
+            nChunk = nMaxBytes - nBytes;
+
+        SIZE_T nRead = 0;
+        ReadProcessMemory(reinterpret_cast<LPCVOID>(ulpAddress), lpBuffer + nBytes, nChunk, &nRead);
+        if (nRead == 0) {
+            *pbFailed = true;
+            return(nScanned);
+        }
+        nBytes += nRead;
+
+        // A wide character split between pages is scanned with the next chunk
+        SIZE_T nChars = nBytes / nCharSize;
+        SIZE_T n = FindTerminator(lpBuffer + nScanned * nCharSize, nChars - nScanned, nCharSize);
+        if (n < nChars - nScanned)
+            return(nScanned + n);
+        nScanned = nChars;
+    }
+
+    *pbTruncated = true;
+    return(nScanned);
+}
+
+int CDebugger::GetCStringFromProcess(LPCVOID lpBaseAddress, LPSTR lpString, SIZE_T nMaxString, BOOL bUnicode)
+{
+    int nCharSize = (bUnicode == TRUE) ? sizeof(WCHAR) : sizeof(char);
+
+    if (nMaxString == 0)
+        return(0);
+
+    bool bTruncated = false;
+    bool bFailed = false;
+    SIZE_T nCur = ReadStringChunks(lpBaseAddress, reinterpret_cast<LPBYTE>(lpString), nMaxString - 1, nCharSize, &bTruncated, &bFailed);
+
+    // Terminate the string
+    memset(&lpString[nCur * nCharSize], 0, nCharSize);
+
+    return(static_cast<int>(nCur));
+}
+
+bool CDebugger::GetCStringFromProcess(LPCVOID lpBaseAddress, std::string & String, SIZE_T nMaxString)
+{
+    String.clear();
+
+    // Grow the buffer until the terminator shows up
+    SIZE_T nCur = 0;
+    SIZE_T nSize = 256;
+    bool bTruncated = true;
+    bool bFailed = false;
+    while (bTruncated == true && nCur < nMaxString) {
+        if (nSize > nMaxString)
+            nSize = nMaxString;
+        String.resize(nSize);
+        nCur += ReadStringChunks(reinterpret_cast<LPCSTR>(lpBaseAddress) + nCur, reinterpret_cast<LPBYTE>(&String[nCur]), nSize - nCur, sizeof(char), &bTruncated, &bFailed);
+        nSize *= 2;
+    }
+    String.resize(nCur);
+
+    // An empty string is still a string, only an unreadable start fails
+    return(nCur != 0 || bFailed == false);
+}
+
+bool CDebugger::GetCStringFromProcess(LPCVOID lpBaseAddress, WString & String, SIZE_T nMaxString)
+{
+    String.clear();
+
+    // Grow the buffer until the terminator shows up
+    SIZE_T nCur = 0;
+    SIZE_T nSize = 256;
+    bool bTruncated = true;
+    bool bFailed = false;
+    while (bTruncated == true && nCur < nMaxString) {
+        if (nSize > nMaxString)
+            nSize = nMaxString;
+        String.resize(nSize);
+        nCur += ReadStringChunks(reinterpret_cast<const WCHAR *>(lpBaseAddress) + nCur, reinterpret_cast<LPBYTE>(&String[nCur]), nSize - nCur, sizeof(WCHAR), &bTruncated, &bFailed);
+        nSize *= 2;
+    }
+    String.resize(nCur);
+
+    // An empty string is still a string, only an unreadable start fails
+    return(nCur != 0 || bFailed == false);
+}
+
+DWORD CDebugger::GetThreadId(HANDLE hThread) const
 {
-    Handle2Tid::const_iterator i = m_Handle2Tid.find(hThread);
-    if (i == m_Handle2Tid.end()) return(0);
-    return(i->second);
+    // The debugger thread writes the table, it reads it without the guard
+    if (IsOtherThread() == false) {
+        const CThreadTable::Thread *pThread = m_Threads.FindByHandle(hThread);
+        if (pThread == NULL)
+            return(0);
+        return(pThread->dwTid);
+    }
+    return(m_Threads.GetTid(hThread));
 }
 
 HANDLE CDebugger::GetThreadHandle(DWORD dwTid) const
 {
-    Tid2Handle::const_iterator i = m_Tid2Handle.find(dwTid);
-    if (i == m_Tid2Handle.end()) return(NULL);
-    return(i->second);
+    if (IsOtherThread() == false) {
+        const CThreadTable::Thread *pThread = m_Threads.Find(dwTid);
+        if (pThread == NULL)
+            return(NULL);
+        return(pThread->hThread);
+    }
+    return(m_Threads.GetHandle(dwTid));
 }
 
 void CDebugger::SetMultithread(bool bMultithread)
@@ -526,6 +1668,614 @@ void CDebugger::SetMultithread(bool bMultithread)
     m_bMultithread = bMultithread;
 }
 
+bool CDebugger::SetReactor(CDebuggerReactor *pReactor)
+{
+    // Only before the debugger thread is taken
+    if (m_dwThreadId != 0)
+        return(false);
+
+    m_pReactor = pReactor;
+    return(true);
+}
+
+void CDebugger::SetFollowChildren(bool bFollowChildren)
+{
+    m_bFollowChildren = bFollowChildren;
+}
+
+void CDebugger::SetInheritBreakPoints(bool bInheritBreakPoints)
+{
+    m_bInheritBreakPoints = bInheritBreakPoints;
+}
+
+SIZE_T CDebugger::GetNumProcesses(void) const
+{
+    return(m_lProcessesCreated);
+}
+
+void CDebugger::SetPageCache(bool bPageCache)
+{
+    m_bPageCache = bPageCache;
+    m_PageCache.Invalidate();
+}
+
+SIZE_T CDebugger::GetPageCacheHits(void) const
+{
+    return(m_PageCache.GetHits());
+}
+
+SIZE_T CDebugger::GetPageCacheMisses(void) const
+{
+    return(m_PageCache.GetMisses());
+}
+
+LPVOID CDebugger::AllocateTrampoline(SIZE_T nSize)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandAllocateTrampoline);
+        cmd.nSize = nSize;
+        Execute(&cmd);
+        return(cmd.lpResult);
+    }
+
+    if (m_pProcess->hProcess == NULL)
+        return(0);
+
+    return(m_pProcess->Trampolines.Allocate(m_pProcess->hProcess, nSize));
+}
+
+void CDebugger::FreeTrampoline(LPVOID lpTrampoline)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandFreeTrampoline);
+        cmd.lpAddress = lpTrampoline;
+        Execute(&cmd);
+        return;
+    }
+
+    m_pProcess->Trampolines.Free(lpTrampoline);
+}
+
+CMemoryRangeIndex & CDebugger::GetMemoryRangeIndex(void)
+{
+    return(m_RangeIndex);
+}
+
+SIZE_T CDebugger::GetTrampolineAllocations(void) const
+{
+    SIZE_T nAllocations = m_nTrampolineAllocations;
+    for (size_t n = 0; n < m_Processes.size(); n++)
+        nAllocations += m_Processes[n]->Trampolines.GetAllocations();
+    return(nAllocations);
+}
+
+SIZE_T CDebugger::GetTrampolineReuses(void) const
+{
+    SIZE_T nReuses = m_nTrampolineReuses;
+    for (size_t n = 0; n < m_Processes.size(); n++)
+        nReuses += m_Processes[n]->Trampolines.GetReuses();
+    return(nReuses);
+}
+
+SIZE_T CDebugger::GetTrampolineSyscallsSaved(void) const
+{
+    SIZE_T nSaved = m_nTrampolineSyscallsSaved;
+    for (size_t n = 0; n < m_Processes.size(); n++)
+        nSaved += m_Processes[n]->Trampolines.GetSyscallsSaved();
+    return(nSaved);
+}
+
+bool CDebugger::InsertBreakPointSite(LPVOID lpAddress)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandInsertSite);
+        cmd.lpAddress = lpAddress;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(lpAddress);
+
+    // The first breakpoint at the address writes the INT3
+    BYTE byOriginal = 0;
+    if (m_pProcess->Sites.Find(ulpAddress, 0) == false) {
+        SIZE_T nNumRead = 0;
+        if (ReadProcessMemory(lpAddress, &byOriginal, 1, &nNumRead) == FALSE || nNumRead == 0)
+            return(false);
+        if (WriteSiteByte(ulpAddress, CBreakPointSites::cInt3) == false)
+            return(false);
+    }
+
+    m_pProcess->Sites.AddRef(ulpAddress, byOriginal);
+    return(true);
+}
+
+bool CDebugger::RemoveBreakPointSite(LPVOID lpAddress)
+{
+    if (IsOtherThread() == true) {
+        Command cmd(cCommandRemoveSite);
+        cmd.lpAddress = lpAddress;
+        Execute(&cmd);
+        return(cmd.bResult);
+    }
+
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(lpAddress);
+
+    // The last one puts the original byte back
+    BYTE byOriginal = 0;
+    LONG lRefs = m_pProcess->Sites.Release(ulpAddress, &byOriginal);
+    if (lRefs < 0)
+        return(false);
+
+    if (lRefs == 0)
+        return(WriteSiteByte(ulpAddress, byOriginal));
+
+    return(true);
+}
+
+bool CDebugger::WriteSiteByte(ULONG_PTR ulpAddress, BYTE byValue)
+{
+    LPVOID lpAddress = reinterpret_cast<LPVOID>(ulpAddress);
+    SIZE_T nWritten = 0;
+    WriteMemory(lpAddress, &byValue, 1, &nWritten);
+    FlushInstructionCache(m_pProcess->hProcess, lpAddress, nWritten);
+    return(nWritten == 1);
+}
+
+void CDebugger::StepOverSite(HANDLE hThread)
+{
+    // Still armed, and the thread wasn't moved away by a client?
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    GetThreadContext(hThread, &ctx);
+
+    ULONG_PTR ulpAddress = ctx.Eip;
+    BYTE byOriginal = 0;
+    if (m_pProcess->Sites.Find(ulpAddress, &byOriginal) == false)
+        return;
+
+    if (m_pProcess->Stepper.Begin(*this, hThread, reinterpret_cast<LPVOID>(ulpAddress)) == true)
+        return;
+
+    // It can't be run out of line, lift the INT3 for the step. Other threads
+    // can run through the site meanwhile.
+    CThreadTable::Thread *pThread = m_Threads.FindByHandle(hThread);
+    if (pThread == NULL || pThread->bLifted == true || WriteSiteByte(ulpAddress, byOriginal) == false)
+        return;
+
+    pThread->bLifted = true;
+    pThread->bLiftedTrapFlag = (ctx.EFlags & 0x100) ? true : false;
+    pThread->ulpLifted = ulpAddress;
+    m_pProcess->nLifted++;
+
+    ctx.EFlags |= 0x100;
+    SetThreadContext(hThread, &ctx);
+}
+
+bool CDebugger::RewindRemovedSite(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    if (pException->dwFirstChance == 0 || pException->ExceptionRecord.ExceptionCode != EXCEPTION_BREAKPOINT)
+        return(false);
+
+    // The other threads run while one is handled: a thread may report an INT3
+    // that was removed (or moved, by a stepping breakpoint) after it hit it
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(pException->ExceptionRecord.ExceptionAddress);
+    if (m_pProcess->Sites.Find(ulpAddress, 0) == true)
+        return(false);
+
+    BYTE byCode = 0;
+    SIZE_T nRead = 0;
+    if (ReadProcessMemory(reinterpret_cast<LPCVOID>(ulpAddress), &byCode, 1, &nRead) == FALSE || nRead != 1)
+        return(false);
+    if (byCode == CBreakPointSites::cInt3)
+        return(false);
+
+    // Run the original instruction again
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    GetThreadContext(hThread, &ctx);
+    if (ctx.Eip != ulpAddress + 1)
+        return(false);
+    ctx.Eip = ulpAddress;
+    SetThreadContext(hThread, &ctx);
+
+    return(true);
+}
+
+bool CDebugger::StepOverForeignSite(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    if (m_pProcess->bForked == false || pException->dwFirstChance == 0 || pException->ExceptionRecord.ExceptionCode != EXCEPTION_BREAKPOINT)
+        return(false);
+
+    // Processes related by a fork share INT3s: one may belong to a breakpoint
+    // of the other process, or to one disabled there
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(pException->ExceptionRecord.ExceptionAddress);
+    if (m_pProcess->Sites.Find(ulpAddress, 0) == false)
+        return(false);
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    GetThreadContext(hThread, &ctx);
+    if (ctx.Eip != ulpAddress + 1)
+        return(false);
+    ctx.Eip = ulpAddress;
+    SetThreadContext(hThread, &ctx);
+
+    StepOverSite(hThread);
+    return(true);
+}
+
+void CDebugger::EndStepInPlace(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    CThreadTable::Thread *pThread = m_Threads.FindByHandle(hThread);
+    if (pThread == NULL || pThread->bLifted == false)
+        return;
+
+    // Re-arm the site if a breakpoint still wants it
+    if (m_pProcess->Sites.Find(pThread->ulpLifted, 0) == true)
+        WriteSiteByte(pThread->ulpLifted, CBreakPointSites::cInt3);
+
+    // Our own single step is dropped if no breakpoint takes it
+    if (pException->ExceptionRecord.ExceptionCode == EXCEPTION_SINGLE_STEP && pThread->bLiftedTrapFlag == false)
+        pException->dwFirstChance = 0xBADC0DE;
+
+    pThread->bLifted = false;
+    m_pProcess->nLifted--;
+}
+
+SIZE_T CDebugger::GetDisplacedSteps(void) const
+{
+    SIZE_T nSteps = m_nDisplacedSteps;
+    for (size_t n = 0; n < m_Processes.size(); n++)
+        nSteps += m_Processes[n]->Stepper.GetSteps();
+    return(nSteps);
+}
+
+bool CDebugger::SetExceptionDisposition(DWORD dwExceptionCode, LONG lDisposition)
+{
+    return(m_Dispositions.Set(dwExceptionCode, lDisposition));
+}
+
+LONG CDebugger::GetExceptionDisposition(DWORD dwExceptionCode) const
+{
+    return(m_Dispositions.Get(dwExceptionCode));
+}
+
+LONG CDebugger::GetExceptionCount(DWORD dwExceptionCode) const
+{
+    return(m_Dispositions.GetCount(dwExceptionCode));
+}
+
+void CDebugger::ResetExceptionCounts(void)
+{
+    m_Dispositions.ResetCounts();
+}
+
+SIZE_T CDebugger::GetExceptionEvents(void) const
+{
+    return(m_nExceptionEvents);
+}
+
+SIZE_T CDebugger::GetEventAllocations(void) const
+{
+    return(m_nEventAllocations);
+}
+
+void CDebugger::SetDebugRegisters(CThreadTable::Thread *pThread)
+{
+    // Already has this assignment?
+    if (pThread->dwDebugRegisterStamp == m_dwDebugRegisterStamp)
+        return;
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+
+    // DR7: local enable bit, then R/W and LEN fields for each register
+    DWORD_PTR *pDr[cNumDebugRegisters] = { &ctx.Dr0, &ctx.Dr1, &ctx.Dr2, &ctx.Dr3 };
+    for (int i = 0; i < cNumDebugRegisters; i++) {
+        const DebugRegister & dr = m_DebugRegisters[i];
+        if (dr.bUsed == false)
+            continue;
+
+        DWORD_PTR dwLen = (dr.dwLength == 8) ? 2 : dr.dwLength - 1;
+        *pDr[i] = reinterpret_cast<DWORD_PTR>(dr.lpAddress);
+        ctx.Dr7 |= static_cast<DWORD_PTR>(1) << (i * 2);
+        ctx.Dr7 |= static_cast<DWORD_PTR>(dr.dwCondition & 3) << (16 + i * 4);
+        ctx.Dr7 |= (dwLen & 3) << (18 + i * 4);
+    }
+
+    if (SetThreadContext(pThread->hThread, &ctx) == TRUE)
+        pThread->dwDebugRegisterStamp = m_dwDebugRegisterStamp;
+}
+
+void CDebugger::SetDebugRegisters(void)
+{
+    // A new assignment for every thread
+    m_dwDebugRegisterStamp++;
+    for (SIZE_T n = 0; n < m_Threads.GetSlots(); n++) {
+        CThreadTable::Thread *pThread = m_Threads.GetAt(n);
+        if (pThread)
+            SetDebugRegisters(pThread);
+    }
+}
+
+bool CDebugger::DebugRegistersInUse(void) const
+{
+    for (int i = 0; i < cNumDebugRegisters; i++) {
+        if (m_DebugRegisters[i].bUsed == true)
+            return(true);
+    }
+    return(false);
+}
+
+void CDebugger::Wake(void)
+{
+    // The debugger thread's own calls are seen before it waits again
+    if (IsOtherThread() == true)
+        Signal();
+}
+
+void CDebugger::Signal(void)
+{
+    InterlockedExchange(&m_lSignaled, 1);
+    SetEvent(m_hWake);
+}
+
+CDebugger::Command::Command(int nCommand)
+: nType(nCommand)
+, hDone(NULL)
+, dwThreadId(0)
+, pszProcessName(NULL)
+, pszArguments(NULL)
+, pszCurrentDirectory(NULL)
+, lpEnvironment(NULL)
+, psi(NULL)
+, dwPid(0)
+, pClient(NULL)
+, pBreakPoint(NULL)
+, id(0)
+, EnumProc(NULL)
+, pUserData(NULL)
+, lpAddress(NULL)
+, dwCondition(0)
+, dwLength(0)
+, nIndex(-1)
+, lpBuffer(NULL)
+, lpcBuffer(NULL)
+, nSize(0)
+, pnDone(NULL)
+, pRequests(NULL)
+, hThread(NULL)
+, lpContext(NULL)
+, lpcContext(NULL)
+, dwResult(0)
+, bResult(false)
+, idResult(0)
+, pResult(NULL)
+, nResult(-1)
+, fResult(FALSE)
+, lpResult(NULL)
+{
+    pNext = NULL;
+}
+
+bool CDebugger::StartThread(void)
+{
+    if (m_dwThreadId != 0)
+        return(true);
+
+    m_bQuit = false;
+
+    // The reactor picks one of its event threads
+    if (m_pReactor)
+        return(m_pReactor->Attach(this));
+
+    ResetEvent(m_hEvents[cDebugThreadEvent]);
+    if (_beginthread(CommandThread, 0, this) == static_cast<uintptr_t>(-1))
+        return(false);
+
+    // Calls are routed to it once it has its ID
+    WaitForSingleObject(m_hEvents[cDebugThreadEvent], INFINITE);
+    ResetEvent(m_hEvents[cDebugThreadEvent]);
+    return(true);
+}
+
+void CDebugger::EndThread(void)
+{
+    if (IsOtherThread() == false)
+        return;
+
+    Command cmd(cCommandQuit);
+    Execute(&cmd);
+    WaitForSingleObject(m_hEvents[cDebugThreadEvent], INFINITE);
+}
+
+bool CDebugger::IsOtherThread(void) const
+{
+    return(m_dwThreadId != 0 && m_dwThreadId != GetCurrentThreadId());
+}
+
+void CDebugger::Execute(Command *pCommand)
+{
+    pCommand->hDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+    pCommand->dwThreadId = GetCurrentThreadId();
+    m_Commands.Push(pCommand);
+    Signal();
+    WaitForSingleObject(pCommand->hDone, INFINITE);
+    CloseHandle(pCommand->hDone);
+}
+
+void CDebugger::RunCommands(void)
+{
+    // New commands go behind the held ones
+    QueueEntry **ppEntry = &m_pHeld;
+    while (*ppEntry)
+        ppEntry = &(*ppEntry)->pNext;
+    *ppEntry = m_Commands.TakeAll();
+
+    ppEntry = &m_pHeld;
+    while (*ppEntry) {
+        Command *pCommand = static_cast<Command *>(*ppEntry);
+
+        // Held until the event ends, like the calls made while the clients run here
+        if (m_bClientsAway == true && pCommand->dwThreadId != m_dwClientThreadId) {
+            ppEntry = &pCommand->pNext;
+            continue;
+        }
+
+        // The caller's stack may be gone once hDone is set
+        *ppEntry = pCommand->pNext;
+        RunCommand(pCommand);
+        if (pCommand->hDone)
+            SetEvent(pCommand->hDone);
+    }
+}
+
+void CDebugger::RunCommand(Command *pCommand)
+{
+    // Runs on the debugger thread, so each call does the work itself
+    switch (pCommand->nType) {
+        case cCommandLoadProcess:
+            pCommand->dwResult = LoadProcess(pCommand->pszProcessName, pCommand->pszArguments, pCommand->pszCurrentDirectory, pCommand->lpEnvironment, pCommand->psi);
+            break;
+        case cCommandAttachToProcess:
+            pCommand->bResult = AttachToProcess(pCommand->dwPid);
+            break;
+        case cCommandAddClient:
+            AddClient(pCommand->pClient);
+            break;
+        case cCommandRemoveClient:
+            RemoveClient(pCommand->pClient);
+            break;
+        case cCommandUpdateClient:
+            UpdateClient(pCommand->pClient);
+            break;
+        case cCommandAddBreakPoint:
+            pCommand->idResult = AddBreakPoint(pCommand->pBreakPoint, pCommand->pClient);
+            break;
+        case cCommandRemoveBreakPoint:
+            if (pCommand->pBreakPoint)
+                pCommand->bResult = RemoveBreakPoint(pCommand->pBreakPoint);
+            else
+                pCommand->bResult = RemoveBreakPoint(pCommand->id);
+            break;
+        case cCommandGetBreakPoint:
+            pCommand->pResult = GetBreakPoint(pCommand->id);
+            break;
+        case cCommandGetBreakPointId:
+            pCommand->idResult = GetBreakPointId(pCommand->pBreakPoint);
+            break;
+        case cCommandUpdateBreakPoint:
+            UpdateBreakPoint(pCommand->pBreakPoint);
+            break;
+        case cCommandGetNumBreakPoints:
+            pCommand->nResult = GetNumBreakPoints();
+            break;
+        case cCommandEnumBreakPoints:
+            pCommand->bResult = EnumBreakPoints(pCommand->EnumProc, pCommand->pUserData);
+            break;
+        case cCommandAllocateDebugRegister:
+            pCommand->nResult = AllocateDebugRegister(pCommand->lpAddress, pCommand->dwCondition, pCommand->dwLength);
+            break;
+        case cCommandFreeDebugRegister:
+            FreeDebugRegister(pCommand->nIndex);
+            break;
+        case cCommandReadMemory:
+            pCommand->fResult = ReadProcessMemory(pCommand->lpAddress, pCommand->lpBuffer, pCommand->nSize, pCommand->pnDone);
+            break;
+        case cCommandWriteMemory:
+            pCommand->fResult = WriteProcessMemory(pCommand->lpAddress, pCommand->lpcBuffer, pCommand->nSize, pCommand->pnDone);
+            break;
+        case cCommandReadMemoryBatch:
+            pCommand->bResult = ReadProcessMemory(pCommand->pRequests, pCommand->nSize);
+            break;
+        case cCommandWriteMemoryBatch:
+            pCommand->bResult = WriteProcessMemory(pCommand->pRequests, pCommand->nSize);
+            break;
+        case cCommandGetThreadContext:
+            pCommand->fResult = GetThreadContext(pCommand->hThread, pCommand->lpContext);
+            break;
+        case cCommandSetThreadContext:
+            pCommand->fResult = SetThreadContext(pCommand->hThread, pCommand->lpcContext);
+            break;
+        case cCommandAllocateTrampoline:
+            pCommand->lpResult = AllocateTrampoline(pCommand->nSize);
+            break;
+        case cCommandFreeTrampoline:
+            FreeTrampoline(pCommand->lpAddress);
+            break;
+        case cCommandInsertSite:
+            pCommand->bResult = InsertBreakPointSite(pCommand->lpAddress);
+            break;
+        case cCommandRemoveSite:
+            pCommand->bResult = RemoveBreakPointSite(pCommand->lpAddress);
+            break;
+        case cCommandEnableBreakPoint:
+            pCommand->bResult = EnableBreakPoint(pCommand->pBreakPoint);
+            break;
+        case cCommandDisableBreakPoint:
+            pCommand->bResult = DisableBreakPoint(pCommand->pBreakPoint);
+            break;
+        case cCommandGo:
+            // Run by CommandThread once the other commands are done
+            m_bGoPending = true;
+            break;
+        case cCommandQuit:
+            m_bQuit = true;
+            break;
+        default:
+            break;
+    }
+}
+
+void CDebugger::CommandThread(void *pParam)
+{
+    CDebugger *pThis = reinterpret_cast<CDebugger *>(pParam);
+
+    pThis->m_dwThreadId = GetCurrentThreadId();
+    SetEvent(pThis->m_hEvents[cDebugThreadEvent]);
+
+    while (pThis->m_bQuit == false) {
+        // Anything pushed from now on wakes the wait below
+        ResetEvent(pThis->m_hEvents[cDebugWakeEvent]);
+        pThis->RunCommands();
+
+        if (pThis->m_bGoPending == true) {
+            pThis->m_bGoPending = false;
+            pThis->CloseProcessHandles();
+            DebuggerThread(pThis);
+        } else if (pThis->m_bQuit == false) {
+            WaitForSingleObject(pThis->m_hEvents[cDebugWakeEvent], INFINITE);
+        }
+    }
+
+    // Nothing of the debugger is touched after this
+    pThis->m_dwThreadId = 0;
+    SetEvent(pThis->m_hEvents[cDebugThreadEvent]);
+}
+
+#ifdef _WIN32
+
+bool CDebugger::WaitForEvent(DEBUG_EVENT *pDebugEvent)
+{
+    // The debug port can't be waited on with other objects, poll it
+    return(WaitForDebugEvent(pDebugEvent, 1000) != FALSE);
+}
+
+#else
+
+bool CDebugger::WaitForEvent(DEBUG_EVENT *pDebugEvent)
+{
+    // Blocks until a debug event, or until Wake
+    return(WaitForDebugEventOrObject(pDebugEvent, m_hEvents[cDebugWakeEvent], INFINITE) == WAIT_OBJECT_0);
+}
+
+#endif
+
 void CDebugger::CheckSuspend(void)
 {
     if (m_lSuspendCount > 0) {
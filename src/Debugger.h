@@ -2,26 +2,155 @@
 #pragma once
 
 #include "Defs.h"
-#include <map>
+#include "BreakPointIndex.h"
+#include "BreakPointRegistry.h"
+#include "ThreadContextCache.h"
+#include "PageCache.h"
+#include "TrampolineArena.h"
+#include "BreakPointSites.h"
+#include "DisplacedStepper.h"
+#include "CommandQueue.h"
+#include "ExceptionDispositions.h"
+#include "ThreadTable.h"
+#include "MemoryRangeIndex.h"
 #include <deque>
 #include <vector>
+#include <string>
 
 namespace SDE
 {
 
+class CDebuggerReactor;
+
 class CDebugger : public IDebugger
 {
     static const int cDebugStopEvent = 0;
     static const int cDebugStoppedEvent = 1;
     static const int cDebugRunningEvent = 2;
-    static const int cNumEvents = 3;
+    static const int cDebugWakeEvent = 3;
+    static const int cDebugThreadEvent = 4;
+    static const int cNumEvents = 5;
+
+    // Calls made on other threads, run by the debugger thread
+    static const int cCommandLoadProcess = 0;
+    static const int cCommandAttachToProcess = 1;
+    static const int cCommandAddClient = 2;
+    static const int cCommandRemoveClient = 3;
+    static const int cCommandAddBreakPoint = 4;
+    static const int cCommandRemoveBreakPoint = 5;
+    static const int cCommandGetBreakPoint = 6;
+    static const int cCommandGetBreakPointId = 7;
+    static const int cCommandUpdateBreakPoint = 8;
+    static const int cCommandGetNumBreakPoints = 9;
+    static const int cCommandEnumBreakPoints = 10;
+    static const int cCommandAllocateDebugRegister = 11;
+    static const int cCommandFreeDebugRegister = 12;
+    static const int cCommandReadMemory = 13;
+    static const int cCommandWriteMemory = 14;
+    static const int cCommandGetThreadContext = 15;
+    static const int cCommandSetThreadContext = 16;
+    static const int cCommandAllocateTrampoline = 17;
+    static const int cCommandFreeTrampoline = 18;
+    static const int cCommandInsertSite = 19;
+    static const int cCommandRemoveSite = 20;
+    static const int cCommandEnableBreakPoint = 21;
+    static const int cCommandDisableBreakPoint = 22;
+    static const int cCommandGo = 23;
+    static const int cCommandQuit = 24;
+    static const int cCommandUpdateClient = 25;
+    static const int cCommandReadMemoryBatch = 26;
+    static const int cCommandWriteMemoryBatch = 27;
+
+    // One subscriber list per IDebuggerClient::cEvent* bit
+    static const int cNumClientEvents = 12;
+
+    // Lives on the calling thread's stack until hDone is signaled
+    struct Command : public QueueEntry
+    {
+        int nType;
+        HANDLE hDone;
+        // The calling thread
+        DWORD dwThreadId;
+        LPCSTR pszProcessName;
+        LPCSTR pszArguments;
+        LPCSTR pszCurrentDirectory;
+        LPVOID lpEnvironment;
+        LPSTARTUPINFO psi;
+        DWORD dwPid;
+        IDebuggerClient *pClient;
+        IBreakPoint *pBreakPoint;
+        BreakPointId id;
+        EnumBreakPointProc EnumProc;
+        void *pUserData;
+        LPVOID lpAddress;
+        DWORD dwCondition;
+        DWORD dwLength;
+        int nIndex;
+        LPVOID lpBuffer;
+        LPCVOID lpcBuffer;
+        SIZE_T nSize;
+        SIZE_T *pnDone;
+        MemoryRequest *pRequests;
+        HANDLE hThread;
+        LPCONTEXT lpContext;
+        const CONTEXT *lpcContext;
+        // Results
+        DWORD dwResult;
+        bool bResult;
+        BreakPointId idResult;
+        IBreakPoint *pResult;
+        int nResult;
+        BOOL fResult;
+        LPVOID lpResult;
+
+        Command(int nCommand);
+    };
+
+    struct DebugRegister
+    {
+        bool bUsed;
+        LPVOID lpAddress;
+        DWORD dwCondition;
+        DWORD dwLength;
+    };
+
+    typedef std::vector<BreakPointId> BreakPointIdVector;
+    struct ClientEntry
+    {
+        IDebuggerClient *pClient;
+        DWORD dwEventMask;
+    };
 
-    typedef std::deque<IBreakPoint *> BreakPointVector;
-    typedef std::map<DWORD, HANDLE> Tid2Handle;
-    typedef std::map<HANDLE, DWORD> Handle2Tid;
-    typedef std::deque<IDebuggerClient *> ClientVector;
-    typedef std::vector<BreakPointVector::iterator> BPVIteratorVector;
+    typedef std::deque<ClientEntry> ClientVector;
+    typedef std::vector<IDebuggerClient *> ClientList;
+
+    // A debugged process, with its own INT3 sites, trampolines and breakpoints
+    struct Process
+    {
+        DWORD dwPid;
+        HANDLE hProcess;
+        // Reported by the debug API, a later CREATE_PROCESS_DEBUG_EVENT is an exec
+        bool bCreated;
+        // Shares INT3s with a process it was forked from or into
+        bool bForked;
+        // A vfork child that isn't followed, kept until it execs or exits
+        // without the clients seeing it
+        bool bUnfollowed;
+        CBreakPointSites Sites;
+        CTrampolineArena Trampolines;
+        CDisplacedStepper Stepper;
+        // Threads stepping over a lifted INT3
+        SIZE_T nLifted;
+        // The breakpoints asked about its exceptions, by registry slot (0 if none)
+        BreakPointIdVector BreakPoints;
+    };
+
+    typedef std::vector<Process *> ProcessVector;
+
+    friend class CDebuggerReactor;
 public:
+    typedef std::basic_string<WCHAR> WString;
+
     CDebugger();
     virtual ~CDebugger();
 
@@ -31,45 +160,226 @@ public:
 
     virtual void AddClient(IDebuggerClient *pClient);
     virtual void RemoveClient(IDebuggerClient *pClient);
+    virtual void UpdateClient(IDebuggerClient *pClient);
 
-    virtual bool AddBreakPoint(IBreakPoint *pBreakPoint);
+    virtual BreakPointId AddBreakPoint(IBreakPoint *pBreakPoint);
+    virtual BreakPointId AddBreakPoint(IBreakPoint *pBreakPoint, IDebuggerClient *pOwner);
     virtual bool RemoveBreakPoint(IBreakPoint *pBreakPoint);
+    virtual bool RemoveBreakPoint(BreakPointId id);
+    virtual IBreakPoint *GetBreakPoint(BreakPointId id);
+    virtual BreakPointId GetBreakPointId(IBreakPoint *pBreakPoint);
+    virtual void UpdateBreakPoint(IBreakPoint *pBreakPoint);
     virtual int GetNumBreakPoints(void);
     virtual bool EnumBreakPoints(EnumBreakPointProc EnumProc, void *pUserData);
 
+    virtual BOOL ReadProcessMemory(LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead);
+    virtual BOOL WriteProcessMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten);
+
+    virtual BOOL GetThreadContext(HANDLE hThread, LPCONTEXT lpContext);
+    virtual BOOL SetThreadContext(HANDLE hThread, const CONTEXT *lpContext);
+
+    virtual int AllocateDebugRegister(LPVOID lpAddress, DWORD dwCondition, DWORD dwLength);
+    virtual void FreeDebugRegister(int nIndex);
+
+    virtual LPVOID AllocateTrampoline(SIZE_T nSize);
+    virtual void FreeTrampoline(LPVOID lpTrampoline);
+
+    virtual CMemoryRangeIndex & GetMemoryRangeIndex(void);
+
+    virtual bool InsertBreakPointSite(LPVOID lpAddress);
+    virtual bool RemoveBreakPointSite(LPVOID lpAddress);
+
     virtual bool Go(void);
+    // Starts debugging on the debugger thread and returns at once. The
+    // returned event (owned by the debugger) is signaled when debugging ends,
+    // NULL if no process is loaded.
+    HANDLE GoAsync(void);
+
+    // A breakpoint's Enable/Disable, run on the debugger thread. Other
+    // threads use these instead of calling the breakpoint while debugging.
+    bool EnableBreakPoint(IBreakPoint *pBreakPoint);
+    bool DisableBreakPoint(IBreakPoint *pBreakPoint);
     virtual void Stop(void);
     virtual void Suspend(void);
     virtual void Resume(void);
 
-    BOOL ReadProcessMemory(LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead);
-    BOOL WriteProcessMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten);
+    bool ReadProcessMemory(MemoryRequest *pRequests, SIZE_T nRequests);
+    bool WriteProcessMemory(MemoryRequest *pRequests, SIZE_T nRequests);
     int GetCStringFromProcess(LPCVOID lpBaseAddress, LPSTR lpString, SIZE_T nMaxString, BOOL bUnicode);
+    bool GetCStringFromProcess(LPCVOID lpBaseAddress, std::string & String, SIZE_T nMaxString = 0x10000);
+    bool GetCStringFromProcess(LPCVOID lpBaseAddress, WString & String, SIZE_T nMaxString = 0x10000);
 
     DWORD GetThreadId(HANDLE hThread) const;
     HANDLE GetThreadHandle(DWORD dwTid) const;
 
+    // Kept for compatibility: the loop always runs on the debugger thread and
+    // Stop waits for it whenever it's called from another thread
     void SetMultithread(bool bMultithread);
+
+    // Runs the debugger loop on one of the reactor's event threads instead of
+    // a thread of its own, set before LoadProcess/AttachToProcess. NULL goes
+    // back to a thread of its own.
+    bool SetReactor(CDebuggerReactor *pReactor);
+
+    // Debug the processes the debuggee starts as well. On Linux these are the
+    // children of fork and vfork, whether the debuggee was loaded or attached
+    // to; with SetInheritBreakPoints(true) a forked child starts with its
+    // parent's breakpoints, otherwise their INT3s are taken out of its memory.
+    // A child that isn't followed has them taken out and runs undebugged, a
+    // vfork child once it execs.
+    void SetFollowChildren(bool bFollowChildren);
+    void SetInheritBreakPoints(bool bInheritBreakPoints);
+    // Processes being debugged
+    SIZE_T GetNumProcesses(void) const;
+
+    void SetPageCache(bool bPageCache);
+    SIZE_T GetPageCacheHits(void) const;
+    SIZE_T GetPageCacheMisses(void) const;
+
+    SIZE_T GetTrampolineAllocations(void) const;
+    SIZE_T GetTrampolineReuses(void) const;
+    SIZE_T GetTrampolineSyscallsSaved(void) const;
+
+    SIZE_T GetDisplacedSteps(void) const;
+
+    // What happens to the exceptions no breakpoint claims, by exception code
+    // (CExceptionDispositions::cStop, cPass or cSwallow), and how many arrived.
+    // On Linux signals arrive as the codes they map to. Any thread may call
+    // these while debugging, the debugger doesn't have to be stopped.
+    bool SetExceptionDisposition(DWORD dwExceptionCode, LONG lDisposition);
+    LONG GetExceptionDisposition(DWORD dwExceptionCode) const;
+    LONG GetExceptionCount(DWORD dwExceptionCode) const;
+    void ResetExceptionCounts(void);
+
+    // Exception events handled, and the heap allocations made by the debugger
+    // thread while waiting for and handling them (see CAllocationCounter)
+    SIZE_T GetExceptionEvents(void) const;
+    SIZE_T GetEventAllocations(void) const;
     
 protected:
     static void DebuggerThread(void *pParam);
 
+    // The loop's steps, also run by CDebuggerReactor. BeginEvent and EndEvent
+    // run on the debugger thread, before and after the clients are called
+    // with CallClients; BeginEvent returns false if there are none to call.
+    void BeginSession(void);
+    bool BeginEvent(void);
+    void CallClients(void);
+    bool EndEvent(void);
+    void EndSession(void);
+
 private:
     void CloseProcessHandles(void);
+    Process *AddProcess(DWORD dwPid, HANDLE hProcess);
+    Process *FindProcess(DWORD dwPid);
+    Process *FindProcess(HANDLE hProcess);
+    void RemoveProcess(Process *pProcess);
+    void ClearProcesses(void);
+    void ResetProcess(Process *pProcess);
+    void InheritProcess(Process *pChild, Process *pParent, bool bSharedMemory);
+    void RemoveThreads(DWORD dwPid);
+    Process *SelectProcess(Process *pProcess);
+    Process *SelectProcess(IBreakPoint *pBreakPoint);
+    static bool HasBreakPoint(const Process *pProcess, BreakPointId id);
+    static void SetBreakPoint(Process *pProcess, BreakPointId id, bool bIn);
+    void SetDebuggedThread(DWORD dwPid, DWORD dwTid);
+    void BuildSubscribers(void);
+    const ClientList & GetSubscribers(DWORD dwEvent) const;
+    void NotifyBreakPoints(void);
+    bool HasClientWork(DWORD dwEvent) const;
     void CheckSuspend(void);
+    void Wake(void);
+    void Signal(void);
+    bool StartThread(void);
+    void EndThread(void);
+    bool IsOtherThread(void) const;
+    void Execute(Command *pCommand);
+    void RunCommands(void);
+    void RunCommand(Command *pCommand);
+    static void CommandThread(void *pParam);
+    bool WaitForEvent(DEBUG_EVENT *pDebugEvent);
+    void SetDebugRegisters(CThreadTable::Thread *pThread);
+    void SetDebugRegisters(void);
+    bool DebugRegistersInUse(void) const;
+    bool TransferBatch(MemoryRequest *pRequests, SIZE_T nRequests, bool bWrite);
+    BOOL WriteMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten);
+    bool WriteSiteByte(ULONG_PTR ulpAddress, BYTE byValue);
+    void StepOverSite(HANDLE hThread);
+    bool RewindRemovedSite(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    bool StepOverForeignSite(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    void EndStepInPlace(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    SIZE_T ReadStringChunks(LPCVOID lpBaseAddress, LPBYTE lpBuffer, SIZE_T nMaxChars, int nCharSize, bool *pbTruncated, bool *pbFailed);
 
 private:
     ClientVector m_vClients;
-    BreakPointVector m_BreakPoints;
+    // The clients of each event, in m_vClients order
+    ClientList m_Subscribers[cNumClientEvents];
+    CBreakPointRegistry m_BreakPoints;
+    CBreakPointIndex m_Index;
+    CBreakPointIndex::BreakPointVector m_Candidates;
+    BreakPointIdVector m_Triggered;
     bool m_bProcessLoaded;
     bool m_bActiveDebug;
     volatile LONG m_lProcessesCreated;
+    // The first process
     PROCESS_INFORMATION m_pi;
+    ProcessVector m_Processes;
+    Process *m_pMain;
+    // The process of the event being handled, m_pMain between events and
+    // m_NoProcess (which has no handle) when nothing is loaded
+    Process *m_pProcess;
+    Process m_NoProcess;
+    bool m_bFollowChildren;
+    bool m_bInheritBreakPoints;
     HANDLE m_hEvents[cNumEvents];
-    Tid2Handle m_Tid2Handle;
-    Handle2Tid m_Handle2Tid;
+    // The debugger thread, 0 before the first LoadProcess/AttachToProcess
+    volatile DWORD m_dwThreadId;
+    CCommandQueue m_Commands;
+    // Commands taken from the queue but not run yet, oldest first
+    QueueEntry *m_pHeld;
+    CDebuggerReactor *m_pReactor;
+    // Set to wake the debugger thread, a reactor's event thread sets it for
+    // all its debuggers and looks at m_lSignaled to tell which were woken
+    HANDLE m_hWake;
+    LONG volatile m_lSignaled;
+    // While the clients of an event run on another thread (m_dwClientThreadId,
+    // 0 until it starts) only that thread's commands are run
+    bool m_bClientsAway;
+    volatile DWORD m_dwClientThreadId;
+    Command m_GoCommand;
+    bool m_bGoPending;
+    bool m_bQuit;
+    volatile bool m_bRunning;
+    CThreadTable m_Threads;
     bool m_bMultithread;
     LONG m_lSuspendCount;
+    CThreadContextCache m_Contexts;
+    bool m_bInStop;
+    // The event being handled
+    DEBUG_EVENT m_Event;
+    DWORD m_dwContinueStatus;
+    HANDLE m_hEventThread;
+    bool m_bFirstThread;
+    CPageCache m_PageCache;
+    bool m_bPageCache;
+    DebugRegister m_DebugRegisters[cNumDebugRegisters];
+    // Changes with each debug register assignment
+    DWORD m_dwDebugRegisterStamp;
+    // Counters of the processes gone
+    SIZE_T m_nTrampolineAllocations;
+    SIZE_T m_nTrampolineReuses;
+    SIZE_T m_nTrampolineSyscallsSaved;
+    SIZE_T m_nDisplacedSteps;
+    CExceptionDispositions m_Dispositions;
+    CMemoryRangeIndex m_RangeIndex;
+    DWORD m_dwDebuggedPid;
+    DWORD m_dwDebuggedTid;
+    // Reused by writes over INT3 sites
+    std::vector<BYTE> m_WriteBuffer;
+    SIZE_T m_nExceptionEvents;
+    SIZE_T m_nEventAllocations;
+    // The debugger thread's allocation count before the event
+    SIZE_T m_nAllocationsBefore;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,462 @@
+// DebuggerReactor.cpp - Event threads shared by many debuggers implementation
+#include "stdafx.h"
+#include "DebuggerReactor.h"
+#include "Debugger.h"
+#include "CommandQueue.h"
+#include "AllocationCounter.h"
+#include <deque>
+#include <map>
+
+using namespace std;
+
+namespace SDE
+{
+
+// A debugger run by the reactor, owned by its event thread. Queued to the
+// event thread once attached, then each time a worker is done with its
+// clients.
+struct CDebuggerReactor::Session : public QueueEntry
+{
+    CDebugger *pDebugger;
+    EventThread *pThread;
+    // Its debug events not handled yet, oldest first
+    deque<DEBUG_EVENT> Events;
+    // In pThread->Sessions
+    bool bListed;
+    // Between Go and the end of debugging
+    bool bActive;
+    // A worker has its clients
+    bool bInClients;
+    LONG lAffinity;
+};
+
+struct CDebuggerReactor::EventThread
+{
+    CDebuggerReactor *pReactor;
+    volatile DWORD dwThreadId;
+    volatile bool bQuit;
+    // Set by the debuggers' calls and by the workers
+    HANDLE hWake;
+    // Signaled when the thread has its ID, and again when it ends
+    HANDLE hThreadEvent;
+    CCommandQueue Queue;
+    vector<Session *> Sessions;
+    // The debugger of each process, for the events of the process
+    map<DWORD, Session *> Pids;
+    LONG volatile lSessions;
+    SIZE_T nEvents;
+};
+
+CDebuggerReactor::CDebuggerReactor()
+: m_lAffinity(0)
+{
+}
+
+CDebuggerReactor::~CDebuggerReactor()
+{
+    Shutdown();
+}
+
+bool CDebuggerReactor::Start(int nEventThreads, int nWorkers)
+{
+    if (m_Threads.empty() == false || nEventThreads <= 0)
+        return(false);
+
+    if (nWorkers > 0 && m_Pool.Start(nWorkers) == false)
+        return(false);
+
+    for (int n = 0; n < nEventThreads; n++) {
+        EventThread *pThread = new EventThread;
+        pThread->pReactor = this;
+        pThread->dwThreadId = 0;
+        pThread->bQuit = false;
+        pThread->hWake = CreateEvent(NULL, TRUE, FALSE, NULL);
+        pThread->hThreadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        pThread->lSessions = 0;
+        pThread->nEvents = 0;
+
+        if (_beginthread(EventLoop, 0, pThread) == static_cast<uintptr_t>(-1)) {
+            CloseHandle(pThread->hWake);
+            CloseHandle(pThread->hThreadEvent);
+            delete pThread;
+            Shutdown();
+            return(false);
+        }
+
+        // Debuggers are given to it once it has its ID
+        WaitForSingleObject(pThread->hThreadEvent, INFINITE);
+        ResetEvent(pThread->hThreadEvent);
+        m_Threads.push_back(pThread);
+    }
+
+    return(true);
+}
+
+void CDebuggerReactor::Shutdown(void)
+{
+    for (size_t i = 0; i < m_Threads.size(); i++) {
+        EventThread *pThread = m_Threads[i];
+        pThread->bQuit = true;
+        SetEvent(pThread->hWake);
+        WaitForSingleObject(pThread->hThreadEvent, INFINITE);
+
+        // Left by debuggers that were never destroyed
+        for (size_t n = 0; n < pThread->Sessions.size(); n++)
+            delete pThread->Sessions[n];
+        QueueEntry *pEntry = pThread->Queue.TakeAll();
+        while (pEntry) {
+            Session *pSession = static_cast<Session *>(pEntry);
+            pEntry = pEntry->pNext;
+            if (pSession->bListed == false)
+                delete pSession;
+        }
+
+        CloseHandle(pThread->hWake);
+        CloseHandle(pThread->hThreadEvent);
+        delete pThread;
+    }
+    m_Threads.clear();
+
+    m_Pool.Shutdown();
+}
+
+SIZE_T CDebuggerReactor::GetNumDebuggers(void) const
+{
+    SIZE_T nDebuggers = 0;
+    for (size_t i = 0; i < m_Threads.size(); i++)
+        nDebuggers += m_Threads[i]->lSessions;
+    return(nDebuggers);
+}
+
+SIZE_T CDebuggerReactor::GetEvents(void) const
+{
+    SIZE_T nEvents = 0;
+    for (size_t i = 0; i < m_Threads.size(); i++)
+        nEvents += m_Threads[i]->nEvents;
+    return(nEvents);
+}
+
+SIZE_T CDebuggerReactor::GetClientRuns(void) const
+{
+    return(m_Pool.GetRuns());
+}
+
+SIZE_T CDebuggerReactor::GetClientSteals(void) const
+{
+    return(m_Pool.GetSteals());
+}
+
+bool CDebuggerReactor::Attach(CDebugger *pDebugger)
+{
+    if (m_Threads.empty() == true)
+        return(false);
+
+    // The event thread with the fewest debuggers
+    EventThread *pThread = m_Threads[0];
+    for (size_t i = 1; i < m_Threads.size(); i++) {
+        if (m_Threads[i]->lSessions < pThread->lSessions)
+            pThread = m_Threads[i];
+    }
+    InterlockedIncrement(&pThread->lSessions);
+
+    Session *pSession = new Session;
+    pSession->pNext = NULL;
+    pSession->pDebugger = pDebugger;
+    pSession->pThread = pThread;
+    pSession->bListed = false;
+    pSession->bActive = false;
+    pSession->bInClients = false;
+    pSession->lAffinity = InterlockedIncrement(&m_lAffinity);
+
+    // The debugger's calls go to the event thread from now on
+    ResetEvent(pDebugger->m_hEvents[CDebugger::cDebugThreadEvent]);
+    pDebugger->m_hWake = pThread->hWake;
+    pDebugger->m_dwThreadId = pThread->dwThreadId;
+
+    pThread->Queue.Push(pSession);
+    SetEvent(pThread->hWake);
+
+    return(true);
+}
+
+void CDebuggerReactor::EventLoop(void *pParam)
+{
+    EventThread *pThread = reinterpret_cast<EventThread *>(pParam);
+    CDebuggerReactor *pThis = pThread->pReactor;
+
+    pThread->dwThreadId = GetCurrentThreadId();
+    SetEvent(pThread->hThreadEvent);
+
+    while (pThread->bQuit == false) {
+        if (WaitForSingleObject(pThread->hWake, 0) == WAIT_OBJECT_0) {
+            // Anything asked from now on wakes the wait below
+            ResetEvent(pThread->hWake);
+
+            // Debuggers attached, and those a worker is done with
+            QueueEntry *pEntry = pThread->Queue.TakeAll();
+            while (pEntry) {
+                Session *pSession = static_cast<Session *>(pEntry);
+                pEntry = pEntry->pNext;
+                if (pSession->bListed == true) {
+                    pThis->EndClients(pSession);
+                } else {
+                    pSession->bListed = true;
+                    pThread->Sessions.push_back(pSession);
+                }
+            }
+
+            // Debuggers with calls from other threads, Go, Stop, Suspend or Resume
+            for (size_t i = 0; i < pThread->Sessions.size(); ) {
+                Session *pSession = pThread->Sessions[i];
+                CDebugger *pDebugger = pSession->pDebugger;
+                if (pDebugger->m_lSignaled != 0 && InterlockedExchange(&pDebugger->m_lSignaled, 0) != 0)
+                    pThis->Service(pSession);
+
+                // A debugger detached gives its place to the last one
+                if (i < pThread->Sessions.size() && pThread->Sessions[i] == pSession)
+                    i++;
+            }
+        }
+
+        // One debug event of any of our processes, or a wake
+        DEBUG_EVENT de;
+        if (WaitForEvent(pThread, &de) == true)
+            pThis->Route(pThread, de);
+    }
+
+    // Nothing of the thread's state is touched after this
+    SetEvent(pThread->hThreadEvent);
+}
+
+#ifdef _WIN32
+
+bool CDebuggerReactor::WaitForEvent(EventThread *pThread, DEBUG_EVENT *pDebugEvent)
+{
+    // The debug port can't be waited on with other objects, poll it
+    if (WaitForSingleObject(pThread->hWake, 0) == WAIT_OBJECT_0)
+        return(false);
+    return(WaitForDebugEvent(pDebugEvent, 10) != FALSE);
+}
+
+#else
+
+bool CDebuggerReactor::WaitForEvent(EventThread *pThread, DEBUG_EVENT *pDebugEvent)
+{
+    // The thread's tracer waits for all of its processes at once
+    return(WaitForDebugEventOrObject(pDebugEvent, pThread->hWake, INFINITE) == WAIT_OBJECT_0);
+}
+
+#endif
+
+void CDebuggerReactor::Service(Session *pSession)
+{
+    CDebugger *pDebugger = pSession->pDebugger;
+
+    pDebugger->RunCommands();
+
+    if (pDebugger->m_bQuit == true) {
+        Detach(pSession);
+        return;
+    }
+
+    if (pDebugger->m_bGoPending == true && pSession->bActive == false) {
+        pDebugger->m_bGoPending = false;
+        pDebugger->CloseProcessHandles();
+        pDebugger->BeginSession();
+        pSession->bActive = true;
+    }
+
+    Dispatch(pSession);
+}
+
+void CDebuggerReactor::Route(EventThread *pThread, const DEBUG_EVENT & de)
+{
+    Session *pSession = FindSession(pThread, de.dwProcessId);
+    if (pSession == NULL) {
+        // A process of a debugger that stopped runs on
+        ContinueDebugEvent(de.dwProcessId, de.dwThreadId, DBG_CONTINUE);
+        return;
+    }
+
+    // The ID may be given to another process once this one is gone
+    if (de.dwDebugEventCode == EXIT_PROCESS_DEBUG_EVENT)
+        pThread->Pids.erase(de.dwProcessId);
+
+    pSession->Events.push_back(de);
+    Dispatch(pSession);
+}
+
+CDebuggerReactor::Session *CDebuggerReactor::FindSession(EventThread *pThread, DWORD dwPid)
+{
+    map<DWORD, Session *>::iterator i = pThread->Pids.find(dwPid);
+    if (i != pThread->Pids.end())
+        return(i->second);
+
+    // A process seen for the first time, created by one of the debuggers
+    Session *pSession = LookUpSession(pThread, dwPid);
+
+#ifndef _WIN32
+    // or forked by one of their processes
+    if (pSession == NULL) {
+        DWORD dwParent = GetForkParentProcessId(dwPid, NULL);
+        if (dwParent != 0) {
+            i = pThread->Pids.find(dwParent);
+            if (i != pThread->Pids.end())
+                pSession = i->second;
+            else
+                pSession = LookUpSession(pThread, dwParent);
+        }
+    }
+#endif
+
+    if (pSession)
+        pThread->Pids[dwPid] = pSession;
+    return(pSession);
+}
+
+CDebuggerReactor::Session *CDebuggerReactor::LookUpSession(EventThread *pThread, DWORD dwPid)
+{
+    for (size_t i = 0; i < pThread->Sessions.size(); i++) {
+        Session *pSession = pThread->Sessions[i];
+        if (pSession->pDebugger->FindProcess(dwPid) != NULL)
+            return(pSession);
+    }
+    return(NULL);
+}
+
+void CDebuggerReactor::Dispatch(Session *pSession)
+{
+    CDebugger *pDebugger = pSession->pDebugger;
+
+    while (pSession->bActive == true && pSession->bInClients == false) {
+        // Calls from other threads, between events
+        pDebugger->RunCommands();
+
+        // The quit's own wake detaches it
+        if (pDebugger->m_bQuit == true)
+            return;
+
+        // Check stop event
+        if (WaitForSingleObject(pDebugger->m_hEvents[CDebugger::cDebugStopEvent], 0) == WAIT_OBJECT_0) {
+            EndSession(pSession);
+            return;
+        }
+
+        // Suspended, its events wait for Resume
+        if (WaitForSingleObject(pDebugger->m_hEvents[CDebugger::cDebugRunningEvent], 0) != WAIT_OBJECT_0)
+            return;
+
+        if (pSession->Events.empty() == true)
+            return;
+
+        pDebugger->m_nAllocationsBefore = CAllocationCounter::GetCount();
+        pDebugger->m_Event = pSession->Events.front();
+        pSession->Events.pop_front();
+        pSession->pThread->nEvents++;
+
+        if (pDebugger->BeginEvent() == true) {
+            // The event ends once a worker is done with the clients
+            pSession->bInClients = true;
+            pDebugger->m_bClientsAway = true;
+            if (m_Pool.Submit(RunClients, pSession, pSession->lAffinity) == true)
+                return;
+
+            // No workers, or their rings are full
+            pSession->bInClients = false;
+            pDebugger->m_bClientsAway = false;
+            pDebugger->CallClients();
+        }
+
+        if (pDebugger->EndEvent() == false) {
+            EndSession(pSession);
+            return;
+        }
+    }
+}
+
+void CDebuggerReactor::RunClients(void *pParam)
+{
+    Session *pSession = reinterpret_cast<Session *>(pParam);
+    CDebugger *pDebugger = pSession->pDebugger;
+    EventThread *pThread = pSession->pThread;
+
+    // The event thread runs the calls they make into the debugger meanwhile
+    pDebugger->m_dwClientThreadId = GetCurrentThreadId();
+    pDebugger->CallClients();
+    pDebugger->m_dwClientThreadId = 0;
+
+    // The event thread ends the event, the session isn't ours after the push
+    pThread->Queue.Push(pSession);
+    SetEvent(pThread->hWake);
+}
+
+void CDebuggerReactor::EndClients(Session *pSession)
+{
+    CDebugger *pDebugger = pSession->pDebugger;
+
+    pSession->bInClients = false;
+    pDebugger->m_bClientsAway = false;
+
+    // Continue debugging
+    if (pDebugger->EndEvent() == false) {
+        EndSession(pSession);
+        return;
+    }
+
+    // The commands held meanwhile, and the next events
+    Dispatch(pSession);
+}
+
+void CDebuggerReactor::EndSession(Session *pSession)
+{
+    pSession->bActive = false;
+    Release(pSession);
+    pSession->pDebugger->EndSession();
+}
+
+void CDebuggerReactor::Release(Session *pSession)
+{
+    // Its processes run on, their events are continued from now on
+    map<DWORD, Session *> & Pids = pSession->pThread->Pids;
+    map<DWORD, Session *>::iterator i = Pids.begin();
+    while (i != Pids.end()) {
+        if (i->second == pSession)
+            Pids.erase(i++);
+        else
+            ++i;
+    }
+
+    while (pSession->Events.empty() == false) {
+        const DEBUG_EVENT & de = pSession->Events.front();
+        ContinueDebugEvent(de.dwProcessId, de.dwThreadId, DBG_CONTINUE);
+        pSession->Events.pop_front();
+    }
+}
+
+void CDebuggerReactor::Detach(Session *pSession)
+{
+    EventThread *pThread = pSession->pThread;
+    CDebugger *pDebugger = pSession->pDebugger;
+
+    if (pSession->bActive == true)
+        EndSession(pSession);
+    Release(pSession);
+
+    // Its place goes to the last one
+    for (size_t i = 0; i < pThread->Sessions.size(); i++) {
+        if (pThread->Sessions[i] == pSession) {
+            pThread->Sessions[i] = pThread->Sessions.back();
+            pThread->Sessions.pop_back();
+            break;
+        }
+    }
+    InterlockedDecrement(&pThread->lSessions);
+    delete pSession;
+
+    // Back to a thread of its own, nothing of the debugger is touched after this
+    pDebugger->m_hWake = pDebugger->m_hEvents[CDebugger::cDebugWakeEvent];
+    pDebugger->m_dwThreadId = 0;
+    SetEvent(pDebugger->m_hEvents[CDebugger::cDebugThreadEvent]);
+}
+
+}
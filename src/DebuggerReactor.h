@@ -0,0 +1,70 @@
+// DebuggerReactor.h - Event threads shared by many debuggers header
+#pragma once
+
+#include "Defs.h"
+#include "WorkerPool.h"
+#include <vector>
+
+namespace SDE
+{
+
+class CDebugger;
+
+// Runs the debugger loops of many debuggers (CDebugger::SetReactor) on a few
+// event threads instead of a thread each. An event thread creates or
+// attaches to the processes of its debuggers, so it is the one the debug API
+// reports their events to; it waits for the events of all of them at once
+// and queues each to its debugger, which handles one at a time. The clients
+// are called on a pool of worker threads (CWorkerPool) while the event thread
+// goes on with the other debuggers; the calls they make into their debugger
+// are run by the event thread, as for any other thread.
+class CDebuggerReactor
+{
+    struct Session;
+    struct EventThread;
+
+    typedef std::vector<EventThread *> EventThreadVector;
+
+    friend class CDebugger;
+public:
+    CDebuggerReactor();
+    ~CDebuggerReactor();
+
+    // With no workers the clients are called on the event threads
+    bool Start(int nEventThreads, int nWorkers);
+    // The debuggers must be destroyed first
+    void Shutdown(void);
+
+    SIZE_T GetNumDebuggers(void) const;
+    // Debug events handled
+    SIZE_T GetEvents(void) const;
+    // Events whose clients ran on a worker, and those a worker took from another's ring
+    SIZE_T GetClientRuns(void) const;
+    SIZE_T GetClientSteals(void) const;
+
+private:
+    static void EventLoop(void *pParam);
+    static void RunClients(void *pParam);
+    static bool WaitForEvent(EventThread *pThread, DEBUG_EVENT *pDebugEvent);
+
+    // Called by the debugger
+    bool Attach(CDebugger *pDebugger);
+
+    // On the event thread
+    void Service(Session *pSession);
+    void Route(EventThread *pThread, const DEBUG_EVENT & de);
+    Session *FindSession(EventThread *pThread, DWORD dwPid);
+    Session *LookUpSession(EventThread *pThread, DWORD dwPid);
+    void Dispatch(Session *pSession);
+    void EndClients(Session *pSession);
+    void EndSession(Session *pSession);
+    void Release(Session *pSession);
+    void Detach(Session *pSession);
+
+private:
+    EventThreadVector m_Threads;
+    CWorkerPool m_Pool;
+    LONG volatile m_lAffinity;
+};
+
+}
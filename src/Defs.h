@@ -4,10 +4,36 @@
 namespace SDE
 {
 
+class IDebugger;
+class CMemoryRangeIndex;
+
+// Names a breakpoint added to a debugger, 0 is no breakpoint. IDs of removed
+// breakpoints are not given out again.
+typedef DWORD BreakPointId;
+
+// Describes which exceptions a breakpoint can be triggered by, so the debugger
+// only has to ask the breakpoints that can match. A zero field matches anything.
+struct BreakPointKey
+{
+    DWORD dwExceptionCode;
+    LPVOID lpAddress;
+    HANDLE hThread;
+};
+
+// One range of a batched memory transfer. lpBuffer is the destination of a
+// read and the source of a write, nTransferred receives the bytes moved.
+struct MemoryRequest
+{
+    LPVOID lpAddress;
+    LPVOID lpBuffer;
+    SIZE_T nSize;
+    SIZE_T nTransferred;
+};
+
 class IBreakPoint
 {
 public:
-    virtual bool Initialize(HANDLE hProcess) = 0;
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess) = 0;
     virtual bool Enable(void) = 0;
     virtual bool Disable(void) = 0;
     virtual void Deinitialize(void) = 0;
@@ -15,11 +41,36 @@ public:
     virtual LPVOID GetAddress(void) const = 0;
     virtual HANDLE GetThread(void) const = 0;
     virtual HANDLE GetProcess(void) const = 0;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const
+    {
+        return(false); // Asked about every exception
+    }
 };
 
 class IDebuggerClient
 {
 public:
+    // Events a client can subscribe to, see GetEventMask
+    static const DWORD cEventBreakPoint = 0x0001;
+    static const DWORD cEventException = 0x0002;
+    static const DWORD cEventThreadCreated = 0x0004;
+    static const DWORD cEventThreadExit = 0x0008;
+    static const DWORD cEventProcessCreated = 0x0010;
+    static const DWORD cEventProcessExit = 0x0020;
+    static const DWORD cEventModuleLoaded = 0x0040;
+    static const DWORD cEventModuleUnloaded = 0x0080;
+    static const DWORD cEventDebugString = 0x0100;
+    static const DWORD cEventDebuggedThread = 0x0200;
+    static const DWORD cEventFinished = 0x0400;
+    static const DWORD cEventAll = 0x07FF;
+    // OnBreakPoint only for the breakpoints added with this client as owner
+    static const DWORD cEventOwnBreakPoints = 0x0800;
+
+    // Read by AddClient and UpdateClient, the client is only called for these
+    virtual DWORD GetEventMask(void) const
+    {
+        return(cEventAll);
+    }
     virtual bool OnBreakPoint(IBreakPoint *pBreakPoint) 
     {
         return(false); // We didn't remove any breakpoints
@@ -44,17 +95,54 @@ typedef bool (*EnumBreakPointProc)(IBreakPoint *pBreakPoint, void *pUserData);
 class IDebugger
 {
 public:
+    // Debug register conditions
+    static const DWORD cDrExecute = 0;
+    static const DWORD cDrWrite = 1;
+    static const DWORD cDrReadWrite = 3;
+    static const int cNumDebugRegisters = 4;
+
     virtual DWORD LoadProcess(LPCSTR pszProcessName, LPCSTR pszArguments, LPCSTR pszCurrentDirectory, LPVOID lpEnvironment, LPSTARTUPINFO psi) = 0;
     virtual bool AttachToProcess(DWORD dwPid) = 0;
 
     virtual void AddClient(IDebuggerClient *pClient) = 0;
     virtual void RemoveClient(IDebuggerClient *pClient) = 0;
+    // Reads the client's event mask again
+    virtual void UpdateClient(IDebuggerClient *pClient) = 0;
 
-    virtual bool AddBreakPoint(IBreakPoint *pBreakPoint) = 0;
+    // Returns 0 if the breakpoint couldn't be added. The owner gets the
+    // breakpoint's OnBreakPoint calls if it subscribes to cEventOwnBreakPoints.
+    virtual BreakPointId AddBreakPoint(IBreakPoint *pBreakPoint) = 0;
+    virtual BreakPointId AddBreakPoint(IBreakPoint *pBreakPoint, IDebuggerClient *pOwner) = 0;
     virtual bool RemoveBreakPoint(IBreakPoint *pBreakPoint) = 0;
+    virtual bool RemoveBreakPoint(BreakPointId id) = 0;
+    virtual IBreakPoint *GetBreakPoint(BreakPointId id) = 0;
+    virtual BreakPointId GetBreakPointId(IBreakPoint *pBreakPoint) = 0;
+    virtual void UpdateBreakPoint(IBreakPoint *pBreakPoint) = 0;
     virtual int GetNumBreakPoints(void) = 0;
     virtual bool EnumBreakPoints(EnumBreakPointProc EnumProc, void *pUserData) = 0;
 
+    virtual BOOL ReadProcessMemory(LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead) = 0;
+    virtual BOOL WriteProcessMemory(LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten) = 0;
+
+    virtual BOOL GetThreadContext(HANDLE hThread, LPCONTEXT lpContext) = 0;
+    virtual BOOL SetThreadContext(HANDLE hThread, const CONTEXT *lpContext) = 0;
+
+    // Takes one of DR0-DR3 and sets it in every thread, returns -1 if all are in use
+    virtual int AllocateDebugRegister(LPVOID lpAddress, DWORD dwCondition, DWORD dwLength) = 0;
+    virtual void FreeDebugRegister(int nIndex) = 0;
+
+    // INT3 sites, counted per address. The debugger's reads show the original byte
+    // and threads hitting a site that stays armed run the instruction out of line.
+    virtual bool InsertBreakPointSite(LPVOID lpAddress) = 0;
+    virtual bool RemoveBreakPointSite(LPVOID lpAddress) = 0;
+
+    // Executable memory in the debuggee for injected code, valid until freed or the process exits
+    virtual LPVOID AllocateTrampoline(SIZE_T nSize) = 0;
+    virtual void FreeTrampoline(LPVOID lpTrampoline) = 0;
+
+    // The pages guarded by the debugger's memory range breakpoints, used on the debugger thread
+    virtual CMemoryRangeIndex & GetMemoryRangeIndex(void) = 0;
+
     virtual bool Go(void) = 0;
     virtual void Stop(void) = 0;
     virtual void Suspend(void) = 0;
@@ -0,0 +1,250 @@
+// DisplacedStepper.cpp - Out of line execution of instructions under breakpoints implementation
+#include "stdafx.h"
+#include "DisplacedStepper.h"
+#include "InstructionDecoder.h"
+
+namespace SDE
+{
+
+// EFlags trap flag
+static const DWORD cTrapFlag = 0x100;
+
+// Registers that can replace RIP: no instruction with a ModR/M memory operand
+// uses them implicitly, except RBX in CMPXCHG8B/16B
+static const int cScratchRegisters[] = { 3, 6, 7 }; // RBX, RSI, RDI
+
+CDisplacedStepper::CDisplacedStepper()
+: m_nSteps(0)
+{
+}
+
+CDisplacedStepper::~CDisplacedStepper()
+{
+}
+
+ULONG_PTR *CDisplacedStepper::GetRegister(CONTEXT *pContext, int nRegister)
+{
+    switch (nRegister) {
+        case 3: return(reinterpret_cast<ULONG_PTR *>(&pContext->Ebx));
+        case 6: return(reinterpret_cast<ULONG_PTR *>(&pContext->Esi));
+        case 7: return(reinterpret_cast<ULONG_PTR *>(&pContext->Edi));
+        default: return(0);
+    }
+}
+
+bool CDisplacedStepper::Begin(IDebugger & debugger, HANDLE hThread, LPVOID lpAddress)
+{
+    if (IsStepping(hThread) == true)
+        return(false);
+
+    // The debugger's reads see the original bytes under the INT3s
+    BYTE Code[CInstructionDecoder::cMaxLength];
+    InstructionInfo info;
+    int nLength = CInstructionDecoder::Decode(debugger, lpAddress, Code, &info);
+    if (nLength == 0)
+        return(false);
+
+    // An INT3 of the program itself would only trap again, and a system call
+    // can't run out of line: a thread cloned by it starts after the copy
+    if (info.dwFlags & (CInstructionDecoder::cInterrupt | CInstructionDecoder::cSystemCall))
+        return(false);
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    if (debugger.GetThreadContext(hThread, &ctx) == FALSE)
+        return(false);
+
+    Step step;
+    step.ulpAddress = reinterpret_cast<ULONG_PTR>(lpAddress);
+    step.nLength = nLength;
+    step.dwFlags = info.dwFlags;
+    step.nScratch = -1;
+    step.ulpScratch = 0;
+    step.bTrapFlag = (ctx.EFlags & cTrapFlag) ? true : false;
+
+    // [RIP + disp32] becomes [scratch + disp32], the scratch register holding
+    // what RIP would have been
+    if (info.dwFlags & CInstructionDecoder::cRipRelative) {
+        BYTE bModRM = Code[info.nModRMOffset];
+        BYTE bLead = Code[info.nOpcodeOffset];
+        bool bVex = (info.dwMap >= 0x100);
+        int nReg = (bModRM >> 3) & 7;
+        int nVvvv = -1;
+        if (bVex == true) {
+            // Inverted, in the second byte of C5 and the third of C4/8F/62
+            nVvvv = (~Code[info.nOpcodeOffset + (bLead == 0xC5 ? 1 : 2)] >> 3) & 7;
+        }
+
+        for (size_t n = 0; n < sizeof(cScratchRegisters) / sizeof(cScratchRegisters[0]); n++) {
+            int nScratch = cScratchRegisters[n];
+            if (nScratch == nReg || nScratch == nVvvv)
+                continue;
+            if (nScratch == 3 && info.dwMap == 1 && info.bOpcode == 0xC7)
+                continue;
+            step.nScratch = nScratch;
+            break;
+        }
+        if (step.nScratch == -1)
+            return(false);
+
+        // mod 10 (disp32) with the scratch register as base, and REX.B/VEX.B cleared
+        Code[info.nModRMOffset] = static_cast<BYTE>(0x80 | (bModRM & 0x38) | step.nScratch);
+        if (bVex == true) {
+            if (bLead != 0xC5)
+                Code[info.nOpcodeOffset + 1] |= 0x20;
+        } else if (info.nPrefixes && (Code[info.nOpcodeOffset - 1] & 0xF0) == 0x40) {
+            Code[info.nOpcodeOffset - 1] &= ~0x01;
+        }
+
+        ULONG_PTR *pScratch = GetRegister(&ctx, step.nScratch);
+        step.ulpScratch = *pScratch;
+        *pScratch = step.ulpAddress + nLength;
+    }
+
+    // Copy the instruction out of line
+    LPVOID lpTrampoline = debugger.AllocateTrampoline(nLength);
+    if (lpTrampoline == 0)
+        return(false);
+
+    SIZE_T nWritten = 0;
+    debugger.WriteProcessMemory(lpTrampoline, Code, nLength, &nWritten);
+    if (nWritten != static_cast<SIZE_T>(nLength)) {
+        debugger.FreeTrampoline(lpTrampoline);
+        return(false);
+    }
+    step.ulpTrampoline = reinterpret_cast<ULONG_PTR>(lpTrampoline);
+
+    // Run it alone
+    ctx.Eip = step.ulpTrampoline;
+    ctx.EFlags |= cTrapFlag;
+    if (debugger.SetThreadContext(hThread, &ctx) == FALSE) {
+        debugger.FreeTrampoline(lpTrampoline);
+        return(false);
+    }
+
+    step.bActive = true;
+    m_Steps[hThread] = step;
+    m_nSteps++;
+
+    return(true);
+}
+
+bool CDisplacedStepper::IsStepping(HANDLE hThread) const
+{
+    StepMap::const_iterator i = m_Steps.find(hThread);
+    return(i != m_Steps.end() && i->second.bActive == true);
+}
+
+bool CDisplacedStepper::OnException(IDebugger & debugger, HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    StepMap::iterator i = m_Steps.find(hThread);
+    if (i == m_Steps.end() || i->second.bActive == false)
+        return(false);
+
+    Step & step = i->second;
+    ULONG_PTR ulpNext = step.ulpTrampoline + step.nLength;
+    ULONG_PTR ulpOriginalNext = step.ulpAddress + step.nLength;
+
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+    debugger.GetThreadContext(hThread, &ctx);
+
+    if (pException->ExceptionRecord.ExceptionCode == EXCEPTION_SINGLE_STEP) {
+        // A repeated string operation traps after every iteration
+        if (ctx.Eip == step.ulpTrampoline && (step.dwFlags & CInstructionDecoder::cRepString)) {
+            ctx.EFlags |= cTrapFlag;
+            debugger.SetThreadContext(hThread, &ctx);
+            return(true);
+        }
+
+        // Go where the original instruction would have gone
+        if (ctx.Eip == ulpNext)
+            ctx.Eip = ulpOriginalNext;
+        else if (step.dwFlags & CInstructionDecoder::cRelativeBranch)
+            ctx.Eip += step.ulpAddress - step.ulpTrampoline;
+
+        // The return address pushed points after the copy
+        if (step.dwFlags & CInstructionDecoder::cCall) {
+            LPVOID lpStack = reinterpret_cast<LPVOID>(ctx.Esp);
+            ULONG_PTR ulpReturn = 0;
+            SIZE_T nNumRead = 0;
+            if (debugger.ReadProcessMemory(lpStack, &ulpReturn, sizeof(ulpReturn), &nNumRead) && ulpReturn == ulpNext) {
+                SIZE_T nWritten = 0;
+                debugger.WriteProcessMemory(lpStack, &ulpOriginalNext, sizeof(ulpOriginalNext), &nWritten);
+            }
+        }
+
+        pException->ExceptionRecord.ExceptionAddress = reinterpret_cast<LPVOID>(ctx.Eip);
+
+        // A single step asked for meanwhile (guard page re-arming) or a data
+        // breakpoint hit by the instruction is still dispatched, and dropped if
+        // no breakpoint takes it. One the thread was doing anyway goes as usual.
+        if (step.bTrapFlag == false)
+            pException->dwFirstChance = 0xBADC0DE;
+
+        End(debugger, i, &ctx);
+        return(false);
+    }
+
+    // Not raised by the copy
+    if (ctx.Eip < step.ulpTrampoline || ctx.Eip > ulpNext)
+        return(false);
+
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(pException->ExceptionRecord.ExceptionAddress);
+    if (ulpAddress >= step.ulpTrampoline && ulpAddress <= ulpNext)
+        pException->ExceptionRecord.ExceptionAddress = reinterpret_cast<LPVOID>(step.ulpAddress + (ulpAddress - step.ulpTrampoline));
+
+    // The guard is gone and the copy is run again, the step goes on
+    if (pException->ExceptionRecord.ExceptionCode == EXCEPTION_GUARD_PAGE)
+        return(false);
+
+    // Anything else is the program's business, it sees its own addresses
+    ctx.Eip = step.ulpAddress + (ctx.Eip - step.ulpTrampoline);
+    if (step.bTrapFlag == true)
+        ctx.EFlags |= cTrapFlag;
+    else
+        ctx.EFlags &= ~cTrapFlag;
+
+    End(debugger, i, &ctx);
+    return(false);
+}
+
+void CDisplacedStepper::End(IDebugger & debugger, StepMap::iterator i, CONTEXT *pContext)
+{
+    HANDLE hThread = i->first;
+    Step & step = i->second;
+
+    if (step.nScratch != -1)
+        *GetRegister(pContext, step.nScratch) = step.ulpScratch;
+    debugger.SetThreadContext(hThread, pContext);
+
+    debugger.FreeTrampoline(reinterpret_cast<LPVOID>(step.ulpTrampoline));
+
+    // Not erased, the thread's next step reuses the entry
+    step.bActive = false;
+}
+
+void CDisplacedStepper::Cancel(IDebugger & debugger, HANDLE hThread)
+{
+    StepMap::iterator i = m_Steps.find(hThread);
+    if (i == m_Steps.end())
+        return;
+
+    if (i->second.bActive == true)
+        debugger.FreeTrampoline(reinterpret_cast<LPVOID>(i->second.ulpTrampoline));
+    m_Steps.erase(i);
+}
+
+void CDisplacedStepper::Clear(void)
+{
+    m_Steps.clear();
+}
+
+SIZE_T CDisplacedStepper::GetSteps(void) const
+{
+    return(m_nSteps);
+}
+
+}
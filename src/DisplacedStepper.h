@@ -0,0 +1,60 @@
+// DisplacedStepper.h - Out of line execution of instructions under breakpoints header
+#pragma once
+
+#include "Defs.h"
+#include <map>
+
+namespace SDE
+{
+
+// Runs the instruction under an INT3 from a copy in a trampoline, so the
+// breakpoint never has to be lifted and other threads can't slip through it.
+// The thread single steps the copy and is then moved to where the original
+// would have left it: past the instruction, to a relative branch target or
+// with a call's return address fixed. RIP relative operands are rewritten
+// to use a scratch register holding the original instruction's address.
+class CDisplacedStepper
+{
+    struct Step
+    {
+        ULONG_PTR ulpAddress;       // Original instruction
+        ULONG_PTR ulpTrampoline;    // Its copy
+        int nLength;
+        DWORD dwFlags;              // CInstructionDecoder kinds
+        int nScratch;               // Register replacing RIP, -1 if none
+        ULONG_PTR ulpScratch;       // Its value before the step
+        bool bTrapFlag;             // The thread was already single stepping
+        bool bActive;               // Kept for the thread's next step when false
+    };
+
+    typedef std::map<HANDLE, Step> StepMap;
+public:
+    CDisplacedStepper();
+    ~CDisplacedStepper();
+
+    // Moves the thread to a relocated copy of the instruction at lpAddress
+    // (read through the debugger, so without the INT3) and sets the trap flag
+    bool Begin(IDebugger & debugger, HANDLE hThread, LPVOID lpAddress);
+    bool IsStepping(HANDLE hThread) const;
+
+    // Called with the exceptions of a stepping thread. Returns true if the
+    // exception only finished the step and must not be dispatched.
+    bool OnException(IDebugger & debugger, HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+
+    // The thread exited in the middle of a step
+    void Cancel(IDebugger & debugger, HANDLE hThread);
+    // The process is gone
+    void Clear(void);
+
+    SIZE_T GetSteps(void) const;
+
+private:
+    static ULONG_PTR *GetRegister(CONTEXT *pContext, int nRegister);
+    void End(IDebugger & debugger, StepMap::iterator i, CONTEXT *pContext);
+
+private:
+    StepMap m_Steps;
+    SIZE_T m_nSteps;
+};
+
+}
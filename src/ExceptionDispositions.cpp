@@ -0,0 +1,103 @@
+// ExceptionDispositions.cpp - What the debugger does with unclaimed exceptions implementation
+#include "stdafx.h"
+#include "ExceptionDispositions.h"
+
+namespace SDE
+{
+
+// Code 0 marks a free entry
+static const LONG cFree = 0;
+
+static int HashCode(DWORD dwCode)
+{
+    // The severity bits of most codes are alike, mix them into the low ones
+    DWORD dwHash = dwCode * 0x9E3779B1;
+    return(static_cast<int>((dwHash ^ (dwHash >> 16)) & (CExceptionDispositions::cMaxCodes - 1)));
+}
+
+CExceptionDispositions::CExceptionDispositions()
+{
+    ZeroMemory(m_Entries, sizeof(m_Entries));
+}
+
+CExceptionDispositions::~CExceptionDispositions()
+{
+}
+
+const CExceptionDispositions::Entry *CExceptionDispositions::Find(DWORD dwCode) const
+{
+    int n = HashCode(dwCode);
+    for (int i = 0; i < cMaxCodes; i++) {
+        const Entry & entry = m_Entries[n];
+        if (entry.lCode == static_cast<LONG>(dwCode))
+            return(&entry);
+        if (entry.lCode == cFree)
+            break;
+        n = (n + 1) & (cMaxCodes - 1);
+    }
+    return(NULL);
+}
+
+CExceptionDispositions::Entry *CExceptionDispositions::Insert(DWORD dwCode)
+{
+    if (dwCode == 0)
+        return(NULL);
+
+    int n = HashCode(dwCode);
+    for (int i = 0; i < cMaxCodes; i++) {
+        Entry & entry = m_Entries[n];
+        LONG lCode = entry.lCode;
+        if (lCode == cFree)
+            lCode = InterlockedCompareExchange(&entry.lCode, static_cast<LONG>(dwCode), cFree);
+        // Ours, or another thread took it for the same code
+        if (lCode == cFree || lCode == static_cast<LONG>(dwCode))
+            return(&entry);
+        n = (n + 1) & (cMaxCodes - 1);
+    }
+    return(NULL);
+}
+
+bool CExceptionDispositions::Set(DWORD dwCode, LONG lDisposition)
+{
+    Entry *pEntry = Insert(dwCode);
+    if (pEntry == NULL)
+        return(false);
+
+    InterlockedExchange(&pEntry->lDisposition, lDisposition);
+    return(true);
+}
+
+LONG CExceptionDispositions::Get(DWORD dwCode) const
+{
+    const Entry *pEntry = Find(dwCode);
+    if (pEntry == NULL)
+        return(cStop);
+    return(pEntry->lDisposition);
+}
+
+LONG CExceptionDispositions::Hit(DWORD dwCode)
+{
+    // Codes seen for the first time get an entry, so they're counted too
+    Entry *pEntry = Insert(dwCode);
+    if (pEntry == NULL)
+        return(cStop);
+
+    InterlockedIncrement(&pEntry->lCount);
+    return(pEntry->lDisposition);
+}
+
+LONG CExceptionDispositions::GetCount(DWORD dwCode) const
+{
+    const Entry *pEntry = Find(dwCode);
+    if (pEntry == NULL)
+        return(0);
+    return(pEntry->lCount);
+}
+
+void CExceptionDispositions::ResetCounts(void)
+{
+    for (int n = 0; n < cMaxCodes; n++)
+        InterlockedExchange(&m_Entries[n].lCount, 0);
+}
+
+}
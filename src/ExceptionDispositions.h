@@ -0,0 +1,47 @@
+// ExceptionDispositions.h - What the debugger does with unclaimed exceptions header
+#pragma once
+
+namespace SDE
+{
+
+// A disposition and a hit counter per exception code, for the exceptions no
+// breakpoint claimed. The table has a fixed size and its entries are never
+// moved or removed: a code takes an entry with a compare-and-swap the first
+// time it's set or seen, so any thread can change dispositions and read the
+// counters while the debugger thread looks codes up, without locks.
+class CExceptionDispositions
+{
+    struct Entry
+    {
+        volatile LONG lCode;
+        volatile LONG lDisposition;
+        volatile LONG lCount;
+    };
+public:
+    // Dispositions
+    static const LONG cStop = 0;    // Reported to the clients (the default)
+    static const LONG cPass = 1;    // Continued unhandled, the clients aren't called
+    static const LONG cSwallow = 2; // Continued as handled, the clients aren't called
+
+    static const int cMaxCodes = 256;
+
+    CExceptionDispositions();
+    ~CExceptionDispositions();
+
+    // Returns false if the table is full
+    bool Set(DWORD dwCode, LONG lDisposition);
+    LONG Get(DWORD dwCode) const;
+    // Counts an exception and returns its disposition
+    LONG Hit(DWORD dwCode);
+    LONG GetCount(DWORD dwCode) const;
+    void ResetCounts(void);
+
+private:
+    const Entry *Find(DWORD dwCode) const;
+    Entry *Insert(DWORD dwCode);
+
+private:
+    Entry m_Entries[cMaxCodes];
+};
+
+}
@@ -0,0 +1,163 @@
+// HardwareBreakPointOnExecution.cpp - Breakpoint on execution (using debug registers) implementation
+#include "stdafx.h"
+#include "HardwareBreakPointOnExecution.h"
+
+namespace SDE
+{
+
+// EFlags resume flag, lets the instruction run without hitting DRx again
+static const DWORD cResumeFlag = 0x10000;
+
+CHardwareBreakPointOnExecution::CHardwareBreakPointOnExecution(LPVOID lpVA)
+: m_bIsInitialized(false)
+, m_lpVA(lpVA)
+, m_nIndex(-1)
+, m_hProcess(NULL)
+, m_hThread(NULL)
+, m_pDebugger(NULL)
+{
+}
+
+CHardwareBreakPointOnExecution::~CHardwareBreakPointOnExecution()
+{
+    if (m_bIsInitialized == true)
+        Deinitialize();
+}
+
+bool CHardwareBreakPointOnExecution::SetAddress(LPVOID lpVA)
+{
+    bool bIsEnabled = (m_nIndex >= 0);
+
+    if (bIsEnabled == true)
+        Disable();
+
+    m_lpVA = lpVA;
+
+    // Re-key the breakpoint in the debugger's index
+    if (m_pDebugger)
+        m_pDebugger->UpdateBreakPoint(this);
+
+    if (bIsEnabled == true)
+        return(Enable());
+
+    return(true);
+}
+
+LPVOID CHardwareBreakPointOnExecution::GetAddress(void) const
+{
+    return(m_lpVA);
+}
+
+bool CHardwareBreakPointOnExecution::Initialize(IDebugger *pDebugger, HANDLE hProcess)
+{
+    // Breakpoint address must be initialized
+    if (m_lpVA == 0)
+        return(false);
+
+    // Initialize member variables
+    m_bIsInitialized = true;
+    m_hProcess = hProcess;
+    m_pDebugger = pDebugger;
+
+    return(true);
+}
+
+bool CHardwareBreakPointOnExecution::Enable(void)
+{
+    // Must be initialized first
+    if (m_bIsInitialized == false)
+        return(false);
+
+    if (m_lpVA == 0)
+        return(false);
+
+    // Is already enabled?
+    if (m_nIndex >= 0)
+        return(false);
+
+    // Take a debug register, nothing is written to the debuggee's code
+    m_nIndex = m_pDebugger->AllocateDebugRegister(m_lpVA, IDebugger::cDrExecute, 1);
+
+    return(m_nIndex >= 0);
+}
+
+bool CHardwareBreakPointOnExecution::Disable(void)
+{
+    // Must be initialized first
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already disabled?
+    if (m_nIndex < 0)
+        return(false);
+
+    m_pDebugger->FreeDebugRegister(m_nIndex);
+    m_nIndex = -1;
+
+    return(true);
+}
+
+void CHardwareBreakPointOnExecution::Deinitialize(void)
+{
+    // The debug register would stay taken otherwise
+    if (m_nIndex >= 0)
+        Disable();
+
+    m_bIsInitialized = false;
+}
+
+bool CHardwareBreakPointOnExecution::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    // Must be initialized and enabled
+    if (m_bIsInitialized == false || m_nIndex < 0)
+        return(false);
+
+    // Must be a first-chance exception
+    if (pException->dwFirstChance == 0)
+        return(false);
+
+    // Debug register hits are reported as EXCEPTION_SINGLE_STEP
+    if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return(false);
+
+    if (pException->ExceptionRecord.ExceptionAddress != m_lpVA)
+        return(false);
+
+    // DR6 tells which debug register was hit, a trap flag step shows none
+    _CONTEXT ctx;
+    ZeroMemory(&ctx, sizeof(_CONTEXT));
+    ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_DEBUG_REGISTERS;
+    m_pDebugger->GetThreadContext(hThread, &ctx);
+    if ((ctx.Dr6 & (static_cast<DWORD_PTR>(1) << m_nIndex)) == 0)
+        return(false);
+
+    // Clear the hit and let the instruction run when the thread continues
+    ctx.Dr6 &= ~(static_cast<DWORD_PTR>(1) << m_nIndex);
+    ctx.EFlags |= cResumeFlag;
+    m_pDebugger->SetThreadContext(hThread, &ctx);
+
+    m_hThread = hThread;
+
+    return(true);
+}
+
+HANDLE CHardwareBreakPointOnExecution::GetThread(void) const
+{
+    return(m_hThread);
+}
+
+HANDLE CHardwareBreakPointOnExecution::GetProcess(void) const
+{
+    return(m_hProcess);
+}
+
+bool CHardwareBreakPointOnExecution::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // Only a debug register hit at our address can trigger us
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = m_lpVA;
+    pKey->hThread = NULL;
+    return(true);
+}
+
+}
@@ -0,0 +1,37 @@
+// HardwareBreakPointOnExecution.h - Breakpoint on execution (using debug registers) header
+#pragma once
+
+#include "Defs.h"
+
+namespace SDE
+{
+
+class CHardwareBreakPointOnExecution : public IBreakPoint
+{
+public:
+    CHardwareBreakPointOnExecution(LPVOID lpVA = 0);
+    virtual ~CHardwareBreakPointOnExecution();
+
+    bool SetAddress(LPVOID lpVA);
+
+    // IBreakPoint implementation
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
+    virtual bool Enable(void);
+    virtual bool Disable(void);
+    virtual void Deinitialize(void);
+    virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    virtual HANDLE GetThread(void) const;
+    virtual HANDLE GetProcess(void) const;
+    virtual LPVOID GetAddress(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
+
+private:
+    bool m_bIsInitialized;
+    LPVOID m_lpVA;
+    int m_nIndex;
+    HANDLE m_hProcess;
+    HANDLE m_hThread;
+    IDebugger *m_pDebugger;
+};
+
+}
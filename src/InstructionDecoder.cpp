@@ -0,0 +1,321 @@
+// InstructionDecoder.cpp - x86/x86-64 instruction length decoder implementation
+#include "stdafx.h"
+#include "InstructionDecoder.h"
+
+namespace SDE
+{
+
+// Operand flags of an opcode
+#define M   0x01    // ModR/M (and SIB/displacement)
+#define B   0x02    // imm8
+#define W   0x04    // imm16
+#define Z   0x08    // imm16/32 by operand size
+#define V   0x10    // imm16/32/64 by operand size and REX.W
+#define A   0x20    // Far pointer, imm16 + imm16/32
+#define O   0x40    // Memory offset, by address size
+#define P   0x80    // Legacy prefix
+
+// One-byte opcodes
+static const BYTE c1ByteMap[256] = {
+//  0      1      2      3      4      5      6      7      8      9      A      B      C      D      E      F
+    M,     M,     M,     M,     B,     Z,     0,     0,     M,     M,     M,     M,     B,     Z,     0,     0,     // 00
+    M,     M,     M,     M,     B,     Z,     0,     0,     M,     M,     M,     M,     B,     Z,     0,     0,     // 10
+    M,     M,     M,     M,     B,     Z,     P,     0,     M,     M,     M,     M,     B,     Z,     P,     0,     // 20
+    M,     M,     M,     M,     B,     Z,     P,     0,     M,     M,     M,     M,     B,     Z,     P,     0,     // 30
+    0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     // 40
+    0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     // 50
+    0,     0,     M,     M,     P,     P,     P,     P,     Z,     M|Z,   B,     M|B,   0,     0,     0,     0,     // 60
+    B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     B,     // 70
+    M|B,   M|Z,   M|B,   M|B,   M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 80
+    0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     A,     0,     0,     0,     0,     0,     // 90
+    O,     O,     O,     O,     0,     0,     0,     0,     B,     Z,     0,     0,     0,     0,     0,     0,     // A0
+    B,     B,     B,     B,     B,     B,     B,     B,     V,     V,     V,     V,     V,     V,     V,     V,     // B0
+    M|B,   M|B,   W,     0,     M,     M,     M|B,   M|Z,   W|B,   0,     W,     0,     0,     B,     0,     0,     // C0
+    M,     M,     M,     M,     B,     B,     0,     0,     M,     M,     M,     M,     M,     M,     M,     M,     // D0
+    B,     B,     B,     B,     B,     B,     B,     B,     Z,     Z,     A,     B,     0,     0,     0,     0,     // E0
+    P,     0,     P,     P,     0,     0,     M,     M,     0,     0,     0,     0,     0,     0,     M,     M      // F0
+};
+
+// Two-byte opcodes (0F xx), 0F 38 and 0F 3A are handled separately
+static const BYTE c2ByteMap[256] = {
+//  0      1      2      3      4      5      6      7      8      9      A      B      C      D      E      F
+    M,     M,     M,     M,     0,     0,     0,     0,     0,     0,     0,     0,     0,     M,     0,     M|B,   // 00
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 10
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 20
+    0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     // 30
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 40
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 50
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 60
+    M|B,   M|B,   M|B,   M|B,   M,     M,     M,     0,     M,     M,     M,     M,     M,     M,     M,     M,     // 70
+    Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     Z,     // 80
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // 90
+    0,     0,     0,     M,     M|B,   M,     M,     M,     0,     0,     0,     M,     M|B,   M,     M,     M,     // A0
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M|B,   M,     M,     M,     M,     M,     // B0
+    M,     M,     M|B,   M,     M|B,   M|B,   M|B,   M,     0,     0,     0,     0,     0,     0,     0,     0,     // C0
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // D0
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     // E0
+    M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M,     M      // F0
+};
+
+// Opcode maps, as numbered by VEX/EVEX/XOP
+static const DWORD cMap0F = 1;
+static const DWORD cMap0F38 = 2;
+static const DWORD cMap0F3A = 3;
+static const DWORD cMapXop8 = 8;
+static const DWORD cMapXopA = 10;
+static const DWORD cMapVex = 0x100;
+
+// Operand flags of VEX/EVEX/XOP encoded opcodes
+static BYTE GetVexFlags(DWORD dwMap, BYTE bOpcode)
+{
+    switch (dwMap) {
+        case cMap0F:
+            if (bOpcode == 0x77)
+                return(0); // VZEROUPPER/VZEROALL
+            if ((bOpcode >= 0x70 && bOpcode <= 0x73) || bOpcode == 0xC2 || (bOpcode >= 0xC4 && bOpcode <= 0xC6))
+                return(M | B);
+            return(M);
+        case cMap0F3A:
+        case cMapXop8:
+            return(M | B);
+        default:
+            return(M);
+    }
+}
+
+int CInstructionDecoder::Decode(const BYTE *pCode, size_t nSize, bool b64Bit, InstructionInfo *pInfo)
+{
+    size_t nMax = (nSize < static_cast<size_t>(cMaxLength)) ? nSize : static_cast<size_t>(cMaxLength);
+    size_t n = 0;
+    int nPrefixes = 0;
+    bool bOperandSize = false;
+    bool bAddressSize = false;
+    bool bRep = false;
+    bool bRexW = false;
+
+    // Legacy prefixes, then REX (a REX followed by another prefix is ignored)
+    for (;;) {
+        if (n >= nMax)
+            return(0);
+
+        BYTE b = pCode[n];
+        if (c1ByteMap[b] == P) {
+            if (b == 0x66)
+                bOperandSize = true;
+            else if (b == 0x67)
+                bAddressSize = true;
+            else if (b == 0xF2 || b == 0xF3)
+                bRep = true;
+            bRexW = false;
+        } else if (b64Bit && (b & 0xF0) == 0x40) {
+            bRexW = (b & 0x08) ? true : false;
+        } else {
+            break;
+        }
+        n++;
+        nPrefixes++;
+    }
+
+    size_t nOpcodeOffset = n;
+    BYTE bOpcode = pCode[n++];
+    DWORD dwMap = 0;
+    BYTE bFlags = 0;
+
+    if (bOpcode == 0x0F) {
+        if (n >= nMax)
+            return(0);
+        bOpcode = pCode[n++];
+        if (bOpcode == 0x38 || bOpcode == 0x3A) {
+            dwMap = (bOpcode == 0x38) ? cMap0F38 : cMap0F3A;
+            bFlags = (bOpcode == 0x38) ? M : (M | B);
+            if (n >= nMax)
+                return(0);
+            bOpcode = pCode[n++];
+        } else {
+            dwMap = cMap0F;
+            bFlags = c2ByteMap[bOpcode];
+            // EXTRQ/INSERTQ take two imm8
+            if (bOpcode == 0x78 && (bOperandSize || bRep))
+                bFlags = M | W;
+        }
+    } else if (bOpcode == 0xC4 || bOpcode == 0xC5 || bOpcode == 0x62 || bOpcode == 0x8F) {
+        // VEX/EVEX outside 64-bit mode, and XOP, are told apart from LES/LDS/BOUND/POP
+        // by the next byte, which would be their ModR/M
+        bool bVex = false;
+        if (n < nMax) {
+            BYTE bNext = pCode[n];
+            if (bOpcode == 0x8F)
+                bVex = ((bNext & 0x1F) >= 8);
+            else
+                bVex = b64Bit || ((bNext & 0xC0) == 0xC0);
+        }
+
+        if (bVex == false) {
+            bFlags = c1ByteMap[bOpcode];
+        } else {
+            size_t nPayload = (bOpcode == 0xC5) ? 1 : (bOpcode == 0x62) ? 3 : 2;
+            if (n + nPayload >= nMax)
+                return(0);
+
+            if (bOpcode == 0xC5)
+                dwMap = cMap0F;
+            else if (bOpcode == 0x62)
+                dwMap = pCode[n] & 0x07;
+            else
+                dwMap = pCode[n] & 0x1F;
+            n += nPayload;
+
+            bOpcode = pCode[n++];
+            bFlags = GetVexFlags(dwMap, bOpcode);
+            dwMap |= cMapVex;
+        }
+    } else {
+        bFlags = c1ByteMap[bOpcode];
+    }
+
+    // ModR/M, SIB and displacement
+    BYTE bReg = 0;
+    size_t nModRMOffset = 0;
+    bool bRipRelative = false;
+    if (bFlags & M) {
+        if (n >= nMax)
+            return(0);
+        nModRMOffset = n;
+        BYTE bModRM = pCode[n++];
+        BYTE bMod = bModRM >> 6;
+        BYTE bRm = bModRM & 0x07;
+        bReg = (bModRM >> 3) & 0x07;
+
+        if (bMod != 3) {
+            if (bAddressSize && b64Bit == false) {
+                // 16-bit addressing, no SIB
+                if (bMod == 0 && bRm == 6)
+                    n += 2;
+                else if (bMod == 1)
+                    n += 1;
+                else if (bMod == 2)
+                    n += 2;
+            } else {
+                if (bRm == 4) {
+                    if (n >= nMax)
+                        return(0);
+                    BYTE bSib = pCode[n++];
+                    if (bMod == 0 && (bSib & 0x07) == 5)
+                        n += 4;
+                } else if (bMod == 0 && bRm == 5) {
+                    n += 4; // disp32, RIP relative in 64-bit mode
+                    bRipRelative = b64Bit;
+                }
+                if (bMod == 1)
+                    n += 1;
+                else if (bMod == 2)
+                    n += 4;
+            }
+        }
+
+        // TEST in group 3 has an immediate, NOT/NEG/MUL/DIV don't
+        if (dwMap == 0 && (bOpcode == 0xF6 || bOpcode == 0xF7) && bReg < 2)
+            bFlags |= (bOpcode == 0xF6) ? B : Z;
+    }
+
+    // Immediates
+    if (bFlags & B)
+        n += 1;
+    if (bFlags & W)
+        n += 2;
+    if (bFlags & Z) {
+        // Near branches are rel32 in 64-bit mode whatever the operand size
+        bool bRel32 = b64Bit && ((dwMap == 0 && (bOpcode == 0xE8 || bOpcode == 0xE9)) || (dwMap == cMap0F && (bOpcode & 0xF0) == 0x80));
+        n += (bOperandSize && bRel32 == false) ? 2 : 4;
+    }
+    if (bFlags & V)
+        n += bRexW ? 8 : (bOperandSize ? 2 : 4);
+    if (bFlags & A)
+        n += bOperandSize ? 4 : 6;
+    if (bFlags & O) {
+        if (b64Bit)
+            n += bAddressSize ? 4 : 8;
+        else
+            n += bAddressSize ? 2 : 4;
+    }
+    if (dwMap == (cMapVex | cMapXopA))
+        n += 4;
+
+    if (n > nMax)
+        return(0);
+
+    // Classify
+    DWORD dwFlags = 0;
+    if (bRipRelative)
+        dwFlags |= cRipRelative;
+    if ((dwMap == 0 && ((bOpcode >= 0x70 && bOpcode <= 0x7F) || (bOpcode >= 0xE0 && bOpcode <= 0xE3) || bOpcode == 0xE8 || bOpcode == 0xE9 || bOpcode == 0xEB)) ||
+        (dwMap == cMap0F && (bOpcode & 0xF0) == 0x80))
+        dwFlags |= cRelativeBranch;
+    if (dwMap == 0) {
+        if (bOpcode == 0xE8 || bOpcode == 0x9A || (bOpcode == 0xFF && (bReg == 2 || bReg == 3)))
+            dwFlags |= cCall;
+        if (bRep && ((bOpcode >= 0x6C && bOpcode <= 0x6F) || (bOpcode >= 0xA4 && bOpcode <= 0xA7) || (bOpcode >= 0xAA && bOpcode <= 0xAF)))
+            dwFlags |= cRepString;
+        if (bOpcode == 0xCC || bOpcode == 0xCD || bOpcode == 0xCE)
+            dwFlags |= cInterrupt;
+        if (bOpcode == 0xC2 || bOpcode == 0xC3 || bOpcode == 0xCA || bOpcode == 0xCB || bOpcode == 0xCF ||
+            bOpcode == 0xEA || bOpcode == 0xF1 || (bOpcode == 0xFF && bReg >= 2 && bReg <= 5))
+            dwFlags |= cBranch;
+    } else if (dwMap == cMap0F) {
+        // SYSCALL, SYSRET, SYSENTER, SYSEXIT
+        if (bOpcode == 0x05 || bOpcode == 0x07 || bOpcode == 0x34 || bOpcode == 0x35)
+            dwFlags |= cBranch;
+        if (bOpcode == 0x05 || bOpcode == 0x34)
+            dwFlags |= cSystemCall;
+    }
+    if (dwFlags & (cRelativeBranch | cCall | cInterrupt))
+        dwFlags |= cBranch;
+
+    if (pInfo) {
+        pInfo->nLength = static_cast<int>(n);
+        pInfo->nPrefixes = nPrefixes;
+        pInfo->nOpcodeOffset = static_cast<int>(nOpcodeOffset);
+        pInfo->nModRMOffset = static_cast<int>(nModRMOffset);
+        pInfo->bOpcode = bOpcode;
+        pInfo->dwMap = dwMap;
+        pInfo->dwFlags = dwFlags;
+    }
+
+    return(static_cast<int>(n));
+}
+
+int CInstructionDecoder::Decode(const BYTE *pCode, size_t nSize, InstructionInfo *pInfo)
+{
+#if defined(_WIN64) || defined(__x86_64__)
+    return(Decode(pCode, nSize, true, pInfo));
+#else
+    return(Decode(pCode, nSize, false, pInfo));
+#endif
+}
+
+int CInstructionDecoder::Decode(IDebugger & debugger, LPCVOID lpAddress, BYTE *pCode, InstructionInfo *pInfo)
+{
+    SIZE_T nNumRead = 0;
+    if (debugger.ReadProcessMemory(lpAddress, pCode, cMaxLength, &nNumRead) == FALSE) {
+        SIZE_T nToPageEnd = 0x1000 - (reinterpret_cast<ULONG_PTR>(lpAddress) & 0xFFF);
+        nNumRead = 0;
+        if (nToPageEnd < static_cast<SIZE_T>(cMaxLength))
+            debugger.ReadProcessMemory(lpAddress, pCode, nToPageEnd, &nNumRead);
+    }
+
+    if (nNumRead == 0)
+        return(0);
+
+    return(Decode(pCode, nNumRead, pInfo));
+}
+
+#undef M
+#undef B
+#undef W
+#undef Z
+#undef V
+#undef A
+#undef O
+#undef P
+
+}
@@ -0,0 +1,51 @@
+// InstructionDecoder.h - x86/x86-64 instruction length decoder header
+#pragma once
+
+#include "Defs.h"
+
+namespace SDE
+{
+
+// What the decoder found out about an instruction
+struct InstructionInfo
+{
+    int nLength;            // Total length, prefixes included
+    int nPrefixes;          // Legacy and REX prefixes
+    int nOpcodeOffset;      // First opcode byte (0F, VEX/EVEX/XOP included)
+    int nModRMOffset;       // ModR/M byte, 0 if there is none
+    BYTE bOpcode;           // Last opcode byte
+    DWORD dwMap;            // 0 one-byte, 1 0F, 2 0F38, 3 0F3A, 0x100+ VEX/EVEX/XOP maps
+    DWORD dwFlags;          // cCall, cRepString...
+};
+
+// Decodes instruction lengths with per-opcode tables (ModR/M, immediate
+// sizes), handling legacy/REX/VEX/EVEX/XOP prefixes, SIB and displacements.
+// It doesn't validate the instructions beyond what's needed for the length.
+class CInstructionDecoder
+{
+public:
+    static const int cMaxLength = 15;
+
+    // Instruction kinds
+    static const DWORD cCall = 0x01;        // CALL near/far
+    static const DWORD cRepString = 0x02;   // REP/REPcc string operation
+    static const DWORD cInterrupt = 0x04;   // INT3, INT n, INTO
+    static const DWORD cRipRelative = 0x08; // Memory operand relative to the next instruction (x64)
+    static const DWORD cRelativeBranch = 0x10; // JMP/Jcc/CALL/LOOP/JrCXZ with a relative target
+    static const DWORD cBranch = 0x20;      // Any transfer of control: jumps, calls, returns, interrupts, system calls
+    static const DWORD cSystemCall = 0x40;  // SYSCALL, SYSENTER
+    static const DWORD cStepOver = cCall | cRepString | cInterrupt;
+
+    // Decodes the instruction in pCode (nSize bytes available), returns its
+    // length, or 0 if it is longer than nSize or cMaxLength bytes
+    static int Decode(const BYTE *pCode, size_t nSize, bool b64Bit, InstructionInfo *pInfo);
+
+    // Decodes for the mode the library was built for
+    static int Decode(const BYTE *pCode, size_t nSize, InstructionInfo *pInfo);
+
+    // Reads the instruction at lpAddress in the debuggee into pCode (cMaxLength
+    // bytes) and decodes it, an unreadable page may cut the read short
+    static int Decode(IDebugger & debugger, LPCVOID lpAddress, BYTE *pCode, InstructionInfo *pInfo);
+};
+
+}
@@ -8,7 +8,7 @@ namespace SDE
 class CInterruptFlagSet
 {
 public:
-    static bool SetInterruptFlag(HANDLE hThread)
+    static bool SetInterruptFlag(IDebugger & debugger, HANDLE hThread)
     {
         if (hThread == NULL)
             return(false);
@@ -16,13 +16,13 @@ public:
         _CONTEXT ctx;
         ZeroMemory(&ctx, sizeof(_CONTEXT));
         ctx.ContextFlags = CONTEXT_CONTROL;
-        GetThreadContext(hThread, &ctx);
+        debugger.GetThreadContext(hThread, &ctx);
         ctx.EFlags |= 0x100;
-        SetThreadContext(hThread, &ctx);
+        debugger.SetThreadContext(hThread, &ctx);
 
         return(true);
     }
-    static bool ClearInterruptFlag(HANDLE hThread)
+    static bool ClearInterruptFlag(IDebugger & debugger, HANDLE hThread)
     {
         if (hThread == NULL)
             return(false);
@@ -30,9 +30,9 @@ public:
         _CONTEXT ctx;
         ZeroMemory(&ctx, sizeof(_CONTEXT));
         ctx.ContextFlags = CONTEXT_CONTROL;
-        GetThreadContext(hThread, &ctx);
+        debugger.GetThreadContext(hThread, &ctx);
         ctx.EFlags &= ~0x100;
-        SetThreadContext(hThread, &ctx);
+        debugger.SetThreadContext(hThread, &ctx);
 
         return(true);
     }
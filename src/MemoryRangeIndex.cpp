@@ -0,0 +1,238 @@
+// MemoryRangeIndex.cpp - Watched memory ranges and guard pages of a debuggee
+#include "stdafx.h"
+#include "MemoryRangeIndex.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace SDE
+{
+
+static const ULONG_PTR cPageSize = 0x1000;
+
+CMemoryRangeIndex::CMemoryRangeIndex()
+: m_nRanges(0)
+{
+}
+
+CMemoryRangeIndex::~CMemoryRangeIndex()
+{
+}
+
+ULONG_PTR CMemoryRangeIndex::PageOf(ULONG_PTR ulpAddress)
+{
+    return(ulpAddress & ~(cPageSize - 1));
+}
+
+void CMemoryRangeIndex::Release(PageMap::iterator i)
+{
+    if (i->second.Ranges.empty() == true && i->second.lGuards == 0 && i->second.bRearm == false)
+        m_Pages.erase(i);
+}
+
+void CMemoryRangeIndex::Insert(IBreakPoint *pOwner, const RangePair & range)
+{
+    Range r;
+    r.ulpLow = reinterpret_cast<ULONG_PTR>(range.first);
+    r.ulpHigh = reinterpret_cast<ULONG_PTR>(range.second);
+    r.pOwner = pOwner;
+    if (r.ulpHigh < r.ulpLow)
+        return;
+
+    // Every page of the range points back to it
+    for (ULONG_PTR ulpPage = PageOf(r.ulpLow); ; ulpPage += cPageSize) {
+        m_Pages[ulpPage].Ranges.push_back(r);
+        if (ulpPage == PageOf(r.ulpHigh))
+            break;
+    }
+    m_nRanges++;
+}
+
+void CMemoryRangeIndex::Remove(IBreakPoint *pOwner, const RangePair & range)
+{
+    ULONG_PTR ulpLow = reinterpret_cast<ULONG_PTR>(range.first);
+    ULONG_PTR ulpHigh = reinterpret_cast<ULONG_PTR>(range.second);
+    if (ulpHigh < ulpLow)
+        return;
+
+    bool bRemoved = false;
+    for (ULONG_PTR ulpPage = PageOf(ulpLow); ; ulpPage += cPageSize) {
+        PageMap::iterator i = m_Pages.find(ulpPage);
+        if (i != m_Pages.end()) {
+            RangeList & ranges = i->second.Ranges;
+            for (size_t n = 0; n < ranges.size(); n++) {
+                if (ranges[n].pOwner == pOwner && ranges[n].ulpLow == ulpLow && ranges[n].ulpHigh == ulpHigh) {
+                    ranges.erase(ranges.begin() + n);
+                    bRemoved = true;
+                    break;
+                }
+            }
+            Release(i);
+        }
+        if (ulpPage == PageOf(ulpHigh))
+            break;
+    }
+
+    if (bRemoved == true)
+        m_nRanges--;
+}
+
+bool CMemoryRangeIndex::IsEmpty(void) const
+{
+    return(m_nRanges == 0 && m_Pages.empty() == true);
+}
+
+bool CMemoryRangeIndex::Contains(IBreakPoint *pOwner, ULONG_PTR ulpAddress) const
+{
+    PageMap::const_iterator i = m_Pages.find(PageOf(ulpAddress));
+    if (i == m_Pages.end())
+        return(false);
+
+    const RangeList & ranges = i->second.Ranges;
+    for (size_t n = 0; n < ranges.size(); n++) {
+        if (ranges[n].pOwner == pOwner && ulpAddress >= ranges[n].ulpLow && ulpAddress <= ranges[n].ulpHigh)
+            return(true);
+    }
+    return(false);
+}
+
+bool CMemoryRangeIndex::Guard(HANDLE hProcess, const RangeVector & ranges)
+{
+    // Collect the pages that become guarded
+    PageVector Pages;
+    for (size_t n = 0; n < ranges.size(); n++) {
+        ULONG_PTR ulpLow = reinterpret_cast<ULONG_PTR>(ranges[n].first);
+        ULONG_PTR ulpHigh = reinterpret_cast<ULONG_PTR>(ranges[n].second);
+        if (ulpHigh < ulpLow)
+            continue;
+
+        for (ULONG_PTR ulpPage = PageOf(ulpLow); ; ulpPage += cPageSize) {
+            if (++m_Pages[ulpPage].lGuards == 1)
+                Pages.push_back(ulpPage);
+            if (ulpPage == PageOf(ulpHigh))
+                break;
+        }
+    }
+
+    return(ProtectRuns(hProcess, Pages, true));
+}
+
+bool CMemoryRangeIndex::Unguard(HANDLE hProcess, const RangeVector & ranges)
+{
+    // Collect the pages that are no longer guarded
+    PageVector Pages;
+    for (size_t n = 0; n < ranges.size(); n++) {
+        ULONG_PTR ulpLow = reinterpret_cast<ULONG_PTR>(ranges[n].first);
+        ULONG_PTR ulpHigh = reinterpret_cast<ULONG_PTR>(ranges[n].second);
+        if (ulpHigh < ulpLow)
+            continue;
+
+        for (ULONG_PTR ulpPage = PageOf(ulpLow); ; ulpPage += cPageSize) {
+            PageMap::iterator i = m_Pages.find(ulpPage);
+            if (i != m_Pages.end() && i->second.lGuards > 0 && --i->second.lGuards == 0)
+                Pages.push_back(ulpPage);
+            if (ulpPage == PageOf(ulpHigh))
+                break;
+        }
+    }
+
+    bool bRet = ProtectRuns(hProcess, Pages, false);
+
+    for (size_t n = 0; n < Pages.size(); n++) {
+        PageMap::iterator i = m_Pages.find(Pages[n]);
+        if (i != m_Pages.end())
+            Release(i);
+    }
+
+    return(bRet);
+}
+
+bool CMemoryRangeIndex::ProtectRuns(HANDLE hProcess, const PageVector & Pages, bool bGuard)
+{
+    if (Pages.empty() == true)
+        return(true);
+
+    PageVector Sorted(Pages);
+    sort(Sorted.begin(), Sorted.end());
+    Sorted.erase(unique(Sorted.begin(), Sorted.end()), Sorted.end());
+
+    bool bRet = true;
+    size_t n = 0;
+    while (n < Sorted.size()) {
+        ULONG_PTR ulpStart = Sorted[n];
+        DWORD dwProtect = 0;
+
+        if (bGuard == true) {
+            // Ask the real protection of the run once, it is kept to restore and re-guard the pages
+            MEMORY_BASIC_INFORMATION mbi;
+            if (VirtualQueryEx(hProcess, reinterpret_cast<LPCVOID>(ulpStart), &mbi, sizeof(mbi)) == 0 || mbi.State != MEM_COMMIT) {
+                bRet = false;
+                n++;
+                continue;
+            }
+            dwProtect = mbi.Protect & ~PAGE_GUARD;
+            ULONG_PTR ulpRegionEnd = reinterpret_cast<ULONG_PTR>(mbi.BaseAddress) + mbi.RegionSize;
+
+            m_Pages[ulpStart].dwProtect = dwProtect;
+            size_t nEnd = n + 1;
+            while (nEnd < Sorted.size() && Sorted[nEnd] == Sorted[nEnd - 1] + cPageSize && Sorted[nEnd] < ulpRegionEnd) {
+                m_Pages[Sorted[nEnd]].dwProtect = dwProtect;
+                nEnd++;
+            }
+
+            DWORD dwOldProtect = 0;
+            if (VirtualProtectEx(hProcess, reinterpret_cast<LPVOID>(ulpStart), (nEnd - n) * cPageSize, dwProtect | PAGE_GUARD, &dwOldProtect) == FALSE)
+                bRet = false;
+            n = nEnd;
+        } else {
+            // Restore consecutive pages that had the same protection at once
+            dwProtect = m_Pages[ulpStart].dwProtect;
+            size_t nEnd = n + 1;
+            while (nEnd < Sorted.size() && Sorted[nEnd] == Sorted[nEnd - 1] + cPageSize && m_Pages[Sorted[nEnd]].dwProtect == dwProtect)
+                nEnd++;
+
+            DWORD dwOldProtect = 0;
+            if (VirtualProtectEx(hProcess, reinterpret_cast<LPVOID>(ulpStart), (nEnd - n) * cPageSize, dwProtect, &dwOldProtect) == FALSE)
+                bRet = false;
+            n = nEnd;
+        }
+    }
+
+    return(bRet);
+}
+
+bool CMemoryRangeIndex::IsGuarded(ULONG_PTR ulpAddress) const
+{
+    PageMap::const_iterator i = m_Pages.find(PageOf(ulpAddress));
+    return(i != m_Pages.end() && i->second.lGuards > 0);
+}
+
+bool CMemoryRangeIndex::BeginRearm(ULONG_PTR ulpAddress)
+{
+    PageMap::iterator i = m_Pages.find(PageOf(ulpAddress));
+    if (i == m_Pages.end() || i->second.lGuards == 0 || i->second.bRearm == true)
+        return(false);
+
+    i->second.bRearm = true;
+    return(true);
+}
+
+bool CMemoryRangeIndex::EndRearm(HANDLE hProcess, ULONG_PTR ulpAddress)
+{
+    PageMap::iterator i = m_Pages.find(PageOf(ulpAddress));
+    if (i == m_Pages.end() || i->second.bRearm == false)
+        return(false);
+
+    i->second.bRearm = false;
+
+    // Unguarded meanwhile?
+    if (i->second.lGuards == 0) {
+        Release(i);
+        return(true);
+    }
+
+    DWORD dwOldProtect = 0;
+    return(VirtualProtectEx(hProcess, reinterpret_cast<LPVOID>(i->first), cPageSize, i->second.dwProtect | PAGE_GUARD, &dwOldProtect) != FALSE);
+}
+
+}
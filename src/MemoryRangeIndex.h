@@ -0,0 +1,76 @@
+// MemoryRangeIndex.h - Watched memory ranges and guard pages of a debuggee
+#pragma once
+
+#include "Defs.h"
+#include <utility>
+#include <vector>
+#include <map>
+
+namespace SDE
+{
+
+// Keeps the ranges watched by the memory range breakpoints of one debugger,
+// indexed by page:
+// - the ranges touching a faulting address are found with one map lookup
+// - each page counts the enabled ranges guarding it, so it is protected when
+//   the first one is enabled and restored when the last one is disabled
+// - protection changes are made once per run of consecutive pages
+// Ranges are inclusive, like the RangePairs of CBreakPointOnMemoryRange.
+class CMemoryRangeIndex
+{
+public:
+    typedef std::pair<LPVOID, LPVOID> RangePair;
+    typedef std::vector<RangePair> RangeVector;
+
+    CMemoryRangeIndex();
+    ~CMemoryRangeIndex();
+
+    void Insert(IBreakPoint *pOwner, const RangePair & range);
+    void Remove(IBreakPoint *pOwner, const RangePair & range);
+    bool IsEmpty(void) const;
+
+    // Does one of the owner's ranges contain the address?
+    bool Contains(IBreakPoint *pOwner, ULONG_PTR ulpAddress) const;
+
+    // Adds/releases a guard reference on each page of the ranges
+    bool Guard(HANDLE hProcess, const RangeVector & ranges);
+    bool Unguard(HANDLE hProcess, const RangeVector & ranges);
+    bool IsGuarded(ULONG_PTR ulpAddress) const;
+
+    // A guard page fault removes the guard of its page. The first caller of
+    // BeginRearm steps over the faulting instruction, then calls EndRearm to
+    // guard the page again.
+    bool BeginRearm(ULONG_PTR ulpAddress);
+    bool EndRearm(HANDLE hProcess, ULONG_PTR ulpAddress);
+
+private:
+    struct Range
+    {
+        ULONG_PTR ulpLow;
+        ULONG_PTR ulpHigh;
+        IBreakPoint *pOwner;
+    };
+    typedef std::vector<Range> RangeList;
+
+    struct Page
+    {
+        Page() : lGuards(0), dwProtect(0), bRearm(false) {}
+
+        RangeList Ranges;
+        LONG lGuards;
+        DWORD dwProtect;
+        bool bRearm;
+    };
+    typedef std::map<ULONG_PTR, Page> PageMap;
+    typedef std::vector<ULONG_PTR> PageVector;
+
+    static ULONG_PTR PageOf(ULONG_PTR ulpAddress);
+    void Release(PageMap::iterator i);
+    bool ProtectRuns(HANDLE hProcess, const PageVector & Pages, bool bGuard);
+
+private:
+    PageMap m_Pages;
+    size_t m_nRanges;
+};
+
+}
@@ -0,0 +1,158 @@
+// PageCache.cpp - Debuggee memory page cache implementation
+#include "stdafx.h"
+#include "PageCache.h"
+
+using namespace std;
+
+namespace SDE
+{
+
+CPageCache::CPageCache()
+: m_nHits(0)
+, m_nMisses(0)
+{
+}
+
+CPageCache::~CPageCache()
+{
+    Invalidate();
+
+    for (size_t i = 0; i < m_FreeBuffers.size(); i++)
+        delete [] m_FreeBuffers[i];
+}
+
+BOOL CPageCache::Read(HANDLE hProcess, LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead)
+{
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(lpBaseAddress);
+    LPBYTE lpDest = reinterpret_cast<LPBYTE>(lpBuffer);
+    SIZE_T nRead = 0;
+
+    while (nRead < nSize) {
+        ULONG_PTR ulpPage = ulpAddress & ~(cPageSize - 1);
+        SIZE_T nOffset = ulpAddress - ulpPage;
+        SIZE_T nChunk = cPageSize - nOffset;
+        if (nChunk > nSize - nRead)
+            nChunk = nSize - nRead;
+
+        LPBYTE lpData = Find(ulpPage);
+        if (lpData) {
+            m_nHits++;
+        } else {
+            m_nMisses++;
+            lpData = Load(hProcess, ulpPage);
+        }
+
+        if (lpData == 0) {
+            // The page can't be read as a whole, read what we can of it directly
+            SIZE_T nDone = 0;
+            ::ReadProcessMemory(hProcess, reinterpret_cast<LPCVOID>(ulpAddress), lpDest + nRead, nChunk, &nDone);
+            nRead += nDone;
+            break;
+        }
+
+        memcpy(lpDest + nRead, lpData + nOffset, nChunk);
+        nRead += nChunk;
+        ulpAddress += nChunk;
+    }
+
+    if (lpNumberOfBytesRead)
+        *lpNumberOfBytesRead = nRead;
+
+    return((nSize && nRead == nSize) ? TRUE : FALSE);
+}
+
+void CPageCache::Write(LPCVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize)
+{
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(lpBaseAddress);
+    const BYTE *lpSource = reinterpret_cast<const BYTE *>(lpBuffer);
+    SIZE_T nDone = 0;
+
+    // Apply the written bytes to the pages we hold
+    while (nDone < nSize) {
+        ULONG_PTR ulpPage = ulpAddress & ~(cPageSize - 1);
+        SIZE_T nOffset = ulpAddress - ulpPage;
+        SIZE_T nChunk = cPageSize - nOffset;
+        if (nChunk > nSize - nDone)
+            nChunk = nSize - nDone;
+
+        LPBYTE lpData = Find(ulpPage);
+        if (lpData)
+            memcpy(lpData + nOffset, lpSource + nDone, nChunk);
+
+        nDone += nChunk;
+        ulpAddress += nChunk;
+    }
+}
+
+void CPageCache::Invalidate(void)
+{
+    // Keep the buffers for the next stop
+    for (size_t i = 0; i < m_Pages.size(); i++)
+        m_FreeBuffers.push_back(m_Pages[i].lpData);
+    m_Pages.clear();
+}
+
+SIZE_T CPageCache::GetHits(void) const
+{
+    return(m_nHits);
+}
+
+SIZE_T CPageCache::GetMisses(void) const
+{
+    return(m_nMisses);
+}
+
+void CPageCache::ResetCounters(void)
+{
+    m_nHits = 0;
+    m_nMisses = 0;
+}
+
+LPBYTE CPageCache::Find(ULONG_PTR ulpPage) const
+{
+    // Pages are kept sorted by address
+    size_t nLow = 0, nHigh = m_Pages.size();
+    while (nLow < nHigh) {
+        size_t nMid = (nLow + nHigh) / 2;
+        if (m_Pages[nMid].ulpAddress < ulpPage)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+
+    if (nLow < m_Pages.size() && m_Pages[nLow].ulpAddress == ulpPage)
+        return(m_Pages[nLow].lpData);
+
+    return(0);
+}
+
+LPBYTE CPageCache::Load(HANDLE hProcess, ULONG_PTR ulpPage)
+{
+    LPBYTE lpData = 0;
+    if (m_FreeBuffers.empty() == false) {
+        lpData = m_FreeBuffers.back();
+        m_FreeBuffers.pop_back();
+    } else {
+        lpData = new BYTE[cPageSize];
+    }
+
+    SIZE_T nRead = 0;
+    ::ReadProcessMemory(hProcess, reinterpret_cast<LPCVOID>(ulpPage), lpData, cPageSize, &nRead);
+    if (nRead != cPageSize) {
+        m_FreeBuffers.push_back(lpData);
+        return(0);
+    }
+
+    // Insert in address order
+    Page page;
+    page.ulpAddress = ulpPage;
+    page.lpData = lpData;
+    PageVector::iterator i = m_Pages.begin();
+    while (i != m_Pages.end() && i->ulpAddress < ulpPage)
+        ++i;
+    m_Pages.insert(i, page);
+
+    return(lpData);
+}
+
+}
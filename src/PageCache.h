@@ -0,0 +1,46 @@
+// PageCache.h - Debuggee memory page cache header
+#pragma once
+
+#include <vector>
+
+namespace SDE
+{
+
+// Keeps copies of the debuggee's pages read during a stop. The debuggee can't
+// change its memory while stopped, so the pages stay valid until it continues,
+// as long as our own writes are applied to the cached copies too.
+class CPageCache
+{
+    struct Page
+    {
+        ULONG_PTR ulpAddress;
+        LPBYTE lpData;
+    };
+    typedef std::vector<Page> PageVector;
+    typedef std::vector<LPBYTE> BufferVector;
+public:
+    static const SIZE_T cPageSize = 0x1000;
+
+    CPageCache();
+    ~CPageCache();
+
+    BOOL Read(HANDLE hProcess, LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead);
+    void Write(LPCVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize);
+    void Invalidate(void);
+
+    SIZE_T GetHits(void) const;
+    SIZE_T GetMisses(void) const;
+    void ResetCounters(void);
+
+private:
+    LPBYTE Find(ULONG_PTR ulpPage) const;
+    LPBYTE Load(HANDLE hProcess, ULONG_PTR ulpPage);
+
+private:
+    PageVector m_Pages;
+    BufferVector m_FreeBuffers;
+    SIZE_T m_nHits;
+    SIZE_T m_nMisses;
+};
+
+}
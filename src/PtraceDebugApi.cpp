@@ -0,0 +1,1968 @@
+// PtraceDebugApi.cpp - Win32 debugging API subset on top of Linux ptrace
+#include "stdafx.h"
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <elf.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+
+const int cMaxTracers = 64;
+const DWORD cTrapFlag = 0x100;
+
+// Handles
+HANDLE MakeHandle(pid_t id)
+{
+    return(reinterpret_cast<HANDLE>((static_cast<ULONG_PTR>(id) << 1) | 1));
+}
+
+pid_t HandleToId(HANDLE h)
+{
+    ULONG_PTR ulp = reinterpret_cast<ULONG_PTR>(h);
+    if ((ulp & 1) == 0)
+        return(0);
+    return(static_cast<pid_t>(ulp >> 1));
+}
+
+DWORD GetTickMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(static_cast<DWORD>(ts.tv_sec * 1000 + ts.tv_nsec / 1000000));
+}
+
+ULONG_PTR PageSize(void)
+{
+    static ULONG_PTR ulpPageSize = static_cast<ULONG_PTR>(sysconf(_SC_PAGESIZE));
+    return(ulpPageSize);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// SIGCHLD self-pipes, one per tracer thread
+
+volatile int g_nWakeFds[cMaxTracers];
+struct sigaction g_OldChildAction;
+pthread_once_t g_ChildHandlerOnce = PTHREAD_ONCE_INIT;
+
+void ChildSignalHandler(int nSignal, siginfo_t *pInfo, void *pContext)
+{
+    int nSavedErrno = errno;
+    for (int i = 0; i < cMaxTracers; i++) {
+        int fd = g_nWakeFds[i];
+        if (fd > 0) {
+            char c = 0;
+            ssize_t n = write(fd, &c, 1);
+            (void)n;
+        }
+    }
+    errno = nSavedErrno;
+
+    // Chain to the handler that was installed before us
+    if (g_OldChildAction.sa_flags & SA_SIGINFO) {
+        if (g_OldChildAction.sa_sigaction)
+            g_OldChildAction.sa_sigaction(nSignal, pInfo, pContext);
+    } else if (g_OldChildAction.sa_handler != SIG_DFL && g_OldChildAction.sa_handler != SIG_IGN) {
+        g_OldChildAction.sa_handler(nSignal);
+    }
+}
+
+void InstallChildHandler(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = ChildSignalHandler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, &g_OldChildAction);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// /proc/<pid>/mem descriptors, shared by all threads of the debugger
+
+pthread_mutex_t g_MemFdLock = PTHREAD_MUTEX_INITIALIZER;
+map<pid_t, int> g_MemFds;
+
+int GetMemFd(pid_t pid)
+{
+    pthread_mutex_lock(&g_MemFdLock);
+    map<pid_t, int>::iterator i = g_MemFds.find(pid);
+    int fd = -1;
+    if (i != g_MemFds.end()) {
+        fd = i->second;
+    } else {
+        char szPath[64];
+        snprintf(szPath, sizeof(szPath), "/proc/%d/mem", static_cast<int>(pid));
+        fd = open(szPath, O_RDWR | O_CLOEXEC);
+        if (fd >= 0)
+            g_MemFds[pid] = fd;
+    }
+    pthread_mutex_unlock(&g_MemFdLock);
+    return(fd);
+}
+
+void CloseMemFd(pid_t pid)
+{
+    pthread_mutex_lock(&g_MemFdLock);
+    map<pid_t, int>::iterator i = g_MemFds.find(pid);
+    if (i != g_MemFds.end()) {
+        close(i->second);
+        g_MemFds.erase(i);
+    }
+    pthread_mutex_unlock(&g_MemFdLock);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Protection flags
+
+int PageToProt(DWORD flProtect)
+{
+    switch (flProtect & 0xFF) {
+        case PAGE_READONLY:             return(PROT_READ);
+        case PAGE_READWRITE:
+        case PAGE_WRITECOPY:            return(PROT_READ | PROT_WRITE);
+        case PAGE_EXECUTE:              return(PROT_EXEC);
+        case PAGE_EXECUTE_READ:         return(PROT_READ | PROT_EXEC);
+        case PAGE_EXECUTE_READWRITE:
+        case PAGE_EXECUTE_WRITECOPY:    return(PROT_READ | PROT_WRITE | PROT_EXEC);
+        default:                        return(PROT_NONE);
+    }
+}
+
+DWORD ProtToPage(int nProt)
+{
+    if (nProt & PROT_EXEC) {
+        if (nProt & PROT_WRITE) return(PAGE_EXECUTE_READWRITE);
+        if (nProt & PROT_READ) return(PAGE_EXECUTE_READ);
+        return(PAGE_EXECUTE);
+    }
+    if (nProt & PROT_WRITE) return(PAGE_READWRITE);
+    if (nProt & PROT_READ) return(PAGE_READONLY);
+    return(PAGE_NOACCESS);
+}
+
+// Look up the mapping containing an address in /proc/<pid>/maps. If there is
+// none, the start of the next mapping (or 0) is returned in *pulpNext.
+bool QueryRegion(pid_t pid, ULONG_PTR ulpAddress, ULONG_PTR *pulpStart, ULONG_PTR *pulpEnd, int *pnProt, ULONG_PTR *pulpNext)
+{
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/proc/%d/maps", static_cast<int>(pid));
+    FILE *f = fopen(szPath, "r");
+    if (f == NULL)
+        return(false);
+
+    bool bFound = false;
+    if (pulpNext)
+        *pulpNext = 0;
+    char szLine[512];
+    while (fgets(szLine, sizeof(szLine), f)) {
+        unsigned long ulStart = 0, ulEnd = 0;
+        char szPerms[8] = {0};
+        if (sscanf(szLine, "%lx-%lx %7s", &ulStart, &ulEnd, szPerms) != 3)
+            continue;
+        if (ulpAddress < ulStart) {
+            // The lines are sorted, the address is unmapped
+            if (pulpNext)
+                *pulpNext = ulStart;
+            break;
+        }
+        if (ulpAddress < ulEnd) {
+            int nProt = PROT_NONE;
+            if (szPerms[0] == 'r') nProt |= PROT_READ;
+            if (szPerms[1] == 'w') nProt |= PROT_WRITE;
+            if (szPerms[2] == 'x') nProt |= PROT_EXEC;
+            *pulpStart = ulStart;
+            *pulpEnd = ulEnd;
+            *pnProt = nProt;
+            bFound = true;
+            break;
+        }
+    }
+    fclose(f);
+    return(bFound);
+}
+
+// Look up the current protection of an address
+bool QueryProt(pid_t pid, ULONG_PTR ulpAddress, int *pnProt)
+{
+    ULONG_PTR ulpStart = 0, ulpEnd = 0;
+    return(QueryRegion(pid, ulpAddress, &ulpStart, &ulpEnd, pnProt, NULL));
+}
+
+// Read the program entry point from the auxiliary vector
+LPVOID QueryEntryPoint(pid_t pid)
+{
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/proc/%d/auxv", static_cast<int>(pid));
+    int fd = open(szPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return(0);
+
+    LPVOID lpEntry = 0;
+    unsigned long aux[2];
+    while (read(fd, aux, sizeof(aux)) == sizeof(aux)) {
+        if (aux[0] == AT_NULL)
+            break;
+        if (aux[0] == AT_ENTRY) {
+            lpEntry = reinterpret_cast<LPVOID>(aux[1]);
+            break;
+        }
+    }
+    close(fd);
+    return(lpEntry);
+}
+
+// Find a system call instruction in the vDSO, which no thread modifies and
+// every process has, so a remote system call doesn't patch code other threads run
+ULONG_PTR QuerySyscallInsn(pid_t pid)
+{
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/proc/%d/maps", static_cast<int>(pid));
+    FILE *f = fopen(szPath, "r");
+    if (f == NULL)
+        return(0);
+
+    unsigned long ulStart = 0, ulEnd = 0;
+    bool bFound = false;
+    char szLine[512];
+    while (fgets(szLine, sizeof(szLine), f)) {
+        if (strstr(szLine, "[vdso]") && sscanf(szLine, "%lx-%lx", &ulStart, &ulEnd) == 2) {
+            bFound = true;
+            break;
+        }
+    }
+    fclose(f);
+    if (bFound == false || ulEnd <= ulStart || ulEnd - ulStart > 0x10000)
+        return(0);
+
+    int fd = GetMemFd(pid);
+    if (fd < 0)
+        return(0);
+
+    vector<unsigned char> Image(ulEnd - ulStart);
+    if (pread(fd, &Image[0], Image.size(), static_cast<off_t>(ulStart)) != static_cast<ssize_t>(Image.size()))
+        return(0);
+
+#ifdef __x86_64__
+    const unsigned char cInsn[2] = { 0x0F, 0x05 };          // syscall
+#else
+    const unsigned char cInsn[2] = { 0xCD, 0x80 };          // int 0x80
+#endif
+    for (size_t i = 0; i + 1 < Image.size(); i++) {
+        if (Image[i] == cInsn[0] && Image[i + 1] == cInsn[1])
+            return(ulStart + i);
+    }
+    return(0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Event objects, each with an eventfd that is readable while it is signaled
+// so the tracer can wait on it together with its SIGCHLD pipe
+
+struct EventObject
+{
+    pthread_mutex_t Lock;
+    pthread_cond_t Cond;
+    bool bManualReset;
+    bool bSignaled;
+    int nFd;
+};
+
+void DrainEventFd(EventObject *pEvent)
+{
+    eventfd_t value;
+    eventfd_read(pEvent->nFd, &value);
+}
+
+// Takes the signal of an auto-reset event, call with the lock held
+void ConsumeEvent(EventObject *pEvent)
+{
+    if (pEvent->bManualReset == false) {
+        pEvent->bSignaled = false;
+        DrainEventFd(pEvent);
+    }
+}
+
+bool TestEvent(EventObject *pEvent)
+{
+    pthread_mutex_lock(&pEvent->Lock);
+    bool bSignaled = pEvent->bSignaled;
+    if (bSignaled == true)
+        ConsumeEvent(pEvent);
+    pthread_mutex_unlock(&pEvent->Lock);
+    return(bSignaled);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Tracer state
+
+struct GuardRange
+{
+    ULONG_PTR ulpStart;
+    ULONG_PTR ulpEnd;
+    int nProt;
+};
+
+struct TracedProcess
+{
+    pid_t pid;
+    vector<GuardRange> Guards;
+    vector<GuardRange> NewGuards;       // Kept to rebuild Guards without allocating
+    vector<ULONG_PTR> Lifted;           // Sorted pages whose guard was removed by a fault
+    map<ULONG_PTR, SIZE_T> Allocations;
+    ULONG_PTR ulpSyscall;               // System call instruction for RemoteSyscall, 0 if not found
+    bool bSyscallQueried;
+    pid_t ForkParent;                   // The process it was forked from, 0 if none or since exec
+    bool bVFork;                        // Forked by vfork, shares the parent's memory
+};
+
+struct TracedThread
+{
+    pid_t tid;
+    pid_t pid;
+    bool bStopped;
+    bool bStepPending;
+    bool bInitialStopSeen;
+    bool bResumeOnInitialStop;
+    bool bExitReported;
+    int nStopSignal;
+    int nPendingSignal;
+    bool bRegsValid;
+    struct user_regs_struct Regs;
+    bool bDebugRegsPending;
+    bool bInterruptPending;
+    DWORD_PTR PendingDebugRegs[6];
+};
+
+class CTracer
+{
+public:
+    typedef map<pid_t, TracedThread> ThreadMap;
+    typedef map<pid_t, TracedProcess> ProcessMap;
+
+    CTracer();
+    ~CTracer();
+
+    bool IsValid(void) const { return(m_nSlot >= 0); }
+
+    TracedThread *FindThread(pid_t tid);
+    TracedThread *AddThread(pid_t tid, pid_t pid);
+    TracedProcess *FindProcess(pid_t pid);
+    TracedProcess *AddProcess(pid_t pid);
+    TracedThread *FindStoppedThread(pid_t pid);
+
+    bool ReadRegs(TracedThread *pThread);
+    bool WriteRegs(TracedThread *pThread);
+    bool WriteDebugRegs(TracedThread *pThread, const DWORD_PTR *pValues);
+    void Interrupt(TracedThread *pThread);
+    bool Resume(TracedThread *pThread, int nSignal);
+
+    void QueueEvent(const DEBUG_EVENT & de) { m_Pending.push_back(de); }
+    DWORD WaitForEvent(LPDEBUG_EVENT lpDebugEvent, EventObject *pEvent, DWORD dwMilliseconds);
+    BOOL Continue(DWORD dwProcessId, DWORD dwThreadId, DWORD dwContinueStatus);
+    bool Detach(pid_t pid);
+
+    long RemoteSyscall(pid_t pid, long lNumber, long a1, long a2, long a3, long a4, long a5, long a6);
+    bool RemoteProtect(pid_t pid, ULONG_PTR ulpStart, ULONG_PTR ulpEnd, int nProt);
+
+    void QueueCreateProcess(pid_t pid);
+
+private:
+    bool Translate(pid_t tid, int nStatus, LPDEBUG_EVENT lpDebugEvent);
+    bool TranslateSignal(TracedThread *pThread, int nSignal, LPDEBUG_EVENT lpDebugEvent);
+    void RemoveProcess(pid_t pid);
+    void DrainWakePipe(void);
+
+private:
+    ThreadMap m_Threads;
+    ProcessMap m_Processes;
+    deque<DEBUG_EVENT> m_Pending;
+    int m_WakePipe[2];
+    int m_nSlot;
+    pid_t m_LastEventTid;
+};
+
+__thread CTracer *g_pTracer = 0;
+
+CTracer *GetTracer(bool bCreate)
+{
+    if (g_pTracer == 0 && bCreate == true) {
+        CTracer *pTracer = new CTracer;
+        if (pTracer->IsValid() == false) {
+            delete pTracer;
+            return(0);
+        }
+        g_pTracer = pTracer;
+    }
+    return(g_pTracer);
+}
+
+CTracer::CTracer()
+: m_nSlot(-1)
+, m_LastEventTid(0)
+{
+    pthread_once(&g_ChildHandlerOnce, InstallChildHandler);
+
+    m_WakePipe[0] = m_WakePipe[1] = -1;
+    if (pipe2(m_WakePipe, O_NONBLOCK | O_CLOEXEC) != 0)
+        return;
+
+    // Register our pipe with the SIGCHLD handler
+    for (int i = 0; i < cMaxTracers; i++) {
+        if (__sync_bool_compare_and_swap(&g_nWakeFds[i], 0, m_WakePipe[1])) {
+            m_nSlot = i;
+            break;
+        }
+    }
+}
+
+CTracer::~CTracer()
+{
+    if (m_nSlot >= 0)
+        g_nWakeFds[m_nSlot] = 0;
+    if (m_WakePipe[0] >= 0)
+        close(m_WakePipe[0]);
+    if (m_WakePipe[1] >= 0)
+        close(m_WakePipe[1]);
+}
+
+TracedThread *CTracer::FindThread(pid_t tid)
+{
+    ThreadMap::iterator i = m_Threads.find(tid);
+    if (i == m_Threads.end())
+        return(0);
+    return(&i->second);
+}
+
+TracedThread *CTracer::AddThread(pid_t tid, pid_t pid)
+{
+    TracedThread & t = m_Threads[tid];
+    memset(&t, 0, sizeof(TracedThread));
+    t.tid = tid;
+    t.pid = pid;
+    return(&t);
+}
+
+TracedProcess *CTracer::FindProcess(pid_t pid)
+{
+    ProcessMap::iterator i = m_Processes.find(pid);
+    if (i == m_Processes.end())
+        return(0);
+    return(&i->second);
+}
+
+TracedProcess *CTracer::AddProcess(pid_t pid)
+{
+    TracedProcess & p = m_Processes[pid];
+    p.pid = pid;
+    p.Guards.clear();
+    p.Lifted.clear();
+    p.Allocations.clear();
+    p.ulpSyscall = 0;
+    p.bSyscallQueried = false;
+    p.ForkParent = 0;
+    p.bVFork = false;
+    return(&p);
+}
+
+TracedThread *CTracer::FindStoppedThread(pid_t pid)
+{
+    // Prefer the thread that reported the current event
+    TracedThread *pThread = FindThread(m_LastEventTid);
+    if (pThread && pThread->pid == pid && pThread->bStopped)
+        return(pThread);
+
+    for (ThreadMap::iterator i = m_Threads.begin(); i != m_Threads.end(); ++i) {
+        if (i->second.pid == pid && i->second.bStopped)
+            return(&i->second);
+    }
+    return(0);
+}
+
+bool CTracer::ReadRegs(TracedThread *pThread)
+{
+    if (pThread->bRegsValid)
+        return(true);
+
+    struct iovec iov;
+    iov.iov_base = &pThread->Regs;
+    iov.iov_len = sizeof(pThread->Regs);
+    if (ptrace(PTRACE_GETREGSET, pThread->tid, reinterpret_cast<void *>(NT_PRSTATUS), &iov) != 0)
+        return(false);
+
+    pThread->bRegsValid = true;
+    return(true);
+}
+
+bool CTracer::WriteRegs(TracedThread *pThread)
+{
+    struct iovec iov;
+    iov.iov_base = &pThread->Regs;
+    iov.iov_len = sizeof(pThread->Regs);
+    return(ptrace(PTRACE_SETREGSET, pThread->tid, reinterpret_cast<void *>(NT_PRSTATUS), &iov) == 0);
+}
+
+bool CTracer::WriteDebugRegs(TracedThread *pThread, const DWORD_PTR *pValues)
+{
+    // Addresses first, DR7 validates against them
+    const int nDr[6] = { 0, 1, 2, 3, 6, 7 };
+    for (int i = 0; i < 6; i++) {
+        if (ptrace(PTRACE_POKEUSER, pThread->tid, reinterpret_cast<void *>(offsetof(struct user, u_debugreg) + nDr[i] * sizeof(long)), reinterpret_cast<void *>(pValues[i])) != 0)
+            return(false);
+    }
+    return(true);
+}
+
+void CTracer::Interrupt(TracedThread *pThread)
+{
+    // A SIGSTOP works for both PTRACE_TRACEME and PTRACE_SEIZE tracees, the
+    // stop it causes is swallowed in Translate
+    if (pThread->bInterruptPending == true || pThread->bInitialStopSeen == false)
+        return;
+
+    pThread->bInterruptPending = true;
+    syscall(SYS_tgkill, pThread->pid, pThread->tid, SIGSTOP);
+}
+
+bool CTracer::Resume(TracedThread *pThread, int nSignal)
+{
+    if (nSignal == 0) {
+        nSignal = pThread->nPendingSignal;
+        pThread->nPendingSignal = 0;
+    }
+
+    enum __ptrace_request req = pThread->bStepPending ? PTRACE_SINGLESTEP : PTRACE_CONT;
+    long lRet = ptrace(req, pThread->tid, 0, reinterpret_cast<void *>(static_cast<long>(nSignal)));
+
+    pThread->bStopped = false;
+    pThread->bRegsValid = false;
+    pThread->nStopSignal = 0;
+
+    return(lRet == 0);
+}
+
+void CTracer::QueueCreateProcess(pid_t pid)
+{
+    DEBUG_EVENT de;
+    ZeroMemory(&de, sizeof(DEBUG_EVENT));
+    de.dwDebugEventCode = CREATE_PROCESS_DEBUG_EVENT;
+    de.dwProcessId = pid;
+    de.dwThreadId = pid;
+    de.u.CreateProcessInfo.hProcess = MakeHandle(pid);
+    de.u.CreateProcessInfo.hThread = MakeHandle(pid);
+    de.u.CreateProcessInfo.lpStartAddress = reinterpret_cast<LPTHREAD_START_ROUTINE>(QueryEntryPoint(pid));
+    QueueEvent(de);
+}
+
+void CTracer::RemoveProcess(pid_t pid)
+{
+    ThreadMap::iterator i = m_Threads.begin();
+    while (i != m_Threads.end()) {
+        if (i->second.pid == pid)
+            m_Threads.erase(i++);
+        else
+            ++i;
+    }
+    m_Processes.erase(pid);
+    CloseMemFd(pid);
+}
+
+void CTracer::DrainWakePipe(void)
+{
+    char buf[64];
+    while (read(m_WakePipe[0], buf, sizeof(buf)) > 0) {
+    }
+}
+
+DWORD CTracer::WaitForEvent(LPDEBUG_EVENT lpDebugEvent, EventObject *pEvent, DWORD dwMilliseconds)
+{
+    DWORD dwStart = GetTickMs();
+
+    while (1) {
+        // Synthesized events first
+        if (m_Pending.empty() == false) {
+            *lpDebugEvent = m_Pending.front();
+            m_Pending.pop_front();
+            m_LastEventTid = static_cast<pid_t>(lpDebugEvent->dwThreadId);
+            return(WAIT_OBJECT_0);
+        }
+
+        // Reap one state change of one of our tracees
+        int nStatus = 0;
+        pid_t tid = waitpid(-1, &nStatus, __WALL | __WNOTHREAD | WNOHANG);
+        if (tid > 0) {
+            if (Translate(tid, nStatus, lpDebugEvent) == true) {
+                m_LastEventTid = static_cast<pid_t>(lpDebugEvent->dwThreadId);
+                return(WAIT_OBJECT_0);
+            }
+            continue;
+        }
+
+        // Debug events go first, the event object only ends the wait
+        if (pEvent && TestEvent(pEvent) == true)
+            return(WAIT_OBJECT_0 + 1);
+
+        // Nothing ready, sleep on the SIGCHLD pipe and the event's descriptor
+        int nTimeout = -1;
+        if (dwMilliseconds != INFINITE) {
+            DWORD dwElapsed = GetTickMs() - dwStart;
+            if (dwElapsed >= dwMilliseconds)
+                return(WAIT_TIMEOUT);
+            nTimeout = static_cast<int>(dwMilliseconds - dwElapsed);
+        }
+
+        struct pollfd pfd[2];
+        pfd[0].fd = m_WakePipe[0];
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = pEvent ? pEvent->nFd : -1;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        poll(pfd, 2, nTimeout);
+        DrainWakePipe();
+    }
+}
+
+bool CTracer::Translate(pid_t tid, int nStatus, LPDEBUG_EVENT lpDebugEvent)
+{
+    TracedThread *pThread = FindThread(tid);
+
+    ZeroMemory(lpDebugEvent, sizeof(DEBUG_EVENT));
+
+    // Thread or process termination
+    if (WIFEXITED(nStatus) || WIFSIGNALED(nStatus)) {
+        if (pThread == 0)
+            return(false);
+
+        DWORD dwExitCode = WIFEXITED(nStatus) ? WEXITSTATUS(nStatus) : 128 + WTERMSIG(nStatus);
+        pid_t pid = pThread->pid;
+
+        lpDebugEvent->dwProcessId = pid;
+        lpDebugEvent->dwThreadId = tid;
+
+        if (tid == pid) {
+            // The leader is reaped last
+            lpDebugEvent->dwDebugEventCode = EXIT_PROCESS_DEBUG_EVENT;
+            lpDebugEvent->u.ExitProcess.dwExitCode = dwExitCode;
+            RemoveProcess(pid);
+            return(true);
+        }
+
+        bool bReport = (pThread->bExitReported == false);
+        m_Threads.erase(tid);
+        if (bReport == false)
+            return(false);
+
+        lpDebugEvent->dwDebugEventCode = EXIT_THREAD_DEBUG_EVENT;
+        lpDebugEvent->u.ExitThread.dwExitCode = dwExitCode;
+        return(true);
+    }
+
+    if (WIFSTOPPED(nStatus) == 0)
+        return(false);
+
+    int nSignal = WSTOPSIG(nStatus);
+    int nEvent = nStatus >> 16;
+
+    if (pThread == 0) {
+        // A new thread reported its initial stop before its creator
+        // reported the clone, keep it stopped until then
+        pThread = AddThread(tid, 0);
+        pThread->bStopped = true;
+        pThread->bInitialStopSeen = true;
+        return(false);
+    }
+
+    pThread->bStopped = true;
+    pThread->bRegsValid = false;
+
+    // Debug registers set while the thread was running
+    if (pThread->bDebugRegsPending == true) {
+        WriteDebugRegs(pThread, pThread->PendingDebugRegs);
+        pThread->bDebugRegsPending = false;
+    }
+
+    if (pThread->bInterruptPending == true && nEvent == 0 && nSignal == SIGSTOP) {
+        pThread->bInterruptPending = false;
+        Resume(pThread, 0);
+        return(false);
+    }
+
+    if (pThread->bInitialStopSeen == false) {
+        pThread->bInitialStopSeen = true;
+        if (nEvent == PTRACE_EVENT_STOP || (nEvent == 0 && nSignal == SIGSTOP)) {
+            if (pThread->bResumeOnInitialStop == true)
+                Resume(pThread, 0);
+            return(false);
+        }
+    }
+
+    lpDebugEvent->dwProcessId = pThread->pid;
+    lpDebugEvent->dwThreadId = tid;
+
+    switch (nEvent) {
+        case PTRACE_EVENT_CLONE:
+            {
+            unsigned long ulNewTid = 0;
+            ptrace(PTRACE_GETEVENTMSG, tid, 0, &ulNewTid);
+            pid_t NewTid = static_cast<pid_t>(ulNewTid);
+            pid_t pid = pThread->pid;
+
+            // The creator goes on, the new thread waits for its event
+            Resume(pThread, 0);
+
+            TracedThread *pNewThread = FindThread(NewTid);
+            if (pNewThread) {
+                pNewThread->pid = pid;
+            } else {
+                pNewThread = AddThread(NewTid, pid);
+            }
+
+            lpDebugEvent->dwDebugEventCode = CREATE_THREAD_DEBUG_EVENT;
+            lpDebugEvent->dwThreadId = NewTid;
+            lpDebugEvent->u.CreateThread.hThread = MakeHandle(NewTid);
+            }
+            return(true);
+        case PTRACE_EVENT_FORK:
+        case PTRACE_EVENT_VFORK:
+            {
+            unsigned long ulChild = 0;
+            ptrace(PTRACE_GETEVENTMSG, tid, 0, &ulChild);
+            pid_t Child = static_cast<pid_t>(ulChild);
+            pid_t pid = pThread->pid;
+
+            // The parent goes on, the child waits for its event like a new thread
+            Resume(pThread, 0);
+
+            TracedThread *pChild = FindThread(Child);
+            if (pChild) {
+                pChild->pid = Child;
+            } else {
+                pChild = AddThread(Child, Child);
+            }
+
+            // The child has a copy of the parent's mappings (the same ones after vfork)
+            TracedProcess *pProcess = AddProcess(Child);
+            TracedProcess *pParent = FindProcess(pid);
+            if (pParent) {
+                pProcess->Guards = pParent->Guards;
+                pProcess->Lifted = pParent->Lifted;
+                pProcess->Allocations = pParent->Allocations;
+            }
+            pProcess->ForkParent = pid;
+            pProcess->bVFork = (nEvent == PTRACE_EVENT_VFORK);
+            CloseMemFd(Child);
+
+            lpDebugEvent->dwDebugEventCode = CREATE_PROCESS_DEBUG_EVENT;
+            lpDebugEvent->dwProcessId = Child;
+            lpDebugEvent->dwThreadId = Child;
+            lpDebugEvent->u.CreateProcessInfo.hProcess = MakeHandle(Child);
+            lpDebugEvent->u.CreateProcessInfo.hThread = MakeHandle(Child);
+            lpDebugEvent->u.CreateProcessInfo.lpStartAddress = reinterpret_cast<LPTHREAD_START_ROUTINE>(QueryEntryPoint(Child));
+            }
+            return(true);
+        case PTRACE_EVENT_EXEC:
+            {
+            // Every other thread is gone and the address space was replaced
+            pid_t pid = pThread->pid;
+            ThreadMap::iterator i = m_Threads.begin();
+            while (i != m_Threads.end()) {
+                if (i->second.pid == pid && i->first != tid)
+                    m_Threads.erase(i++);
+                else
+                    ++i;
+            }
+            AddProcess(pid);
+            CloseMemFd(pid);
+
+            lpDebugEvent->dwDebugEventCode = CREATE_PROCESS_DEBUG_EVENT;
+            lpDebugEvent->u.CreateProcessInfo.hProcess = MakeHandle(pid);
+            lpDebugEvent->u.CreateProcessInfo.hThread = MakeHandle(tid);
+            lpDebugEvent->u.CreateProcessInfo.lpStartAddress = reinterpret_cast<LPTHREAD_START_ROUTINE>(QueryEntryPoint(pid));
+            }
+            return(true);
+        case PTRACE_EVENT_EXIT:
+            {
+            if (tid == pThread->pid) {
+                // Reported as process exit once the leader is reaped
+                Resume(pThread, 0);
+                return(false);
+            }
+
+            unsigned long ulStatus = 0;
+            ptrace(PTRACE_GETEVENTMSG, tid, 0, &ulStatus);
+            int nExitStatus = static_cast<int>(ulStatus);
+            pThread->bExitReported = true;
+
+            lpDebugEvent->dwDebugEventCode = EXIT_THREAD_DEBUG_EVENT;
+            lpDebugEvent->u.ExitThread.dwExitCode = WIFEXITED(nExitStatus) ? WEXITSTATUS(nExitStatus) : 128 + WTERMSIG(nExitStatus);
+            }
+            return(true);
+        case 0:
+            return(TranslateSignal(pThread, nSignal, lpDebugEvent));
+        default:
+            // Group-stops and events we did not ask for
+            Resume(pThread, 0);
+            return(false);
+    }
+}
+
+bool CTracer::TranslateSignal(TracedThread *pThread, int nSignal, LPDEBUG_EVENT lpDebugEvent)
+{
+    siginfo_t si;
+    memset(&si, 0, sizeof(si));
+    ptrace(PTRACE_GETSIGINFO, pThread->tid, 0, &si);
+
+    EXCEPTION_RECORD & er = lpDebugEvent->u.Exception.ExceptionRecord;
+
+    if (ReadRegs(pThread) == false) {
+        Resume(pThread, nSignal);
+        return(false);
+    }
+#ifdef __x86_64__
+    ULONG_PTR ulpPC = pThread->Regs.rip;
+#else
+    ULONG_PTR ulpPC = pThread->Regs.eip;
+#endif
+
+    switch (nSignal) {
+        case SIGTRAP:
+            // A step over a system call instruction is reported as TRAP_BRKPT
+            if (si.si_code == TRAP_BRKPT && pThread->bStepPending)
+                si.si_code = TRAP_TRACE;
+
+            if (si.si_code == SI_KERNEL || si.si_code == TRAP_BRKPT) {
+                // INT3, the PC is past the breakpoint byte
+                er.ExceptionCode = EXCEPTION_BREAKPOINT;
+                er.ExceptionAddress = reinterpret_cast<LPVOID>(ulpPC - 1);
+            } else if (si.si_code == TRAP_TRACE || si.si_code == TRAP_HWBKPT) {
+                // Trap flag or debug register hit, the trap flag is one-shot
+                er.ExceptionCode = EXCEPTION_SINGLE_STEP;
+                er.ExceptionAddress = reinterpret_cast<LPVOID>(ulpPC);
+                pThread->bStepPending = false;
+            } else {
+                // Sent by someone, not a debug trap
+                Resume(pThread, nSignal);
+                return(false);
+            }
+            break;
+        case SIGSEGV:
+            {
+            ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(si.si_addr);
+            er.ExceptionCode = EXCEPTION_ACCESS_VIOLATION;
+            er.ExceptionAddress = reinterpret_cast<LPVOID>(ulpPC);
+            er.NumberParameters = 2;
+            er.ExceptionInformation[0] = 0;
+            er.ExceptionInformation[1] = ulpAddress;
+
+            // Emulated guard page? Guards are one-shot, like on Windows
+            TracedProcess *pProcess = FindProcess(pThread->pid);
+            if (pProcess && si.si_code == SEGV_ACCERR) {
+                ULONG_PTR ulpPage = ulpAddress & ~(PageSize() - 1);
+                for (size_t i = 0; i < pProcess->Guards.size(); i++) {
+                    GuardRange g = pProcess->Guards[i];
+                    if (ulpPage >= g.ulpStart && ulpPage < g.ulpEnd) {
+                        pProcess->Guards.erase(pProcess->Guards.begin() + i);
+                        if (g.ulpStart < ulpPage) {
+                            GuardRange low = { g.ulpStart, ulpPage, g.nProt };
+                            pProcess->Guards.push_back(low);
+                        }
+                        if (ulpPage + PageSize() < g.ulpEnd) {
+                            GuardRange high = { ulpPage + PageSize(), g.ulpEnd, g.nProt };
+                            pProcess->Guards.push_back(high);
+                        }
+                        RemoteProtect(pThread->pid, ulpPage, ulpPage + PageSize(), g.nProt);
+                        vector<ULONG_PTR>::iterator l = lower_bound(pProcess->Lifted.begin(), pProcess->Lifted.end(), ulpPage);
+                        if (l == pProcess->Lifted.end() || *l != ulpPage)
+                            pProcess->Lifted.insert(l, ulpPage);
+                        er.ExceptionCode = EXCEPTION_GUARD_PAGE;
+                        break;
+                    }
+                }
+
+                // Other threads may have faulted on the page before its guard was
+                // removed, they can simply retry the access
+                if (er.ExceptionCode != EXCEPTION_GUARD_PAGE && binary_search(pProcess->Lifted.begin(), pProcess->Lifted.end(), ulpPage)) {
+                    Resume(pThread, 0);
+                    return(false);
+                }
+            }
+            }
+            break;
+        case SIGBUS:
+            er.ExceptionCode = EXCEPTION_DATATYPE_MISALIGNMENT;
+            er.ExceptionAddress = reinterpret_cast<LPVOID>(ulpPC);
+            break;
+        case SIGILL:
+            er.ExceptionCode = (si.si_code == ILL_PRVOPC) ? EXCEPTION_PRIV_INSTRUCTION : EXCEPTION_ILLEGAL_INSTRUCTION;
+            er.ExceptionAddress = reinterpret_cast<LPVOID>(ulpPC);
+            break;
+        case SIGFPE:
+            if (si.si_code == FPE_INTDIV)
+                er.ExceptionCode = EXCEPTION_INT_DIVIDE_BY_ZERO;
+            else if (si.si_code == FPE_INTOVF)
+                er.ExceptionCode = EXCEPTION_INT_OVERFLOW;
+            else
+                er.ExceptionCode = EXCEPTION_FLT_INVALID_OPERATION;
+            er.ExceptionAddress = reinterpret_cast<LPVOID>(ulpPC);
+            break;
+        default:
+            // Asynchronous signals go straight to the target
+            Resume(pThread, nSignal);
+            return(false);
+    }
+
+    pThread->nStopSignal = nSignal;
+
+    lpDebugEvent->dwDebugEventCode = EXCEPTION_DEBUG_EVENT;
+    lpDebugEvent->u.Exception.dwFirstChance = 1;
+    return(true);
+}
+
+BOOL CTracer::Continue(DWORD dwProcessId, DWORD dwThreadId, DWORD dwContinueStatus)
+{
+    TracedThread *pThread = FindThread(static_cast<pid_t>(dwThreadId));
+    if (pThread == 0) {
+        // Exited threads/processes have nothing to continue
+        return(TRUE);
+    }
+
+    if (pThread->bStopped == false) {
+        // A new thread that hasn't reached its initial stop yet
+        if (pThread->bInitialStopSeen == false)
+            pThread->bResumeOnInitialStop = true;
+        return(TRUE);
+    }
+
+    int nSignal = 0;
+    if (dwContinueStatus == DBG_EXCEPTION_NOT_HANDLED)
+        nSignal = pThread->nStopSignal;
+
+    return(Resume(pThread, nSignal) ? TRUE : FALSE);
+}
+
+bool CTracer::Detach(pid_t pid)
+{
+    // A thread running past its initial stop would have to be stopped first
+    for (ThreadMap::iterator i = m_Threads.begin(); i != m_Threads.end(); ++i) {
+        if (i->second.pid == pid && i->second.bStopped == false && i->second.bInitialStopSeen == true)
+            return(false);
+    }
+
+    bool bRet = true;
+    for (ThreadMap::iterator i = m_Threads.begin(); i != m_Threads.end(); ++i) {
+        TracedThread & t = i->second;
+        if (t.pid != pid)
+            continue;
+
+        // A new thread is let go of from its initial stop
+        if (t.bStopped == false) {
+            int nStatus = 0;
+            if (waitpid(t.tid, &nStatus, __WALL) != t.tid || WIFSTOPPED(nStatus) == 0) {
+                bRet = false;
+                continue;
+            }
+        }
+        if (ptrace(PTRACE_DETACH, t.tid, 0, reinterpret_cast<void *>(static_cast<long>(t.nPendingSignal))) != 0)
+            bRet = false;
+    }
+
+    RemoveProcess(pid);
+    return(bRet);
+}
+
+long CTracer::RemoteSyscall(pid_t pid, long lNumber, long a1, long a2, long a3, long a4, long a5, long a6)
+{
+    TracedThread *pThread = FindStoppedThread(pid);
+    if (pThread == 0 || ReadRegs(pThread) == false)
+        return(-ESRCH);
+
+    struct user_regs_struct Saved = pThread->Regs;
+    struct user_regs_struct Regs = Saved;
+
+    // Run the vDSO's system call instruction. Without one, one is placed at the
+    // current PC, where other threads may run into it.
+    TracedProcess *pProcess = FindProcess(pid);
+    ULONG_PTR ulpSyscall = 0;
+    if (pProcess) {
+        if (pProcess->bSyscallQueried == false) {
+            pProcess->ulpSyscall = QuerySyscallInsn(pid);
+            pProcess->bSyscallQueried = true;
+        }
+        ulpSyscall = pProcess->ulpSyscall;
+    }
+
+#ifdef __x86_64__
+    ULONG_PTR ulpPC = ulpSyscall ? ulpSyscall : Saved.rip;
+    Regs.rip = ulpPC;
+    const unsigned long ulInsn = 0x050F;                    // syscall
+    Regs.rax = lNumber;
+    Regs.orig_rax = -1;
+    Regs.rdi = a1;
+    Regs.rsi = a2;
+    Regs.rdx = a3;
+    Regs.r10 = a4;
+    Regs.r8 = a5;
+    Regs.r9 = a6;
+#else
+    ULONG_PTR ulpPC = ulpSyscall ? ulpSyscall : Saved.eip;
+    Regs.eip = ulpPC;
+    const unsigned long ulInsn = 0x80CD;                    // int 0x80
+    Regs.eax = lNumber;
+    Regs.orig_eax = -1;
+    Regs.ebx = a1;
+    Regs.ecx = a2;
+    Regs.edx = a3;
+    Regs.esi = a4;
+    Regs.edi = a5;
+    Regs.ebp = a6;
+#endif
+
+    long lWord = 0;
+    if (ulpSyscall == 0) {
+        errno = 0;
+        lWord = ptrace(PTRACE_PEEKTEXT, pThread->tid, reinterpret_cast<void *>(ulpPC), 0);
+        if (errno != 0)
+            return(-EFAULT);
+        long lPatched = (lWord & ~0xFFFFL) | ulInsn;
+        if (ptrace(PTRACE_POKETEXT, pThread->tid, reinterpret_cast<void *>(ulpPC), reinterpret_cast<void *>(lPatched)) != 0)
+            return(-EFAULT);
+    }
+
+    pThread->Regs = Regs;
+    long lResult = -EFAULT;
+    if (WriteRegs(pThread) == true) {
+        // Step over the system call, stashing any signal that arrives meanwhile
+        for (int nTries = 0; nTries < 16; nTries++) {
+            if (ptrace(PTRACE_SINGLESTEP, pThread->tid, 0, 0) != 0)
+                break;
+            int nStatus = 0;
+            if (waitpid(pThread->tid, &nStatus, __WALL) != pThread->tid || WIFSTOPPED(nStatus) == 0)
+                break;
+            if (WSTOPSIG(nStatus) != SIGTRAP || (nStatus >> 16) != 0) {
+                if ((nStatus >> 16) == 0)
+                    pThread->nPendingSignal = WSTOPSIG(nStatus);
+                continue;
+            }
+            pThread->bRegsValid = false;
+            if (ReadRegs(pThread) == true) {
+#ifdef __x86_64__
+                lResult = pThread->Regs.rax;
+#else
+                lResult = pThread->Regs.eax;
+#endif
+            }
+            break;
+        }
+    }
+
+    // Restore code and registers
+    if (ulpSyscall == 0)
+        ptrace(PTRACE_POKETEXT, pThread->tid, reinterpret_cast<void *>(ulpPC), reinterpret_cast<void *>(lWord));
+    pThread->Regs = Saved;
+    WriteRegs(pThread);
+    pThread->bRegsValid = true;
+
+    return(lResult);
+}
+
+bool CTracer::RemoteProtect(pid_t pid, ULONG_PTR ulpStart, ULONG_PTR ulpEnd, int nProt)
+{
+    return(RemoteSyscall(pid, SYS_mprotect, static_cast<long>(ulpStart), static_cast<long>(ulpEnd - ulpStart), nProt, 0, 0, 0) == 0);
+}
+
+// Split command line into arguments, honoring double quotes
+void SplitCommandLine(LPCSTR pszCommandLine, vector<string> & Args)
+{
+    string Arg;
+    bool bInQuotes = false;
+    bool bHaveArg = false;
+
+    for (LPCSTR p = pszCommandLine; p && *p; p++) {
+        if (*p == '"') {
+            bInQuotes = !bInQuotes;
+            bHaveArg = true;
+        } else if ((*p == ' ' || *p == '\t') && bInQuotes == false) {
+            if (bHaveArg) {
+                Args.push_back(Arg);
+                Arg.clear();
+                bHaveArg = false;
+            }
+        } else {
+            Arg += *p;
+            bHaveArg = true;
+        }
+    }
+    if (bHaveArg)
+        Args.push_back(Arg);
+}
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Process control
+
+BOOL CreateProcess(LPCSTR lpApplicationName, LPSTR lpCommandLine, LPSECURITY_ATTRIBUTES lpProcessAttributes, LPSECURITY_ATTRIBUTES lpThreadAttributes, BOOL bInheritHandles, DWORD dwCreationFlags, LPVOID lpEnvironment, LPCSTR lpCurrentDirectory, LPSTARTUPINFO lpStartupInfo, LPPROCESS_INFORMATION lpProcessInformation)
+{
+    CTracer *pTracer = GetTracer(true);
+    if (pTracer == 0)
+        return(FALSE);
+
+    // Prepare everything the child needs before forking
+    vector<string> Args;
+    SplitCommandLine(lpCommandLine, Args);
+    if (Args.empty() && lpApplicationName)
+        Args.push_back(lpApplicationName);
+    if (Args.empty())
+        return(FALSE);
+
+    vector<char *> argv;
+    for (size_t i = 0; i < Args.size(); i++)
+        argv.push_back(const_cast<char *>(Args[i].c_str()));
+    argv.push_back(0);
+
+    vector<char *> envp;
+    if (lpEnvironment) {
+        // Windows environment block: "a=b\0c=d\0\0"
+        for (char *p = reinterpret_cast<char *>(lpEnvironment); *p; p += strlen(p) + 1)
+            envp.push_back(p);
+        envp.push_back(0);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return(FALSE);
+
+    if (pid == 0) {
+        // Child
+        ptrace(PTRACE_TRACEME, 0, 0, 0);
+        if (lpCurrentDirectory && chdir(lpCurrentDirectory) != 0)
+            _exit(127);
+        char **env = envp.empty() ? environ : &envp[0];
+        if (lpApplicationName)
+            execve(lpApplicationName, &argv[0], env);
+        else
+            execvpe(argv[0], &argv[0], env);
+        _exit(127);
+    }
+
+    // The child stops with SIGTRAP once exec succeeded
+    int nStatus = 0;
+    if (waitpid(pid, &nStatus, __WALL) != pid || WIFSTOPPED(nStatus) == 0) {
+        return(FALSE);
+    }
+
+    // The children are always stopped, they have the debugger's INT3s in their memory
+    long lOptions = PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL;
+    ptrace(PTRACE_SETOPTIONS, pid, 0, reinterpret_cast<void *>(lOptions));
+
+    pTracer->AddProcess(pid);
+    TracedThread *pThread = pTracer->AddThread(pid, pid);
+    pThread->bStopped = true;
+    pThread->bInitialStopSeen = true;
+    pTracer->QueueCreateProcess(pid);
+
+    if (lpProcessInformation) {
+        lpProcessInformation->hProcess = MakeHandle(pid);
+        lpProcessInformation->hThread = MakeHandle(pid);
+        lpProcessInformation->dwProcessId = pid;
+        lpProcessInformation->dwThreadId = pid;
+    }
+
+    return(TRUE);
+}
+
+BOOL DebugActiveProcess(DWORD dwProcessId)
+{
+    CTracer *pTracer = GetTracer(true);
+    if (pTracer == 0)
+        return(FALSE);
+
+    pid_t pid = static_cast<pid_t>(dwProcessId);
+    long lOptions = PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT;
+
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/proc/%d/task", static_cast<int>(pid));
+
+    // Seize every thread, rescanning until no new threads show up
+    vector<pid_t> Seized;
+    bool bNewThreads = true;
+    while (bNewThreads) {
+        bNewThreads = false;
+        DIR *pDir = opendir(szPath);
+        if (pDir == 0)
+            break;
+        struct dirent *pEntry;
+        while ((pEntry = readdir(pDir)) != 0) {
+            if (pEntry->d_name[0] < '0' || pEntry->d_name[0] > '9')
+                continue;
+            pid_t tid = static_cast<pid_t>(atoi(pEntry->d_name));
+            if (pTracer->FindThread(tid))
+                continue;
+            if (ptrace(PTRACE_SEIZE, tid, 0, reinterpret_cast<void *>(lOptions)) != 0)
+                continue;
+            ptrace(PTRACE_INTERRUPT, tid, 0, 0);
+            TracedThread *pThread = pTracer->AddThread(tid, pid);
+            pThread->bInitialStopSeen = true;
+            Seized.push_back(tid);
+            bNewThreads = true;
+        }
+        closedir(pDir);
+    }
+
+    if (Seized.empty())
+        return(FALSE);
+
+    // Wait for every thread to reach its interrupt stop
+    for (size_t i = 0; i < Seized.size(); i++) {
+        int nStatus = 0;
+        if (waitpid(Seized[i], &nStatus, __WALL) == Seized[i] && WIFSTOPPED(nStatus)) {
+            TracedThread *pThread = pTracer->FindThread(Seized[i]);
+            if (pThread)
+                pThread->bStopped = true;
+        }
+    }
+
+    pTracer->AddProcess(pid);
+    pTracer->QueueCreateProcess(pid);
+
+    // Report the other threads, like Windows does on attach
+    for (size_t i = 0; i < Seized.size(); i++) {
+        if (Seized[i] == pid)
+            continue;
+        DEBUG_EVENT de;
+        ZeroMemory(&de, sizeof(DEBUG_EVENT));
+        de.dwDebugEventCode = CREATE_THREAD_DEBUG_EVENT;
+        de.dwProcessId = pid;
+        de.dwThreadId = Seized[i];
+        de.u.CreateThread.hThread = MakeHandle(Seized[i]);
+        pTracer->QueueEvent(de);
+    }
+
+    return(TRUE);
+}
+
+BOOL DebugActiveProcessStop(DWORD dwProcessId)
+{
+    CTracer *pTracer = GetTracer(false);
+    if (pTracer == 0)
+        return(FALSE);
+    return(pTracer->Detach(static_cast<pid_t>(dwProcessId)) ? TRUE : FALSE);
+}
+
+BOOL WaitForDebugEvent(LPDEBUG_EVENT lpDebugEvent, DWORD dwMilliseconds)
+{
+    CTracer *pTracer = GetTracer(false);
+    if (pTracer == 0) {
+        poll(0, 0, dwMilliseconds == INFINITE ? -1 : static_cast<int>(dwMilliseconds));
+        return(FALSE);
+    }
+    return(pTracer->WaitForEvent(lpDebugEvent, 0, dwMilliseconds) == WAIT_OBJECT_0);
+}
+
+DWORD WaitForDebugEventOrObject(LPDEBUG_EVENT lpDebugEvent, HANDLE hObject, DWORD dwMilliseconds)
+{
+    EventObject *pEvent = reinterpret_cast<EventObject *>(hObject);
+    if (pEvent == 0 || HandleToId(hObject))
+        return(WaitForDebugEvent(lpDebugEvent, dwMilliseconds) ? WAIT_OBJECT_0 : WAIT_TIMEOUT);
+
+    CTracer *pTracer = GetTracer(false);
+    if (pTracer == 0)
+        return(WaitForSingleObject(hObject, dwMilliseconds) == WAIT_OBJECT_0 ? WAIT_OBJECT_0 + 1 : WAIT_TIMEOUT);
+    return(pTracer->WaitForEvent(lpDebugEvent, pEvent, dwMilliseconds));
+}
+
+DWORD GetForkParentProcessId(DWORD dwProcessId, BOOL *pbVFork)
+{
+    if (pbVFork)
+        *pbVFork = FALSE;
+
+    CTracer *pTracer = GetTracer(false);
+    if (pTracer == 0)
+        return(0);
+    TracedProcess *pProcess = pTracer->FindProcess(static_cast<pid_t>(dwProcessId));
+    if (pProcess == 0)
+        return(0);
+
+    if (pbVFork)
+        *pbVFork = pProcess->bVFork ? TRUE : FALSE;
+    return(static_cast<DWORD>(pProcess->ForkParent));
+}
+
+BOOL ContinueDebugEvent(DWORD dwProcessId, DWORD dwThreadId, DWORD dwContinueStatus)
+{
+    CTracer *pTracer = GetTracer(false);
+    if (pTracer == 0)
+        return(FALSE);
+    return(pTracer->Continue(dwProcessId, dwThreadId, dwContinueStatus));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Target memory
+
+BOOL ReadProcessMemory(HANDLE hProcess, LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead)
+{
+    pid_t pid = HandleToId(hProcess);
+    SIZE_T nRead = 0;
+
+    if (pid && nSize) {
+        struct iovec local, remote;
+        local.iov_base = lpBuffer;
+        local.iov_len = nSize;
+        remote.iov_base = const_cast<LPVOID>(lpBaseAddress);
+        remote.iov_len = nSize;
+        ssize_t n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        if (n > 0)
+            nRead = static_cast<SIZE_T>(n);
+
+        // Pages process_vm_readv can't read (e.g. PROT_NONE) go through /proc
+        if (nRead < nSize) {
+            int fd = GetMemFd(pid);
+            if (fd >= 0) {
+                n = pread(fd, reinterpret_cast<char *>(lpBuffer) + nRead, nSize - nRead, static_cast<off_t>(reinterpret_cast<ULONG_PTR>(lpBaseAddress) + nRead));
+                if (n > 0)
+                    nRead += static_cast<SIZE_T>(n);
+            }
+        }
+    }
+
+    if (lpNumberOfBytesRead)
+        *lpNumberOfBytesRead = nRead;
+
+    return((nSize && nRead == nSize) ? TRUE : FALSE);
+}
+
+BOOL WriteProcessMemory(HANDLE hProcess, LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten)
+{
+    pid_t pid = HandleToId(hProcess);
+    SIZE_T nWritten = 0;
+
+    // /proc/<pid>/mem writes through read-only code pages
+    if (pid && nSize) {
+        int fd = GetMemFd(pid);
+        if (fd >= 0) {
+            ssize_t n = pwrite(fd, lpBuffer, nSize, static_cast<off_t>(reinterpret_cast<ULONG_PTR>(lpBaseAddress)));
+            if (n > 0)
+                nWritten = static_cast<SIZE_T>(n);
+        }
+    }
+
+    if (lpNumberOfBytesWritten)
+        *lpNumberOfBytesWritten = nWritten;
+
+    return((nSize && nWritten == nSize) ? TRUE : FALSE);
+}
+
+// Moves the entries with as few process_vm_readv/writev calls as possible.
+// The entry a call stopped in is finished with the single-range path, which
+// can also reach pages the vm calls can't (PROT_NONE, read-only code).
+static BOOL TransferBatch(HANDLE hProcess, LPMEMORY_TRANSFER lpTransfers, SIZE_T nCount, bool bWrite)
+{
+    static const SIZE_T cMaxVectors = 64;
+    pid_t pid = HandleToId(hProcess);
+    BOOL bRet = TRUE;
+
+    for (SIZE_T i = 0; i < nCount; i++)
+        lpTransfers[i].nTransferred = 0;
+
+    SIZE_T nFirst = 0;
+    while (nFirst < nCount) {
+        struct iovec local[cMaxVectors], remote[cMaxVectors];
+        SIZE_T nVectors = 0;
+        SIZE_T nLast = nFirst;
+        for (; nLast < nCount && nVectors < cMaxVectors; nLast++) {
+            if (lpTransfers[nLast].nSize == 0)
+                continue;
+            local[nVectors].iov_base = lpTransfers[nLast].lpLocal;
+            local[nVectors].iov_len = lpTransfers[nLast].nSize;
+            remote[nVectors].iov_base = lpTransfers[nLast].lpRemote;
+            remote[nVectors].iov_len = lpTransfers[nLast].nSize;
+            nVectors++;
+        }
+
+        ssize_t n = 0;
+        if (pid && nVectors) {
+            if (bWrite)
+                n = process_vm_writev(pid, local, nVectors, remote, nVectors, 0);
+            else
+                n = process_vm_readv(pid, local, nVectors, remote, nVectors, 0);
+            if (n < 0)
+                n = 0;
+        }
+
+        // Hand out the transferred bytes in order
+        SIZE_T nLeft = static_cast<SIZE_T>(n);
+        SIZE_T nStop = nLast;
+        for (SIZE_T i = nFirst; i < nLast; i++) {
+            MEMORY_TRANSFER & t = lpTransfers[i];
+            t.nTransferred = (nLeft < t.nSize) ? nLeft : t.nSize;
+            nLeft -= t.nTransferred;
+            if (t.nTransferred < t.nSize) {
+                nStop = i;
+                break;
+            }
+        }
+        if (nStop == nLast) {
+            nFirst = nLast;
+            continue;
+        }
+
+        // Finish the entry we stopped in, the call didn't try the ones after it
+        MEMORY_TRANSFER & t = lpTransfers[nStop];
+        SIZE_T nDone = 0;
+        if (bWrite)
+            WriteProcessMemory(hProcess, reinterpret_cast<BYTE *>(t.lpRemote) + t.nTransferred, reinterpret_cast<BYTE *>(t.lpLocal) + t.nTransferred, t.nSize - t.nTransferred, &nDone);
+        else
+            ReadProcessMemory(hProcess, reinterpret_cast<BYTE *>(t.lpRemote) + t.nTransferred, reinterpret_cast<BYTE *>(t.lpLocal) + t.nTransferred, t.nSize - t.nTransferred, &nDone);
+        t.nTransferred += nDone;
+        if (t.nTransferred < t.nSize)
+            bRet = FALSE;
+
+        nFirst = nStop + 1;
+    }
+
+    return(bRet);
+}
+
+BOOL ReadProcessMemoryBatch(HANDLE hProcess, LPMEMORY_TRANSFER lpTransfers, SIZE_T nCount)
+{
+    return(TransferBatch(hProcess, lpTransfers, nCount, false));
+}
+
+BOOL WriteProcessMemoryBatch(HANDLE hProcess, LPMEMORY_TRANSFER lpTransfers, SIZE_T nCount)
+{
+    return(TransferBatch(hProcess, lpTransfers, nCount, true));
+}
+
+BOOL FlushInstructionCache(HANDLE hProcess, LPCVOID lpBaseAddress, SIZE_T dwSize)
+{
+    // x86 keeps instruction fetch coherent with stores
+    return(TRUE);
+}
+
+LPVOID VirtualAllocEx(HANDLE hProcess, LPVOID lpAddress, SIZE_T dwSize, DWORD flAllocationType, DWORD flProtect)
+{
+    CTracer *pTracer = GetTracer(false);
+    pid_t pid = HandleToId(hProcess);
+    if (pTracer == 0 || pid == 0 || dwSize == 0)
+        return(0);
+
+    TracedProcess *pProcess = pTracer->FindProcess(pid);
+    if (pProcess == 0)
+        return(0);
+
+    SIZE_T nSize = (dwSize + PageSize() - 1) & ~(PageSize() - 1);
+#ifdef __x86_64__
+    long lRet = pTracer->RemoteSyscall(pid, SYS_mmap, reinterpret_cast<long>(lpAddress), static_cast<long>(nSize), PageToProt(flProtect), MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+    long lRet = pTracer->RemoteSyscall(pid, SYS_mmap2, reinterpret_cast<long>(lpAddress), static_cast<long>(nSize), PageToProt(flProtect), MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+    if (static_cast<unsigned long>(lRet) >= static_cast<unsigned long>(-4095L))
+        return(0);
+
+    pProcess->Allocations[static_cast<ULONG_PTR>(lRet)] = nSize;
+    return(reinterpret_cast<LPVOID>(lRet));
+}
+
+BOOL VirtualFreeEx(HANDLE hProcess, LPVOID lpAddress, SIZE_T dwSize, DWORD dwFreeType)
+{
+    CTracer *pTracer = GetTracer(false);
+    pid_t pid = HandleToId(hProcess);
+    if (pTracer == 0 || pid == 0)
+        return(FALSE);
+
+    TracedProcess *pProcess = pTracer->FindProcess(pid);
+    if (pProcess == 0)
+        return(FALSE);
+
+    // MEM_RELEASE frees the whole allocation
+    map<ULONG_PTR, SIZE_T>::iterator i = pProcess->Allocations.find(reinterpret_cast<ULONG_PTR>(lpAddress));
+    if (i == pProcess->Allocations.end())
+        return(FALSE);
+
+    long lRet = pTracer->RemoteSyscall(pid, SYS_munmap, reinterpret_cast<long>(lpAddress), static_cast<long>(i->second), 0, 0, 0, 0);
+    if (lRet != 0)
+        return(FALSE);
+
+    pProcess->Allocations.erase(i);
+    return(TRUE);
+}
+
+BOOL VirtualProtectEx(HANDLE hProcess, LPVOID lpAddress, SIZE_T dwSize, DWORD flNewProtect, DWORD *lpflOldProtect)
+{
+    CTracer *pTracer = GetTracer(false);
+    pid_t pid = HandleToId(hProcess);
+    if (pTracer == 0 || pid == 0 || dwSize == 0)
+        return(FALSE);
+
+    TracedProcess *pProcess = pTracer->FindProcess(pid);
+    if (pProcess == 0)
+        return(FALSE);
+
+    ULONG_PTR ulpStart = reinterpret_cast<ULONG_PTR>(lpAddress) & ~(PageSize() - 1);
+    ULONG_PTR ulpEnd = (reinterpret_cast<ULONG_PTR>(lpAddress) + dwSize + PageSize() - 1) & ~(PageSize() - 1);
+
+    // Old protection, guarded pages report their real protection plus PAGE_GUARD
+    DWORD flOldProtect = PAGE_NOACCESS;
+    bool bFound = false;
+    for (size_t i = 0; i < pProcess->Guards.size(); i++) {
+        const GuardRange & g = pProcess->Guards[i];
+        if (ulpStart >= g.ulpStart && ulpStart < g.ulpEnd) {
+            flOldProtect = ProtToPage(g.nProt) | PAGE_GUARD;
+            bFound = true;
+            break;
+        }
+    }
+    if (bFound == false) {
+        int nProt = PROT_NONE;
+        if (QueryProt(pid, ulpStart, &nProt) == false)
+            return(FALSE);
+        flOldProtect = ProtToPage(nProt);
+    }
+
+    int nProt = PageToProt(flNewProtect);
+    if (pTracer->RemoteProtect(pid, ulpStart, ulpEnd, (flNewProtect & PAGE_GUARD) ? PROT_NONE : nProt) == false)
+        return(FALSE);
+
+    // Update guard ranges: cut [ulpStart, ulpEnd) out, then add it back if guarded
+    vector<GuardRange> & Guards = pProcess->NewGuards;
+    Guards.clear();
+    for (size_t i = 0; i < pProcess->Guards.size(); i++) {
+        const GuardRange & g = pProcess->Guards[i];
+        if (g.ulpEnd <= ulpStart || g.ulpStart >= ulpEnd) {
+            Guards.push_back(g);
+            continue;
+        }
+        if (g.ulpStart < ulpStart) {
+            GuardRange low = { g.ulpStart, ulpStart, g.nProt };
+            Guards.push_back(low);
+        }
+        if (g.ulpEnd > ulpEnd) {
+            GuardRange high = { ulpEnd, g.ulpEnd, g.nProt };
+            Guards.push_back(high);
+        }
+    }
+    if (flNewProtect & PAGE_GUARD) {
+        GuardRange g = { ulpStart, ulpEnd, nProt };
+        Guards.push_back(g);
+    }
+    pProcess->Guards.swap(Guards);
+    pProcess->Lifted.erase(lower_bound(pProcess->Lifted.begin(), pProcess->Lifted.end(), ulpStart),
+        lower_bound(pProcess->Lifted.begin(), pProcess->Lifted.end(), ulpEnd));
+
+    if (lpflOldProtect)
+        *lpflOldProtect = flOldProtect;
+
+    return(TRUE);
+}
+
+SIZE_T VirtualQueryEx(HANDLE hProcess, LPCVOID lpAddress, PMEMORY_BASIC_INFORMATION lpBuffer, SIZE_T dwLength)
+{
+    CTracer *pTracer = GetTracer(false);
+    pid_t pid = HandleToId(hProcess);
+    if (pTracer == 0 || pid == 0 || lpBuffer == 0 || dwLength < sizeof(MEMORY_BASIC_INFORMATION))
+        return(0);
+
+    TracedProcess *pProcess = pTracer->FindProcess(pid);
+    if (pProcess == 0)
+        return(0);
+
+    ULONG_PTR ulpPage = reinterpret_cast<ULONG_PTR>(lpAddress) & ~(PageSize() - 1);
+    ULONG_PTR ulpStart = 0, ulpEnd = 0, ulpNext = 0;
+    int nProt = PROT_NONE;
+    ZeroMemory(lpBuffer, sizeof(MEMORY_BASIC_INFORMATION));
+    lpBuffer->BaseAddress = reinterpret_cast<LPVOID>(ulpPage);
+
+    if (QueryRegion(pid, ulpPage, &ulpStart, &ulpEnd, &nProt, &ulpNext) == false) {
+        lpBuffer->AllocationBase = 0;
+        lpBuffer->RegionSize = ulpNext - ulpPage; // Up to the top of the address space if there is no next mapping
+        lpBuffer->State = MEM_FREE;
+        lpBuffer->Protect = PAGE_NOACCESS;
+        return(sizeof(MEMORY_BASIC_INFORMATION));
+    }
+
+    // Guard ranges split the mapping, guarded pages show their real protection plus PAGE_GUARD
+    DWORD flProtect = ProtToPage(nProt);
+    for (size_t i = 0; i < pProcess->Guards.size(); i++) {
+        const GuardRange & g = pProcess->Guards[i];
+        if (ulpPage >= g.ulpStart && ulpPage < g.ulpEnd) {
+            flProtect = ProtToPage(g.nProt) | PAGE_GUARD;
+            if (g.ulpEnd < ulpEnd)
+                ulpEnd = g.ulpEnd;
+        } else if (g.ulpStart > ulpPage && g.ulpStart < ulpEnd) {
+            ulpEnd = g.ulpStart;
+        }
+    }
+    lpBuffer->AllocationBase = reinterpret_cast<LPVOID>(ulpStart);
+    lpBuffer->AllocationProtect = ProtToPage(nProt);
+    lpBuffer->RegionSize = ulpEnd - ulpPage;
+    lpBuffer->State = MEM_COMMIT;
+    lpBuffer->Protect = flProtect;
+    lpBuffer->Type = MEM_PRIVATE;
+
+    return(sizeof(MEMORY_BASIC_INFORMATION));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Thread context
+
+BOOL GetThreadContext(HANDLE hThread, LPCONTEXT lpContext)
+{
+    CTracer *pTracer = GetTracer(false);
+    pid_t tid = HandleToId(hThread);
+    TracedThread *pThread = pTracer ? pTracer->FindThread(tid) : 0;
+    if (pThread == 0)
+        return(FALSE);
+
+    DWORD dwFlags = lpContext->ContextFlags;
+
+    if ((dwFlags & CONTEXT_FULL & ~CONTEXT_i386) != 0) {
+        if (pTracer->ReadRegs(pThread) == false)
+            return(FALSE);
+
+        const struct user_regs_struct & r = pThread->Regs;
+#ifdef __x86_64__
+        if ((dwFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL) {
+            lpContext->Ebp = r.rbp;
+            lpContext->Eip = r.rip;
+            lpContext->SegCs = r.cs;
+            lpContext->EFlags = r.eflags;
+            lpContext->Esp = r.rsp;
+            lpContext->SegSs = r.ss;
+        }
+        if ((dwFlags & CONTEXT_INTEGER) == CONTEXT_INTEGER) {
+            lpContext->Edi = r.rdi;
+            lpContext->Esi = r.rsi;
+            lpContext->Ebx = r.rbx;
+            lpContext->Edx = r.rdx;
+            lpContext->Ecx = r.rcx;
+            lpContext->Eax = r.rax;
+            lpContext->R8 = r.r8;
+            lpContext->R9 = r.r9;
+            lpContext->R10 = r.r10;
+            lpContext->R11 = r.r11;
+            lpContext->R12 = r.r12;
+            lpContext->R13 = r.r13;
+            lpContext->R14 = r.r14;
+            lpContext->R15 = r.r15;
+        }
+        if ((dwFlags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS) {
+            lpContext->SegGs = r.gs;
+            lpContext->SegFs = r.fs;
+            lpContext->SegEs = r.es;
+            lpContext->SegDs = r.ds;
+        }
+#else
+        if ((dwFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL) {
+            lpContext->Ebp = r.ebp;
+            lpContext->Eip = r.eip;
+            lpContext->SegCs = r.xcs;
+            lpContext->EFlags = r.eflags;
+            lpContext->Esp = r.esp;
+            lpContext->SegSs = r.xss;
+        }
+        if ((dwFlags & CONTEXT_INTEGER) == CONTEXT_INTEGER) {
+            lpContext->Edi = r.edi;
+            lpContext->Esi = r.esi;
+            lpContext->Ebx = r.ebx;
+            lpContext->Edx = r.edx;
+            lpContext->Ecx = r.ecx;
+            lpContext->Eax = r.eax;
+        }
+        if ((dwFlags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS) {
+            lpContext->SegGs = r.xgs;
+            lpContext->SegFs = r.xfs;
+            lpContext->SegEs = r.xes;
+            lpContext->SegDs = r.xds;
+        }
+#endif
+        // Trap flag is emulated with PTRACE_SINGLESTEP
+        if ((dwFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL && pThread->bStepPending)
+            lpContext->EFlags |= cTrapFlag;
+    }
+
+    if ((dwFlags & CONTEXT_DEBUG_REGISTERS) == CONTEXT_DEBUG_REGISTERS) {
+        DWORD_PTR *pDr[6] = { &lpContext->Dr0, &lpContext->Dr1, &lpContext->Dr2, &lpContext->Dr3, &lpContext->Dr6, &lpContext->Dr7 };
+        const int nDr[6] = { 0, 1, 2, 3, 6, 7 };
+        if (pThread->bDebugRegsPending == true) {
+            for (int i = 0; i < 6; i++)
+                *pDr[i] = pThread->PendingDebugRegs[i];
+            return(TRUE);
+        }
+        for (int i = 0; i < 6; i++) {
+            errno = 0;
+            long lValue = ptrace(PTRACE_PEEKUSER, tid, reinterpret_cast<void *>(offsetof(struct user, u_debugreg) + nDr[i] * sizeof(long)), 0);
+            if (errno != 0)
+                return(FALSE);
+            *pDr[i] = static_cast<DWORD_PTR>(lValue);
+        }
+    }
+
+    return(TRUE);
+}
+
+BOOL SetThreadContext(HANDLE hThread, const CONTEXT *lpContext)
+{
+    CTracer *pTracer = GetTracer(false);
+    pid_t tid = HandleToId(hThread);
+    TracedThread *pThread = pTracer ? pTracer->FindThread(tid) : 0;
+    if (pThread == 0)
+        return(FALSE);
+
+    DWORD dwFlags = lpContext->ContextFlags;
+
+    if ((dwFlags & CONTEXT_FULL & ~CONTEXT_i386) != 0) {
+        // The register cache makes this a single write
+        if (pTracer->ReadRegs(pThread) == false)
+            return(FALSE);
+
+        const struct user_regs_struct Before = pThread->Regs;
+        struct user_regs_struct & r = pThread->Regs;
+#ifdef __x86_64__
+        if ((dwFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL) {
+            r.rbp = lpContext->Ebp;
+            r.rip = lpContext->Eip;
+            r.cs = lpContext->SegCs;
+            r.eflags = lpContext->EFlags & ~cTrapFlag;
+            r.rsp = lpContext->Esp;
+            r.ss = lpContext->SegSs;
+        }
+        if ((dwFlags & CONTEXT_INTEGER) == CONTEXT_INTEGER) {
+            r.rdi = lpContext->Edi;
+            r.rsi = lpContext->Esi;
+            r.rbx = lpContext->Ebx;
+            r.rdx = lpContext->Edx;
+            r.rcx = lpContext->Ecx;
+            r.rax = lpContext->Eax;
+            r.r8 = lpContext->R8;
+            r.r9 = lpContext->R9;
+            r.r10 = lpContext->R10;
+            r.r11 = lpContext->R11;
+            r.r12 = lpContext->R12;
+            r.r13 = lpContext->R13;
+            r.r14 = lpContext->R14;
+            r.r15 = lpContext->R15;
+        }
+        if ((dwFlags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS) {
+            r.gs = lpContext->SegGs;
+            r.fs = lpContext->SegFs;
+            r.es = lpContext->SegEs;
+            r.ds = lpContext->SegDs;
+        }
+#else
+        if ((dwFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL) {
+            r.ebp = lpContext->Ebp;
+            r.eip = lpContext->Eip;
+            r.xcs = lpContext->SegCs;
+            r.eflags = lpContext->EFlags & ~cTrapFlag;
+            r.esp = lpContext->Esp;
+            r.xss = lpContext->SegSs;
+        }
+        if ((dwFlags & CONTEXT_INTEGER) == CONTEXT_INTEGER) {
+            r.edi = lpContext->Edi;
+            r.esi = lpContext->Esi;
+            r.ebx = lpContext->Ebx;
+            r.edx = lpContext->Edx;
+            r.ecx = lpContext->Ecx;
+            r.eax = lpContext->Eax;
+        }
+        if ((dwFlags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS) {
+            r.xgs = lpContext->SegGs;
+            r.xfs = lpContext->SegFs;
+            r.xes = lpContext->SegEs;
+            r.xds = lpContext->SegDs;
+        }
+#endif
+        if ((dwFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL)
+            pThread->bStepPending = (lpContext->EFlags & cTrapFlag) ? true : false;
+
+        // Nothing to write if only the (emulated) trap flag changed
+        if (memcmp(&Before, &r, sizeof(r)) != 0 && pTracer->WriteRegs(pThread) == false) {
+            pThread->bRegsValid = false;
+            return(FALSE);
+        }
+    }
+
+    if ((dwFlags & CONTEXT_DEBUG_REGISTERS) == CONTEXT_DEBUG_REGISTERS) {
+        const DWORD_PTR dwValue[6] = { lpContext->Dr0, lpContext->Dr1, lpContext->Dr2, lpContext->Dr3, lpContext->Dr6, lpContext->Dr7 };
+        if (pThread->bStopped == false || pTracer->WriteDebugRegs(pThread, dwValue) == false) {
+            // A running thread can't be written to, apply the values at its
+            // next stop and make it stop soon
+            if (pThread->bStopped == true)
+                return(FALSE);
+            memcpy(pThread->PendingDebugRegs, dwValue, sizeof(dwValue));
+            pThread->bDebugRegsPending = true;
+            pTracer->Interrupt(pThread);
+        }
+    }
+
+    return(TRUE);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Synchronization
+
+HANDLE CreateEvent(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL bManualReset, BOOL bInitialState, LPCSTR lpName)
+{
+    EventObject *pEvent = new EventObject;
+    pthread_mutex_init(&pEvent->Lock, 0);
+    pthread_cond_init(&pEvent->Cond, 0);
+    pEvent->bManualReset = bManualReset ? true : false;
+    pEvent->bSignaled = bInitialState ? true : false;
+    pEvent->nFd = eventfd(pEvent->bSignaled ? 1 : 0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return(pEvent);
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+    EventObject *pEvent = reinterpret_cast<EventObject *>(hEvent);
+    if (pEvent == 0 || HandleToId(hEvent))
+        return(FALSE);
+
+    pthread_mutex_lock(&pEvent->Lock);
+    if (pEvent->bSignaled == false)
+        eventfd_write(pEvent->nFd, 1);
+    pEvent->bSignaled = true;
+    pthread_cond_broadcast(&pEvent->Cond);
+    pthread_mutex_unlock(&pEvent->Lock);
+    return(TRUE);
+}
+
+BOOL ResetEvent(HANDLE hEvent)
+{
+    EventObject *pEvent = reinterpret_cast<EventObject *>(hEvent);
+    if (pEvent == 0 || HandleToId(hEvent))
+        return(FALSE);
+
+    pthread_mutex_lock(&pEvent->Lock);
+    if (pEvent->bSignaled == true)
+        DrainEventFd(pEvent);
+    pEvent->bSignaled = false;
+    pthread_mutex_unlock(&pEvent->Lock);
+    return(TRUE);
+}
+
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
+{
+    EventObject *pEvent = reinterpret_cast<EventObject *>(hHandle);
+    if (pEvent == 0 || HandleToId(hHandle))
+        return(WAIT_TIMEOUT);
+
+    struct timespec ts;
+    if (dwMilliseconds != INFINITE) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += dwMilliseconds / 1000;
+        ts.tv_nsec += (dwMilliseconds % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+    }
+
+    DWORD dwRet = WAIT_OBJECT_0;
+    pthread_mutex_lock(&pEvent->Lock);
+    while (pEvent->bSignaled == false) {
+        if (dwMilliseconds == INFINITE) {
+            pthread_cond_wait(&pEvent->Cond, &pEvent->Lock);
+        } else if (dwMilliseconds == 0 || pthread_cond_timedwait(&pEvent->Cond, &pEvent->Lock, &ts) == ETIMEDOUT) {
+            dwRet = WAIT_TIMEOUT;
+            break;
+        }
+    }
+    if (dwRet == WAIT_OBJECT_0)
+        ConsumeEvent(pEvent);
+    pthread_mutex_unlock(&pEvent->Lock);
+
+    return(dwRet);
+}
+
+BOOL CloseHandle(HANDLE hObject)
+{
+    // Process/thread handles are plain IDs
+    if (hObject == 0 || HandleToId(hObject))
+        return(TRUE);
+
+    EventObject *pEvent = reinterpret_cast<EventObject *>(hObject);
+    pthread_cond_destroy(&pEvent->Cond);
+    pthread_mutex_destroy(&pEvent->Lock);
+    if (pEvent->nFd >= 0)
+        close(pEvent->nFd);
+    delete pEvent;
+    return(TRUE);
+}
+
+DWORD GetCurrentThreadId(void)
+{
+    static __thread DWORD dwTid = 0;
+    if (dwTid == 0)
+        dwTid = static_cast<DWORD>(syscall(SYS_gettid));
+    return(dwTid);
+}
+
+namespace
+{
+
+struct ThreadStart
+{
+    void (*pfnStart)(void *);
+    void *pParam;
+};
+
+void *ThreadProc(void *pParam)
+{
+    ThreadStart start = *static_cast<ThreadStart *>(pParam);
+    delete static_cast<ThreadStart *>(pParam);
+    start.pfnStart(start.pParam);
+
+    // The thread's tracer goes with it, its SIGCHLD slot is taken by the next one
+    delete g_pTracer;
+    g_pTracer = 0;
+    return(0);
+}
+
+}
+
+uintptr_t _beginthread(void (*start_address)(void *), unsigned stack_size, void *arglist)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (stack_size)
+        pthread_attr_setstacksize(&attr, stack_size);
+
+    ThreadStart *pStart = new ThreadStart;
+    pStart->pfnStart = start_address;
+    pStart->pParam = arglist;
+
+    pthread_t thread;
+    int nError = pthread_create(&thread, &attr, ThreadProc, pStart);
+    pthread_attr_destroy(&attr);
+    if (nError != 0) {
+        delete pStart;
+        return(static_cast<uintptr_t>(-1));
+    }
+
+    return(static_cast<uintptr_t>(thread));
+}
@@ -0,0 +1,377 @@
+// PtraceDebugApi.h - Win32 debugging API subset on top of Linux ptrace
+//
+// The debugger and the breakpoint classes are written against the Win32
+// debugging API. On Linux this header supplies the types, constants and
+// functions they use, implemented with ptrace, waitpid, process_vm_readv
+// and /proc/<pid>/mem, so the rest of the library compiles unchanged.
+//
+// Notes:
+// - DWORD is an unsigned long, so it is pointer sized on 64-bit targets
+//   (code that stores addresses in DWORDs keeps working).
+// - Process and thread handles are tagged PIDs/TIDs and need no closing.
+// - Like a Win32 debug port, the tracer state belongs to the thread that
+//   called CreateProcess/DebugActiveProcess; WaitForDebugEvent and
+//   ContinueDebugEvent must be called from that thread.
+// - Only the reporting thread is stopped while an event is pending, other
+//   threads of the target keep running.
+// - The trap flag in CONTEXT::EFlags is emulated with PTRACE_SINGLESTEP.
+// - Debug registers set on a running thread are applied at its next stop,
+//   a SIGSTOP (swallowed by the tracer) makes it stop soon.
+// - Synchronous faults (SIGTRAP, SIGSEGV, SIGBUS, SIGILL, SIGFPE) become
+//   exceptions, other signals are passed to the target without an event.
+// - PAGE_GUARD is emulated with PROT_NONE and reported as
+//   EXCEPTION_GUARD_PAGE on first touch. Faults of other threads that raced
+//   with the first touch are retried without an event. The kernel doesn't
+//   tell the access type, ExceptionInformation[0] is always 0 (read).
+// - VirtualAllocEx/VirtualProtectEx run the system call in a stopped thread,
+//   from the vDSO's system call instruction so no code other threads may be
+//   running is patched.
+// - CreateProcess and DebugActiveProcess also debug the children of fork and
+//   vfork, DEBUG_ONLY_THIS_PROCESS included: they start with the debugger's
+//   INT3s in their memory. A child is reported as CREATE_PROCESS_DEBUG_EVENT
+//   and doesn't run before that event is continued, DebugActiveProcessStop
+//   lets go of one that isn't to be debugged. It only works on processes
+//   whose threads are all stopped or yet to report their first stop.
+#pragma once
+
+#if !defined(__i386__) && !defined(__x86_64__)
+#error PtraceDebugApi supports x86 and x86-64 targets only
+#endif
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Basic types
+typedef unsigned long DWORD;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned short WCHAR;           // Wide strings in the target are UTF-16
+typedef int BOOL;
+typedef long LONG;
+typedef int INT32;
+typedef unsigned int UINT32;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef unsigned long ULONG_PTR;
+typedef unsigned long DWORD_PTR;
+typedef long LONG_PTR;
+typedef ULONG_PTR SIZE_T;
+typedef void *PVOID;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+typedef char *LPSTR;
+typedef const char *LPCSTR;
+typedef BYTE *LPBYTE;
+typedef void *HANDLE;
+typedef void *LPSECURITY_ATTRIBUTES;
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID lpThreadParameter);
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define INFINITE                        0xFFFFFFFF
+#define WAIT_OBJECT_0                   0x00000000
+#define WAIT_TIMEOUT                    0x00000102
+
+#define ZeroMemory(p, n)                memset((p), 0, (n))
+// The CRT's name. Too small a buffer gives the length needed here, a negative
+// count there; neither terminates it the same way, so callers check both.
+#define _snprintf                       snprintf
+
+// Process creation flags
+#define DEBUG_PROCESS                   0x00000001
+#define DEBUG_ONLY_THIS_PROCESS         0x00000002
+
+// Continue status
+#define DBG_CONTINUE                    0x00010002
+#define DBG_EXCEPTION_NOT_HANDLED       0x80010001
+
+// Exception codes
+#define EXCEPTION_GUARD_PAGE            0x80000001
+#define EXCEPTION_DATATYPE_MISALIGNMENT 0x80000002
+#define EXCEPTION_BREAKPOINT            0x80000003
+#define EXCEPTION_SINGLE_STEP           0x80000004
+#define EXCEPTION_ACCESS_VIOLATION      0xC0000005
+#define EXCEPTION_ILLEGAL_INSTRUCTION   0xC000001D
+#define EXCEPTION_FLT_INVALID_OPERATION 0xC0000090
+#define EXCEPTION_INT_DIVIDE_BY_ZERO    0xC0000094
+#define EXCEPTION_INT_OVERFLOW          0xC0000095
+#define EXCEPTION_PRIV_INSTRUCTION      0xC0000096
+#define EXCEPTION_MAXIMUM_PARAMETERS    15
+
+// Debug event codes
+#define EXCEPTION_DEBUG_EVENT           1
+#define CREATE_THREAD_DEBUG_EVENT       2
+#define CREATE_PROCESS_DEBUG_EVENT      3
+#define EXIT_THREAD_DEBUG_EVENT         4
+#define EXIT_PROCESS_DEBUG_EVENT        5
+#define LOAD_DLL_DEBUG_EVENT            6
+#define UNLOAD_DLL_DEBUG_EVENT          7
+#define OUTPUT_DEBUG_STRING_EVENT       8
+
+// Memory protection/allocation
+#define PAGE_NOACCESS                   0x01
+#define PAGE_READONLY                   0x02
+#define PAGE_READWRITE                  0x04
+#define PAGE_WRITECOPY                  0x08
+#define PAGE_EXECUTE                    0x10
+#define PAGE_EXECUTE_READ               0x20
+#define PAGE_EXECUTE_READWRITE          0x40
+#define PAGE_EXECUTE_WRITECOPY          0x80
+#define PAGE_GUARD                      0x100
+#define MEM_COMMIT                      0x1000
+#define MEM_RESERVE                     0x2000
+#define MEM_RELEASE                     0x8000
+#define MEM_FREE                        0x10000
+#define MEM_PRIVATE                     0x20000
+
+// Thread context flags
+#define CONTEXT_i386                    0x00010000
+#define CONTEXT_CONTROL                 (CONTEXT_i386 | 0x01)
+#define CONTEXT_INTEGER                 (CONTEXT_i386 | 0x02)
+#define CONTEXT_SEGMENTS                (CONTEXT_i386 | 0x04)
+#define CONTEXT_FLOATING_POINT          (CONTEXT_i386 | 0x08)
+#define CONTEXT_DEBUG_REGISTERS         (CONTEXT_i386 | 0x10)
+#define CONTEXT_FULL                    (CONTEXT_CONTROL | CONTEXT_INTEGER | CONTEXT_SEGMENTS)
+
+// Thread context. The register names follow the Win32 x86 CONTEXT, on
+// x86-64 they hold the full 64-bit registers (Eip is RIP, Eax is RAX...).
+typedef struct _CONTEXT {
+    DWORD ContextFlags;
+
+    // CONTEXT_DEBUG_REGISTERS
+    DWORD_PTR Dr0;
+    DWORD_PTR Dr1;
+    DWORD_PTR Dr2;
+    DWORD_PTR Dr3;
+    DWORD_PTR Dr6;
+    DWORD_PTR Dr7;
+
+    // CONTEXT_SEGMENTS
+    DWORD SegGs;
+    DWORD SegFs;
+    DWORD SegEs;
+    DWORD SegDs;
+
+    // CONTEXT_INTEGER
+    ULONG_PTR Edi;
+    ULONG_PTR Esi;
+    ULONG_PTR Ebx;
+    ULONG_PTR Edx;
+    ULONG_PTR Ecx;
+    ULONG_PTR Eax;
+#ifdef __x86_64__
+    ULONG_PTR R8;
+    ULONG_PTR R9;
+    ULONG_PTR R10;
+    ULONG_PTR R11;
+    ULONG_PTR R12;
+    ULONG_PTR R13;
+    ULONG_PTR R14;
+    ULONG_PTR R15;
+#endif
+
+    // CONTEXT_CONTROL
+    ULONG_PTR Ebp;
+    ULONG_PTR Eip;
+    DWORD SegCs;
+    DWORD EFlags;
+    ULONG_PTR Esp;
+    DWORD SegSs;
+} CONTEXT, *LPCONTEXT;
+
+// Debug event structures
+typedef struct _EXCEPTION_RECORD {
+    DWORD ExceptionCode;
+    DWORD ExceptionFlags;
+    struct _EXCEPTION_RECORD *ExceptionRecord;
+    LPVOID ExceptionAddress;
+    DWORD NumberParameters;
+    ULONG_PTR ExceptionInformation[EXCEPTION_MAXIMUM_PARAMETERS];
+} EXCEPTION_RECORD;
+
+typedef struct _EXCEPTION_DEBUG_INFO {
+    EXCEPTION_RECORD ExceptionRecord;
+    DWORD dwFirstChance;
+} EXCEPTION_DEBUG_INFO;
+
+typedef struct _CREATE_THREAD_DEBUG_INFO {
+    HANDLE hThread;
+    LPVOID lpThreadLocalBase;
+    LPTHREAD_START_ROUTINE lpStartAddress;
+} CREATE_THREAD_DEBUG_INFO;
+
+typedef struct _CREATE_PROCESS_DEBUG_INFO {
+    HANDLE hFile;
+    HANDLE hProcess;
+    HANDLE hThread;
+    LPVOID lpBaseOfImage;
+    DWORD dwDebugInfoFileOffset;
+    DWORD nDebugInfoSize;
+    LPVOID lpThreadLocalBase;
+    LPTHREAD_START_ROUTINE lpStartAddress;
+    LPVOID lpImageName;
+    WORD fUnicode;
+} CREATE_PROCESS_DEBUG_INFO;
+
+typedef struct _EXIT_THREAD_DEBUG_INFO {
+    DWORD dwExitCode;
+} EXIT_THREAD_DEBUG_INFO;
+
+typedef struct _EXIT_PROCESS_DEBUG_INFO {
+    DWORD dwExitCode;
+} EXIT_PROCESS_DEBUG_INFO;
+
+typedef struct _LOAD_DLL_DEBUG_INFO {
+    HANDLE hFile;
+    LPVOID lpBaseOfDll;
+    DWORD dwDebugInfoFileOffset;
+    DWORD nDebugInfoSize;
+    LPVOID lpImageName;
+    WORD fUnicode;
+} LOAD_DLL_DEBUG_INFO;
+
+typedef struct _UNLOAD_DLL_DEBUG_INFO {
+    LPVOID lpBaseOfDll;
+} UNLOAD_DLL_DEBUG_INFO;
+
+typedef struct _OUTPUT_DEBUG_STRING_INFO {
+    LPSTR lpDebugStringData;
+    WORD fUnicode;
+    WORD nDebugStringLength;
+} OUTPUT_DEBUG_STRING_INFO;
+
+typedef struct _DEBUG_EVENT {
+    DWORD dwDebugEventCode;
+    DWORD dwProcessId;
+    DWORD dwThreadId;
+    union {
+        EXCEPTION_DEBUG_INFO Exception;
+        CREATE_THREAD_DEBUG_INFO CreateThread;
+        CREATE_PROCESS_DEBUG_INFO CreateProcessInfo;
+        EXIT_THREAD_DEBUG_INFO ExitThread;
+        EXIT_PROCESS_DEBUG_INFO ExitProcess;
+        LOAD_DLL_DEBUG_INFO LoadDll;
+        UNLOAD_DLL_DEBUG_INFO UnloadDll;
+        OUTPUT_DEBUG_STRING_INFO DebugString;
+    } u;
+} DEBUG_EVENT, *LPDEBUG_EVENT;
+
+typedef struct _STARTUPINFO {
+    DWORD cb;
+} STARTUPINFO, *LPSTARTUPINFO;
+
+typedef struct _PROCESS_INFORMATION {
+    HANDLE hProcess;
+    HANDLE hThread;
+    DWORD dwProcessId;
+    DWORD dwThreadId;
+} PROCESS_INFORMATION, *LPPROCESS_INFORMATION;
+
+// Process control
+BOOL CreateProcess(LPCSTR lpApplicationName, LPSTR lpCommandLine, LPSECURITY_ATTRIBUTES lpProcessAttributes, LPSECURITY_ATTRIBUTES lpThreadAttributes, BOOL bInheritHandles, DWORD dwCreationFlags, LPVOID lpEnvironment, LPCSTR lpCurrentDirectory, LPSTARTUPINFO lpStartupInfo, LPPROCESS_INFORMATION lpProcessInformation);
+BOOL DebugActiveProcess(DWORD dwProcessId);
+BOOL DebugActiveProcessStop(DWORD dwProcessId);
+BOOL WaitForDebugEvent(LPDEBUG_EVENT lpDebugEvent, DWORD dwMilliseconds);
+BOOL ContinueDebugEvent(DWORD dwProcessId, DWORD dwThreadId, DWORD dwContinueStatus);
+
+// Waits for a debug event or for an event object (no Win32 equivalent).
+// Returns WAIT_OBJECT_0 with a debug event, WAIT_OBJECT_0 + 1 if the event
+// object was signaled first or WAIT_TIMEOUT. Pending debug events win.
+DWORD WaitForDebugEventOrObject(LPDEBUG_EVENT lpDebugEvent, HANDLE hObject, DWORD dwMilliseconds);
+
+// The process a debugged process was forked from (no Win32 equivalent), 0 if
+// it wasn't forked or has exec'd since. *pbVFork tells if it was a vfork,
+// whose child shares the parent's memory until it execs or exits.
+DWORD GetForkParentProcessId(DWORD dwProcessId, BOOL *pbVFork);
+
+// Target memory
+BOOL ReadProcessMemory(HANDLE hProcess, LPCVOID lpBaseAddress, LPVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesRead);
+BOOL WriteProcessMemory(HANDLE hProcess, LPVOID lpBaseAddress, LPCVOID lpBuffer, SIZE_T nSize, SIZE_T *lpNumberOfBytesWritten);
+BOOL FlushInstructionCache(HANDLE hProcess, LPCVOID lpBaseAddress, SIZE_T dwSize);
+LPVOID VirtualAllocEx(HANDLE hProcess, LPVOID lpAddress, SIZE_T dwSize, DWORD flAllocationType, DWORD flProtect);
+BOOL VirtualFreeEx(HANDLE hProcess, LPVOID lpAddress, SIZE_T dwSize, DWORD dwFreeType);
+BOOL VirtualProtectEx(HANDLE hProcess, LPVOID lpAddress, SIZE_T dwSize, DWORD flNewProtect, DWORD *lpflOldProtect);
+
+typedef struct _MEMORY_BASIC_INFORMATION {
+    LPVOID BaseAddress;
+    LPVOID AllocationBase;
+    DWORD AllocationProtect;
+    SIZE_T RegionSize;
+    DWORD State;
+    DWORD Protect;
+    DWORD Type;
+} MEMORY_BASIC_INFORMATION, *PMEMORY_BASIC_INFORMATION;
+
+SIZE_T VirtualQueryEx(HANDLE hProcess, LPCVOID lpAddress, PMEMORY_BASIC_INFORMATION lpBuffer, SIZE_T dwLength);
+
+// Batched transfers (no Win32 equivalent). Each entry reports the bytes it
+// transferred, the calls return TRUE only if every entry was completed.
+typedef struct _MEMORY_TRANSFER {
+    LPVOID lpRemote;
+    LPVOID lpLocal;
+    SIZE_T nSize;
+    SIZE_T nTransferred;
+} MEMORY_TRANSFER, *LPMEMORY_TRANSFER;
+
+BOOL ReadProcessMemoryBatch(HANDLE hProcess, LPMEMORY_TRANSFER lpTransfers, SIZE_T nCount);
+BOOL WriteProcessMemoryBatch(HANDLE hProcess, LPMEMORY_TRANSFER lpTransfers, SIZE_T nCount);
+
+// Thread context
+BOOL GetThreadContext(HANDLE hThread, LPCONTEXT lpContext);
+BOOL SetThreadContext(HANDLE hThread, const CONTEXT *lpContext);
+
+// Synchronization
+HANDLE CreateEvent(LPSECURITY_ATTRIBUTES lpEventAttributes, BOOL bManualReset, BOOL bInitialState, LPCSTR lpName);
+BOOL SetEvent(HANDLE hEvent);
+BOOL ResetEvent(HANDLE hEvent);
+DWORD WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds);
+BOOL CloseHandle(HANDLE hObject);
+DWORD GetCurrentThreadId(void);
+
+inline LONG InterlockedIncrement(LONG volatile *lpAddend)
+{
+    return(__sync_add_and_fetch(lpAddend, 1));
+}
+
+inline LONG InterlockedDecrement(LONG volatile *lpAddend)
+{
+    return(__sync_sub_and_fetch(lpAddend, 1));
+}
+
+inline LONG InterlockedExchange(LONG volatile *Target, LONG Value)
+{
+    __sync_synchronize();
+    return(__sync_lock_test_and_set(Target, Value));
+}
+
+inline LONG InterlockedCompareExchange(LONG volatile *Destination, LONG Exchange, LONG Comparand)
+{
+    return(__sync_val_compare_and_swap(Destination, Comparand, Exchange));
+}
+
+inline PVOID InterlockedExchangePointer(PVOID volatile *Target, PVOID Value)
+{
+    __sync_synchronize();
+    return(__sync_lock_test_and_set(Target, Value));
+}
+
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile *Destination, PVOID Exchange, PVOID Comparand)
+{
+    return(__sync_val_compare_and_swap(Destination, Comparand, Exchange));
+}
+
+inline void MemoryBarrier(void)
+{
+    __sync_synchronize();
+}
+
+// Threads (process.h), the thread runs detached
+uintptr_t _beginthread(void (*start_address)(void *), unsigned stack_size, void *arglist);
@@ -0,0 +1,188 @@
+// RangeStepBreakPoint.cpp - Range stepping breakpoint implementation
+#include "stdafx.h"
+#include "RangeStepBreakPoint.h"
+#include "InterruptFlagSet.h"
+
+namespace SDE
+{
+
+CRangeStepBreakPoint::CRangeStepBreakPoint(HANDLE hThread)
+: m_hProcess(NULL)
+, m_hThread(hThread)
+, m_bIsInitialized(false)
+, m_bIsEnabled(false)
+, m_lpVA(NULL)
+, m_pDebugger(NULL)
+, m_nSteps(0)
+, m_pRecorder(NULL)
+{
+}
+
+CRangeStepBreakPoint::CRangeStepBreakPoint(HANDLE hThread, LPVOID lpStart, LPVOID lpEnd)
+: m_hProcess(NULL)
+, m_hThread(hThread)
+, m_bIsInitialized(false)
+, m_bIsEnabled(false)
+, m_lpVA(NULL)
+, m_pDebugger(NULL)
+, m_nSteps(0)
+, m_pRecorder(NULL)
+{
+    AddRange(lpStart, lpEnd);
+}
+
+CRangeStepBreakPoint::~CRangeStepBreakPoint()
+{
+    if (m_bIsInitialized == true)
+        Deinitialize();
+}
+
+bool CRangeStepBreakPoint::AddRange(LPVOID lpStart, LPVOID lpEnd)
+{
+    ULONG_PTR ulpStart = reinterpret_cast<ULONG_PTR>(lpStart);
+    ULONG_PTR ulpEnd = reinterpret_cast<ULONG_PTR>(lpEnd);
+    if (ulpEnd <= ulpStart)
+        return(false);
+
+    m_Ranges.push_back(Range(ulpStart, ulpEnd));
+    return(true);
+}
+
+void CRangeStepBreakPoint::ClearRanges(void)
+{
+    m_Ranges.clear();
+}
+
+bool CRangeStepBreakPoint::Contains(LPVOID lpAddress) const
+{
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(lpAddress);
+    for (size_t i = 0; i < m_Ranges.size(); i++) {
+        if (ulpAddress >= m_Ranges[i].first && ulpAddress < m_Ranges[i].second)
+            return(true);
+    }
+    return(false);
+}
+
+SIZE_T CRangeStepBreakPoint::GetSteps(void) const
+{
+    return(m_nSteps);
+}
+
+void CRangeStepBreakPoint::SetRecorder(CTraceRecorder *pRecorder)
+{
+    m_pRecorder = pRecorder;
+}
+
+bool CRangeStepBreakPoint::Initialize(IDebugger *pDebugger, HANDLE hProcess)
+{
+    m_hProcess = hProcess;
+    m_pDebugger = pDebugger;
+    m_bIsInitialized = true;
+    return(true);
+}
+
+bool CRangeStepBreakPoint::Enable(void)
+{
+    // Must be initialized
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already enabled?
+    if (m_bIsEnabled == true)
+        return(false);
+
+    // Set TF
+    if (CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread) == false)
+        return(false);
+
+    m_nSteps = 0;
+    m_bIsEnabled = true;
+
+    return(true);
+}
+
+bool CRangeStepBreakPoint::Disable(void)
+{
+    // Must be initialized
+    if (m_bIsInitialized == false)
+        return(false);
+
+    // Is already disabled?
+    if (m_bIsEnabled == false)
+        return(false);
+
+    // Clear TF
+    if (CInterruptFlagSet::ClearInterruptFlag(*m_pDebugger, m_hThread) == false)
+        return(false);
+
+    m_bIsEnabled = false;
+
+    return(true);
+}
+
+void CRangeStepBreakPoint::Deinitialize(void)
+{
+    m_bIsInitialized = false;
+}
+
+bool CRangeStepBreakPoint::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    // Must be initialized and enabled
+    if (m_bIsInitialized == false || m_bIsEnabled == false)
+        return(false);
+
+    // Must be the same thread
+    if (hThread != m_hThread)
+        return(false);
+
+    // Must be a first-chance exception
+    if (pException->dwFirstChance == 0)
+        return(false);
+
+    // Exception must be of EXCEPTION_SINGLE_STEP type
+    if (pException->ExceptionRecord.ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return(false);
+
+    if (m_pRecorder)
+        m_pRecorder->Record(*m_pDebugger, m_hThread, pException->ExceptionRecord.ExceptionAddress);
+
+    // Still inside, step on without telling anyone
+    if (Contains(pException->ExceptionRecord.ExceptionAddress) == true) {
+        CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread);
+        m_nSteps++;
+        pException->dwFirstChance = 0xBADC0DE;
+        return(false);
+    }
+
+    // Left the ranges, the trap flag is already clear
+    m_lpVA = pException->ExceptionRecord.ExceptionAddress;
+    m_bIsEnabled = false;
+
+    return(true);
+}
+
+LPVOID CRangeStepBreakPoint::GetAddress(void) const
+{
+    return(m_lpVA);
+}
+
+HANDLE CRangeStepBreakPoint::GetThread(void) const
+{
+    return(m_hThread);
+}
+
+HANDLE CRangeStepBreakPoint::GetProcess(void) const
+{
+    return(m_hProcess);
+}
+
+bool CRangeStepBreakPoint::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // Only a single step in our thread can trigger us
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = NULL;
+    pKey->hThread = m_hThread;
+    return(true);
+}
+
+}
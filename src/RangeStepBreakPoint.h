@@ -0,0 +1,56 @@
+// RangeStepBreakPoint.h - Range stepping breakpoint header
+#pragma once
+
+#include "Defs.h"
+#include "TraceRecorder.h"
+#include <vector>
+
+namespace SDE
+{
+
+// Single steps a thread while its PC stays within the ranges [start, end),
+// re-arming the trap flag from within the debugger loop. Steps inside the
+// ranges reach no client, the breakpoint triggers once, on the first
+// instruction outside them, and is then disabled.
+class CRangeStepBreakPoint : public IBreakPoint
+{
+    typedef std::pair<ULONG_PTR, ULONG_PTR> Range;
+    typedef std::vector<Range> RangeVector;
+public:
+    CRangeStepBreakPoint(HANDLE hThread);
+    CRangeStepBreakPoint(HANDLE hThread, LPVOID lpStart, LPVOID lpEnd);
+    virtual ~CRangeStepBreakPoint();
+
+    bool AddRange(LPVOID lpStart, LPVOID lpEnd);
+    void ClearRanges(void);
+    bool Contains(LPVOID lpAddress) const;
+
+    // Instructions stepped within the ranges since the breakpoint was enabled
+    SIZE_T GetSteps(void) const;
+
+    // Records every step, the one leaving the ranges included
+    void SetRecorder(CTraceRecorder *pRecorder);
+
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
+    virtual bool Enable(void);
+    virtual bool Disable(void);
+    virtual void Deinitialize(void);
+    virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+    virtual LPVOID GetAddress(void) const;
+    virtual HANDLE GetThread(void) const;
+    virtual HANDLE GetProcess(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
+
+private:
+    HANDLE m_hProcess;
+    HANDLE m_hThread;
+    bool m_bIsInitialized;
+    bool m_bIsEnabled;
+    LPVOID m_lpVA;
+    IDebugger *m_pDebugger;
+    RangeVector m_Ranges;
+    SIZE_T m_nSteps;
+    CTraceRecorder *m_pRecorder;
+};
+
+}
@@ -1,5 +1,5 @@
 // SingleStepBreakPoint.h - Single step breakpoint implementation
-#include "StdAfx.h"
+#include "stdafx.h"
 #include "SingleStepIntoBreakPoint.h"
 #include "InterruptFlagSet.h"
 
@@ -14,6 +14,8 @@ CSingleStepIntoBreakPoint::CSingleStepIntoBreakPoint(HANDLE hThread)
 , m_bIsInitialized(false)
 , m_bIsEnabled(false)
 , m_hThread(hThread)
+, m_pDebugger(NULL)
+, m_pRecorder(NULL)
 {
 }
 
@@ -23,9 +25,15 @@ CSingleStepIntoBreakPoint::~CSingleStepIntoBreakPoint()
         Deinitialize();
 }
 
-bool CSingleStepIntoBreakPoint::Initialize(HANDLE hProcess)
+void CSingleStepIntoBreakPoint::SetRecorder(CTraceRecorder *pRecorder)
+{
+    m_pRecorder = pRecorder;
+}
+
+bool CSingleStepIntoBreakPoint::Initialize(IDebugger *pDebugger, HANDLE hProcess)
 {
     m_hProcess = hProcess;
+    m_pDebugger = pDebugger;
     m_bIsInitialized = true;
     return(true);
 }
@@ -41,7 +49,7 @@ bool CSingleStepIntoBreakPoint::Enable(void)
         return(false);
 
     // Set IF
-    if (CInterruptFlagSet::SetInterruptFlag(m_hThread) == false)
+    if (CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread) == false)
         return(false);
 
     m_bIsEnabled = true;
@@ -60,7 +68,7 @@ bool CSingleStepIntoBreakPoint::Disable(void)
         return(false);
 
     // Clear IF
-    if (CInterruptFlagSet::ClearInterruptFlag(m_hThread) == false)
+    if (CInterruptFlagSet::ClearInterruptFlag(*m_pDebugger, m_hThread) == false)
         return(false);
 
     m_bIsEnabled = false;
@@ -92,7 +100,13 @@ bool CSingleStepIntoBreakPoint::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO
         return(false);
 
     m_lpVA = pException->ExceptionRecord.ExceptionAddress;
-    CInterruptFlagSet::SetInterruptFlag(m_hThread);
+    CInterruptFlagSet::SetInterruptFlag(*m_pDebugger, m_hThread);
+
+    if (m_pRecorder) {
+        m_pRecorder->Record(*m_pDebugger, m_hThread, m_lpVA);
+        pException->dwFirstChance = 0xBADC0DE;
+        return(false);
+    }
 
     return(true);
 }
@@ -112,4 +126,13 @@ HANDLE CSingleStepIntoBreakPoint::GetProcess(void) const
     return(m_hProcess);
 }
 
+bool CSingleStepIntoBreakPoint::GetTriggerKey(BreakPointKey *pKey) const
+{
+    // Only a single step in our thread can trigger us
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = NULL;
+    pKey->hThread = m_hThread;
+    return(true);
+}
+
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #pragma once
 
 #include "Defs.h"
+#include "TraceRecorder.h"
 
 namespace SDE
 {
@@ -12,7 +13,11 @@ public:
     CSingleStepIntoBreakPoint(HANDLE hThread);
     virtual ~CSingleStepIntoBreakPoint();
 
-    virtual bool Initialize(HANDLE hProcess);
+    // With a recorder every step is recorded and the thread steps on without
+    // the breakpoint triggering
+    void SetRecorder(CTraceRecorder *pRecorder);
+
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
     virtual bool Enable(void);
     virtual bool Disable(void);
     virtual void Deinitialize(void);
@@ -20,6 +25,7 @@ public:
     virtual LPVOID GetAddress(void) const;
     virtual HANDLE GetThread(void) const;
     virtual HANDLE GetProcess(void) const;
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
 
 private:
     HANDLE m_hProcess;
@@ -27,6 +33,8 @@ private:
     bool m_bIsInitialized;
     bool m_bIsEnabled;
     LPVOID m_lpVA;
+    IDebugger *m_pDebugger;
+    CTraceRecorder *m_pRecorder;
 };
 
 }
\ No newline at end of file
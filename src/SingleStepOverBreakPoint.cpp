@@ -1,7 +1,8 @@
 // SingleStepBreakPoint.h - Single step breakpoint implementation
-#include "StdAfx.h"
+#include "stdafx.h"
 #include "SingleStepOverBreakPoint.h"
 #include "InterruptFlagSet.h"
+#include "InstructionDecoder.h"
 
 #pragma warning(disable:4311) // 'reinterpret_cast' : pointer truncation from 'PVOID' to 'DWORD'
 #pragma warning(disable:4312) // 'reinterpret_cast' : conversion from 'DWORD' to 'LPVOID' of greater size
@@ -9,15 +10,36 @@
 namespace SDE
 {
 
+CSingleStepOverBreakPoint::CReturnSite::CReturnSite(CSingleStepOverBreakPoint *pOwner)
+: m_pOwner(pOwner)
+{
+}
+
+bool CSingleStepOverBreakPoint::CReturnSite::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException)
+{
+    // Puts EIP back on the INT3
+    if (CBreakPointOnExecution::IsTriggered(hThread, pException) == false)
+        return(false);
+
+    if (hThread == m_pOwner->m_hThread && m_pOwner->m_bWaitForBreakPoint == true)
+        m_pOwner->OnReturn();
+
+    // Never reaches the clients, the debugger steps other threads past the INT3
+    pException->dwFirstChance = 0xBADC0DE;
+    return(false);
+}
+
 CSingleStepOverBreakPoint::CSingleStepOverBreakPoint(IDebugger & debugger, HANDLE hThread)
 : m_hProcess(NULL)
 , m_bIsInitialized(false)
 , m_bIsEnabled(false)
 , m_hThread(hThread)
-, m_pBpOnExec(NULL)
+, m_Return(this)
+, m_bReturnAdded(false)
 , m_debugger(debugger)
 , m_bShouldFree(false)
 , m_bWaitForBreakPoint(false)
+, m_pRecorder(NULL)
 {
 }
 
@@ -25,13 +47,14 @@ CSingleStepOverBreakPoint::~CSingleStepOverBreakPoint()
 {
     if (m_bIsInitialized == true)
         Deinitialize();
+}
 
-    if (m_pBpOnExec) {
-        delete m_pBpOnExec;
-    }
+void CSingleStepOverBreakPoint::SetRecorder(CTraceRecorder *pRecorder)
+{
+    m_pRecorder = pRecorder;
 }
 
-bool CSingleStepOverBreakPoint::Initialize(HANDLE hProcess)
+bool CSingleStepOverBreakPoint::Initialize(IDebugger *pDebugger, HANDLE hProcess)
 {
     m_hProcess = hProcess;
     m_bIsInitialized = true;
@@ -49,7 +72,7 @@ bool CSingleStepOverBreakPoint::Enable(void)
         return(false);
 
     // Set IF
-    if (CInterruptFlagSet::SetInterruptFlag(m_hThread) == false)
+    if (CInterruptFlagSet::SetInterruptFlag(m_debugger, m_hThread) == false)
         return(false);
 
     m_bIsEnabled = true;
@@ -68,9 +91,15 @@ bool CSingleStepOverBreakPoint::Disable(void)
         return(false);
 
     // Clear IF
-    if (CInterruptFlagSet::ClearInterruptFlag(m_hThread) == false)
+    if (CInterruptFlagSet::ClearInterruptFlag(m_debugger, m_hThread) == false)
         return(false);
 
+    // Stop waiting for the stepped over instruction to return
+    if (m_bWaitForBreakPoint == true) {
+        m_Return.Disable();
+        m_bWaitForBreakPoint = false;
+    }
+
     m_bIsEnabled = false;
 
     return(true);
@@ -78,6 +107,19 @@ bool CSingleStepOverBreakPoint::Disable(void)
 
 void CSingleStepOverBreakPoint::Deinitialize(void)
 {
+    if (m_bIsEnabled == true)
+        Disable();
+
+    if (m_bReturnAdded == true) {
+        m_debugger.RemoveBreakPoint(&m_Return);
+        m_bReturnAdded = false;
+    }
+
+    if (m_bShouldFree == true) {
+        m_debugger.FreeTrampoline(m_lpMem);
+        m_bShouldFree = false;
+    }
+
     m_bIsInitialized = false;
 }
 
@@ -103,81 +145,41 @@ bool CSingleStepOverBreakPoint::IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO
     
     // Check if we need to write the stack value back (from our exec-breakpoint handler)
     if (m_bShouldFree == true) {
-        VirtualFreeEx(m_hProcess, m_lpMem, 5, MEM_RELEASE);
+        m_debugger.FreeTrampoline(m_lpMem);
         m_bShouldFree = false;
     }
     
-    // Get first byte of instruction
-    BYTE byte;
-    DWORD dwNumRead = 0;
-    ReadProcessMemory(m_hProcess, m_lpVA, &byte, 1, &dwNumRead);
-
+    // Calls, interrupts and repeated string operations are stepped over
+    BYTE Code[CInstructionDecoder::cMaxLength];
     int nInstructionSize = 0;
-
-    if (dwNumRead) {
-        switch (byte) {
-            case 0xCC: // INT 3
-                nInstructionSize = 1;
-                break;
-            case 0xCD: // INT xx
-                nInstructionSize = 2;
-                break;
-            case 0xE8: // CALL Dword [mem]
-                nInstructionSize = 5;
-                break;
-            case 0x9A: // CALL Fword [mem]
-                nInstructionSize = 7;
-                break;
-            case 0xFF:
-                {
-                dwNumRead = 0;
-                ReadProcessMemory(m_hProcess, reinterpret_cast<LPVOID>(reinterpret_cast<ULONG_PTR>(m_lpVA) + 1), &byte, 1, &dwNumRead);
-                if (dwNumRead) {
-                    if (byte == 0x15) {
-                        // CALL Dword
-                        nInstructionSize = 6;
-                    } else if ((byte & 0xD8) == 0xD0) {
-                        // CALL reg
-                        nInstructionSize = 2;
-                    } else if ((byte & 0x90) == 0x90) {
-                        // CALL d,[reg][mem] / CALL f,[reg][mem]
-                        nInstructionSize = 6;
-                    } else if ((byte & 0x50) == 0x50) {
-                        // CALL d,[reg][pos] / CALL f,[reg][pos]
-                        nInstructionSize = 3;
-                    } else if ((byte & 0x10) == 0x10) {
-                        // CALL d,[reg] / CALL f,[reg]
-                        nInstructionSize = 2;
-                    }
-                }
-                }
-                break;
-            default:
-                break;
-        }
-    }
+    InstructionInfo info;
+    if (CInstructionDecoder::Decode(m_debugger, m_lpVA, Code, &info) && (info.dwFlags & CInstructionDecoder::cStepOver))
+        nInstructionSize = info.nLength;
 
     if (nInstructionSize) {
         // Set breakpoint after the instruction and continue single stepping from there
         ULONG_PTR ulpVA = reinterpret_cast<ULONG_PTR>(m_lpVA);
         ulpVA += nInstructionSize;
         
-        if (m_pBpOnExec) {
-            delete m_pBpOnExec;
-            m_pBpOnExec = 0;
+        // The same INT3 breakpoint serves every step over
+        m_Return.SetAddress(reinterpret_cast<LPVOID>(ulpVA));
+        if (m_bReturnAdded == false) {
+            m_debugger.AddBreakPoint(&m_Return);
+            m_bReturnAdded = true;
         }
-        
-        m_pBpOnExec = new CBreakPointOnExecution(reinterpret_cast<LPVOID>(ulpVA));
-        m_debugger.AddBreakPoint(m_pBpOnExec);
-        m_pBpOnExec->Enable();
-
-        m_debugger.AddClient(this);
+        m_Return.Enable();
  
         m_bWaitForBreakPoint = true;
         
-        CInterruptFlagSet::ClearInterruptFlag(m_hThread);
+        CInterruptFlagSet::ClearInterruptFlag(m_debugger, m_hThread);
     } else {
-        CInterruptFlagSet::SetInterruptFlag(m_hThread);
+        CInterruptFlagSet::SetInterruptFlag(m_debugger, m_hThread);
+    }
+
+    if (m_pRecorder) {
+        m_pRecorder->Record(m_debugger, m_hThread, m_lpVA);
+        pException->dwFirstChance = 0xBADC0DE;
+        return(false);
     }
 
     return(true);
@@ -198,62 +200,53 @@ HANDLE CSingleStepOverBreakPoint::GetProcess(void) const
     return(m_hProcess);
 }
 
-bool CSingleStepOverBreakPoint::OnBreakPoint(IBreakPoint *pBreakPoint)
+bool CSingleStepOverBreakPoint::GetTriggerKey(BreakPointKey *pKey) const
 {
-    CBreakPointOnExecution *pBp = dynamic_cast<CBreakPointOnExecution *>(pBreakPoint);
-
-    if (pBp == m_pBpOnExec) {
-        DWORD dwAddress = reinterpret_cast<DWORD>(pBreakPoint->GetAddress());
-        m_pBpOnExec->Disable();
-        m_debugger.RemoveBreakPoint(m_pBpOnExec);
-        delete m_pBpOnExec;
-        m_pBpOnExec = 0;
-
-        m_debugger.RemoveClient(this);
-        
-        // Allocate some space for a JMP <our address>
-        m_lpMem = VirtualAllocEx(m_hProcess, 0, 5, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-        if (m_lpMem) {
-            m_bShouldFree = true;
-
-            // Write JMP code
-            BYTE Jmp[5];
-            Jmp[0] = 0xE9;
-            *((DWORD *)&Jmp[1]) = dwAddress;
-            *((DWORD *)&Jmp[1]) -= reinterpret_cast<DWORD>(m_lpMem);
-            *((DWORD *)&Jmp[1]) -= 5;
-            DWORD dw;
-            WriteProcessMemory(m_hProcess, m_lpMem, Jmp, 5, &dw);
-
-            // Set EIP to the JMP code
-            _CONTEXT ctx;
-            ZeroMemory(&ctx, sizeof(_CONTEXT));
-            ctx.ContextFlags = CONTEXT_CONTROL;
-            GetThreadContext(m_hThread, &ctx);
-            ctx.Eip = reinterpret_cast<DWORD>(m_lpMem);
-            SetThreadContext(m_hThread, &ctx);
-        }
-
-        CInterruptFlagSet::SetInterruptFlag(m_hThread);
-
-        m_bWaitForBreakPoint = false;
-
-        return(true); // We removed a breakpoint
-    }
-
-    return(false); // We didn't remove any breakpoints
+    // Only a single step in our thread can trigger us
+    pKey->dwExceptionCode = EXCEPTION_SINGLE_STEP;
+    pKey->lpAddress = NULL;
+    pKey->hThread = m_hThread;
+    return(true);
 }
 
-void CSingleStepOverBreakPoint::OnFinishedDebugging(void)
+void CSingleStepOverBreakPoint::OnReturn(void)
 {
-    if (m_pBpOnExec) {
-        m_pBpOnExec->Disable();
-        m_debugger.RemoveBreakPoint(m_pBpOnExec);
-        delete m_pBpOnExec;
-        m_pBpOnExec = 0;
+    DWORD dwAddress = reinterpret_cast<DWORD>(m_Return.GetAddress());
+    m_Return.Disable();
+
+#ifdef __x86_64__
+    // JMP [RIP+0] followed by the absolute target
+    BYTE Jmp[14] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+#else
+    BYTE Jmp[5] = { 0xE9 };
+#endif
+
+    // Take a trampoline for a JMP <our address>
+    m_lpMem = m_debugger.AllocateTrampoline(sizeof(Jmp));
+    if (m_lpMem) {
+        m_bShouldFree = true;
+
+        // Write JMP code
+#ifdef __x86_64__
+        *((ULONG_PTR *)&Jmp[6]) = dwAddress;
+#else
+        *((INT32 *)&Jmp[1]) = static_cast<INT32>(dwAddress - reinterpret_cast<DWORD>(m_lpMem) - 5);
+#endif
+        DWORD dw;
+        m_debugger.WriteProcessMemory(m_lpMem, Jmp, sizeof(Jmp), &dw);
+
+        // Set EIP to the JMP code
+        _CONTEXT ctx;
+        ZeroMemory(&ctx, sizeof(_CONTEXT));
+        ctx.ContextFlags = CONTEXT_CONTROL;
+        m_debugger.GetThreadContext(m_hThread, &ctx);
+        ctx.Eip = reinterpret_cast<DWORD>(m_lpMem);
+        m_debugger.SetThreadContext(m_hThread, &ctx);
     }
 
-    m_debugger.RemoveClient(this);
+    CInterruptFlagSet::SetInterruptFlag(m_debugger, m_hThread);
+
+    m_bWaitForBreakPoint = false;
 }
 
 }
\ No newline at end of file
@@ -3,17 +3,33 @@
 
 #include "Defs.h"
 #include "BreakPointOnExecution.h"
+#include "TraceRecorder.h"
 
 namespace SDE
 {
 
-class CSingleStepOverBreakPoint : public IBreakPoint, public IDebuggerClient
+class CSingleStepOverBreakPoint : public IBreakPoint
 {
+    // The INT3 after a stepped over instruction. It is kept across steps, moved
+    // and enabled for each one; other threads pass it.
+    class CReturnSite : public CBreakPointOnExecution
+    {
+    public:
+        CReturnSite(CSingleStepOverBreakPoint *pOwner);
+        virtual bool IsTriggered(HANDLE hThread, EXCEPTION_DEBUG_INFO *pException);
+
+    private:
+        CSingleStepOverBreakPoint *m_pOwner;
+    };
 public:
     CSingleStepOverBreakPoint(IDebugger & debugger, HANDLE hThread);
     virtual ~CSingleStepOverBreakPoint();
 
-    virtual bool Initialize(HANDLE hProcess);
+    // With a recorder every step is recorded and the thread steps on without
+    // the breakpoint triggering
+    void SetRecorder(CTraceRecorder *pRecorder);
+
+    virtual bool Initialize(IDebugger *pDebugger, HANDLE hProcess);
     virtual bool Enable(void);
     virtual bool Disable(void);
     virtual void Deinitialize(void);
@@ -21,8 +37,10 @@ public:
     virtual LPVOID GetAddress(void) const;
     virtual HANDLE GetThread(void) const;
     virtual HANDLE GetProcess(void) const;
-    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint);
-    virtual void OnFinishedDebugging(void);
+    virtual bool GetTriggerKey(BreakPointKey *pKey) const;
+
+private:
+    void OnReturn(void);
 
 private:
     HANDLE m_hProcess;
@@ -30,11 +48,13 @@ private:
     bool m_bIsInitialized;
     bool m_bIsEnabled;
     LPVOID m_lpVA;
-    CBreakPointOnExecution *m_pBpOnExec;
+    CReturnSite m_Return;
+    bool m_bReturnAdded;
     IDebugger & m_debugger;
     LPVOID m_lpMem;
     bool m_bShouldFree;
     bool m_bWaitForBreakPoint;
+    CTraceRecorder *m_pRecorder;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+// ThreadContextCache.cpp - Per-stop thread context cache implementation
+#include "stdafx.h"
+#include "ThreadContextCache.h"
+
+namespace SDE
+{
+
+// The architecture bit is part of every CONTEXT_xxx flag, the cache keeps
+// track of the register groups only
+static const DWORD cContextArch = CONTEXT_i386;
+
+CThreadContextCache::CThreadContextCache()
+{
+}
+
+CThreadContextCache::~CThreadContextCache()
+{
+}
+
+bool CThreadContextCache::Get(HANDLE hThread, LPCONTEXT lpContext)
+{
+    if (hThread == NULL)
+        return(false);
+
+    DWORD dwGroups = lpContext->ContextFlags & ~cContextArch;
+
+    Entry *pEntry = Find(hThread);
+    if (pEntry == 0) {
+        Entry entry;
+        ZeroMemory(&entry, sizeof(Entry));
+        entry.hThread = hThread;
+        m_Entries.push_back(entry);
+        pEntry = &m_Entries.back();
+    }
+
+    // Read the groups we don't have yet
+    DWORD dwMissing = dwGroups & ~pEntry->dwValid;
+    if (dwMissing) {
+        _CONTEXT ctx;
+        ZeroMemory(&ctx, sizeof(_CONTEXT));
+        ctx.ContextFlags = cContextArch | dwMissing;
+        if (::GetThreadContext(hThread, &ctx) == FALSE)
+            return(false);
+
+        CopyContext(&pEntry->Context, &ctx, dwMissing);
+        pEntry->dwValid |= dwMissing;
+    }
+
+    CopyContext(lpContext, &pEntry->Context, dwGroups);
+
+    return(true);
+}
+
+bool CThreadContextCache::Set(HANDLE hThread, const CONTEXT *lpContext)
+{
+    if (hThread == NULL)
+        return(false);
+
+    DWORD dwGroups = lpContext->ContextFlags & ~cContextArch;
+
+    Entry *pEntry = Find(hThread);
+    if (pEntry == 0) {
+        Entry entry;
+        ZeroMemory(&entry, sizeof(Entry));
+        entry.hThread = hThread;
+        m_Entries.push_back(entry);
+        pEntry = &m_Entries.back();
+    }
+
+    CopyContext(&pEntry->Context, lpContext, dwGroups);
+    pEntry->dwValid |= dwGroups;
+    pEntry->dwDirty |= dwGroups;
+
+    return(true);
+}
+
+bool CThreadContextCache::Flush(void)
+{
+    bool bRet = true;
+
+    // Write back the changed groups, once per thread
+    for (size_t i = 0; i < m_Entries.size(); i++) {
+        Entry & entry = m_Entries[i];
+        if (entry.dwDirty == 0)
+            continue;
+
+        entry.Context.ContextFlags = cContextArch | entry.dwDirty;
+        if (::SetThreadContext(entry.hThread, &entry.Context) == FALSE)
+            bRet = false;
+
+        entry.dwDirty = 0;
+    }
+
+    return(bRet);
+}
+
+void CThreadContextCache::Clear(void)
+{
+    // Keeps the capacity, the next stop doesn't need to allocate
+    m_Entries.clear();
+}
+
+CThreadContextCache::Entry *CThreadContextCache::Find(HANDLE hThread)
+{
+    // Only a few threads are touched per stop, a linear scan is enough
+    for (size_t i = 0; i < m_Entries.size(); i++) {
+        if (m_Entries[i].hThread == hThread)
+            return(&m_Entries[i]);
+    }
+    return(0);
+}
+
+void CThreadContextCache::CopyContext(LPCONTEXT lpDest, const CONTEXT *lpSource, DWORD dwGroups)
+{
+    if (dwGroups & (CONTEXT_CONTROL & ~cContextArch)) {
+        lpDest->Ebp = lpSource->Ebp;
+        lpDest->Eip = lpSource->Eip;
+        lpDest->SegCs = lpSource->SegCs;
+        lpDest->EFlags = lpSource->EFlags;
+        lpDest->Esp = lpSource->Esp;
+        lpDest->SegSs = lpSource->SegSs;
+    }
+    if (dwGroups & (CONTEXT_INTEGER & ~cContextArch)) {
+        lpDest->Edi = lpSource->Edi;
+        lpDest->Esi = lpSource->Esi;
+        lpDest->Ebx = lpSource->Ebx;
+        lpDest->Edx = lpSource->Edx;
+        lpDest->Ecx = lpSource->Ecx;
+        lpDest->Eax = lpSource->Eax;
+#ifdef __x86_64__
+        lpDest->R8 = lpSource->R8;
+        lpDest->R9 = lpSource->R9;
+        lpDest->R10 = lpSource->R10;
+        lpDest->R11 = lpSource->R11;
+        lpDest->R12 = lpSource->R12;
+        lpDest->R13 = lpSource->R13;
+        lpDest->R14 = lpSource->R14;
+        lpDest->R15 = lpSource->R15;
+#endif
+    }
+    if (dwGroups & (CONTEXT_SEGMENTS & ~cContextArch)) {
+        lpDest->SegGs = lpSource->SegGs;
+        lpDest->SegFs = lpSource->SegFs;
+        lpDest->SegEs = lpSource->SegEs;
+        lpDest->SegDs = lpSource->SegDs;
+    }
+    if (dwGroups & (CONTEXT_DEBUG_REGISTERS & ~cContextArch)) {
+        lpDest->Dr0 = lpSource->Dr0;
+        lpDest->Dr1 = lpSource->Dr1;
+        lpDest->Dr2 = lpSource->Dr2;
+        lpDest->Dr3 = lpSource->Dr3;
+        lpDest->Dr6 = lpSource->Dr6;
+        lpDest->Dr7 = lpSource->Dr7;
+    }
+#ifdef _WIN32
+    if (dwGroups & (CONTEXT_FLOATING_POINT & ~cContextArch))
+        lpDest->FloatSave = lpSource->FloatSave;
+    if (dwGroups & (CONTEXT_EXTENDED_REGISTERS & ~cContextArch))
+        memcpy(lpDest->ExtendedRegisters, lpSource->ExtendedRegisters, sizeof(lpDest->ExtendedRegisters));
+#endif
+}
+
+}
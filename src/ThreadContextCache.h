@@ -0,0 +1,39 @@
+// ThreadContextCache.h - Per-stop thread context cache header
+#pragma once
+
+#include <vector>
+
+namespace SDE
+{
+
+// Caches thread contexts while the debuggee is stopped. A thread's registers
+// are read the first time they are asked for, changes are kept in the cache
+// and written back once by Flush before the debuggee continues.
+class CThreadContextCache
+{
+    struct Entry
+    {
+        HANDLE hThread;
+        DWORD dwValid;
+        DWORD dwDirty;
+        CONTEXT Context;
+    };
+    typedef std::vector<Entry> EntryVector;
+public:
+    CThreadContextCache();
+    ~CThreadContextCache();
+
+    bool Get(HANDLE hThread, LPCONTEXT lpContext);
+    bool Set(HANDLE hThread, const CONTEXT *lpContext);
+    bool Flush(void);
+    void Clear(void);
+
+private:
+    Entry *Find(HANDLE hThread);
+    static void CopyContext(LPCONTEXT lpDest, const CONTEXT *lpSource, DWORD dwGroups);
+
+private:
+    EntryVector m_Entries;
+};
+
+}
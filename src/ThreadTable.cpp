@@ -0,0 +1,367 @@
+// ThreadTable.cpp - Debuggee threads by TID and handle implementation
+#include "stdafx.h"
+#include "ThreadTable.h"
+
+namespace SDE
+{
+
+static const size_t cInitialTable = 64;
+static const size_t cNoSlot = static_cast<size_t>(-1);
+// TIDs marking free and deleted slots
+static const DWORD cFreeTid = 0;
+static const DWORD cDeletedTid = 0xFFFFFFFF;
+// Handle index entries
+static const LONG cEmpty = 0;
+static const LONG cDeleted = -1;
+
+CThreadTable::CThreadTable()
+: m_pTable(NULL)
+, m_nCount(0)
+, m_lReaders(0)
+{
+}
+
+CThreadTable::~CThreadTable()
+{
+    // No reader is left by now
+    if (m_pTable)
+        DestroyTable(m_pTable);
+    for (size_t i = 0; i < m_Retired.size(); i++)
+        DestroyTable(m_Retired[i]);
+}
+
+size_t CThreadTable::HashTid(DWORD dwTid, size_t nMask)
+{
+    DWORD dwHash = dwTid * 0x9E3779B1;
+    return(static_cast<size_t>(dwHash ^ (dwHash >> 16)) & nMask);
+}
+
+size_t CThreadTable::HashHandle(HANDLE hThread, size_t nMask)
+{
+    ULONG_PTR ulpHash = (reinterpret_cast<ULONG_PTR>(hThread) >> 2) * static_cast<ULONG_PTR>(0x9E3779B1);
+    return(static_cast<size_t>(ulpHash ^ (ulpHash >> 16)) & nMask);
+}
+
+CThreadTable::Table *CThreadTable::CreateTable(size_t nSize)
+{
+    Table *pTable = new Table;
+    pTable->nSize = nSize;
+    pTable->nUsed = 0;
+    pTable->nHandlesUsed = 0;
+    pTable->pSlots = new Slot[nSize];
+    pTable->plByHandle = new LONG[nSize];
+    ZeroMemory(pTable->pSlots, nSize * sizeof(Slot));
+    ZeroMemory(const_cast<LONG *>(pTable->plByHandle), nSize * sizeof(LONG));
+    return(pTable);
+}
+
+void CThreadTable::DestroyTable(Table *pTable)
+{
+    delete [] pTable->pSlots;
+    delete [] pTable->plByHandle;
+    delete pTable;
+}
+
+void CThreadTable::ReadSlot(const Slot & slot, DWORD *pdwTid, HANDLE *phThread)
+{
+    // Retry while the writer is in the slot
+    for (;;) {
+        LONG lSequence = slot.lSequence;
+        MemoryBarrier();
+        *pdwTid = slot.thread.dwTid;
+        *phThread = slot.thread.hThread;
+        MemoryBarrier();
+        if ((lSequence & 1) == 0 && slot.lSequence == lSequence)
+            break;
+    }
+}
+
+size_t CThreadTable::FindSlot(DWORD dwTid) const
+{
+    const Table *pTable = m_pTable;
+    if (pTable == NULL || dwTid == cFreeTid || dwTid == cDeletedTid)
+        return(cNoSlot);
+
+    size_t nMask = pTable->nSize - 1;
+    size_t n = HashTid(dwTid, nMask);
+    for (size_t i = 0; i < pTable->nSize; i++) {
+        DWORD dwSlotTid = pTable->pSlots[n].thread.dwTid;
+        if (dwSlotTid == dwTid)
+            return(n);
+        if (dwSlotTid == cFreeTid)
+            break;
+        n = (n + 1) & nMask;
+    }
+    return(cNoSlot);
+}
+
+void CThreadTable::IndexHandle(Table *pTable, size_t nSlot)
+{
+    size_t nMask = pTable->nSize - 1;
+    size_t n = HashHandle(pTable->pSlots[nSlot].thread.hThread, nMask);
+    while (pTable->plByHandle[n] != cEmpty && pTable->plByHandle[n] != cDeleted)
+        n = (n + 1) & nMask;
+
+    if (pTable->plByHandle[n] == cEmpty)
+        pTable->nHandlesUsed++;
+    InterlockedExchange(&pTable->plByHandle[n], static_cast<LONG>(nSlot + 1));
+}
+
+void CThreadTable::Rebuild(void)
+{
+    // Without deleted entries, doubling if still too full
+    Table *pOld = m_pTable;
+    size_t nSize = pOld ? pOld->nSize : cInitialTable;
+    while (m_nCount * 2 >= nSize)
+        nSize *= 2;
+
+    Table *pTable = CreateTable(nSize);
+    size_t nMask = nSize - 1;
+    for (size_t i = 0; pOld && i < pOld->nSize; i++) {
+        const Thread & thread = pOld->pSlots[i].thread;
+        if (thread.dwTid == cFreeTid || thread.dwTid == cDeletedTid)
+            continue;
+
+        size_t n = HashTid(thread.dwTid, nMask);
+        while (pTable->pSlots[n].thread.dwTid != cFreeTid)
+            n = (n + 1) & nMask;
+        pTable->pSlots[n].thread = thread;
+        pTable->nUsed++;
+        IndexHandle(pTable, n);
+    }
+
+    // Readers that come in from now on see the new table
+    InterlockedExchangePointer(reinterpret_cast<PVOID volatile *>(&m_pTable), pTable);
+    if (pOld)
+        m_Retired.push_back(pOld);
+    FreeRetired();
+}
+
+void CThreadTable::FreeRetired(void)
+{
+    if (m_Retired.empty() == true || m_lReaders != 0)
+        return;
+
+    for (size_t i = 0; i < m_Retired.size(); i++)
+        DestroyTable(m_Retired[i]);
+    m_Retired.clear();
+}
+
+CThreadTable::Thread *CThreadTable::Insert(DWORD dwTid, HANDLE hThread)
+{
+    if (dwTid == cFreeTid || dwTid == cDeletedTid)
+        return(NULL);
+
+    // A TID given again takes the new handle
+    size_t nSlot = FindSlot(dwTid);
+    if (nSlot != cNoSlot) {
+        if (m_pTable->pSlots[nSlot].thread.hThread == hThread)
+            return(&m_pTable->pSlots[nSlot].thread);
+        Remove(dwTid);
+    }
+
+    if (m_pTable == NULL || (m_pTable->nUsed + 1) * 4 >= m_pTable->nSize * 3 || (m_pTable->nHandlesUsed + 1) * 4 >= m_pTable->nSize * 3)
+        Rebuild();
+
+    // The first deleted slot on the way, or the free one ending it
+    Table *pTable = m_pTable;
+    size_t nMask = pTable->nSize - 1;
+    size_t n = HashTid(dwTid, nMask);
+    nSlot = cNoSlot;
+    while (pTable->pSlots[n].thread.dwTid != cFreeTid) {
+        if (nSlot == cNoSlot && pTable->pSlots[n].thread.dwTid == cDeletedTid)
+            nSlot = n;
+        n = (n + 1) & nMask;
+    }
+    if (nSlot == cNoSlot) {
+        nSlot = n;
+        pTable->nUsed++;
+    }
+
+    Slot & slot = pTable->pSlots[nSlot];
+    InterlockedIncrement(&slot.lSequence);
+    ZeroMemory(&slot.thread, sizeof(Thread));
+    slot.thread.dwTid = dwTid;
+    slot.thread.hThread = hThread;
+    InterlockedIncrement(&slot.lSequence);
+
+    IndexHandle(pTable, nSlot);
+    m_nCount++;
+    FreeRetired();
+
+    return(&slot.thread);
+}
+
+void CThreadTable::Remove(DWORD dwTid)
+{
+    size_t nSlot = FindSlot(dwTid);
+    if (nSlot == cNoSlot)
+        return;
+
+    Table *pTable = m_pTable;
+    Slot & slot = pTable->pSlots[nSlot];
+    HANDLE hThread = slot.thread.hThread;
+
+    // Drop the handle's entry first, then the slot
+    size_t nMask = pTable->nSize - 1;
+    size_t n = HashHandle(hThread, nMask);
+    for (size_t i = 0; i < pTable->nSize && pTable->plByHandle[n] != cEmpty; i++) {
+        if (pTable->plByHandle[n] == static_cast<LONG>(nSlot + 1)) {
+            InterlockedExchange(&pTable->plByHandle[n], cDeleted);
+            break;
+        }
+        n = (n + 1) & nMask;
+    }
+
+    InterlockedIncrement(&slot.lSequence);
+    slot.thread.dwTid = cDeletedTid;
+    slot.thread.hThread = NULL;
+    InterlockedIncrement(&slot.lSequence);
+
+    m_nCount--;
+    FreeRetired();
+}
+
+size_t CThreadTable::FindHandleSlot(HANDLE hThread) const
+{
+    const Table *pTable = m_pTable;
+    if (pTable == NULL || hThread == NULL)
+        return(cNoSlot);
+
+    size_t nMask = pTable->nSize - 1;
+    size_t n = HashHandle(hThread, nMask);
+    for (size_t i = 0; i < pTable->nSize && pTable->plByHandle[n] != cEmpty; i++) {
+        LONG lEntry = pTable->plByHandle[n];
+        if (lEntry != cDeleted && pTable->pSlots[lEntry - 1].thread.hThread == hThread)
+            return(static_cast<size_t>(lEntry - 1));
+        n = (n + 1) & nMask;
+    }
+    return(cNoSlot);
+}
+
+CThreadTable::Thread *CThreadTable::Find(DWORD dwTid)
+{
+    size_t nSlot = FindSlot(dwTid);
+    if (nSlot == cNoSlot)
+        return(NULL);
+    return(&m_pTable->pSlots[nSlot].thread);
+}
+
+const CThreadTable::Thread *CThreadTable::Find(DWORD dwTid) const
+{
+    size_t nSlot = FindSlot(dwTid);
+    if (nSlot == cNoSlot)
+        return(NULL);
+    return(&m_pTable->pSlots[nSlot].thread);
+}
+
+CThreadTable::Thread *CThreadTable::FindByHandle(HANDLE hThread)
+{
+    size_t nSlot = FindHandleSlot(hThread);
+    if (nSlot == cNoSlot)
+        return(NULL);
+    return(&m_pTable->pSlots[nSlot].thread);
+}
+
+const CThreadTable::Thread *CThreadTable::FindByHandle(HANDLE hThread) const
+{
+    size_t nSlot = FindHandleSlot(hThread);
+    if (nSlot == cNoSlot)
+        return(NULL);
+    return(&m_pTable->pSlots[nSlot].thread);
+}
+
+SIZE_T CThreadTable::GetCount(void) const
+{
+    return(m_nCount);
+}
+
+void CThreadTable::Clear(void)
+{
+    Table *pOld = static_cast<Table *>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile *>(&m_pTable), NULL));
+    if (pOld)
+        m_Retired.push_back(pOld);
+    m_nCount = 0;
+    FreeRetired();
+}
+
+SIZE_T CThreadTable::GetSlots(void) const
+{
+    if (m_pTable == NULL)
+        return(0);
+    return(m_pTable->nSize);
+}
+
+CThreadTable::Thread *CThreadTable::GetAt(SIZE_T nSlot)
+{
+    Thread & thread = m_pTable->pSlots[nSlot].thread;
+    if (thread.dwTid == cFreeTid || thread.dwTid == cDeletedTid)
+        return(NULL);
+    return(&thread);
+}
+
+HANDLE CThreadTable::GetHandle(DWORD dwTid) const
+{
+    if (dwTid == cFreeTid || dwTid == cDeletedTid)
+        return(NULL);
+
+    HANDLE hThread = NULL;
+    InterlockedIncrement(&m_lReaders);
+
+    const Table *pTable = m_pTable;
+    if (pTable) {
+        size_t nMask = pTable->nSize - 1;
+        size_t n = HashTid(dwTid, nMask);
+        for (size_t i = 0; i < pTable->nSize; i++) {
+            DWORD dwSlotTid;
+            HANDLE hSlotThread;
+            ReadSlot(pTable->pSlots[n], &dwSlotTid, &hSlotThread);
+            if (dwSlotTid == dwTid) {
+                hThread = hSlotThread;
+                break;
+            }
+            if (dwSlotTid == cFreeTid)
+                break;
+            n = (n + 1) & nMask;
+        }
+    }
+
+    InterlockedDecrement(&m_lReaders);
+    return(hThread);
+}
+
+DWORD CThreadTable::GetTid(HANDLE hThread) const
+{
+    if (hThread == NULL)
+        return(0);
+
+    DWORD dwTid = 0;
+    InterlockedIncrement(&m_lReaders);
+
+    const Table *pTable = m_pTable;
+    if (pTable) {
+        size_t nMask = pTable->nSize - 1;
+        size_t n = HashHandle(hThread, nMask);
+        for (size_t i = 0; i < pTable->nSize; i++) {
+            LONG lEntry = pTable->plByHandle[n];
+            if (lEntry == cEmpty)
+                break;
+            if (lEntry != cDeleted) {
+                // The slot may have been given to another thread meanwhile
+                DWORD dwSlotTid;
+                HANDLE hSlotThread;
+                ReadSlot(pTable->pSlots[lEntry - 1], &dwSlotTid, &hSlotThread);
+                if (hSlotThread == hThread && dwSlotTid != cDeletedTid) {
+                    dwTid = dwSlotTid;
+                    break;
+                }
+            }
+            n = (n + 1) & nMask;
+        }
+    }
+
+    InterlockedDecrement(&m_lReaders);
+    return(dwTid);
+}
+
+}
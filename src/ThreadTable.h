@@ -0,0 +1,97 @@
+// ThreadTable.h - Debuggee threads by TID and handle header
+#pragma once
+
+#include <vector>
+
+namespace SDE
+{
+
+// The threads of the debuggee with the debugger's state for each, in an
+// open-addressing table by TID plus an index by handle. The debugger thread
+// is the only writer; GetHandle and GetTid may be called from any thread at
+// the same time, without locks and without allocating:
+// - A slot is rewritten between two increments of its sequence number, a
+//   reader retries when the number was odd or changed under it.
+// - The table is rebuilt when its deleted slots pile up, and the new one is
+//   published with an exchange. The old one is freed once no reader is in.
+class CThreadTable
+{
+public:
+    // Only used on the debugger thread
+    struct Thread
+    {
+        DWORD dwTid;
+        HANDLE hThread;
+        // Its process, set by the debugger
+        DWORD dwPid;
+        // An INT3 site whose original byte is back in memory for the thread's
+        // step, and whether the thread was single stepping before
+        bool bLifted;
+        bool bLiftedTrapFlag;
+        ULONG_PTR ulpLifted;
+        // The debug register assignment the thread has been given
+        DWORD dwDebugRegisterStamp;
+    };
+
+private:
+    struct Slot
+    {
+        volatile LONG lSequence;
+        Thread thread;
+    };
+
+    struct Table
+    {
+        size_t nSize;
+        // Live and deleted entries of each
+        size_t nUsed;
+        size_t nHandlesUsed;
+        Slot *pSlots;
+        // Slot number + 1 by handle
+        volatile LONG *plByHandle;
+    };
+
+    typedef std::vector<Table *> TableVector;
+public:
+    CThreadTable();
+    ~CThreadTable();
+
+    // Debugger thread. Insert may rebuild the table, which moves the threads.
+    Thread *Insert(DWORD dwTid, HANDLE hThread);
+    void Remove(DWORD dwTid);
+    Thread *Find(DWORD dwTid);
+    const Thread *Find(DWORD dwTid) const;
+    Thread *FindByHandle(HANDLE hThread);
+    const Thread *FindByHandle(HANDLE hThread) const;
+    SIZE_T GetCount(void) const;
+    void Clear(void);
+
+    // Enumeration by slot, nSlot from 0 to GetSlots() - 1; returns NULL for
+    // empty slots
+    SIZE_T GetSlots(void) const;
+    Thread *GetAt(SIZE_T nSlot);
+
+    // Any thread, NULL/0 if the thread isn't in
+    HANDLE GetHandle(DWORD dwTid) const;
+    DWORD GetTid(HANDLE hThread) const;
+
+private:
+    static size_t HashTid(DWORD dwTid, size_t nMask);
+    static size_t HashHandle(HANDLE hThread, size_t nMask);
+    static Table *CreateTable(size_t nSize);
+    static void DestroyTable(Table *pTable);
+    static void ReadSlot(const Slot & slot, DWORD *pdwTid, HANDLE *phThread);
+    size_t FindSlot(DWORD dwTid) const;
+    size_t FindHandleSlot(HANDLE hThread) const;
+    void IndexHandle(Table *pTable, size_t nSlot);
+    void Rebuild(void);
+    void FreeRetired(void);
+
+private:
+    Table * volatile m_pTable;
+    TableVector m_Retired;
+    SIZE_T m_nCount;
+    mutable volatile LONG m_lReaders;
+};
+
+}
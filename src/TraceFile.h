@@ -0,0 +1,154 @@
+// TraceFile.h - Instruction trace file layout
+#pragma once
+
+namespace SDE
+{
+
+// A trace file is a header, chunks that each decode on their own, the chunk
+// index and a trailer locating it. Everything is in the byte order of the
+// recording machine and 8 byte aligned, so the file can be mapped and the
+// index used in place. A file whose trailer is missing (the recorder never
+// closed it) can still be read by walking the chunk headers.
+//
+// A chunk's payload holds one record after the other, as varints: the zigzag
+// PC delta from the previous record of the chunk, EFlags if recorded, then
+// the zigzag delta from the previous value of every recorded register. The
+// previous values start at 0 in each chunk.
+
+struct TraceFileHeader
+{
+    UINT32 dwMagic;
+    UINT32 dwVersion;
+    UINT32 dwContents;          // CTraceFile::cFlags, ...
+    UINT32 dwRegisters;         // Mask of the recorded registers
+    UINT32 dwPointerSize;
+    UINT32 dwReserved;
+};
+
+struct TraceChunkHeader
+{
+    UINT32 dwMagic;
+    UINT32 dwRecords;
+    UINT32 dwSize;              // Payload bytes, without the alignment padding
+    UINT32 dwReserved;
+    ULONGLONG ullFirst;         // Index of the first record
+};
+
+struct TraceIndexEntry
+{
+    ULONGLONG ullFirst;
+    ULONGLONG ullOffset;        // Of the chunk header
+};
+
+struct TraceFileTrailer
+{
+    ULONGLONG ullIndexOffset;
+    ULONGLONG ullChunks;
+    ULONGLONG ullRecords;
+    UINT32 dwMagic;
+    UINT32 dwReserved;
+};
+
+// One executed instruction. Registers are numbered as in the instruction
+// encoding (0 EAX, 1 ECX, ... 7 EDI, then R8-R15 on x64).
+struct TraceRecord
+{
+    ULONG_PTR ulpPC;
+    DWORD dwFlags;
+    ULONG_PTR Registers[16];
+};
+
+class CTraceFile
+{
+public:
+    static const UINT32 cFileMagic = 0x54454453;    // "SDET"
+    static const UINT32 cChunkMagic = 0x43454453;   // "SDEC"
+    static const UINT32 cIndexMagic = 0x49454453;   // "SDEI"
+    static const UINT32 cVersion = 1;
+
+    // What a record holds besides the PC
+    static const UINT32 cFlags = 0x01;
+
+    // Register mask bits
+    static const UINT32 cEax = 0x0001;
+    static const UINT32 cEcx = 0x0002;
+    static const UINT32 cEdx = 0x0004;
+    static const UINT32 cEbx = 0x0008;
+    static const UINT32 cEsp = 0x0010;
+    static const UINT32 cEbp = 0x0020;
+    static const UINT32 cEsi = 0x0040;
+    static const UINT32 cEdi = 0x0080;
+#ifdef __x86_64__
+    static const UINT32 cMaxRegisters = 16;
+#else
+    static const UINT32 cMaxRegisters = 8;
+#endif
+
+    static const int cMaxVarint = 10;
+
+    static ULONG_PTR *GetRegister(CONTEXT *pContext, int nRegister)
+    {
+        switch (nRegister) {
+            case 0: return(reinterpret_cast<ULONG_PTR *>(&pContext->Eax));
+            case 1: return(reinterpret_cast<ULONG_PTR *>(&pContext->Ecx));
+            case 2: return(reinterpret_cast<ULONG_PTR *>(&pContext->Edx));
+            case 3: return(reinterpret_cast<ULONG_PTR *>(&pContext->Ebx));
+            case 4: return(reinterpret_cast<ULONG_PTR *>(&pContext->Esp));
+            case 5: return(reinterpret_cast<ULONG_PTR *>(&pContext->Ebp));
+            case 6: return(reinterpret_cast<ULONG_PTR *>(&pContext->Esi));
+            case 7: return(reinterpret_cast<ULONG_PTR *>(&pContext->Edi));
+#ifdef __x86_64__
+            case 8: return(&pContext->R8);
+            case 9: return(&pContext->R9);
+            case 10: return(&pContext->R10);
+            case 11: return(&pContext->R11);
+            case 12: return(&pContext->R12);
+            case 13: return(&pContext->R13);
+            case 14: return(&pContext->R14);
+            case 15: return(&pContext->R15);
+#endif
+            default: return(0);
+        }
+    }
+
+    static int EncodeVarint(ULONGLONG ullValue, BYTE *pOut)
+    {
+        int n = 0;
+        while (ullValue >= 0x80) {
+            pOut[n++] = static_cast<BYTE>(ullValue | 0x80);
+            ullValue >>= 7;
+        }
+        pOut[n++] = static_cast<BYTE>(ullValue);
+        return(n);
+    }
+
+    // Returns the bytes taken, 0 if the varint runs past pEnd
+    static int DecodeVarint(const BYTE *pIn, const BYTE *pEnd, ULONGLONG *pullValue)
+    {
+        ULONGLONG ullValue = 0;
+        for (int n = 0; n < cMaxVarint && pIn + n < pEnd; n++) {
+            ullValue |= static_cast<ULONGLONG>(pIn[n] & 0x7F) << (7 * n);
+            if ((pIn[n] & 0x80) == 0) {
+                *pullValue = ullValue;
+                return(n + 1);
+            }
+        }
+        return(0);
+    }
+
+    // Deltas are taken in pointer width and sign extended, so a 32 bit
+    // wrap-around stays small
+    static ULONGLONG ZigZag(ULONG_PTR ulpValue, ULONG_PTR ulpPrevious)
+    {
+        LONGLONG llDelta = static_cast<LONG_PTR>(ulpValue - ulpPrevious);
+        return((static_cast<ULONGLONG>(llDelta) << 1) ^ static_cast<ULONGLONG>(llDelta >> 63));
+    }
+
+    static ULONG_PTR UnZigZag(ULONGLONG ullValue, ULONG_PTR ulpPrevious)
+    {
+        ULONGLONG ullDelta = (ullValue >> 1) ^ (0 - (ullValue & 1));
+        return(ulpPrevious + static_cast<ULONG_PTR>(ullDelta));
+    }
+};
+
+}
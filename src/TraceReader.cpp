@@ -0,0 +1,276 @@
+// TraceReader.cpp - Instruction trace reader implementation
+#include "stdafx.h"
+#include "TraceReader.h"
+
+namespace SDE
+{
+
+static const DWORD cAlignment = 8;
+static const SIZE_T cNoChunk = static_cast<SIZE_T>(-1);
+
+static int SeekFile(FILE *pFile, ULONGLONG ullOffset, int nOrigin)
+{
+#ifdef _WIN32
+    return(_fseeki64(pFile, static_cast<__int64>(ullOffset), nOrigin));
+#else
+    return(fseeko(pFile, static_cast<off_t>(ullOffset), nOrigin));
+#endif
+}
+
+static ULONGLONG TellFile(FILE *pFile)
+{
+#ifdef _WIN32
+    return(static_cast<ULONGLONG>(_ftelli64(pFile)));
+#else
+    return(static_cast<ULONGLONG>(ftello(pFile)));
+#endif
+}
+
+CTraceReader::CTraceReader()
+: m_pFile(NULL)
+, m_ullFileSize(0)
+, m_ullCount(0)
+, m_nChunk(cNoChunk)
+, m_nPosition(0)
+, m_ullNext(0)
+{
+    ZeroMemory(&m_Header, sizeof(m_Header));
+}
+
+CTraceReader::~CTraceReader()
+{
+    Close();
+}
+
+bool CTraceReader::Open(const char *pszFileName)
+{
+    Close();
+
+    m_pFile = fopen(pszFileName, "rb");
+    if (m_pFile == NULL)
+        return(false);
+
+    if (SeekFile(m_pFile, 0, SEEK_END) == 0)
+        m_ullFileSize = TellFile(m_pFile);
+
+    if (ReadAt(0, &m_Header, sizeof(m_Header)) == false || m_Header.dwMagic != CTraceFile::cFileMagic ||
+        m_Header.dwVersion != CTraceFile::cVersion || m_Header.dwPointerSize != sizeof(ULONG_PTR) ||
+        (m_Header.dwRegisters & ~((1 << CTraceFile::cMaxRegisters) - 1))) {
+        Close();
+        return(false);
+    }
+
+    // A file that wasn't closed has no index, the chunk headers still chain
+    if (ReadIndex() == false && ScanChunks() == false) {
+        Close();
+        return(false);
+    }
+
+    return(true);
+}
+
+void CTraceReader::Close(void)
+{
+    if (m_pFile) {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+
+    m_ullFileSize = 0;
+    m_ullCount = 0;
+    m_Index.clear();
+    m_Chunk.clear();
+    m_nChunk = cNoChunk;
+    m_nPosition = 0;
+    m_ullNext = 0;
+}
+
+ULONGLONG CTraceReader::GetCount(void) const
+{
+    return(m_ullCount);
+}
+
+DWORD CTraceReader::GetContents(void) const
+{
+    return(m_Header.dwContents);
+}
+
+DWORD CTraceReader::GetRegisters(void) const
+{
+    return(m_Header.dwRegisters);
+}
+
+bool CTraceReader::ReadIndex(void)
+{
+    TraceFileTrailer trailer;
+    if (m_ullFileSize < sizeof(m_Header) + sizeof(trailer))
+        return(false);
+    if (ReadAt(m_ullFileSize - sizeof(trailer), &trailer, sizeof(trailer)) == false)
+        return(false);
+    if (trailer.dwMagic != CTraceFile::cIndexMagic)
+        return(false);
+
+    ULONGLONG ullIndexSize = trailer.ullChunks * sizeof(TraceIndexEntry);
+    if (trailer.ullIndexOffset + ullIndexSize + sizeof(trailer) != m_ullFileSize)
+        return(false);
+
+    m_Index.resize(static_cast<SIZE_T>(trailer.ullChunks));
+    if (m_Index.empty() == false && ReadAt(trailer.ullIndexOffset, &m_Index[0], static_cast<SIZE_T>(ullIndexSize)) == false) {
+        m_Index.clear();
+        return(false);
+    }
+
+    m_ullCount = trailer.ullRecords;
+    return(true);
+}
+
+bool CTraceReader::ScanChunks(void)
+{
+    m_Index.clear();
+    m_ullCount = 0;
+
+    ULONGLONG ullOffset = sizeof(m_Header);
+    TraceChunkHeader header;
+    while (ullOffset + sizeof(header) <= m_ullFileSize && ReadAt(ullOffset, &header, sizeof(header)) == true) {
+        if (header.dwMagic != CTraceFile::cChunkMagic || header.ullFirst != m_ullCount)
+            break;
+
+        ULONGLONG ullNext = ullOffset + sizeof(header) + (header.dwSize + cAlignment - 1) / cAlignment * cAlignment;
+        if (ullNext > m_ullFileSize)
+            break;
+
+        TraceIndexEntry entry;
+        entry.ullFirst = header.ullFirst;
+        entry.ullOffset = ullOffset;
+        m_Index.push_back(entry);
+
+        m_ullCount += header.dwRecords;
+        ullOffset = ullNext;
+    }
+
+    return(true);
+}
+
+bool CTraceReader::Seek(ULONGLONG ullIndex)
+{
+    if (m_pFile == NULL || ullIndex >= m_ullCount)
+        return(false);
+
+    // Last chunk starting at or before the record
+    SIZE_T nLow = 0;
+    SIZE_T nHigh = m_Index.size();
+    while (nHigh - nLow > 1) {
+        SIZE_T nMiddle = (nLow + nHigh) / 2;
+        if (m_Index[nMiddle].ullFirst <= ullIndex)
+            nLow = nMiddle;
+        else
+            nHigh = nMiddle;
+    }
+
+    // Going on in the current chunk saves reloading it
+    if (m_nChunk != nLow || m_ullNext > ullIndex) {
+        if (LoadChunk(nLow) == false)
+            return(false);
+    }
+
+    while (m_ullNext < ullIndex) {
+        if (Decode(NULL) == false)
+            return(false);
+    }
+
+    return(true);
+}
+
+bool CTraceReader::Next(TraceRecord *pRecord)
+{
+    if (m_pFile == NULL || m_ullNext >= m_ullCount)
+        return(false);
+
+    // The current chunk is used up, or there is none yet
+    if (m_nChunk == cNoChunk || m_ullNext >= m_ChunkHeader.ullFirst + m_ChunkHeader.dwRecords) {
+        if (Seek(m_ullNext) == false)
+            return(false);
+    }
+
+    return(Decode(pRecord));
+}
+
+bool CTraceReader::Get(ULONGLONG ullIndex, TraceRecord *pRecord)
+{
+    if (Seek(ullIndex) == false)
+        return(false);
+
+    return(Next(pRecord));
+}
+
+bool CTraceReader::LoadChunk(SIZE_T nChunk)
+{
+    m_nChunk = cNoChunk;
+
+    if (ReadAt(m_Index[nChunk].ullOffset, &m_ChunkHeader, sizeof(m_ChunkHeader)) == false)
+        return(false);
+    if (m_ChunkHeader.dwMagic != CTraceFile::cChunkMagic || m_ChunkHeader.ullFirst != m_Index[nChunk].ullFirst)
+        return(false);
+
+    m_Chunk.resize(m_ChunkHeader.dwSize);
+    if (m_Chunk.empty() == false &&
+        ReadAt(m_Index[nChunk].ullOffset + sizeof(m_ChunkHeader), &m_Chunk[0], m_Chunk.size()) == false)
+        return(false);
+
+    m_nChunk = nChunk;
+    m_nPosition = 0;
+    m_ullNext = m_ChunkHeader.ullFirst;
+    ZeroMemory(&m_Previous, sizeof(m_Previous));
+
+    return(true);
+}
+
+bool CTraceReader::Decode(TraceRecord *pRecord)
+{
+    if (m_nChunk == cNoChunk || m_ullNext >= m_ChunkHeader.ullFirst + m_ChunkHeader.dwRecords)
+        return(false);
+
+    const BYTE *pIn = m_Chunk.empty() ? 0 : &m_Chunk[0] + m_nPosition;
+    const BYTE *pEnd = m_Chunk.empty() ? 0 : &m_Chunk[0] + m_Chunk.size();
+    ULONGLONG ullValue;
+    int n;
+
+    if ((n = CTraceFile::DecodeVarint(pIn, pEnd, &ullValue)) == 0)
+        return(false);
+    pIn += n;
+    m_Previous.ulpPC = CTraceFile::UnZigZag(ullValue, m_Previous.ulpPC);
+
+    m_Previous.dwFlags = 0;
+    if (m_Header.dwContents & CTraceFile::cFlags) {
+        if ((n = CTraceFile::DecodeVarint(pIn, pEnd, &ullValue)) == 0)
+            return(false);
+        pIn += n;
+        m_Previous.dwFlags = static_cast<DWORD>(ullValue);
+    }
+
+    for (DWORD i = 0; i < CTraceFile::cMaxRegisters; i++) {
+        if ((m_Header.dwRegisters & (1 << i)) == 0)
+            continue;
+        if ((n = CTraceFile::DecodeVarint(pIn, pEnd, &ullValue)) == 0)
+            return(false);
+        pIn += n;
+        m_Previous.Registers[i] = CTraceFile::UnZigZag(ullValue, m_Previous.Registers[i]);
+    }
+
+    m_nPosition = pIn - &m_Chunk[0];
+    m_ullNext++;
+    if (pRecord)
+        *pRecord = m_Previous;
+
+    return(true);
+}
+
+bool CTraceReader::ReadAt(ULONGLONG ullOffset, void *pData, SIZE_T nSize)
+{
+    if (SeekFile(m_pFile, ullOffset, SEEK_SET) != 0)
+        return(false);
+
+    return(fread(pData, 1, nSize, m_pFile) == nSize);
+}
+
+}
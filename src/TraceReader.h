@@ -0,0 +1,59 @@
+// TraceReader.h - Instruction trace reader header
+#pragma once
+
+#include "TraceFile.h"
+#include <vector>
+#include <stdio.h>
+
+namespace SDE
+{
+
+// Reads a trace file written by CTraceRecorder. Only the chunk index is kept
+// in memory; Seek finds the chunk holding a record through it and decodes that
+// chunk alone, Next then goes on from there.
+class CTraceReader
+{
+    typedef std::vector<BYTE> ByteVector;
+    typedef std::vector<TraceIndexEntry> IndexVector;
+public:
+    CTraceReader();
+    ~CTraceReader();
+
+    bool Open(const char *pszFileName);
+    void Close(void);
+
+    ULONGLONG GetCount(void) const;
+    DWORD GetContents(void) const;
+    DWORD GetRegisters(void) const;
+
+    // Positions the reader so that Next returns record ullIndex
+    bool Seek(ULONGLONG ullIndex);
+    bool Next(TraceRecord *pRecord);
+    // Seek and Next
+    bool Get(ULONGLONG ullIndex, TraceRecord *pRecord);
+
+private:
+    bool ReadIndex(void);
+    bool ScanChunks(void);
+    bool LoadChunk(SIZE_T nChunk);
+    // pRecord NULL skips the record
+    bool Decode(TraceRecord *pRecord);
+    bool ReadAt(ULONGLONG ullOffset, void *pData, SIZE_T nSize);
+
+private:
+    FILE *m_pFile;
+    TraceFileHeader m_Header;
+    ULONGLONG m_ullFileSize;
+    ULONGLONG m_ullCount;
+    IndexVector m_Index;
+
+    // Current chunk
+    SIZE_T m_nChunk;
+    TraceChunkHeader m_ChunkHeader;
+    ByteVector m_Chunk;
+    SIZE_T m_nPosition;
+    ULONGLONG m_ullNext;
+    TraceRecord m_Previous;
+};
+
+}
@@ -0,0 +1,309 @@
+// TraceRecorder.cpp - Instruction trace recorder implementation
+#include "stdafx.h"
+#include "TraceRecorder.h"
+
+namespace SDE
+{
+
+// Wake the writer when this many records are waiting
+static const LONG cBatch = 1024;
+
+// Chunk payloads are padded to keep the headers aligned
+static const DWORD cAlignment = 8;
+
+static LONG ReadIndex(LONG volatile *plIndex)
+{
+    return(InterlockedCompareExchange(plIndex, 0, 0));
+}
+
+static DWORD Distance(LONG lFrom, LONG lTo)
+{
+    return(static_cast<DWORD>(lTo) - static_cast<DWORD>(lFrom));
+}
+
+CTraceRecorder::CTraceRecorder()
+: m_pFile(NULL)
+, m_dwContents(0)
+, m_dwRegisters(0)
+, m_bNeedContext(false)
+, m_ullRecords(0)
+, m_lHead(0)
+, m_lTail(0)
+, m_lStop(0)
+, m_hDataEvent(NULL)
+, m_hSpaceEvent(NULL)
+, m_hDoneEvent(NULL)
+, m_ullOffset(0)
+, m_ullWritten(0)
+, m_bWriteFailed(false)
+{
+}
+
+CTraceRecorder::~CTraceRecorder()
+{
+    if (IsOpen() == true)
+        Close();
+}
+
+bool CTraceRecorder::Open(const char *pszFileName, DWORD dwContents, DWORD dwRegisters)
+{
+    if (IsOpen() == true)
+        return(false);
+
+    if (dwRegisters & ~((1 << CTraceFile::cMaxRegisters) - 1))
+        return(false);
+
+    m_pFile = fopen(pszFileName, "wb");
+    if (m_pFile == NULL)
+        return(false);
+
+    m_dwContents = dwContents;
+    m_dwRegisters = dwRegisters;
+    m_bNeedContext = (dwContents != 0 || dwRegisters != 0);
+    m_ullRecords = 0;
+    m_ullOffset = 0;
+    m_ullWritten = 0;
+    m_bWriteFailed = false;
+    m_Index.clear();
+    m_Chunk.clear();
+    m_Chunk.reserve(cChunkSize + CTraceFile::cMaxVarint * (2 + CTraceFile::cMaxRegisters) + cAlignment);
+    ZeroMemory(&m_ChunkHeader, sizeof(m_ChunkHeader));
+    ZeroMemory(&m_Previous, sizeof(m_Previous));
+
+    TraceFileHeader header;
+    ZeroMemory(&header, sizeof(header));
+    header.dwMagic = CTraceFile::cFileMagic;
+    header.dwVersion = CTraceFile::cVersion;
+    header.dwContents = dwContents;
+    header.dwRegisters = dwRegisters;
+    header.dwPointerSize = sizeof(ULONG_PTR);
+    if (Write(&header, sizeof(header)) == false) {
+        fclose(m_pFile);
+        m_pFile = NULL;
+        return(false);
+    }
+
+    m_Ring.resize(cRingSize);
+    m_lHead = 0;
+    m_lTail = 0;
+    m_lStop = 0;
+    m_hDataEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hSpaceEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_hDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (_beginthread(WriterThread, 0, this) == static_cast<uintptr_t>(-1)) {
+        CloseHandle(m_hDataEvent);
+        CloseHandle(m_hSpaceEvent);
+        CloseHandle(m_hDoneEvent);
+        fclose(m_pFile);
+        m_pFile = NULL;
+        return(false);
+    }
+
+    return(true);
+}
+
+bool CTraceRecorder::Close(void)
+{
+    if (IsOpen() == false)
+        return(false);
+
+    // The writer drains the ring once more after seeing the stop
+    InterlockedExchange(&m_lStop, 1);
+    SetEvent(m_hDataEvent);
+    WaitForSingleObject(m_hDoneEvent, INFINITE);
+
+    CloseHandle(m_hDataEvent);
+    CloseHandle(m_hSpaceEvent);
+    CloseHandle(m_hDoneEvent);
+    m_hDataEvent = m_hSpaceEvent = m_hDoneEvent = NULL;
+
+    bool bRet = (m_bWriteFailed == false);
+    if (fclose(m_pFile) != 0)
+        bRet = false;
+    m_pFile = NULL;
+
+    return(bRet);
+}
+
+bool CTraceRecorder::IsOpen(void) const
+{
+    return(m_pFile != NULL);
+}
+
+bool CTraceRecorder::Record(IDebugger & debugger, HANDLE hThread, LPVOID lpPC)
+{
+    if (IsOpen() == false)
+        return(false);
+
+    TraceRecord record;
+    record.ulpPC = reinterpret_cast<ULONG_PTR>(lpPC);
+    record.dwFlags = 0;
+
+    if (m_bNeedContext == true || lpPC == NULL) {
+        _CONTEXT ctx;
+        ZeroMemory(&ctx, sizeof(_CONTEXT));
+        ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+        if (debugger.GetThreadContext(hThread, &ctx) == FALSE)
+            return(false);
+
+        if (lpPC == NULL)
+            record.ulpPC = ctx.Eip;
+        record.dwFlags = ctx.EFlags;
+        for (DWORD n = 0; n < CTraceFile::cMaxRegisters; n++) {
+            if (m_dwRegisters & (1 << n))
+                record.Registers[n] = *CTraceFile::GetRegister(&ctx, n);
+        }
+    }
+
+    Push(record);
+    m_ullRecords++;
+
+    return(true);
+}
+
+ULONGLONG CTraceRecorder::GetCount(void) const
+{
+    return(m_ullRecords);
+}
+
+void CTraceRecorder::Push(const TraceRecord & record)
+{
+    LONG lTail = m_lTail;
+
+    // Wait for the writer to make room
+    while (Distance(ReadIndex(&m_lHead), lTail) >= static_cast<DWORD>(cRingSize)) {
+        ResetEvent(m_hSpaceEvent);
+        if (Distance(ReadIndex(&m_lHead), lTail) < static_cast<DWORD>(cRingSize))
+            break;
+        SetEvent(m_hDataEvent);
+        WaitForSingleObject(m_hSpaceEvent, INFINITE);
+    }
+
+    // Only the fields recorded are copied
+    TraceRecord & slot = m_Ring[lTail & (cRingSize - 1)];
+    slot.ulpPC = record.ulpPC;
+    slot.dwFlags = record.dwFlags;
+    for (DWORD n = 0; n < CTraceFile::cMaxRegisters; n++) {
+        if (m_dwRegisters & (1 << n))
+            slot.Registers[n] = record.Registers[n];
+    }
+
+    LONG lNext = static_cast<LONG>(static_cast<DWORD>(lTail) + 1);
+    InterlockedExchange(&m_lTail, lNext);
+
+    if ((lNext & (cBatch - 1)) == 0)
+        SetEvent(m_hDataEvent);
+}
+
+void CTraceRecorder::WriterThread(void *pParam)
+{
+    CTraceRecorder *pThis = reinterpret_cast<CTraceRecorder *>(pParam);
+
+    for (;;) {
+        WaitForSingleObject(pThis->m_hDataEvent, cFlushInterval);
+
+        // Everything pushed before the stop is in the ring by now
+        bool bStop = (ReadIndex(&pThis->m_lStop) != 0);
+        pThis->Drain();
+        if (bStop == true)
+            break;
+    }
+
+    // Last chunk, index and trailer
+    pThis->WriteChunk();
+
+    TraceFileTrailer trailer;
+    ZeroMemory(&trailer, sizeof(trailer));
+    trailer.ullIndexOffset = pThis->m_ullOffset;
+    trailer.ullChunks = pThis->m_Index.size();
+    trailer.ullRecords = pThis->m_ullWritten;
+    trailer.dwMagic = CTraceFile::cIndexMagic;
+    if (pThis->m_Index.empty() == false)
+        pThis->Write(&pThis->m_Index[0], pThis->m_Index.size() * sizeof(TraceIndexEntry));
+    pThis->Write(&trailer, sizeof(trailer));
+
+    SetEvent(pThis->m_hDoneEvent);
+}
+
+void CTraceRecorder::Drain(void)
+{
+    LONG lHead = m_lHead;
+    LONG lTail = ReadIndex(&m_lTail);
+    if (lHead == lTail)
+        return;
+
+    while (lHead != lTail) {
+        Encode(m_Ring[lHead & (cRingSize - 1)]);
+        lHead = static_cast<LONG>(static_cast<DWORD>(lHead) + 1);
+    }
+
+    InterlockedExchange(&m_lHead, lHead);
+    SetEvent(m_hSpaceEvent);
+}
+
+void CTraceRecorder::Encode(const TraceRecord & record)
+{
+    if (m_ChunkHeader.dwRecords == 0) {
+        m_ChunkHeader.ullFirst = m_ullWritten;
+        ZeroMemory(&m_Previous, sizeof(m_Previous));
+    }
+
+    BYTE Out[CTraceFile::cMaxVarint * (2 + CTraceFile::cMaxRegisters)];
+
+    int n = CTraceFile::EncodeVarint(CTraceFile::ZigZag(record.ulpPC, m_Previous.ulpPC), Out);
+    m_Previous.ulpPC = record.ulpPC;
+
+    if (m_dwContents & CTraceFile::cFlags)
+        n += CTraceFile::EncodeVarint(record.dwFlags, Out + n);
+
+    for (DWORD i = 0; i < CTraceFile::cMaxRegisters; i++) {
+        if ((m_dwRegisters & (1 << i)) == 0)
+            continue;
+        n += CTraceFile::EncodeVarint(CTraceFile::ZigZag(record.Registers[i], m_Previous.Registers[i]), Out + n);
+        m_Previous.Registers[i] = record.Registers[i];
+    }
+
+    m_Chunk.insert(m_Chunk.end(), Out, Out + n);
+    m_ChunkHeader.dwRecords++;
+    m_ullWritten++;
+
+    if (m_Chunk.size() >= cChunkSize || m_ChunkHeader.dwRecords >= cChunkRecords)
+        WriteChunk();
+}
+
+bool CTraceRecorder::WriteChunk(void)
+{
+    if (m_ChunkHeader.dwRecords == 0)
+        return(true);
+
+    TraceIndexEntry entry;
+    entry.ullFirst = m_ChunkHeader.ullFirst;
+    entry.ullOffset = m_ullOffset;
+    m_Index.push_back(entry);
+
+    m_ChunkHeader.dwMagic = CTraceFile::cChunkMagic;
+    m_ChunkHeader.dwSize = static_cast<UINT32>(m_Chunk.size());
+    while (m_Chunk.size() % cAlignment)
+        m_Chunk.push_back(0);
+
+    bool bRet = Write(&m_ChunkHeader, sizeof(m_ChunkHeader)) && Write(&m_Chunk[0], m_Chunk.size());
+
+    m_Chunk.clear();
+    m_ChunkHeader.dwRecords = 0;
+
+    return(bRet);
+}
+
+bool CTraceRecorder::Write(const void *pData, SIZE_T nSize)
+{
+    if (fwrite(pData, 1, nSize, m_pFile) != nSize) {
+        m_bWriteFailed = true;
+        return(false);
+    }
+
+    m_ullOffset += nSize;
+    return(true);
+}
+
+}
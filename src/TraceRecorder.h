@@ -0,0 +1,77 @@
+// TraceRecorder.h - Instruction trace recorder header
+#pragma once
+
+#include "Defs.h"
+#include "TraceFile.h"
+#include <vector>
+#include <stdio.h>
+
+namespace SDE
+{
+
+// Records the PCs a thread is stepped through, and optionally EFlags and a
+// set of registers, into a trace file (see TraceFile.h). Record is called on
+// the debugger thread and only puts the record in a ring; a writer thread
+// takes the records out, delta encodes them into chunks and writes those.
+// The ring is single producer, single consumer, a full ring holds up the
+// debugger until the writer has made room.
+class CTraceRecorder
+{
+    typedef std::vector<TraceRecord> RecordVector;
+    typedef std::vector<BYTE> ByteVector;
+    typedef std::vector<TraceIndexEntry> IndexVector;
+public:
+    static const LONG cRingSize = 4096;         // Power of 2
+    static const DWORD cChunkSize = 64 * 1024;  // Payload bytes per chunk
+    static const DWORD cChunkRecords = 1024;    // Records per chunk, bounds a seek
+    static const DWORD cFlushInterval = 100;    // ms
+
+    CTraceRecorder();
+    ~CTraceRecorder();
+
+    // dwContents: CTraceFile::cFlags or 0, dwRegisters: CTraceFile::cEax | ...
+    bool Open(const char *pszFileName, DWORD dwContents = 0, DWORD dwRegisters = 0);
+    // Writes out what is left, the index and the trailer
+    bool Close(void);
+    bool IsOpen(void) const;
+
+    // lpPC NULL records the thread's current PC
+    bool Record(IDebugger & debugger, HANDLE hThread, LPVOID lpPC);
+
+    ULONGLONG GetCount(void) const;
+
+private:
+    static void WriterThread(void *pParam);
+    void Push(const TraceRecord & record);
+    void Drain(void);
+    void Encode(const TraceRecord & record);
+    bool WriteChunk(void);
+    bool Write(const void *pData, SIZE_T nSize);
+
+private:
+    FILE *m_pFile;
+    DWORD m_dwContents;
+    DWORD m_dwRegisters;
+    bool m_bNeedContext;
+    ULONGLONG m_ullRecords;
+
+    // Ring, m_lTail is written by the debugger thread only, m_lHead by the writer
+    RecordVector m_Ring;
+    LONG volatile m_lHead;
+    LONG volatile m_lTail;
+    LONG volatile m_lStop;
+    HANDLE m_hDataEvent;
+    HANDLE m_hSpaceEvent;
+    HANDLE m_hDoneEvent;
+
+    // Writer thread state
+    ByteVector m_Chunk;
+    TraceChunkHeader m_ChunkHeader;
+    TraceRecord m_Previous;
+    IndexVector m_Index;
+    ULONGLONG m_ullOffset;
+    ULONGLONG m_ullWritten;
+    bool m_bWriteFailed;
+};
+
+}
@@ -0,0 +1,123 @@
+// TrampolineArena.cpp - Executable memory for injected code implementation
+#include "stdafx.h"
+#include "TrampolineArena.h"
+
+namespace SDE
+{
+
+CTrampolineArena::CTrampolineArena()
+: m_ulpNext(0)
+, m_ulpEnd(0)
+, m_nAllocations(0)
+, m_nReuses(0)
+, m_nBlockAllocations(0)
+{
+}
+
+CTrampolineArena::~CTrampolineArena()
+{
+}
+
+LPVOID CTrampolineArena::Allocate(HANDLE hProcess, SIZE_T nSize)
+{
+    if (nSize == 0 || nSize > cArenaSize)
+        return(0);
+
+    SIZE_T nSlots = (nSize + cSlotSize - 1) / cSlotSize;
+    ULONG_PTR ulpSlot = 0;
+
+    // Reuse a freed slot of the same size
+    FreeLists::iterator i = m_FreeLists.find(nSlots);
+    if (i != m_FreeLists.end() && i->second.empty() == false) {
+        ulpSlot = i->second.back();
+        i->second.pop_back();
+        m_nReuses++;
+    } else {
+        // Carve from the current block, take a new one if it is used up
+        if (m_ulpEnd - m_ulpNext < nSlots * cSlotSize) {
+            LPVOID lpBlock = VirtualAllocEx(hProcess, 0, cArenaSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+            if (lpBlock == 0)
+                return(0);
+
+            // The rest of the old block is given to the free lists
+            while (m_ulpEnd - m_ulpNext >= cSlotSize) {
+                m_FreeLists[1].push_back(m_ulpNext);
+                m_ulpNext += cSlotSize;
+            }
+
+            m_Blocks.push_back(reinterpret_cast<ULONG_PTR>(lpBlock));
+            m_Used.resize(m_Blocks.size() * cBlockSlots, 0);
+            m_nBlockAllocations++;
+            m_ulpNext = reinterpret_cast<ULONG_PTR>(lpBlock);
+            m_ulpEnd = m_ulpNext + cArenaSize;
+        }
+        ulpSlot = m_ulpNext;
+        m_ulpNext += nSlots * cSlotSize;
+    }
+
+    *FindSlot(ulpSlot) = static_cast<WORD>(nSlots);
+    m_nAllocations++;
+
+    return(reinterpret_cast<LPVOID>(ulpSlot));
+}
+
+bool CTrampolineArena::Free(LPVOID lpTrampoline)
+{
+    ULONG_PTR ulpSlot = reinterpret_cast<ULONG_PTR>(lpTrampoline);
+    WORD *pwSlots = FindSlot(ulpSlot);
+    if (pwSlots == 0 || *pwSlots == 0 || (ulpSlot % cSlotSize) != 0)
+        return(false);
+
+    m_FreeLists[*pwSlots].push_back(ulpSlot);
+    *pwSlots = 0;
+    return(true);
+}
+
+WORD *CTrampolineArena::FindSlot(ULONG_PTR ulpSlot)
+{
+    // There are few blocks, the newest is the likeliest
+    for (size_t n = m_Blocks.size(); n-- > 0; ) {
+        if (ulpSlot >= m_Blocks[n] && ulpSlot - m_Blocks[n] < cArenaSize)
+            return(&m_Used[n * cBlockSlots + (ulpSlot - m_Blocks[n]) / cSlotSize]);
+    }
+    return(0);
+}
+
+void CTrampolineArena::Release(HANDLE hProcess)
+{
+    for (size_t i = 0; i < m_Blocks.size(); i++)
+        VirtualFreeEx(hProcess, reinterpret_cast<LPVOID>(m_Blocks[i]), 0, MEM_RELEASE);
+    Reset();
+}
+
+void CTrampolineArena::Reset(void)
+{
+    m_Blocks.clear();
+    m_FreeLists.clear();
+    m_Used.clear();
+    m_ulpNext = m_ulpEnd = 0;
+}
+
+SIZE_T CTrampolineArena::GetAllocations(void) const
+{
+    return(m_nAllocations);
+}
+
+SIZE_T CTrampolineArena::GetReuses(void) const
+{
+    return(m_nReuses);
+}
+
+SIZE_T CTrampolineArena::GetBlockAllocations(void) const
+{
+    return(m_nBlockAllocations);
+}
+
+SIZE_T CTrampolineArena::GetSyscallsSaved(void) const
+{
+    // Each allocation would have been a VirtualAllocEx and a VirtualFreeEx
+    SIZE_T nSyscalls = m_nAllocations * 2;
+    return(nSyscalls > m_nBlockAllocations ? nSyscalls - m_nBlockAllocations : 0);
+}
+
+}
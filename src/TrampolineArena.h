@@ -0,0 +1,59 @@
+// TrampolineArena.h - Executable memory for injected code header
+#pragma once
+
+#include <vector>
+#include <map>
+
+namespace SDE
+{
+
+// Hands out executable memory in the debuggee for trampolines and other
+// injected code. Memory is taken from the process in cArenaSize blocks and
+// carved into cSlotSize slots; freed slots go to a free list per slot count
+// and are handed out again, so most allocations cost no system call. The
+// size of each slot in use is kept in an array per block, handing out and
+// freeing a reused slot allocates nothing in the debugger either.
+class CTrampolineArena
+{
+    typedef std::vector<ULONG_PTR> AddressVector;
+    typedef std::map<SIZE_T, AddressVector> FreeLists;
+    typedef std::vector<WORD> SlotSizes;
+public:
+    static const SIZE_T cSlotSize = 32;
+    static const SIZE_T cArenaSize = 0x10000;
+
+    CTrampolineArena();
+    ~CTrampolineArena();
+
+    LPVOID Allocate(HANDLE hProcess, SIZE_T nSize);
+    bool Free(LPVOID lpTrampoline);
+
+    // Frees the blocks in the debuggee
+    void Release(HANDLE hProcess);
+    // Forgets the blocks, when the process is gone
+    void Reset(void);
+
+    SIZE_T GetAllocations(void) const;
+    SIZE_T GetReuses(void) const;
+    SIZE_T GetBlockAllocations(void) const;
+    SIZE_T GetSyscallsSaved(void) const;
+
+private:
+    static const SIZE_T cBlockSlots = cArenaSize / cSlotSize;
+
+    WORD *FindSlot(ULONG_PTR ulpSlot);
+
+private:
+    AddressVector m_Blocks;
+    ULONG_PTR m_ulpNext;
+    ULONG_PTR m_ulpEnd;
+    FreeLists m_FreeLists;
+    // Slots spanned by the trampoline starting at each slot, 0 if none;
+    // cBlockSlots entries per block
+    SlotSizes m_Used;
+    SIZE_T m_nAllocations;
+    SIZE_T m_nReuses;
+    SIZE_T m_nBlockAllocations;
+};
+
+}
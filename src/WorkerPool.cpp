@@ -0,0 +1,252 @@
+// WorkerPool.cpp - Work-stealing thread pool implementation
+#include "stdafx.h"
+#include "WorkerPool.h"
+
+namespace SDE
+{
+
+// Ring positions wrap around, compare them as distances
+static LONG Distance(LONG lTo, LONG lFrom)
+{
+    return(static_cast<LONG>(static_cast<DWORD>(lTo) - static_cast<DWORD>(lFrom)));
+}
+
+static LONG Advance(LONG lPosition, LONG lBy)
+{
+    return(static_cast<LONG>(static_cast<DWORD>(lPosition) + static_cast<DWORD>(lBy)));
+}
+
+CWorkerPool::CWorkerPool()
+: m_bQuit(false)
+, m_lRunning(0)
+, m_hExited(NULL)
+{
+}
+
+CWorkerPool::~CWorkerPool()
+{
+    Shutdown();
+}
+
+bool CWorkerPool::Start(int nThreads)
+{
+    if (m_Workers.empty() == false)
+        return(false);
+
+    m_bQuit = false;
+    m_hExited = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    for (int n = 0; n < nThreads; n++) {
+        Worker *pWorker = new Worker;
+        pWorker->pPool = this;
+        pWorker->nIndex = n;
+        pWorker->pCells = new Cell[cRingSize];
+        for (LONG l = 0; l < cRingSize; l++)
+            pWorker->pCells[l].lSequence = l;
+        pWorker->lEnqueue = 0;
+        pWorker->lDequeue = 0;
+        pWorker->lIdle = 0;
+        pWorker->hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+        pWorker->nRuns = 0;
+        pWorker->nSteals = 0;
+        m_Workers.push_back(pWorker);
+    }
+
+    // The rings are all there before any thread looks at them
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        InterlockedIncrement(&m_lRunning);
+        if (_beginthread(WorkerThread, 0, m_Workers[i]) == static_cast<uintptr_t>(-1)) {
+            InterlockedDecrement(&m_lRunning);
+            Shutdown();
+            return(false);
+        }
+    }
+
+    return(true);
+}
+
+void CWorkerPool::Shutdown(void)
+{
+    if (m_hExited == NULL)
+        return;
+
+    m_bQuit = true;
+    for (size_t i = 0; i < m_Workers.size(); i++)
+        SetEvent(m_Workers[i]->hWake);
+    if (m_lRunning != 0)
+        WaitForSingleObject(m_hExited, INFINITE);
+
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        CloseHandle(m_Workers[i]->hWake);
+        delete [] m_Workers[i]->pCells;
+        delete m_Workers[i];
+    }
+    m_Workers.clear();
+
+    CloseHandle(m_hExited);
+    m_hExited = NULL;
+}
+
+int CWorkerPool::GetNumThreads(void) const
+{
+    return(static_cast<int>(m_Workers.size()));
+}
+
+bool CWorkerPool::Submit(WorkProc pfnProc, void *pParam, LONG lAffinity)
+{
+    size_t nWorkers = m_Workers.size();
+    if (nWorkers == 0)
+        return(false);
+
+    // Our thread's ring, the next one if it's full
+    size_t nFirst = static_cast<size_t>(static_cast<DWORD>(lAffinity)) % nWorkers;
+    Worker *pWorker = NULL;
+    for (size_t i = 0; i < nWorkers && pWorker == NULL; i++) {
+        if (Push(m_Workers[(nFirst + i) % nWorkers], pfnProc, pParam) == true)
+            pWorker = m_Workers[(nFirst + i) % nWorkers];
+    }
+    if (pWorker == NULL)
+        return(false);
+
+    SetEvent(pWorker->hWake);
+
+    // A busy thread would leave the item waiting, an idle one takes it
+    if (pWorker->lIdle == 0) {
+        for (size_t i = 0; i < nWorkers; i++) {
+            if (m_Workers[i]->lIdle != 0) {
+                SetEvent(m_Workers[i]->hWake);
+                break;
+            }
+        }
+    }
+
+    return(true);
+}
+
+SIZE_T CWorkerPool::GetRuns(void) const
+{
+    SIZE_T nRuns = 0;
+    for (size_t i = 0; i < m_Workers.size(); i++)
+        nRuns += m_Workers[i]->nRuns;
+    return(nRuns);
+}
+
+SIZE_T CWorkerPool::GetSteals(void) const
+{
+    SIZE_T nSteals = 0;
+    for (size_t i = 0; i < m_Workers.size(); i++)
+        nSteals += m_Workers[i]->nSteals;
+    return(nSteals);
+}
+
+bool CWorkerPool::Push(Worker *pWorker, WorkProc pfnProc, void *pParam)
+{
+    LONG lPosition = pWorker->lEnqueue;
+    Cell *pCell;
+
+    while (1) {
+        pCell = &pWorker->pCells[lPosition & (cRingSize - 1)];
+        LONG lDistance = Distance(pCell->lSequence, lPosition);
+        if (lDistance == 0) {
+            // The cell is free, claim the position
+            if (InterlockedCompareExchange(&pWorker->lEnqueue, Advance(lPosition, 1), lPosition) == lPosition)
+                break;
+            lPosition = pWorker->lEnqueue;
+        } else if (lDistance < 0) {
+            // Still holds the item of the previous round, full
+            return(false);
+        } else {
+            lPosition = pWorker->lEnqueue;
+        }
+    }
+
+    pCell->pfnProc = pfnProc;
+    pCell->pParam = pParam;
+
+    // Hands the cell to the consumers
+    InterlockedExchange(&pCell->lSequence, Advance(lPosition, 1));
+    return(true);
+}
+
+bool CWorkerPool::Pop(Worker *pWorker, WorkProc *ppfnProc, void **ppParam)
+{
+    LONG lPosition = pWorker->lDequeue;
+    Cell *pCell;
+
+    while (1) {
+        pCell = &pWorker->pCells[lPosition & (cRingSize - 1)];
+        LONG lDistance = Distance(pCell->lSequence, Advance(lPosition, 1));
+        if (lDistance == 0) {
+            // The cell holds an item, claim the position
+            if (InterlockedCompareExchange(&pWorker->lDequeue, Advance(lPosition, 1), lPosition) == lPosition)
+                break;
+            lPosition = pWorker->lDequeue;
+        } else if (lDistance < 0) {
+            // Empty
+            return(false);
+        } else {
+            lPosition = pWorker->lDequeue;
+        }
+    }
+
+    *ppfnProc = pCell->pfnProc;
+    *ppParam = pCell->pParam;
+
+    // Hands the cell back to the producers, for the next round
+    InterlockedExchange(&pCell->lSequence, Advance(lPosition, cRingSize));
+    return(true);
+}
+
+bool CWorkerPool::RunOne(Worker *pWorker)
+{
+    WorkProc pfnProc = NULL;
+    void *pParam = NULL;
+    bool bStolen = false;
+
+    if (Pop(pWorker, &pfnProc, &pParam) == false) {
+        // Take from the others, starting with the next one
+        size_t nWorkers = m_Workers.size();
+        size_t i;
+        for (i = 1; i < nWorkers; i++) {
+            if (Pop(m_Workers[(pWorker->nIndex + i) % nWorkers], &pfnProc, &pParam) == true)
+                break;
+        }
+        if (i >= nWorkers)
+            return(false);
+        bStolen = true;
+    }
+
+    pfnProc(pParam);
+
+    pWorker->nRuns++;
+    if (bStolen == true)
+        pWorker->nSteals++;
+
+    return(true);
+}
+
+void CWorkerPool::WorkerThread(void *pParam)
+{
+    Worker *pWorker = reinterpret_cast<Worker *>(pParam);
+    CWorkerPool *pThis = pWorker->pPool;
+
+    while (1) {
+        if (pThis->RunOne(pWorker) == true)
+            continue;
+        if (pThis->m_bQuit == true)
+            break;
+
+        // Idle first, then look again: an item queued meanwhile is either
+        // found here or sets hWake
+        InterlockedExchange(&pWorker->lIdle, 1);
+        if (pThis->RunOne(pWorker) == false && pThis->m_bQuit == false)
+            WaitForSingleObject(pWorker->hWake, INFINITE);
+        InterlockedExchange(&pWorker->lIdle, 0);
+    }
+
+    // Nothing of the pool is touched after this
+    if (InterlockedDecrement(&pThis->m_lRunning) == 0)
+        SetEvent(pThis->m_hExited);
+}
+
+}
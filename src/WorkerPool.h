@@ -0,0 +1,73 @@
+// WorkerPool.h - Work-stealing thread pool header
+#pragma once
+
+#include "Defs.h"
+#include <vector>
+
+namespace SDE
+{
+
+// Runs work items on a fixed set of threads. Each thread has a bounded ring
+// of its own, lock-free for any number of producers and consumers (each cell
+// carries a sequence number, the positions are claimed with a
+// compare-and-swap). An item goes to the ring its affinity picks; a thread
+// whose ring is empty takes items from the others before it sleeps, and an
+// item queued to a busy thread wakes an idle one to take it.
+class CWorkerPool
+{
+public:
+    typedef void (*WorkProc)(void *pParam);
+
+    static const LONG cRingSize = 1024;         // Power of 2
+
+    CWorkerPool();
+    ~CWorkerPool();
+
+    bool Start(int nThreads);
+    void Shutdown(void);
+    int GetNumThreads(void) const;
+
+    // Any thread may submit, returns false if every ring is full
+    bool Submit(WorkProc pfnProc, void *pParam, LONG lAffinity);
+
+    // Items run, and those taken from another thread's ring
+    SIZE_T GetRuns(void) const;
+    SIZE_T GetSteals(void) const;
+
+private:
+    struct Cell
+    {
+        LONG volatile lSequence;
+        WorkProc pfnProc;
+        void *pParam;
+    };
+
+    struct Worker
+    {
+        CWorkerPool *pPool;
+        int nIndex;
+        Cell *pCells;
+        LONG volatile lEnqueue;
+        LONG volatile lDequeue;
+        // Set while it waits for hWake (auto-reset)
+        LONG volatile lIdle;
+        HANDLE hWake;
+        SIZE_T nRuns;
+        SIZE_T nSteals;
+    };
+
+    typedef std::vector<Worker *> WorkerVector;
+
+    static void WorkerThread(void *pParam);
+    static bool Push(Worker *pWorker, WorkProc pfnProc, void *pParam);
+    static bool Pop(Worker *pWorker, WorkProc *ppfnProc, void **ppParam);
+    bool RunOne(Worker *pWorker);
+
+private:
+    WorkerVector m_Workers;
+    volatile bool m_bQuit;
+    LONG volatile m_lRunning;
+    HANDLE m_hExited;
+};
+
+}
@@ -5,9 +5,13 @@
 
 #pragma once
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN		// Exclude rarely-used stuff from Windows headers
 #include <windows.h>
 #include <process.h>
+#else
+#include "PtraceDebugApi.h"     // Linux: Win32 debugging API on top of ptrace
+#endif
 #include <map>
 #include <typeinfo>
 #include <algorithm>
\ No newline at end of file
@@ -0,0 +1,221 @@
+// Bench.cpp - Helpers and debuggee workloads shared by the SDEBench drivers
+#include "stdafx.h"
+#include "Bench.h"
+#include "InstructionDecoder.h"
+#include <stdlib.h>
+#include <string>
+
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/resource.h>
+#endif
+
+using namespace SDE;
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// Debuggee
+
+volatile int g_nTargetHits = 0;
+static volatile int g_nTargetSpin = 0;
+BYTE g_TargetPad[cTargetPadSize];
+
+void TargetHit(void)
+{
+    g_nTargetHits++;
+}
+
+// One RET at the end, FindFunctionEnd stops there
+void TargetSpin(int nCount)
+{
+    int n = 0;
+    do {
+        g_nTargetSpin += n;
+    } while (++n < nCount);
+}
+
+// Called through pointers the compiler can't see through, so they aren't inlined
+static void (* volatile g_pfnHit)(void) = TargetHit;
+static void (* volatile g_pfnSpin)(int) = TargetSpin;
+
+int RunTarget(int argc, char *argv[])
+{
+    if (argc < 3)
+        return(1);
+
+    string Workload(argv[1]);
+    int nCount = atoi(argv[2]);
+
+    if (Workload == "hit") {
+        for (int n = 0; n < nCount; n++)
+            g_pfnHit();
+        return(0);
+    }
+    if (Workload == "spin") {
+        g_pfnSpin(nCount);
+        return(0);
+    }
+    // Gives the debugger no events for nCount * 10 ms
+    if (Workload == "idle") {
+        for (int n = 0; n < nCount; n++)
+            SleepMilliseconds(10);
+        return(0);
+    }
+
+    return(1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Debugger
+
+#ifdef _WIN32
+
+double GetSeconds(void)
+{
+    LARGE_INTEGER liFrequency, liCounter;
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liCounter);
+    return(static_cast<double>(liCounter.QuadPart) / static_cast<double>(liFrequency.QuadPart));
+}
+
+double GetCpuSeconds(void)
+{
+    FILETIME ftCreation, ftExit, ftKernel, ftUser;
+    if (GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser) == FALSE)
+        return(0);
+    ULARGE_INTEGER uliKernel, uliUser;
+    uliKernel.LowPart = ftKernel.dwLowDateTime;
+    uliKernel.HighPart = ftKernel.dwHighDateTime;
+    uliUser.LowPart = ftUser.dwLowDateTime;
+    uliUser.HighPart = ftUser.dwHighDateTime;
+    return(static_cast<double>(static_cast<LONGLONG>(uliKernel.QuadPart + uliUser.QuadPart)) / 1e7);
+}
+
+void SleepMilliseconds(DWORD dwMilliseconds)
+{
+    Sleep(dwMilliseconds);
+}
+
+static bool GetProgramPath(char *pszPath, DWORD dwSize)
+{
+    DWORD dwLength = GetModuleFileName(NULL, pszPath, dwSize);
+    return(dwLength != 0 && dwLength < dwSize);
+}
+
+static ULONG_PTR GetEntryPoint(void)
+{
+    BYTE *pBase = reinterpret_cast<BYTE *>(GetModuleHandle(NULL));
+    IMAGE_DOS_HEADER *pDos = reinterpret_cast<IMAGE_DOS_HEADER *>(pBase);
+    IMAGE_NT_HEADERS *pNt = reinterpret_cast<IMAGE_NT_HEADERS *>(pBase + pDos->e_lfanew);
+    return(reinterpret_cast<ULONG_PTR>(pBase) + pNt->OptionalHeader.AddressOfEntryPoint);
+}
+
+#else
+
+double GetSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+double GetCpuSeconds(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return(0);
+    return(ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+}
+
+void SleepMilliseconds(DWORD dwMilliseconds)
+{
+    usleep(dwMilliseconds * 1000);
+}
+
+static bool GetProgramPath(char *pszPath, DWORD dwSize)
+{
+    ssize_t nLength = readlink("/proc/self/exe", pszPath, dwSize - 1);
+    if (nLength <= 0)
+        return(false);
+    pszPath[nLength] = '\0';
+    return(true);
+}
+
+static ULONG_PTR GetEntryPoint(void)
+{
+    return(getauxval(AT_ENTRY));
+}
+
+#endif
+
+DWORD LoadTarget(CDebugger & debugger, LPCSTR pszWorkload, int nCount)
+{
+    char szPath[1024];
+    if (GetProgramPath(szPath, sizeof(szPath)) == false)
+        return(0);
+
+    char szCommandLine[1280];
+    int nLength = _snprintf(szCommandLine, sizeof(szCommandLine), "\"%s\" target %s %d", szPath, pszWorkload, nCount);
+    if (nLength < 0 || nLength >= static_cast<int>(sizeof(szCommandLine)))
+        return(0);
+
+    STARTUPINFO si;
+    ZeroMemory(&si, sizeof(STARTUPINFO));
+    si.cb = sizeof(STARTUPINFO);
+    return(debugger.LoadProcess(szPath, szCommandLine, NULL, NULL, &si));
+}
+
+bool DebugTarget(CDebugger *pDebugger, IDebuggerClient *pClient, LPCSTR pszWorkload, int nCount)
+{
+    if (LoadTarget(*pDebugger, pszWorkload, nCount) == 0) {
+        printf("can't start the target\n");
+        delete pDebugger;
+        return(false);
+    }
+
+    pDebugger->AddClient(pClient);
+    pDebugger->Go();
+    EndTarget(pDebugger, pClient);
+    return(true);
+}
+
+void EndTarget(CDebugger *pDebugger, IDebuggerClient *pClient)
+{
+    pDebugger->RemoveClient(pClient);
+    delete pDebugger;
+}
+
+LPVOID GetTargetAddress(const CREATE_PROCESS_DEBUG_INFO *pCreateProcess, ULONG_PTR ulpLocal)
+{
+    // Same image, so the same distance from the entry point
+    ULONG_PTR ulpEntry = reinterpret_cast<ULONG_PTR>(pCreateProcess->lpStartAddress);
+    return(reinterpret_cast<LPVOID>(ulpEntry + (ulpLocal - GetEntryPoint())));
+}
+
+LPVOID FindFunctionEnd(IDebugger & debugger, LPVOID lpStart)
+{
+    static const int cMaxInstructions = 1024;
+
+    ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(lpStart);
+    for (int n = 0; n < cMaxInstructions; n++) {
+        BYTE Code[CInstructionDecoder::cMaxLength];
+        InstructionInfo info;
+        int nLength = CInstructionDecoder::Decode(debugger, reinterpret_cast<LPCVOID>(ulpAddress), Code, &info);
+        if (nLength == 0)
+            return(NULL);
+
+        // An incremental linking thunk, the function is at its target
+        if (n == 0 && info.dwMap == 0 && info.bOpcode == 0xE9) {
+            INT32 nDisplacement = *reinterpret_cast<INT32 *>(&Code[info.nOpcodeOffset + 1]);
+            ulpAddress += nLength + nDisplacement;
+            continue;
+        }
+
+        ulpAddress += nLength;
+        if (info.dwMap == 0 && (info.bOpcode == 0xC3 || info.bOpcode == 0xC2))
+            return(reinterpret_cast<LPVOID>(ulpAddress));
+    }
+    return(NULL);
+}
@@ -0,0 +1,48 @@
+// Bench.h - Helpers and debuggee workloads shared by the SDEBench drivers
+#pragma once
+
+#include "Debugger.h"
+
+// The program debugs a copy of itself, started as "SDEBench target <workload>
+// <count>". The addresses of its functions and data in the debuggee are
+// found from the entry point the debugger reports (GetTargetAddress).
+
+// Workloads run by the debuggee
+void TargetHit(void);                   // Called once per hit
+extern volatile int g_nTargetHits;      // Counted up by TargetHit
+void TargetSpin(int nCount);            // A loop of nCount short iterations
+extern BYTE g_TargetPad[];              // Never executed, room for filler breakpoints
+static const int cTargetPadSize = 128 * 1024;
+int RunTarget(int argc, char *argv[]);
+
+// Seconds from an arbitrary start
+double GetSeconds(void);
+// Processor time used by this process, user and kernel
+double GetCpuSeconds(void);
+void SleepMilliseconds(DWORD dwMilliseconds);
+
+// Starts "SDEBench target pszWorkload nCount" under the debugger
+DWORD LoadTarget(SDE::CDebugger & debugger, LPCSTR pszWorkload, int nCount);
+// Loads the target, adds the client and debugs it until Stop, then ends it
+// with EndTarget. The debugger is deleted, the client is still the caller's.
+bool DebugTarget(SDE::CDebugger *pDebugger, SDE::IDebuggerClient *pClient, LPCSTR pszWorkload, int nCount);
+// Removes the client and deletes the debugger. Deleting a debugger
+// deinitializes every breakpoint still added to it, the client's included, so
+// the client and its breakpoints go only after this.
+void EndTarget(SDE::CDebugger *pDebugger, SDE::IDebuggerClient *pClient);
+
+// Where ulpLocal, a function or variable of this program, is in the debuggee
+LPVOID GetTargetAddress(const CREATE_PROCESS_DEBUG_INFO *pCreateProcess, ULONG_PTR ulpLocal);
+// The end of the debuggee's function at lpStart, past its first RET, or NULL
+LPVOID FindFunctionEnd(SDE::IDebugger & debugger, LPVOID lpStart);
+
+// The drivers, argv[0] is the driver's name. They return 0 on success.
+int BenchDispatch(int argc, char *argv[]);
+int BenchBatchMemory(int argc, char *argv[]);
+int BenchDecoder(int argc, char *argv[]);
+int BenchRangeStep(int argc, char *argv[]);
+int BenchBranchStep(int argc, char *argv[]);
+int BenchTrace(int argc, char *argv[]);
+int BenchAllocations(int argc, char *argv[]);
+int BenchStop(int argc, char *argv[]);
+int BenchReactor(int argc, char *argv[]);
@@ -0,0 +1,135 @@
+// BenchAllocations.cpp - Heap allocations made by the debugger once warmed up
+#include "stdafx.h"
+#include "Bench.h"
+#include "AllocationCounter.h"
+#include "BreakPointOnExecution.h"
+#include "BreakPointOnMemoryRange.h"
+#include "SingleStepOverBreakPoint.h"
+#include <stdlib.h>
+
+using namespace SDE;
+using namespace std;
+
+// Keeps a breakpoint on TargetHit and, from the first hit, steps over the
+// target's loop or, guarded, watches the hit counter with a memory range
+// breakpoint on guard pages; the debugger's allocation count is taken after
+// the warm-up hits and again at the last one
+class CAllocationClient : public IDebuggerClient
+{
+public:
+    CAllocationClient(CDebugger & debugger, int nWarmUp, bool bGuard)
+        : m_debugger(debugger)
+        , m_nWarmUp(nWarmUp)
+        , m_bGuard(bGuard)
+        , m_pStep(NULL)
+        , m_pRange(NULL)
+        , m_nHits(0)
+        , m_nSteps(0)
+        , m_nWarmAllocations(0)
+        , m_nLastAllocations(0)
+        , m_nExceptionEvents(0)
+    {
+    }
+    ~CAllocationClient()
+    {
+        delete m_pStep;
+        delete m_pRange;
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint == m_pStep || pBreakPoint == m_pRange) {
+            m_nSteps++;
+            return(false);
+        }
+        if (pBreakPoint != &m_bpHit)
+            return(false);
+
+        if (m_nHits++ == 0 && m_bGuard == false) {
+            m_pStep = new CSingleStepOverBreakPoint(m_debugger, pBreakPoint->GetThread());
+            m_debugger.AddBreakPoint(m_pStep);
+            m_pStep->Enable();
+        }
+        if (m_nHits == m_nWarmUp)
+            m_nWarmAllocations = m_debugger.GetEventAllocations();
+        m_nLastAllocations = m_debugger.GetEventAllocations();
+        return(false);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        m_bpHit.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetHit)));
+        m_debugger.AddBreakPoint(&m_bpHit);
+        m_bpHit.Enable();
+
+        // Larger than a watchpoint, so on guard pages
+        if (m_bGuard == true) {
+            BYTE *pCounter = reinterpret_cast<BYTE *>(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(&g_nTargetHits)));
+            m_pRange = new CBreakPointOnMemoryRange(m_debugger, make_pair(reinterpret_cast<LPVOID>(pCounter), reinterpret_cast<LPVOID>(pCounter + cGuardSize - 1)));
+            m_debugger.AddBreakPoint(m_pRange);
+            m_pRange->Enable();
+        }
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_nExceptionEvents = m_debugger.GetExceptionEvents();
+        m_debugger.Stop();
+    }
+
+    int GetHits(void) const { return(m_nHits); }
+    SIZE_T GetSteps(void) const { return(m_nSteps); }
+    SIZE_T GetWarmAllocations(void) const { return(m_nWarmAllocations); }
+    SIZE_T GetLastAllocations(void) const { return(m_nLastAllocations); }
+    SIZE_T GetExceptionEvents(void) const { return(m_nExceptionEvents); }
+
+private:
+    static const int cGuardSize = 64;
+
+    CDebugger & m_debugger;
+    int m_nWarmUp;
+    bool m_bGuard;
+    CBreakPointOnExecution m_bpHit;
+    CSingleStepOverBreakPoint *m_pStep;
+    CBreakPointOnMemoryRange *m_pRange;
+    int m_nHits;
+    SIZE_T m_nSteps;
+    SIZE_T m_nWarmAllocations;
+    SIZE_T m_nLastAllocations;
+    SIZE_T m_nExceptionEvents;
+};
+
+int BenchAllocations(int argc, char *argv[])
+{
+    static const int cWarmUp = 100;
+
+    if (CAllocationCounter::IsEnabled() == false) {
+        printf("allocations: build with SDE_COUNT_ALLOCATIONS defined to count them\n");
+        return(1);
+    }
+
+    int nHits = (argc >= 2) ? atoi(argv[1]) : 2000;
+    if (nHits <= cWarmUp) {
+        printf("allocations: more than %d hits\n", cWarmUp);
+        return(1);
+    }
+
+    // Stepping over the loop, then watching the counter on guard pages. The
+    // guarded run leaves its range breakpoint, with its re-arm steps, for the
+    // debugger to remove when deleted.
+    int nResult = 0;
+    for (int n = 0; n < 2; n++) {
+        bool bGuard = (n == 1);
+
+        CDebugger *pDebugger = new CDebugger;
+        CAllocationClient client(*pDebugger, cWarmUp, bGuard);
+        if (DebugTarget(pDebugger, &client, "hit", nHits) == false)
+            return(1);
+
+        SIZE_T nGrowth = client.GetLastAllocations() - client.GetWarmAllocations();
+        printf("%d hits, %lu %s, %lu exception events: %lu allocations after %d warm-up hits, %lu after the last\n", client.GetHits(), static_cast<unsigned long>(client.GetSteps()), bGuard ? "guarded accesses" : "steps", static_cast<unsigned long>(client.GetExceptionEvents()), static_cast<unsigned long>(client.GetWarmAllocations()), cWarmUp, static_cast<unsigned long>(client.GetLastAllocations()));
+
+        // Once warm, breakpoints, steps and guard faults are handled without allocating
+        if (client.GetHits() != nHits || client.GetSteps() == 0 || nGrowth != 0)
+            nResult = 1;
+    }
+
+    return(nResult);
+}
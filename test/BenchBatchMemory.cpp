@@ -0,0 +1,128 @@
+// BenchBatchMemory.cpp - Scattered reads at a stop, one call each against one batch
+#include "stdafx.h"
+#include "Bench.h"
+#include "BreakPointOnExecution.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace SDE;
+using namespace std;
+
+// At each hit reads nReads small pieces of the pad, first one call per piece
+// and then as a single batch, and checks both got the same bytes
+class CBatchClient : public IDebuggerClient
+{
+public:
+    CBatchClient(CDebugger & debugger, int nReads)
+        : m_debugger(debugger)
+        , m_nReads(nReads)
+        , m_nHits(0)
+        , m_nFailures(0)
+        , m_dSingle(0)
+        , m_dBatch(0)
+        , m_pPad(NULL)
+        , m_Single(nReads * cReadSize)
+        , m_Batch(nReads * cReadSize)
+        , m_Requests(nReads)
+    {
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint != &m_bpHit)
+            return(false);
+
+        // Spread over the pad, a different pattern at each hit
+        for (int n = 0; n < m_nReads; n++) {
+            SIZE_T nOffset = ((m_nHits * 7919 + n * 104729) % (cTargetPadSize / cReadSize)) * cReadSize;
+            m_Requests[n].lpAddress = m_pPad + nOffset;
+            m_Requests[n].lpBuffer = &m_Batch[n * cReadSize];
+            m_Requests[n].nSize = cReadSize;
+            m_Requests[n].nTransferred = 0;
+        }
+
+        double dStart = GetSeconds();
+        for (int n = 0; n < m_nReads; n++) {
+            SIZE_T nRead = 0;
+            if (m_debugger.ReadProcessMemory(m_Requests[n].lpAddress, &m_Single[n * cReadSize], cReadSize, &nRead) == FALSE || nRead != cReadSize)
+                m_nFailures++;
+        }
+        double dMiddle = GetSeconds();
+        if (m_debugger.ReadProcessMemory(&m_Requests[0], m_Requests.size()) == false)
+            m_nFailures++;
+        double dEnd = GetSeconds();
+
+        if (memcmp(&m_Single[0], &m_Batch[0], m_Single.size()) != 0)
+            m_nFailures++;
+
+        m_dSingle += dMiddle - dStart;
+        m_dBatch += dEnd - dMiddle;
+        m_nHits++;
+        return(false);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        m_pPad = reinterpret_cast<BYTE *>(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(g_TargetPad)));
+        m_bpHit.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetHit)));
+        m_debugger.AddBreakPoint(&m_bpHit);
+        m_bpHit.Enable();
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_debugger.Stop();
+    }
+
+    int GetHits(void) const { return(m_nHits); }
+    int GetFailures(void) const { return(m_nFailures); }
+    // Per stop
+    double GetSingleTime(void) const { return(m_nHits ? m_dSingle / m_nHits : 0); }
+    double GetBatchTime(void) const { return(m_nHits ? m_dBatch / m_nHits : 0); }
+
+private:
+    static const int cReadSize = 16;
+
+    CDebugger & m_debugger;
+    int m_nReads;
+    int m_nHits;
+    int m_nFailures;
+    double m_dSingle;
+    double m_dBatch;
+    BYTE *m_pPad;
+    vector<BYTE> m_Single;
+    vector<BYTE> m_Batch;
+    vector<MemoryRequest> m_Requests;
+    CBreakPointOnExecution m_bpHit;
+};
+
+int BenchBatchMemory(int argc, char *argv[])
+{
+    static const int cHits = 200;
+    static const int cDefaultCounts[] = { 1, 4, 16, 64, 256, 1024 };
+
+    vector<int> Counts;
+    for (int n = 1; n < argc; n++)
+        Counts.push_back(atoi(argv[n]));
+    if (Counts.empty() == true)
+        Counts.assign(cDefaultCounts, cDefaultCounts + sizeof(cDefaultCounts) / sizeof(cDefaultCounts[0]));
+
+    int nResult = 0;
+    for (size_t n = 0; n < Counts.size(); n++) {
+        if (Counts[n] < 1) {
+            printf("%d reads: at least one\n", Counts[n]);
+            return(1);
+        }
+
+        CDebugger *pDebugger = new CDebugger;
+        CBatchClient client(*pDebugger, Counts[n]);
+        if (DebugTarget(pDebugger, &client, "hit", cHits) == false)
+            return(1);
+
+        double dSingle = client.GetSingleTime();
+        double dBatch = client.GetBatchTime();
+        printf("%5d reads/stop: %.1f us one call each, %.1f us batched (%.1fx), %d failures\n", Counts[n], dSingle * 1e6, dBatch * 1e6, dBatch > 0 ? dSingle / dBatch : 0, client.GetFailures());
+        if (client.GetHits() != cHits || client.GetFailures() != 0)
+            nResult = 1;
+    }
+
+    return(nResult);
+}
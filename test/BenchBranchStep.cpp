@@ -0,0 +1,141 @@
+// BenchBranchStep.cpp - Following a loop by single steps and by branch steps
+#include "stdafx.h"
+#include "Bench.h"
+#include "BreakPointOnExecution.h"
+#include "SingleStepIntoBreakPoint.h"
+#include "BranchStepBreakPoint.h"
+#include <stdlib.h>
+
+using namespace SDE;
+using namespace std;
+
+// Follows TargetSpin from its entry until it returns, single stepping every
+// instruction or trapping only on its branches
+class CBranchStepClient : public IDebuggerClient
+{
+public:
+    CBranchStepClient(CDebugger & debugger, bool bBranchStep)
+        : m_debugger(debugger)
+        , m_bBranchStep(bBranchStep)
+        , m_pSingleStep(NULL)
+        , m_pBranchStep(NULL)
+        , m_ulpStart(0)
+        , m_ulpEnd(0)
+        , m_nTraps(0)
+        , m_nBlocks(0)
+        , m_bLeft(false)
+        , m_dStart(0)
+        , m_dTime(0)
+    {
+    }
+    ~CBranchStepClient()
+    {
+        delete m_pSingleStep;
+        delete m_pBranchStep;
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint == &m_bpSpin) {
+            m_bpSpin.Disable();
+            m_debugger.RemoveBreakPoint(&m_bpSpin);
+
+            m_ulpStart = reinterpret_cast<ULONG_PTR>(m_bpSpin.GetAddress());
+            m_ulpEnd = reinterpret_cast<ULONG_PTR>(FindFunctionEnd(m_debugger, m_bpSpin.GetAddress()));
+            if (m_ulpEnd == 0)
+                return(true);
+
+            m_dStart = GetSeconds();
+            if (m_bBranchStep == true) {
+                m_pBranchStep = new CBranchStepBreakPoint(pBreakPoint->GetThread());
+                m_debugger.AddBreakPoint(m_pBranchStep);
+                m_pBranchStep->Enable();
+            } else {
+                m_pSingleStep = new CSingleStepIntoBreakPoint(pBreakPoint->GetThread());
+                m_debugger.AddBreakPoint(m_pSingleStep);
+                m_pSingleStep->Enable();
+            }
+            return(true);
+        }
+
+        if (pBreakPoint != m_pSingleStep && pBreakPoint != m_pBranchStep)
+            return(false);
+
+        if (pBreakPoint == m_pSingleStep)
+            m_nTraps++;
+        ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(pBreakPoint->GetAddress());
+        if (ulpAddress >= m_ulpStart && ulpAddress < m_ulpEnd)
+            return(false);
+
+        m_dTime = GetSeconds() - m_dStart;
+        m_bLeft = true;
+        if (pBreakPoint == m_pBranchStep) {
+            m_nTraps = m_pBranchStep->GetTraps();
+            m_nBlocks = m_pBranchStep->GetBlocks();
+        }
+        pBreakPoint->Disable();
+        m_debugger.RemoveBreakPoint(pBreakPoint);
+        return(true);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        m_bpSpin.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetSpin)));
+        m_debugger.AddBreakPoint(&m_bpSpin);
+        m_bpSpin.Enable();
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_debugger.Stop();
+    }
+
+    bool HasLeft(void) const { return(m_bLeft); }
+    SIZE_T GetTraps(void) const { return(m_nTraps); }
+    SIZE_T GetBlocks(void) const { return(m_nBlocks); }
+    double GetTime(void) const { return(m_dTime); }
+
+private:
+    CDebugger & m_debugger;
+    bool m_bBranchStep;
+    CBreakPointOnExecution m_bpSpin;
+    CSingleStepIntoBreakPoint *m_pSingleStep;
+    CBranchStepBreakPoint *m_pBranchStep;
+    ULONG_PTR m_ulpStart;
+    ULONG_PTR m_ulpEnd;
+    SIZE_T m_nTraps;
+    SIZE_T m_nBlocks;
+    bool m_bLeft;
+    double m_dStart;
+    double m_dTime;
+};
+
+int BenchBranchStep(int argc, char *argv[])
+{
+    int nIterations = (argc >= 2) ? atoi(argv[1]) : 20000;
+    if (nIterations < 1) {
+        printf("branchstep: at least one iteration\n");
+        return(1);
+    }
+
+    SIZE_T Traps[2];
+    for (int n = 0; n < 2; n++) {
+        bool bBranchStep = (n == 1);
+        LPCSTR pszMode = bBranchStep ? "branch step" : "single step";
+
+        CDebugger *pDebugger = new CDebugger;
+        CBranchStepClient client(*pDebugger, bBranchStep);
+        if (DebugTarget(pDebugger, &client, "spin", nIterations) == false)
+            return(1);
+        if (client.HasLeft() == false) {
+            printf("%s: never left TargetSpin\n", pszMode);
+            return(1);
+        }
+
+        Traps[n] = client.GetTraps();
+        printf("%s: %lu traps", pszMode, static_cast<unsigned long>(Traps[n]));
+        if (bBranchStep == true)
+            printf(" for %lu blocks", static_cast<unsigned long>(client.GetBlocks()));
+        printf(" in %.3f s\n", client.GetTime());
+    }
+
+    // One block per iteration, so fewer traps than instructions
+    return(Traps[1] < Traps[0] ? 0 : 1);
+}
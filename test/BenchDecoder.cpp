@@ -0,0 +1,115 @@
+// BenchDecoder.cpp - Instruction decoder lengths against a corpus, and its speed
+#include "stdafx.h"
+#include "Bench.h"
+#include "InstructionDecoder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace SDE;
+using namespace std;
+
+// A corpus file has one instruction per line: its bytes in hex, then the
+// mnemonic. Lines starting with # are comments.
+struct CorpusEntry
+{
+    size_t nOffset;         // In the corpus' byte buffer
+    int nLength;
+    char szMnemonic[16];
+};
+
+static bool LoadCorpus(LPCSTR pszPath, vector<BYTE> & Bytes, vector<CorpusEntry> & Entries)
+{
+    FILE *pFile = fopen(pszPath, "r");
+    if (pFile == NULL)
+        return(false);
+
+    char szLine[256];
+    while (fgets(szLine, sizeof(szLine), pFile) != NULL) {
+        if (szLine[0] == '#' || szLine[0] == '\n')
+            continue;
+
+        char szHex[2 * CInstructionDecoder::cMaxLength + 2];
+        CorpusEntry entry;
+        if (sscanf(szLine, "%31s %15s", szHex, entry.szMnemonic) != 2)
+            continue;
+
+        entry.nOffset = Bytes.size();
+        entry.nLength = static_cast<int>(strlen(szHex) / 2);
+        for (int n = 0; n < entry.nLength; n++) {
+            unsigned int uByte = 0;
+            sscanf(szHex + n * 2, "%2x", &uByte);
+            Bytes.push_back(static_cast<BYTE>(uByte));
+        }
+        Entries.push_back(entry);
+    }
+
+    fclose(pFile);
+    return(Entries.empty() == false);
+}
+
+// Decodes each instruction from a buffer of exactly its length, so a length
+// too long fails as well as one too short. Returns the number of mismatches.
+static int ReplayCorpus(const vector<BYTE> & Bytes, const vector<CorpusEntry> & Entries, bool b64Bit)
+{
+    static const int cMaxReported = 10;
+
+    int nMismatches = 0;
+    for (size_t n = 0; n < Entries.size(); n++) {
+        const CorpusEntry & entry = Entries[n];
+        int nLength = CInstructionDecoder::Decode(&Bytes[entry.nOffset], entry.nLength, b64Bit, NULL);
+        if (nLength == entry.nLength)
+            continue;
+
+        if (nMismatches++ < cMaxReported) {
+            printf("  %s: expected %d got %d:", entry.szMnemonic, entry.nLength, nLength);
+            for (int i = 0; i < entry.nLength; i++)
+                printf(" %02x", Bytes[entry.nOffset + i]);
+            printf("\n");
+        }
+    }
+    return(nMismatches);
+}
+
+int BenchDecoder(int argc, char *argv[])
+{
+    static const int cRounds = 100;
+    static const char *cDefaultArgs[] = { "decoder", "DecoderCorpus64.txt", "64", "DecoderCorpus32.txt", "32" };
+
+    if (argc == 1) {
+        argc = sizeof(cDefaultArgs) / sizeof(cDefaultArgs[0]);
+        argv = const_cast<char **>(cDefaultArgs);
+    }
+    if (argc % 2 == 0) {
+        printf("decoder: a corpus and its bits (32 or 64) each\n");
+        return(1);
+    }
+
+    int nResult = 0;
+    for (int n = 1; n < argc; n += 2) {
+        bool b64Bit = atoi(argv[n + 1]) == 64;
+
+        vector<BYTE> Bytes;
+        vector<CorpusEntry> Entries;
+        if (LoadCorpus(argv[n], Bytes, Entries) == false) {
+            printf("%s: can't read the corpus\n", argv[n]);
+            return(1);
+        }
+
+        int nMismatches = ReplayCorpus(Bytes, Entries, b64Bit);
+
+        double dStart = GetSeconds();
+        int nTotal = 0;
+        for (int nRound = 0; nRound < cRounds; nRound++) {
+            for (size_t i = 0; i < Entries.size(); i++)
+                nTotal += CInstructionDecoder::Decode(&Bytes[Entries[i].nOffset], Entries[i].nLength, b64Bit, NULL);
+        }
+        double dTime = GetSeconds() - dStart;
+
+        printf("%s: %d instructions, %d mismatches, %.1f M instructions/s (%d bytes)\n", argv[n], static_cast<int>(Entries.size()), nMismatches, dTime > 0 ? cRounds * Entries.size() / dTime / 1e6 : 0, nTotal / cRounds);
+        if (nMismatches != 0)
+            nResult = 1;
+    }
+
+    return(nResult);
+}
@@ -0,0 +1,107 @@
+// BenchDispatch.cpp - Breakpoint hit cost against the number of breakpoints
+#include "stdafx.h"
+#include "Bench.h"
+#include "BreakPointOnExecution.h"
+#include <stdlib.h>
+#include <vector>
+
+using namespace SDE;
+using namespace std;
+
+// One breakpoint the target keeps hitting, the others on bytes it never runs
+class CDispatchClient : public IDebuggerClient
+{
+public:
+    CDispatchClient(CDebugger & debugger, int nBreakPoints)
+        : m_debugger(debugger)
+        , m_nBreakPoints(nBreakPoints)
+        , m_nHits(0)
+        , m_dFirstHit(0)
+        , m_dLastHit(0)
+        , m_dSetup(0)
+    {
+    }
+    ~CDispatchClient()
+    {
+        for (size_t n = 0; n < m_Fillers.size(); n++)
+            delete m_Fillers[n];
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint != &m_bpHit)
+            return(false);
+
+        m_dLastHit = GetSeconds();
+        if (m_nHits++ == 0)
+            m_dFirstHit = m_dLastHit;
+        return(false);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        double dStart = GetSeconds();
+
+        m_bpHit.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetHit)));
+        m_debugger.AddBreakPoint(&m_bpHit);
+        m_bpHit.Enable();
+
+        BYTE *pPad = reinterpret_cast<BYTE *>(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(g_TargetPad)));
+        for (int n = 1; n < m_nBreakPoints; n++) {
+            CBreakPointOnExecution *pBreakPoint = new CBreakPointOnExecution(pPad + n);
+            m_Fillers.push_back(pBreakPoint);
+            m_debugger.AddBreakPoint(pBreakPoint);
+            pBreakPoint->Enable();
+        }
+
+        m_dSetup = GetSeconds() - dStart;
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_debugger.Stop();
+    }
+
+    int GetHits(void) const { return(m_nHits); }
+    double GetSetupTime(void) const { return(m_dSetup); }
+    // Between the first and the last hit
+    double GetHitTime(void) const { return(m_nHits > 1 ? (m_dLastHit - m_dFirstHit) / (m_nHits - 1) : 0); }
+
+private:
+    CDebugger & m_debugger;
+    int m_nBreakPoints;
+    int m_nHits;
+    double m_dFirstHit;
+    double m_dLastHit;
+    double m_dSetup;
+    CBreakPointOnExecution m_bpHit;
+    vector<CBreakPointOnExecution *> m_Fillers;
+};
+
+int BenchDispatch(int argc, char *argv[])
+{
+    static const int cHits = 2000;
+    static const int cDefaultCounts[] = { 10, 100, 1000, 10000, 100000 };
+
+    vector<int> Counts;
+    for (int n = 1; n < argc; n++)
+        Counts.push_back(atoi(argv[n]));
+    if (Counts.empty() == true)
+        Counts.assign(cDefaultCounts, cDefaultCounts + sizeof(cDefaultCounts) / sizeof(cDefaultCounts[0]));
+
+    int nResult = 0;
+    for (size_t n = 0; n < Counts.size(); n++) {
+        if (Counts[n] < 1 || Counts[n] > cTargetPadSize) {
+            printf("%d breakpoints: between 1 and %d\n", Counts[n], cTargetPadSize);
+            return(1);
+        }
+
+        CDebugger *pDebugger = new CDebugger;
+        CDispatchClient client(*pDebugger, Counts[n]);
+        if (DebugTarget(pDebugger, &client, "hit", cHits) == false)
+            return(1);
+
+        printf("%6d breakpoints: %d hits, %.1f us/hit (set up in %.3f s)\n", Counts[n], client.GetHits(), client.GetHitTime() * 1e6, client.GetSetupTime());
+        if (client.GetHits() != cHits)
+            nResult = 1;
+    }
+
+    return(nResult);
+}
@@ -0,0 +1,143 @@
+// BenchRangeStep.cpp - Stepping through a function, with and without client round-trips
+#include "stdafx.h"
+#include "Bench.h"
+#include "BreakPointOnExecution.h"
+#include "SingleStepIntoBreakPoint.h"
+#include "RangeStepBreakPoint.h"
+#include <stdlib.h>
+
+using namespace SDE;
+using namespace std;
+
+// Steps TargetSpin from its entry until it returns, either single stepping
+// with the client looking at every step or with a range step that only
+// reports the return
+class CRangeStepClient : public IDebuggerClient
+{
+public:
+    CRangeStepClient(CDebugger & debugger, bool bRangeStep)
+        : m_debugger(debugger)
+        , m_bRangeStep(bRangeStep)
+        , m_pSingleStep(NULL)
+        , m_pRangeStep(NULL)
+        , m_ulpStart(0)
+        , m_ulpEnd(0)
+        , m_nSteps(0)
+        , m_bLeft(false)
+        , m_dStart(0)
+        , m_dTime(0)
+    {
+    }
+    ~CRangeStepClient()
+    {
+        delete m_pSingleStep;
+        delete m_pRangeStep;
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint == &m_bpSpin) {
+            m_bpSpin.Disable();
+            m_debugger.RemoveBreakPoint(&m_bpSpin);
+
+            m_ulpStart = reinterpret_cast<ULONG_PTR>(m_bpSpin.GetAddress());
+            m_ulpEnd = reinterpret_cast<ULONG_PTR>(FindFunctionEnd(m_debugger, m_bpSpin.GetAddress()));
+            if (m_ulpEnd == 0)
+                return(true);
+
+            m_dStart = GetSeconds();
+            if (m_bRangeStep == true) {
+                m_pRangeStep = new CRangeStepBreakPoint(pBreakPoint->GetThread(), reinterpret_cast<LPVOID>(m_ulpStart), reinterpret_cast<LPVOID>(m_ulpEnd));
+                m_debugger.AddBreakPoint(m_pRangeStep);
+                m_pRangeStep->Enable();
+            } else {
+                m_pSingleStep = new CSingleStepIntoBreakPoint(pBreakPoint->GetThread());
+                m_debugger.AddBreakPoint(m_pSingleStep);
+                m_pSingleStep->Enable();
+            }
+            return(true);
+        }
+
+        if (pBreakPoint == m_pSingleStep) {
+            ULONG_PTR ulpAddress = reinterpret_cast<ULONG_PTR>(pBreakPoint->GetAddress());
+            if (ulpAddress >= m_ulpStart && ulpAddress < m_ulpEnd) {
+                m_nSteps++;
+                return(false);
+            }
+            OnLeft();
+            m_pSingleStep->Disable();
+            m_debugger.RemoveBreakPoint(m_pSingleStep);
+            return(true);
+        }
+
+        if (pBreakPoint == m_pRangeStep) {
+            m_nSteps = m_pRangeStep->GetSteps();
+            OnLeft();
+            m_debugger.RemoveBreakPoint(m_pRangeStep);
+            return(true);
+        }
+
+        return(false);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        m_bpSpin.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetSpin)));
+        m_debugger.AddBreakPoint(&m_bpSpin);
+        m_bpSpin.Enable();
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_debugger.Stop();
+    }
+
+    bool HasLeft(void) const { return(m_bLeft); }
+    SIZE_T GetSteps(void) const { return(m_nSteps); }
+    double GetStepsPerSecond(void) const { return(m_dTime > 0 ? m_nSteps / m_dTime : 0); }
+
+private:
+    void OnLeft(void)
+    {
+        m_dTime = GetSeconds() - m_dStart;
+        m_bLeft = true;
+    }
+
+    CDebugger & m_debugger;
+    bool m_bRangeStep;
+    CBreakPointOnExecution m_bpSpin;
+    CSingleStepIntoBreakPoint *m_pSingleStep;
+    CRangeStepBreakPoint *m_pRangeStep;
+    ULONG_PTR m_ulpStart;
+    ULONG_PTR m_ulpEnd;
+    SIZE_T m_nSteps;
+    bool m_bLeft;
+    double m_dStart;
+    double m_dTime;
+};
+
+int BenchRangeStep(int argc, char *argv[])
+{
+    int nIterations = (argc >= 2) ? atoi(argv[1]) : 20000;
+    if (nIterations < 1) {
+        printf("rangestep: at least one iteration\n");
+        return(1);
+    }
+
+    SIZE_T Steps[2];
+    for (int n = 0; n < 2; n++) {
+        bool bRangeStep = (n == 1);
+
+        CDebugger *pDebugger = new CDebugger;
+        CRangeStepClient client(*pDebugger, bRangeStep);
+        if (DebugTarget(pDebugger, &client, "spin", nIterations) == false)
+            return(1);
+        if (client.HasLeft() == false) {
+            printf("%s: never left TargetSpin\n", bRangeStep ? "range step" : "single step");
+            return(1);
+        }
+
+        Steps[n] = client.GetSteps();
+        printf("%-11s: %lu steps, %.0f steps/s\n", bRangeStep ? "range step" : "single step", static_cast<unsigned long>(Steps[n]), client.GetStepsPerSecond());
+    }
+
+    // Both step the same instructions
+    return(Steps[0] == Steps[1] ? 0 : 1);
+}
@@ -0,0 +1,133 @@
+// BenchReactor.cpp - Many debuggers, each on a thread of its own or on a reactor
+#include "stdafx.h"
+#include "Bench.h"
+#include "DebuggerReactor.h"
+#include "BreakPointOnExecution.h"
+#include <stdlib.h>
+#include <vector>
+
+using namespace SDE;
+using namespace std;
+
+class CReactorClient : public IDebuggerClient
+{
+public:
+    CReactorClient(CDebugger & debugger)
+        : m_debugger(debugger)
+        , m_nHits(0)
+        , m_dwExitCode(static_cast<DWORD>(-1))
+    {
+    }
+    virtual ~CReactorClient()
+    {
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint == &m_bpHit)
+            m_nHits++;
+        return(false);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        m_bpHit.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetHit)));
+        m_debugger.AddBreakPoint(&m_bpHit);
+        m_bpHit.Enable();
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_dwExitCode = pExitProcess->dwExitCode;
+        m_debugger.Stop();
+    }
+
+    int GetHits(void) const { return(m_nHits); }
+    DWORD GetExitCode(void) const { return(m_dwExitCode); }
+
+private:
+    CDebugger & m_debugger;
+    CBreakPointOnExecution m_bpHit;
+    int m_nHits;
+    DWORD m_dwExitCode;
+};
+
+// Debugs nSessions targets, nWave at a time, each hitting a breakpoint
+// nHits times. With no reactor each debugger runs on a thread of its own.
+// Returns the sessions that didn't see every hit.
+static int RunSessions(CDebuggerReactor *pReactor, int nSessions, int nWave, int nHits)
+{
+    int nBad = 0;
+    for (int nDone = 0; nDone < nSessions; ) {
+        int nCount = (nSessions - nDone < nWave) ? nSessions - nDone : nWave;
+
+        vector<CDebugger *> Debuggers(nCount);
+        vector<CReactorClient *> Clients(nCount);
+        vector<HANDLE> Stopped(nCount);
+        for (int n = 0; n < nCount; n++) {
+            Debuggers[n] = new CDebugger;
+            if (pReactor)
+                Debuggers[n]->SetReactor(pReactor);
+            Clients[n] = new CReactorClient(*Debuggers[n]);
+            if (LoadTarget(*Debuggers[n], "hit", nHits) == 0) {
+                printf("can't start the target\n");
+                continue;
+            }
+            Debuggers[n]->AddClient(Clients[n]);
+        }
+        for (int n = 0; n < nCount; n++)
+            Stopped[n] = Debuggers[n]->GoAsync();
+
+        for (int n = 0; n < nCount; n++) {
+            if (Stopped[n])
+                WaitForSingleObject(Stopped[n], INFINITE);
+            if (Clients[n]->GetHits() != nHits || Clients[n]->GetExitCode() != 0)
+                nBad++;
+            EndTarget(Debuggers[n], Clients[n]);
+            delete Clients[n];
+        }
+        nDone += nCount;
+    }
+    return(nBad);
+}
+
+int BenchReactor(int argc, char *argv[])
+{
+    static const int cHits = 200;
+    static const int cWave = 64;
+
+    int nSessions = (argc >= 2) ? atoi(argv[1]) : 256;
+    int nThreads = (argc >= 3) ? atoi(argv[2]) : 4;
+    int nWorkers = (argc >= 4) ? atoi(argv[3]) : 4;
+    if (nSessions < 1 || nThreads < 1 || nWorkers < 0) {
+        printf("reactor: at least one session and one event thread\n");
+        return(1);
+    }
+
+    int nResult = 0;
+    for (int n = 0; n < 2; n++) {
+        CDebuggerReactor reactor;
+        CDebuggerReactor *pReactor = NULL;
+        if (n == 1) {
+            if (reactor.Start(nThreads, nWorkers) == false) {
+                printf("can't start the reactor\n");
+                return(1);
+            }
+            pReactor = &reactor;
+        }
+
+        double dStart = GetSeconds();
+        double dCpuStart = GetCpuSeconds();
+        int nBad = RunSessions(pReactor, nSessions, cWave, cHits);
+        double dTime = GetSeconds() - dStart;
+        double dCpu = GetCpuSeconds() - dCpuStart;
+
+        double dHits = static_cast<double>(nSessions - nBad) * cHits;
+        if (pReactor)
+            printf("reactor, %d threads %d workers", nThreads, nWorkers);
+        else
+            printf("a thread per debugger");
+        printf(": %d sessions in %.3f s, %.0f hits/s, %.0f hits per CPU second, %d bad\n", nSessions, dTime, dTime > 0 ? dHits / dTime : 0, dCpu > 0 ? dHits / dCpu : 0, nBad);
+        if (nBad != 0)
+            nResult = 1;
+    }
+
+    return(nResult);
+}
@@ -0,0 +1,70 @@
+// BenchStop.cpp - How long Stop takes while the debugger waits for events
+#include "stdafx.h"
+#include "Bench.h"
+#include <stdlib.h>
+
+using namespace SDE;
+using namespace std;
+
+class CStopClient : public IDebuggerClient
+{
+public:
+    CStopClient(void)
+        : m_lCreated(0)
+    {
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        InterlockedExchange(&m_lCreated, 1);
+    }
+
+    bool IsCreated(void) const { return(m_lCreated != 0); }
+
+private:
+    volatile LONG m_lCreated;
+};
+
+// Debugs an idle target on the debugger thread and stops it from this one,
+// some time into its wait for the next event
+int BenchStop(int argc, char *argv[])
+{
+    static const int cIdleTicks = 300;     // Of 10 ms, bounds each target's life
+    static const double cMaxStop = 0.1;
+
+    int nRuns = (argc >= 2) ? atoi(argv[1]) : 10;
+    if (nRuns < 1) {
+        printf("stop: at least one run\n");
+        return(1);
+    }
+
+    double dTotal = 0;
+    double dMax = 0;
+    for (int n = 0; n < nRuns; n++) {
+        CDebugger *pDebugger = new CDebugger;
+        CStopClient client;
+        if (LoadTarget(*pDebugger, "idle", cIdleTicks) == 0) {
+            printf("can't start the target\n");
+            delete pDebugger;
+            return(1);
+        }
+        pDebugger->AddClient(&client);
+        pDebugger->GoAsync();
+
+        while (client.IsCreated() == false)
+            SleepMilliseconds(1);
+        SleepMilliseconds(20 + (n * 37) % 100);
+
+        double dStart = GetSeconds();
+        pDebugger->Stop();
+        double dStop = GetSeconds() - dStart;
+
+        EndTarget(pDebugger, &client);
+
+        dTotal += dStop;
+        if (dStop > dMax)
+            dMax = dStop;
+    }
+
+    printf("%d stops: %.1f us average, %.1f us max\n", nRuns, dTotal / nRuns * 1e6, dMax * 1e6);
+    return(dMax < cMaxStop ? 0 : 1);
+}
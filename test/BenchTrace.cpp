@@ -0,0 +1,228 @@
+// BenchTrace.cpp - Recording a stepped loop and reading the trace back
+#include "stdafx.h"
+#include "Bench.h"
+#include "BreakPointOnExecution.h"
+#include "RangeStepBreakPoint.h"
+#include "TraceRecorder.h"
+#include "TraceReader.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace SDE;
+using namespace std;
+
+// Range steps TargetSpin from its entry until it returns, recording every step
+class CTraceClient : public IDebuggerClient
+{
+public:
+    CTraceClient(CDebugger & debugger, CTraceRecorder & recorder)
+        : m_debugger(debugger)
+        , m_recorder(recorder)
+        , m_pRangeStep(NULL)
+        , m_ulpStart(0)
+        , m_ulpEnd(0)
+        , m_nSteps(0)
+        , m_bLeft(false)
+    {
+    }
+    ~CTraceClient()
+    {
+        delete m_pRangeStep;
+    }
+    virtual bool OnBreakPoint(IBreakPoint *pBreakPoint)
+    {
+        if (pBreakPoint == &m_bpSpin) {
+            m_bpSpin.Disable();
+            m_debugger.RemoveBreakPoint(&m_bpSpin);
+
+            m_ulpStart = reinterpret_cast<ULONG_PTR>(m_bpSpin.GetAddress());
+            m_ulpEnd = reinterpret_cast<ULONG_PTR>(FindFunctionEnd(m_debugger, m_bpSpin.GetAddress()));
+            if (m_ulpEnd == 0)
+                return(true);
+
+            m_pRangeStep = new CRangeStepBreakPoint(pBreakPoint->GetThread(), reinterpret_cast<LPVOID>(m_ulpStart), reinterpret_cast<LPVOID>(m_ulpEnd));
+            m_pRangeStep->SetRecorder(&m_recorder);
+            m_debugger.AddBreakPoint(m_pRangeStep);
+            m_pRangeStep->Enable();
+            return(true);
+        }
+
+        if (pBreakPoint == m_pRangeStep) {
+            m_nSteps = m_pRangeStep->GetSteps();
+            m_bLeft = true;
+            m_debugger.RemoveBreakPoint(m_pRangeStep);
+            return(true);
+        }
+
+        return(false);
+    }
+    virtual void OnProcessCreated(CREATE_PROCESS_DEBUG_INFO *pCreateProcess)
+    {
+        m_bpSpin.SetAddress(GetTargetAddress(pCreateProcess, reinterpret_cast<ULONG_PTR>(TargetSpin)));
+        m_debugger.AddBreakPoint(&m_bpSpin);
+        m_bpSpin.Enable();
+    }
+    virtual void OnProcessExit(EXIT_PROCESS_DEBUG_INFO *pExitProcess)
+    {
+        m_debugger.Stop();
+    }
+
+    bool HasLeft(void) const { return(m_bLeft); }
+    SIZE_T GetSteps(void) const { return(m_nSteps); }
+    bool IsInside(ULONG_PTR ulpPC) const { return(ulpPC >= m_ulpStart && ulpPC < m_ulpEnd); }
+
+private:
+    CDebugger & m_debugger;
+    CTraceRecorder & m_recorder;
+    CBreakPointOnExecution m_bpSpin;
+    CRangeStepBreakPoint *m_pRangeStep;
+    ULONG_PTR m_ulpStart;
+    ULONG_PTR m_ulpEnd;
+    SIZE_T m_nSteps;
+    bool m_bLeft;
+};
+
+static bool IsSameRecord(const TraceRecord & left, const TraceRecord & right)
+{
+    if (left.ulpPC != right.ulpPC || left.dwFlags != right.dwFlags)
+        return(false);
+    for (UINT32 n = 0; n < CTraceFile::cMaxRegisters; n++) {
+        if (left.Registers[n] != right.Registers[n])
+            return(false);
+    }
+    return(true);
+}
+
+// Reads pszFileName through in order, then checks nGets records picked
+// across it with Get against that pass. Returns the mismatches.
+static int CheckTrace(const char *pszFileName, ULONGLONG ullCount, int nGets, vector<TraceRecord> *pRecords)
+{
+    CTraceReader reader;
+    if (reader.Open(pszFileName) == false) {
+        printf("%s: can't open the trace\n", pszFileName);
+        return(1);
+    }
+    if (reader.GetCount() != ullCount) {
+        printf("%s: %lu records, %lu recorded\n", pszFileName, static_cast<unsigned long>(reader.GetCount()), static_cast<unsigned long>(ullCount));
+        return(1);
+    }
+
+    // The first pass is the reference, later files must read the same
+    bool bReference = pRecords->empty();
+    int nBad = 0;
+    TraceRecord record;
+    for (ULONGLONG n = 0; n < ullCount; n++) {
+        if (reader.Next(&record) == false) {
+            printf("%s: Next failed at record %lu\n", pszFileName, static_cast<unsigned long>(n));
+            return(nBad + 1);
+        }
+        if (bReference == true)
+            pRecords->push_back(record);
+        else if (IsSameRecord(record, (*pRecords)[static_cast<SIZE_T>(n)]) == false)
+            nBad++;
+    }
+    if (reader.Next(&record) == true)
+        nBad++;
+
+    double dStart = GetSeconds();
+    for (int n = 0; n < nGets; n++) {
+        ULONGLONG ullIndex = (static_cast<ULONGLONG>(n) * 104729 + 7919) % ullCount;
+        if (reader.Get(ullIndex, &record) == false || IsSameRecord(record, (*pRecords)[static_cast<SIZE_T>(ullIndex)]) == false)
+            nBad++;
+    }
+    double dTime = GetSeconds() - dStart;
+
+    printf("%s: %lu records, %d gets at %.1f us each, %d mismatches\n", pszFileName, static_cast<unsigned long>(ullCount), nGets, dTime / nGets * 1e6, nBad);
+    return(nBad);
+}
+
+// Copies pszFileName without its index and trailer, as if never closed
+static bool CutTrailer(const char *pszFileName, const char *pszCutName)
+{
+    FILE *pFile = fopen(pszFileName, "rb");
+    if (pFile == NULL)
+        return(false);
+
+    vector<BYTE> Contents;
+    BYTE Buffer[4096];
+    SIZE_T nRead;
+    while ((nRead = fread(Buffer, 1, sizeof(Buffer), pFile)) != 0)
+        Contents.insert(Contents.end(), Buffer, Buffer + nRead);
+    fclose(pFile);
+
+    TraceFileTrailer trailer;
+    if (Contents.size() < sizeof(TraceFileHeader) + sizeof(trailer))
+        return(false);
+    memcpy(&trailer, &Contents[Contents.size() - sizeof(trailer)], sizeof(trailer));
+    if (trailer.dwMagic != CTraceFile::cIndexMagic || trailer.ullIndexOffset > Contents.size())
+        return(false);
+
+    pFile = fopen(pszCutName, "wb");
+    if (pFile == NULL)
+        return(false);
+    SIZE_T nSize = static_cast<SIZE_T>(trailer.ullIndexOffset);
+    bool bWritten = (fwrite(&Contents[0], 1, nSize, pFile) == nSize);
+    return(fclose(pFile) == 0 && bWritten == true);
+}
+
+int BenchTrace(int argc, char *argv[])
+{
+    static const char cszTrace[] = "SDEBench.trace";
+    static const char cszCut[] = "SDEBench.cut.trace";
+    static const int cGets = 10000;
+
+    int nIterations = (argc >= 2) ? atoi(argv[1]) : 20000;
+    if (nIterations < 1) {
+        printf("trace: at least one iteration\n");
+        return(1);
+    }
+
+    CTraceRecorder recorder;
+    if (recorder.Open(cszTrace, CTraceFile::cFlags, CTraceFile::cEax | CTraceFile::cEcx | CTraceFile::cEsp) == false) {
+        printf("can't create %s\n", cszTrace);
+        return(1);
+    }
+
+    double dStart = GetSeconds();
+    CDebugger *pDebugger = new CDebugger;
+    CTraceClient client(*pDebugger, recorder);
+    if (DebugTarget(pDebugger, &client, "spin", nIterations) == false)
+        return(1);
+    bool bClosed = recorder.Close();
+    double dTime = GetSeconds() - dStart;
+    if (client.HasLeft() == false || bClosed == false) {
+        printf("trace: %s\n", bClosed ? "never left TargetSpin" : "can't write the trace");
+        return(1);
+    }
+
+    // Every step is recorded, the one out of TargetSpin included
+    ULONGLONG ullCount = recorder.GetCount();
+    printf("recorded %lu records for %lu steps in %.3f s\n", static_cast<unsigned long>(ullCount), static_cast<unsigned long>(client.GetSteps()), dTime);
+    int nResult = (ullCount == client.GetSteps() + 1) ? 0 : 1;
+
+    vector<TraceRecord> Records;
+    if (CheckTrace(cszTrace, ullCount, cGets, &Records) != 0)
+        nResult = 1;
+
+    // All in the loop but the last
+    for (SIZE_T n = 0; n < Records.size(); n++) {
+        if (client.IsInside(Records[n].ulpPC) != (n + 1 < Records.size())) {
+            printf("record %lu at %p is on the wrong side of TargetSpin's end\n", static_cast<unsigned long>(n), reinterpret_cast<LPVOID>(Records[n].ulpPC));
+            nResult = 1;
+            break;
+        }
+    }
+
+    // Without the index and trailer, read by walking the chunks
+    if (CutTrailer(cszTrace, cszCut) == false) {
+        printf("can't write %s\n", cszCut);
+        nResult = 1;
+    } else if (CheckTrace(cszCut, ullCount, cGets, &Records) != 0) {
+        nResult = 1;
+    }
+
+    remove(cszTrace);
+    remove(cszCut);
+    return(nResult);
+}
@@ -0,0 +1,46 @@
+// SDEBench.cpp : Benchmarks and checks of the debugger, run against a copy of
+// this program.
+//
+
+#include "stdafx.h"
+#include "Bench.h"
+#include <string.h>
+
+struct Driver
+{
+    const char *pszName;
+    int (*pfnRun)(int argc, char *argv[]);
+    const char *pszUsage;
+};
+
+static const Driver g_Drivers[] = {
+    { "dispatch", BenchDispatch, "dispatch [breakpoints...]  hit cost against the number of breakpoints" },
+    { "batchmemory", BenchBatchMemory, "batchmemory [reads...]  scattered reads at a stop, one call each against one batch" },
+    { "decoder", BenchDecoder, "decoder [corpus bits...]  instruction lengths against DecoderCorpus64/32.txt, and decoding speed" },
+    { "rangestep", BenchRangeStep, "rangestep [iterations]  stepping a loop, single steps seen by the client against a range step" },
+    { "branchstep", BenchBranchStep, "branchstep [iterations]  traps following a loop, single steps against branch steps" },
+    { "trace", BenchTrace, "trace [iterations]  recording a range-stepped loop, then reading it in order, by index and without a trailer" },
+    { "allocations", BenchAllocations, "allocations [hits]  no allocations by the debugger after warm-up (needs SDE_COUNT_ALLOCATIONS)" },
+    { "stop", BenchStop, "stop [runs]  Stop latency while the debugger waits for events" },
+    { "reactor", BenchReactor, "reactor [sessions] [threads] [workers]  many debuggers, a thread each against a reactor" },
+};
+
+static const int cNumDrivers = sizeof(g_Drivers) / sizeof(g_Drivers[0]);
+
+int main(int argc, char * argv[])
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    if (argc >= 2 && strcmp(argv[1], "target") == 0)
+        return(RunTarget(argc - 1, argv + 1));
+
+    for (int n = 0; n < cNumDrivers; n++) {
+        if (argc >= 2 && strcmp(argv[1], g_Drivers[n].pszName) == 0)
+            return(g_Drivers[n].pfnRun(argc - 1, argv + 1));
+    }
+
+    printf("usage: SDEBench <driver> [arguments]\n");
+    for (int n = 0; n < cNumDrivers; n++)
+        printf("  %s\n", g_Drivers[n].pszUsage);
+    return(1);
+}
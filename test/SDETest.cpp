@@ -57,7 +57,7 @@ public:
             _CONTEXT ctx;
             ZeroMemory(&ctx, sizeof(_CONTEXT));
             ctx.ContextFlags = CONTEXT_CONTROL;
-            GetThreadContext(bpSSO->GetThread(), &ctx);
+            debug.GetThreadContext(bpSSO->GetThread(), &ctx);
         
             printf("(SSO breakpoint: %p, Eflags = %08lX)\n", bpSSO->GetAddress(), ctx.EFlags);
 
@@ -72,7 +72,7 @@ public:
             _CONTEXT ctx;
             ZeroMemory(&ctx, sizeof(_CONTEXT));
             ctx.ContextFlags = CONTEXT_CONTROL;
-            GetThreadContext(bpFlag->GetThread(), &ctx);
+            debug.GetThreadContext(bpFlag->GetThread(), &ctx);
 
             printf("Flag breakpoint! (%p, Eflags = %08lX)\n", bpFlag->GetAddress(), ctx.EFlags);
 
@@ -221,7 +221,7 @@ public:
             _CONTEXT ctx;
             ZeroMemory(&ctx, sizeof(_CONTEXT));
             ctx.ContextFlags = CONTEXT_INTEGER;
-            GetThreadContext(hThread, &ctx);
+            debug.GetThreadContext(hThread, &ctx);
             printf("Thread Id: %08lX, EAX: %08lX\n", debug.GetThreadId(hThread), ctx.Eax);
             return(false);
         } else if (bpr && MemRange == bpr) {